@@ -0,0 +1,198 @@
+#ifndef ACL_MODULE_H
+#define ACL_MODULE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Server group checks for privileged commands.
+ *
+ * The allow rules of the config (config_module.h) are bitsets over the
+ * server groups they name. Every client that runs into a rule gets an
+ * entry in a fixed open addressing table keyed by unique identifier,
+ * holding its server groups and, for the config generation it was built
+ * for, the bitset of those groups the rules know. A check is a hash lookup
+ * and an AND; the bitset is rebuilt only after a reload.
+ *
+ * An entry is filled when the client first needs a check, through the
+ * seed function given to acl_start (the plugin reads the client's server
+ * groups, which the TS3 client keeps for everybody in view, and asks the
+ * server with requestServerGroupsByClientID in case it was not in view).
+ * From then on events keep it current: the answers to that request and
+ * onServerGroupClientAddedEvent add groups, onServerGroupClientDeletedEvent
+ * removes them. Nothing expires by time; a full probe sequence replaces its
+ * least recently checked entry, and acl_clear empties the table on
+ * (dis)connect.
+ *
+ * Everything runs on the event loop thread.
+ */
+
+/* Power of two */
+#define ACL_CACHE_ENTRIES 1024
+#define ACL_PROBE_LIMIT 8
+#define ACL_MAX_GROUPS 32
+#define ACL_UID_BYTES 64
+#define ACL_STALE UINT64_MAX
+
+typedef struct {
+    char     uid[ACL_UID_BYTES]; /* "" marks a free entry */
+    uint64_t database_id;
+    uint64_t groups[ACL_MAX_GROUPS];
+    uint32_t group_count;
+    uint64_t mask;       /* bits of the config's rule_groups the client is in */
+    uint64_t generation; /* config generation of mask, ACL_STALE to rebuild it */
+    uint64_t used;       /* acl_clock when last checked */
+} acl_entry;
+
+/* Fill entry->database_id and what is known of its groups for client, 0 if there are any */
+typedef int (*acl_seed_fn)(uint64_t server, uint16_t client, acl_entry* entry);
+
+static acl_entry   acl_cache[ACL_CACHE_ENTRIES];
+static uint64_t    acl_clock = 0;
+static acl_seed_fn acl_seed  = NULL;
+
+static int acl_allowed_metric;
+static int acl_denied_metric;
+static int acl_misses_metric;
+static int acl_events_metric;
+
+void acl_register_metrics(void)
+{
+    acl_allowed_metric = metrics_counter("musicbot_acl_checks_total", "Privileged commands checked against the server groups, by outcome", "result", "allowed");
+    acl_denied_metric  = metrics_counter("musicbot_acl_checks_total", "Privileged commands checked against the server groups, by outcome", "result", "denied");
+    acl_misses_metric  = metrics_counter("musicbot_acl_cache_misses_total", "Checks that had to look up the client's server groups", NULL, NULL);
+    acl_events_metric  = metrics_counter("musicbot_acl_group_events_total", "Server group events applied to cached clients", NULL, NULL);
+}
+
+void acl_start(acl_seed_fn seed)
+{
+    acl_seed = seed;
+}
+
+void acl_clear(void)
+{
+    memset(acl_cache, 0, sizeof(acl_cache));
+}
+
+static uint32_t acl_hash(const char* uid)
+{
+    uint32_t hash = 2166136261u;
+    for (; *uid; uid++)
+        hash = (hash ^ (uint8_t)*uid) * 16777619u;
+    return hash;
+}
+
+/* The entry of uid, or with create the slot to fill (free or least recently used), NULL otherwise */
+static acl_entry* acl_find(const char* uid, int create)
+{
+    uint32_t   hash   = acl_hash(uid);
+    acl_entry* oldest = NULL;
+    for (uint32_t probe = 0; probe < ACL_PROBE_LIMIT; probe++) {
+        acl_entry* entry = &acl_cache[(hash + probe) & (ACL_CACHE_ENTRIES - 1)];
+        if (strcmp(entry->uid, uid) == 0)
+            return entry;
+        if (!entry->uid[0])
+            return create ? entry : NULL;
+        if (!oldest || entry->used < oldest->used)
+            oldest = entry;
+    }
+    return create ? oldest : NULL;
+}
+
+static void acl_build_mask(acl_entry* entry, const bot_config* config)
+{
+    entry->mask = 0;
+    for (uint32_t i = 0; i < entry->group_count; i++) {
+        for (size_t bit = 0; bit < config->rule_group_count; bit++) {
+            if (config->rule_groups[bit] == entry->groups[i])
+                entry->mask |= 1ull << bit;
+        }
+    }
+    entry->generation = config->generation;
+}
+
+/* Whether the client passes rule (CONFIG_RULE_*), uid is its unique identifier */
+int acl_check(int rule, uint64_t server, uint16_t client, const char* uid)
+{
+    config_guard guard = config_enter();
+    uint64_t     need  = guard.config->rules[rule];
+    if (!need) {
+        config_leave(&guard);
+        return 1;
+    }
+
+    acl_entry* entry = acl_find(uid, 0);
+    if (!entry) {
+        metrics_inc(acl_misses_metric);
+        entry = acl_find(uid, 1);
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->uid, sizeof(entry->uid), "%s", uid);
+        if (!acl_seed || acl_seed(server, client, entry) != 0)
+            LOG_INFO("No server groups for %s yet, denying until the server answers", uid);
+        entry->generation = ACL_STALE;
+    }
+    if (entry->generation != guard.config->generation)
+        acl_build_mask(entry, guard.config);
+    entry->used = ++acl_clock;
+    int allowed = (entry->mask & need) != 0;
+    config_leave(&guard);
+
+    metrics_inc(allowed ? acl_allowed_metric : acl_denied_metric);
+    return allowed;
+}
+
+static void acl_add_group(acl_entry* entry, uint64_t group)
+{
+    for (uint32_t i = 0; i < entry->group_count; i++) {
+        if (entry->groups[i] == group)
+            return;
+    }
+    if (entry->group_count < ACL_MAX_GROUPS)
+        entry->groups[entry->group_count++] = group;
+    entry->generation = ACL_STALE;
+}
+
+/* onServerGroupClientAddedEvent, clients not in the cache are looked up when they need it */
+void acl_group_added(const char* uid, uint64_t group)
+{
+    acl_entry* entry = acl_find(uid, 0);
+    if (entry) {
+        acl_add_group(entry, group);
+        metrics_inc(acl_events_metric);
+    }
+}
+
+/* onServerGroupClientDeletedEvent */
+void acl_group_deleted(const char* uid, uint64_t group)
+{
+    acl_entry* entry = acl_find(uid, 0);
+    if (!entry)
+        return;
+    for (uint32_t i = 0; i < entry->group_count; i++) {
+        if (entry->groups[i] == group) {
+            entry->groups[i] = entry->groups[--entry->group_count];
+            break;
+        }
+    }
+    entry->generation = ACL_STALE;
+    metrics_inc(acl_events_metric);
+}
+
+/* onServerGroupByClientIDEvent, one per group of the client */
+void acl_group_of_database_id(uint64_t database_id, uint64_t group)
+{
+    for (size_t i = 0; database_id && i < ACL_CACHE_ENTRIES; i++) {
+        acl_entry* entry = &acl_cache[i];
+        if (!entry->uid[0] || entry->database_id != database_id)
+            continue;
+        acl_add_group(entry, group);
+        metrics_inc(acl_events_metric);
+    }
+}
+
+#endif
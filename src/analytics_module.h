@@ -0,0 +1,335 @@
+#ifndef ANALYTICS_MODULE_H
+#define ANALYTICS_MODULE_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_module.h"
+#include "dbus_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Listener-minutes per station.
+ *
+ * The event path only stores the number of listeners in the bot's channel
+ * (analytics_set_listeners, one relaxed store); the station comes from
+ * on_air_station. A background thread samples both once per second and
+ * integrates listeners over the elapsed time into the bucket of the current
+ * minute, and into running hour and day totals for the station on air.
+ * Totals are kept per slot, a station index takes the next free slot the
+ * first time it is on air and keeps it until shutdown. There are as many
+ * slots as a config can have stations; should config reloads bring more
+ * indices on air than that, their samples are dropped and counted.
+ *
+ * When an hour (UTC) ends its totals are appended as hourly records to a
+ * small binary file in the TS3 config directory, days likewise. The partial
+ * hour and day are written on shutdown too, so a restart can split a period
+ * into several records with the same key; analytics_export adds them up.
+ *
+ * File layout, little endian:
+ *   analytics_file_header  magic "MBLSTN01", version, record size
+ *   analytics_record...    appended, never rewritten
+ */
+
+#define ANALYTICS_FILE_NAME "musicbot_listeners.bin"
+#define ANALYTICS_MAGIC "MBLSTN01"
+#define ANALYTICS_VERSION 1
+#define ANALYTICS_STATIONS CONFIG_MAX_STATIONS
+#define ANALYTICS_MINUTES 60
+#define ANALYTICS_SAMPLE_MS 1000
+#define ANALYTICS_DEFAULT_PATH "/tmp/musicbot-listeners.csv"
+
+enum { ANALYTICS_MINUTE = 0, ANALYTICS_HOURLY, ANALYTICS_DAILY };
+static const char* const analytics_period_names[] = {"minute", "hourly", "daily"};
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} analytics_file_header;
+
+typedef struct {
+    uint32_t start; /* unix seconds, first second of the hour or day (UTC) */
+    uint16_t station;
+    uint8_t  period; /* ANALYTICS_HOURLY or ANALYTICS_DAILY */
+    uint8_t  reserved;
+    uint32_t listener_seconds;
+} analytics_record;
+
+/* Written by the event path, read by the sampler */
+static atomic_int analytics_listeners = 0;
+
+/* Station index + 1 of each slot, 0 while free. Claimed by the sampler, read by exports. */
+static atomic_int analytics_slot_station[ANALYTICS_STATIONS];
+static int        analytics_dropped_metric = -1;
+
+/* Minute ring, written by the sampler only, read by exports */
+static _Atomic uint32_t analytics_minute_start[ANALYTICS_MINUTES];
+static _Atomic uint32_t analytics_minute_ms[ANALYTICS_MINUTES][ANALYTICS_STATIONS]; /* listener-milliseconds */
+
+/* Sampler thread only */
+static uint64_t analytics_hour_ms[ANALYTICS_STATIONS];
+static uint64_t analytics_day_ms[ANALYTICS_STATIONS];
+static uint32_t analytics_hour_start = 0;
+static uint32_t analytics_day_start  = 0;
+
+static char       analytics_path[512];
+static int        analytics_fd = -1;
+static pthread_t  analytics_thread;
+static atomic_int analytics_running = 0;
+
+void analytics_set_listeners(int listeners)
+{
+    atomic_store_explicit(&analytics_listeners, listeners, memory_order_relaxed);
+}
+
+static uint64_t analytics_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void analytics_register_metrics(void)
+{
+    analytics_dropped_metric = metrics_counter("musicbot_analytics_dropped_samples_total", "Listener samples dropped because every analytics station slot was taken", NULL, NULL);
+}
+
+/* Slot of station, claiming a free one on first use, -1 if all are taken. Sampler thread only. */
+static int analytics_slot(int station)
+{
+    for (int slot = 0; slot < ANALYTICS_STATIONS; slot++) {
+        int owner = atomic_load_explicit(&analytics_slot_station[slot], memory_order_relaxed);
+        if (owner == station + 1)
+            return slot;
+        if (owner == 0) {
+            atomic_store_explicit(&analytics_slot_station[slot], station + 1, memory_order_release);
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/* Append the non-zero totals of one period and clear them */
+static void analytics_flush(uint64_t* totals, uint32_t start, int period)
+{
+    analytics_record records[ANALYTICS_STATIONS];
+    int              count = 0;
+    for (int slot = 0; slot < ANALYTICS_STATIONS; slot++) {
+        if (totals[slot] < 1000)
+            continue;
+        int station      = atomic_load_explicit(&analytics_slot_station[slot], memory_order_relaxed) - 1;
+        records[count++] = (analytics_record){start, (uint16_t)station, (uint8_t)period, 0, (uint32_t)(totals[slot] / 1000)};
+    }
+    memset(totals, 0, ANALYTICS_STATIONS * sizeof(*totals));
+    if (count == 0 || analytics_fd < 0)
+        return;
+    ssize_t size = (ssize_t)(count * sizeof(analytics_record));
+    if (write(analytics_fd, records, (size_t)size) != size)
+        LOG_WARN("Could not append listener statistics to %s", analytics_path);
+}
+
+static void analytics_sample(uint32_t now, uint64_t elapsed_ms)
+{
+    uint32_t hour = now - now % 3600;
+    uint32_t day  = now - now % 86400;
+    if (hour != analytics_hour_start) {
+        if (analytics_hour_start)
+            analytics_flush(analytics_hour_ms, analytics_hour_start, ANALYTICS_HOURLY);
+        analytics_hour_start = hour;
+    }
+    if (day != analytics_day_start) {
+        if (analytics_day_start)
+            analytics_flush(analytics_day_ms, analytics_day_start, ANALYTICS_DAILY);
+        analytics_day_start = day;
+    }
+
+    uint32_t minute = now - now % 60;
+    int      slot   = (int)(now / 60 % ANALYTICS_MINUTES);
+    if (atomic_load_explicit(&analytics_minute_start[slot], memory_order_relaxed) != minute) {
+        /* Readers skip the slot while it is marked 0 */
+        atomic_store_explicit(&analytics_minute_start[slot], 0, memory_order_relaxed);
+        for (int station = 0; station < ANALYTICS_STATIONS; station++)
+            atomic_store_explicit(&analytics_minute_ms[slot][station], 0, memory_order_relaxed);
+        atomic_store_explicit(&analytics_minute_start[slot], minute, memory_order_release);
+    }
+
+    int station   = atomic_load(&on_air_station);
+    int listeners = atomic_load_explicit(&analytics_listeners, memory_order_relaxed);
+    if (station < 0 || listeners <= 0)
+        return;
+    int station_slot = analytics_slot(station);
+    if (station_slot < 0) {
+        metrics_inc(analytics_dropped_metric);
+        LOG_SAMPLED(LOG_LEVEL_WARN, 1, "No listener statistics slot left for station %d, %d stations were on air", station, ANALYTICS_STATIONS);
+        return;
+    }
+    uint64_t listener_ms = (uint64_t)listeners * elapsed_ms;
+    atomic_fetch_add_explicit(&analytics_minute_ms[slot][station_slot], (uint32_t)listener_ms, memory_order_relaxed);
+    analytics_hour_ms[station_slot] += listener_ms;
+    analytics_day_ms[station_slot] += listener_ms;
+}
+
+static void* analytics_sampler(void* arg)
+{
+    (void)arg;
+    uint64_t last = analytics_now_ms();
+    while (atomic_load(&analytics_running)) {
+        for (int waited = 0; waited < ANALYTICS_SAMPLE_MS && atomic_load(&analytics_running); waited += 100)
+            usleep(100 * 1000);
+        uint64_t now = analytics_now_ms();
+        analytics_sample((uint32_t)time(NULL), now - last);
+        last = now;
+    }
+    return NULL;
+}
+
+/* Open or create dir/ANALYTICS_FILE_NAME and start sampling. Sampling still runs without a file. */
+void analytics_start(const char* dir)
+{
+    snprintf(analytics_path, sizeof(analytics_path), "%s/%s", dir, ANALYTICS_FILE_NAME);
+    analytics_fd = open(analytics_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (analytics_fd < 0) {
+        LOG_ERROR("Cannot open listener statistics %s", analytics_path);
+    } else {
+        analytics_file_header header;
+        struct stat           st;
+        if (fstat(analytics_fd, &st) != 0 || pread(analytics_fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, ANALYTICS_MAGIC, 8) != 0 ||
+            header.version != ANALYTICS_VERSION || header.record_size != sizeof(analytics_record) ||
+            (st.st_size - (off_t)sizeof(header)) % (off_t)sizeof(analytics_record) != 0) {
+            if (st.st_size > 0)
+                LOG_WARN("Listener statistics %s have an unknown layout, starting over", analytics_path);
+            memcpy(header.magic, ANALYTICS_MAGIC, 8);
+            header.version     = ANALYTICS_VERSION;
+            header.record_size = sizeof(analytics_record);
+            if (ftruncate(analytics_fd, 0) != 0 || write(analytics_fd, &header, sizeof(header)) != sizeof(header)) {
+                LOG_ERROR("Cannot initialise listener statistics %s", analytics_path);
+                close(analytics_fd);
+                analytics_fd = -1;
+            }
+        }
+    }
+
+    atomic_store(&analytics_running, 1);
+    pthread_create(&analytics_thread, NULL, analytics_sampler, NULL);
+}
+
+/* Stop sampling and write the partial hour and day */
+void analytics_stop(void)
+{
+    if (!atomic_exchange(&analytics_running, 0))
+        return;
+    pthread_join(analytics_thread, NULL);
+    if (analytics_hour_start)
+        analytics_flush(analytics_hour_ms, analytics_hour_start, ANALYTICS_HOURLY);
+    if (analytics_day_start)
+        analytics_flush(analytics_day_ms, analytics_day_start, ANALYTICS_DAILY);
+    if (analytics_fd >= 0)
+        close(analytics_fd);
+    analytics_fd = -1;
+}
+
+/* Parse "minute", "hourly" or "daily", -1 otherwise */
+int analytics_parse_period(const char* name)
+{
+    for (int i = 0; i < (int)(sizeof(analytics_period_names) / sizeof(analytics_period_names[0])); i++) {
+        if (strcmp(name, analytics_period_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int analytics_record_compare(const void* a, const void* b)
+{
+    const analytics_record* x = (const analytics_record*)a;
+    const analytics_record* y = (const analytics_record*)b;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return (int)x->station - (int)y->station;
+}
+
+static void analytics_csv_row(FILE* out, int period, uint32_t start, int station, uint64_t listener_ms, const char* (*station_name)(int))
+{
+    time_t    when = (time_t)start;
+    struct tm tm;
+    char      stamp[32];
+    gmtime_r(&when, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    fprintf(out, "%s,%s,%d,\"%s\",%.1f\n", analytics_period_names[period], stamp, station, station_name(station), (double)listener_ms / 60000.0);
+}
+
+/*
+ * Write one period as CSV (period,start,station,name,listener_minutes), oldest
+ * first. Minutes come from the in-memory ring (the last hour), hours and days
+ * from the file. Returns the number of rows, -1 if the file cannot be read.
+ */
+long analytics_export(FILE* out, int period, const char* (*station_name)(int))
+{
+    long rows = 0;
+    fputs("period,start,station,name,listener_minutes\n", out);
+
+    if (period == ANALYTICS_MINUTE) {
+        uint32_t now = (uint32_t)time(NULL);
+        for (int i = 1; i <= ANALYTICS_MINUTES; i++) {
+            int      slot  = (int)((now / 60 + i) % ANALYTICS_MINUTES);
+            uint32_t start = atomic_load_explicit(&analytics_minute_start[slot], memory_order_acquire);
+            if (start == 0 || now - start >= ANALYTICS_MINUTES * 60)
+                continue;
+            for (int station_slot = 0; station_slot < ANALYTICS_STATIONS; station_slot++) {
+                int      station     = atomic_load_explicit(&analytics_slot_station[station_slot], memory_order_acquire) - 1;
+                uint32_t listener_ms = atomic_load_explicit(&analytics_minute_ms[slot][station_slot], memory_order_relaxed);
+                if (station >= 0 && listener_ms) {
+                    analytics_csv_row(out, period, start, station, listener_ms, station_name);
+                    rows++;
+                }
+            }
+        }
+        return rows;
+    }
+
+    FILE* in = fopen(analytics_path, "rb");
+    if (!in)
+        return -1;
+    analytics_record* records  = NULL;
+    size_t            count    = 0;
+    size_t            capacity = 0;
+    analytics_record  record;
+    fseek(in, sizeof(analytics_file_header), SEEK_SET);
+    while (fread(&record, sizeof(record), 1, in) == 1) {
+        if (record.period != period)
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            analytics_record* grown = (analytics_record*)realloc(records, capacity * sizeof(*records));
+            if (!grown)
+                break;
+            records = grown;
+        }
+        records[count++] = record;
+    }
+    fclose(in);
+
+    qsort(records, count, sizeof(*records), analytics_record_compare);
+    for (size_t i = 0; i < count;) {
+        uint64_t listener_seconds = 0;
+        size_t   j                = i;
+        for (; j < count && records[j].start == records[i].start && records[j].station == records[i].station; j++)
+            listener_seconds += records[j].listener_seconds;
+        analytics_csv_row(out, period, records[i].start, records[i].station, listener_seconds * 1000, station_name);
+        rows++;
+        i = j;
+    }
+    free(records);
+    return rows;
+}
+
+#endif
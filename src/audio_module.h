@@ -0,0 +1,219 @@
+#ifndef AUDIO_MODULE_H
+#define AUDIO_MODULE_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Sample kernels for the captured voice path. TeamSpeak hands us interleaved
+ * 16-bit frames at 48 kHz from the audio thread, so nothing in here may
+ * allocate, lock or call back into the host.
+ */
+
+#define AUDIO_SAMPLE_RATE 48000
+
+static inline short audio_clip(float value)
+{
+    if (value >= 32767.0f)
+        return 32767;
+    if (value <= -32768.0f)
+        return -32768;
+    return (short)lrintf(value);
+}
+
+/*
+ * Multiply count interleaved samples by a gain that moves linearly from
+ * gain_start to gain_end. The ramp advances per sample rather than per frame,
+ * the resulting left/right skew is far below one LSB.
+ */
+void audio_gain_ramp(short* samples, size_t count, float gain_start, float gain_end)
+{
+    if (count == 0)
+        return;
+
+    const float step = (gain_end - gain_start) / (float)count;
+    size_t      i    = 0;
+
+#if defined(__SSE2__)
+    __m128       g_lo   = _mm_setr_ps(gain_start, gain_start + step, gain_start + 2 * step, gain_start + 3 * step);
+    __m128       g_hi   = _mm_add_ps(g_lo, _mm_set1_ps(4 * step));
+    const __m128 step_8 = _mm_set1_ps(8 * step);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v    = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128i sign = _mm_srai_epi16(v, 15);
+        __m128  lo   = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, sign)), g_lo);
+        __m128  hi   = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, sign)), g_hi);
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+        g_lo = _mm_add_ps(g_lo, step_8);
+        g_hi = _mm_add_ps(g_hi, step_8);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const float       init[4] = {gain_start, gain_start + step, gain_start + 2 * step, gain_start + 3 * step};
+    float32x4_t       g_lo    = vld1q_f32(init);
+    float32x4_t       g_hi    = vaddq_f32(g_lo, vdupq_n_f32(4 * step));
+    const float32x4_t step_8  = vdupq_n_f32(8 * step);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t   v  = vld1q_s16(samples + i);
+        float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), g_lo);
+        float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), g_hi);
+        vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+        g_lo = vaddq_f32(g_lo, step_8);
+        g_hi = vaddq_f32(g_hi, step_8);
+    }
+#endif
+
+    for (; i < count; i++) {
+        samples[i] = audio_clip((float)samples[i] * (gain_start + step * (float)i));
+    }
+}
+
+/*
+ * out = a * gain_a + b * gain_b, both gains ramping linearly over the block
+ * like in audio_gain_ramp. out may alias a or b.
+ */
+void audio_mix_ramp(short* out, const short* a, const short* b, size_t count, float ga_start, float ga_end, float gb_start, float gb_end)
+{
+    if (count == 0)
+        return;
+
+    const float step_a = (ga_end - ga_start) / (float)count;
+    const float step_b = (gb_end - gb_start) / (float)count;
+    size_t      i      = 0;
+
+#if defined(__SSE2__)
+    __m128       ga_lo    = _mm_setr_ps(ga_start, ga_start + step_a, ga_start + 2 * step_a, ga_start + 3 * step_a);
+    __m128       ga_hi    = _mm_add_ps(ga_lo, _mm_set1_ps(4 * step_a));
+    __m128       gb_lo    = _mm_setr_ps(gb_start, gb_start + step_b, gb_start + 2 * step_b, gb_start + 3 * step_b);
+    __m128       gb_hi    = _mm_add_ps(gb_lo, _mm_set1_ps(4 * step_b));
+    const __m128 step_a_8 = _mm_set1_ps(8 * step_a);
+    const __m128 step_b_8 = _mm_set1_ps(8 * step_b);
+    for (; i + 8 <= count; i += 8) {
+        __m128i va     = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb     = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i sign_a = _mm_srai_epi16(va, 15);
+        __m128i sign_b = _mm_srai_epi16(vb, 15);
+        __m128  lo     = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(va, sign_a)), ga_lo), _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(vb, sign_b)), gb_lo));
+        __m128  hi     = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(va, sign_a)), ga_hi), _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(vb, sign_b)), gb_hi));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+        ga_lo = _mm_add_ps(ga_lo, step_a_8);
+        ga_hi = _mm_add_ps(ga_hi, step_a_8);
+        gb_lo = _mm_add_ps(gb_lo, step_b_8);
+        gb_hi = _mm_add_ps(gb_hi, step_b_8);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const float       init_a[4] = {ga_start, ga_start + step_a, ga_start + 2 * step_a, ga_start + 3 * step_a};
+    const float       init_b[4] = {gb_start, gb_start + step_b, gb_start + 2 * step_b, gb_start + 3 * step_b};
+    float32x4_t       ga_lo     = vld1q_f32(init_a);
+    float32x4_t       ga_hi     = vaddq_f32(ga_lo, vdupq_n_f32(4 * step_a));
+    float32x4_t       gb_lo     = vld1q_f32(init_b);
+    float32x4_t       gb_hi     = vaddq_f32(gb_lo, vdupq_n_f32(4 * step_b));
+    const float32x4_t step_a_8  = vdupq_n_f32(8 * step_a);
+    const float32x4_t step_b_8  = vdupq_n_f32(8 * step_b);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t   va = vld1q_s16(a + i);
+        int16x8_t   vb = vld1q_s16(b + i);
+        float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(va))), ga_lo);
+        float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(va))), ga_hi);
+        lo             = vmlaq_f32(lo, vcvtq_f32_s32(vmovl_s16(vget_low_s16(vb))), gb_lo);
+        hi             = vmlaq_f32(hi, vcvtq_f32_s32(vmovl_s16(vget_high_s16(vb))), gb_hi);
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+        ga_lo = vaddq_f32(ga_lo, step_a_8);
+        ga_hi = vaddq_f32(ga_hi, step_a_8);
+        gb_lo = vaddq_f32(gb_lo, step_b_8);
+        gb_hi = vaddq_f32(gb_hi, step_b_8);
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = audio_clip((float)a[i] * (ga_start + step_a * (float)i) + (float)b[i] * (gb_start + step_b * (float)i));
+    }
+}
+
+/*
+ * Sum of squares and absolute peak of count samples, for cheap level
+ * metering on every captured block. RMS is sqrt(sum_squares / count).
+ */
+void audio_measure(const short* samples, size_t count, uint64_t* sum_squares, int* peak)
+{
+    uint64_t sum = 0;
+    int      max = 0, min = 0;
+    size_t   i   = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       acc  = zero;
+    __m128i       vmax = zero, vmin = zero;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+        /* Pairs of squares reach 2^31 at most, which still fits when read as unsigned */
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc        = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(sq, zero), _mm_unpackhi_epi32(sq, zero)));
+        vmax       = _mm_max_epi16(vmax, v);
+        vmin       = _mm_min_epi16(vmin, v);
+    }
+    uint64_t lanes[2];
+    short    maxs[8], mins[8];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    _mm_storeu_si128((__m128i*)maxs, vmax);
+    _mm_storeu_si128((__m128i*)mins, vmin);
+    sum = lanes[0] + lanes[1];
+    for (int k = 0; k < 8; k++) {
+        if (maxs[k] > max)
+            max = maxs[k];
+        if (mins[k] < min)
+            min = mins[k];
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    uint64x2_t acc  = vdupq_n_u64(0);
+    int16x8_t  vmax = vdupq_n_s16(0), vmin = vdupq_n_s16(0);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        acc         = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+        acc         = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+        vmax        = vmaxq_s16(vmax, v);
+        vmin        = vminq_s16(vmin, v);
+    }
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+    max = vmaxvq_s16(vmax);
+    min = vminvq_s16(vmin);
+#endif
+
+    for (; i < count; i++) {
+        sum += (uint64_t)((int)samples[i] * (int)samples[i]);
+        if (samples[i] > max)
+            max = samples[i];
+        if (samples[i] < min)
+            min = samples[i];
+    }
+
+    *sum_squares = sum;
+    *peak        = max > -min ? max : -min;
+}
+
+/* Write stereo frames into a block with the given channel count, downmixing to mono if needed */
+void audio_from_stereo(short* out, int channels, const short* stereo, size_t frames)
+{
+    if (channels == 2) {
+        memcpy(out, stereo, frames * 2 * sizeof(short));
+    } else if (channels == 1) {
+        for (size_t i = 0; i < frames; i++)
+            out[i] = (short)(((int)stereo[2 * i] + (int)stereo[2 * i + 1]) / 2);
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            out[i * channels]     = stereo[2 * i];
+            out[i * channels + 1] = stereo[2 * i + 1];
+            for (int c = 2; c < channels; c++)
+                out[i * channels + c] = 0;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,604 @@
+#ifndef CONFIG_MODULE_H
+#define CONFIG_MODULE_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbus_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Station and channel configuration, reloaded while the bot runs.
+ *
+ * CONFIG_FILE_NAME in the TS3 config directory holds the channel policy,
+ * the station commands and command aliases, one per line:
+ *
+ *   default_channel 12304
+ *   afk_channel 11071
+ *   inn_channel 1
+ *   station !chill 21 Chillout          keyword, track list index, name
+ *   alias !chillout !chill              keyword, command it stands for
+ *   allow stations 6 9                  rule, server groups that pass it
+ *   library /srv/music                  directory library_module.h scans
+ *   dead_stream_timeout_ms 20000        silence until silence_module.h fails over, 0 never
+ *   fallback_station 21                 track list index it fails over to
+ *
+ * Rules are !kick, !join and stations (every station command), a rule
+ * without allow lines lets everybody through. acl_module.h checks them.
+ * Any station line replaces the built-in table (config_defaults) as a
+ * whole, channels that are not given keep their built-in value. A missing
+ * file is written out with the built-in values so there is something to
+ * edit.
+ *
+ * A thread watches the directory with inotify (editors replace the file by
+ * renaming, so the file itself is not watched), parses a new file into a
+ * fresh bot_config and publishes it with an atomic pointer swap. A file
+ * with errors is logged and the current config stays. Configs are never
+ * changed after they are published: readers bracket their use with
+ * config_enter/config_leave, which only bump a counter for the current
+ * epoch, and the watcher frees the old config once the readers of the
+ * epoch it was published in are gone. Readers never block; keep the
+ * bracket short (copy what is needed out, see config_find_station) since
+ * the next reload waits for it. Audio and the player are not touched by a
+ * reload.
+ */
+
+#define CONFIG_FILE_NAME "musicbot.conf"
+#define CONFIG_DEFAULT_CHANNEL_ID 12304
+#define CONFIG_AFK_CHANNEL_ID 11071
+#define CONFIG_INN_CHANNEL_ID 1
+#define CONFIG_DEAD_STREAM_TIMEOUT_MS 20000
+#define CONFIG_FALLBACK_STATION Chillout
+#define CONFIG_MAX_STATIONS 128
+#define CONFIG_MAX_ALIASES 64
+#define CONFIG_KEYWORD_BYTES 32
+#define CONFIG_NAME_BYTES 64
+#define CONFIG_LINE_BYTES 256
+/* Server groups named in allow lines, one bit each in the rule bitsets */
+#define CONFIG_MAX_RULE_GROUPS 64
+/* Directories of library lines, scanned for !play */
+#define CONFIG_MAX_LIBRARY_ROOTS 8
+#define CONFIG_PATH_BYTES 224
+/* Editors write in several steps, parse once the directory was quiet this long */
+#define CONFIG_SETTLE_MS 100
+
+typedef struct {
+    char keyword[CONFIG_KEYWORD_BYTES];
+    char name[CONFIG_NAME_BYTES];
+    int  station; /* track list index */
+    int  metric;  /* musicbot_commands_total slot of the keyword */
+} config_station;
+
+typedef struct {
+    char keyword[CONFIG_KEYWORD_BYTES];
+    char target[CONFIG_KEYWORD_BYTES];
+} config_alias;
+
+enum { CONFIG_RULE_KICK = 0, CONFIG_RULE_JOIN, CONFIG_RULE_STATIONS, CONFIG_RULE_COUNT };
+static const char* const config_rule_names[CONFIG_RULE_COUNT] = {"!kick", "!join", "stations"};
+
+typedef struct {
+    uint64_t       default_channel;
+    uint64_t       afk_channel;
+    uint64_t       inn_channel;
+    uint64_t       generation; /* 0 for the built-in config */
+    size_t         station_count;
+    size_t         alias_count;
+    config_station stations[CONFIG_MAX_STATIONS];
+    config_alias   aliases[CONFIG_MAX_ALIASES];
+    size_t         rule_group_count;
+    uint64_t       rule_groups[CONFIG_MAX_RULE_GROUPS];
+    uint64_t       rules[CONFIG_RULE_COUNT]; /* bits of rule_groups, 0 lets everybody through */
+    size_t         library_root_count;
+    char           library_roots[CONFIG_MAX_LIBRARY_ROOTS][CONFIG_PATH_BYTES];
+    uint64_t       dead_stream_timeout_ms;
+    int            fallback_station; /* track list index */
+} bot_config;
+
+/* Used until a file is loaded and whenever there is none */
+static bot_config config_defaults = {
+    .default_channel        = CONFIG_DEFAULT_CHANNEL_ID,
+    .afk_channel            = CONFIG_AFK_CHANNEL_ID,
+    .inn_channel            = CONFIG_INN_CHANNEL_ID,
+    .dead_stream_timeout_ms = CONFIG_DEAD_STREAM_TIMEOUT_MS,
+    .fallback_station       = CONFIG_FALLBACK_STATION,
+    .station_count          = 32,
+    .stations =
+        {
+            {"!00",                 "00s Club Hits",          ClubHits,              -1},
+            {"!breaks",             "Breaks",                 Breaks,                -1},
+            {"!slap_house",         "Slap House",             SlapHouse,             -1},
+            {"!house",              "House",                  House,                 -1},
+            {"!deep_organic_house", "Deep Organic House",     DeepOrganicHouse,      -1},
+            {"!bassline",           "Bassline",               Bassline,              -1},
+            {"!future_garage",      "Future Garage",          FutureGarage,          -1},
+            {"!bnj",                "Bass & Jackin' House",   BassAndJackingHouse,   -1},
+            {"!fb",                 "Future Bass",            FutureBass,            -1},
+            {"!cnth",               "Chill & Tropical House", ChillAndTropicalHouse, -1},
+            {"!ew",                 "Electro Swing",          ElectroSwing,          -1},
+            {"!cb",                 "Club Dubstep",           ClubDubstep,           -1},
+            {"!vl",                 "Vocal Lounge",           VocalLounge,           -1},
+            {"!vc",                 "Vocal Chillout",         VocalChillout,         -1},
+            {"!ld",                 "Liquid Dubstep",         LiquidDubstep,         -1},
+            {"!ldnb",               "Liquid DnB",             LiquidDnB,             -1},
+            {"!lh",                 "Latin House",            LatinHouse,            -1},
+            {"!jung",               "Jungle",                 Jungle,                -1},
+            {"!jh",                 "Jazz House",             JazzHouse,             -1},
+            {"!dub",                "Dubstep",                Dubstep,               -1},
+            {"!drum",               "Drumstep",               Drumstep,              -1},
+            {"!chill",              "Chillout",               Chillout,              -1},
+            {"!ab",                 "Atmospheric Breaks",     AtmosphericBreaks,     -1},
+            {"!cs",                 "Chillstep",              Chillstep,             -1},
+            {"!dnb",                "Drum and Bass",          DrumAndBass,           -1},
+            {"!mix",                "DJ Mixes",               DJMixes,               -1},
+            {"!lounge",             "Lounge",                 Lounge,                -1},
+            {"!ambient",            "Ambient",                Ambient,               -1},
+            {"!funky",              "Funky House",            FunkyHouse,            -1},
+            {"!space",              "Space Dreams",           SpaceDreams,           -1},
+            {"!cd",                 "Chillout Dreams",        ChilloutDreams,        -1},
+            {"!disco",              "Disco House",            DiscoHouse,            -1},
+        },
+};
+
+static bot_config* _Atomic config_current = &config_defaults;
+static _Atomic uint64_t    config_epoch   = 0;
+static _Atomic long        config_readers[2];
+
+/* Keywords with a musicbot_commands_total series, fixed by config_register_metrics */
+static char config_metric_keywords[CONFIG_MAX_STATIONS][CONFIG_KEYWORD_BYTES];
+static int  config_metric_slots[CONFIG_MAX_STATIONS];
+static int  config_metric_count = 0;
+static int  config_other_metric = -1;
+static int  config_applied_metric  = -1;
+static int  config_rejected_metric = -1;
+
+static char       config_path[512];
+static pthread_t  config_thread;
+static atomic_int config_running = 0;
+static int        config_inotify = -1;
+static int        config_stop_fd = -1;
+
+typedef struct {
+    const bot_config* config;
+    uint64_t          epoch;
+} config_guard;
+
+/* The current config, valid until config_leave. Lock free, never NULL. */
+static inline config_guard config_enter(void)
+{
+    config_guard guard;
+    for (;;) {
+        guard.epoch = atomic_load(&config_epoch);
+        atomic_fetch_add(&config_readers[guard.epoch & 1], 1);
+        /* Counted in an epoch the watcher has not moved past yet, so it waits for us */
+        if (atomic_load(&config_epoch) == guard.epoch)
+            break;
+        atomic_fetch_sub(&config_readers[guard.epoch & 1], 1);
+    }
+    guard.config = atomic_load(&config_current);
+    return guard;
+}
+
+static inline void config_leave(config_guard* guard)
+{
+    atomic_fetch_sub_explicit(&config_readers[guard->epoch & 1], 1, memory_order_release);
+    guard->config = NULL;
+}
+
+/* Swap in next and free the previous config once its readers left. Only one thread publishes at a time. */
+static void config_publish(bot_config* next)
+{
+    bot_config* old    = atomic_exchange(&config_current, next);
+    uint64_t    parity = atomic_fetch_add(&config_epoch, 1) & 1;
+    while (atomic_load(&config_readers[parity]))
+        usleep(1000);
+    if (old != &config_defaults)
+        free(old);
+}
+
+static int config_station_metric(const char* keyword)
+{
+    for (int i = 0; i < config_metric_count; i++) {
+        if (strcmp(config_metric_keywords[i], keyword) == 0)
+            return config_metric_slots[i];
+    }
+    return config_other_metric;
+}
+
+/*
+ * Register musicbot_commands_total for the station keywords of the current
+ * config, from ts3plugin_init after config_load. Keywords that only show up
+ * in a later reload count as keyword="other_station".
+ */
+void config_register_metrics(void)
+{
+    bot_config* config = atomic_load(&config_current);
+    for (size_t i = 0; i < config->station_count && config_metric_count < CONFIG_MAX_STATIONS; i++) {
+        snprintf(config_metric_keywords[config_metric_count], CONFIG_KEYWORD_BYTES, "%s", config->stations[i].keyword);
+        config_metric_slots[config_metric_count] = metrics_counter("musicbot_commands_total", "Text commands handled, by keyword", "keyword", config_metric_keywords[config_metric_count]);
+        config_metric_count++;
+    }
+    config_other_metric    = metrics_counter("musicbot_commands_total", "Text commands handled, by keyword", "keyword", "other_station");
+    config_applied_metric  = metrics_counter("musicbot_config_reloads_total", "Configuration files read, by outcome", "result", "applied");
+    config_rejected_metric = metrics_counter("musicbot_config_reloads_total", "Configuration files read, by outcome", "result", "rejected");
+    /* Nobody reads the config yet, the slots can be filled in place */
+    for (size_t i = 0; i < config->station_count; i++)
+        config->stations[i].metric = config_station_metric(config->stations[i].keyword);
+}
+
+/* Channel and server group ids */
+static int config_parse_id(const char* text, uint64_t* id)
+{
+    char* end;
+    errno                    = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno || end == text || *end || !value)
+        return -1;
+    *id = value;
+    return 0;
+}
+
+static int config_parse_keyword(const char* text, char* out)
+{
+    size_t length = strlen(text);
+    if (text[0] != '!' || length < 2 || length >= CONFIG_KEYWORD_BYTES)
+        return -1;
+    memcpy(out, text, length + 1);
+    return 0;
+}
+
+/* Parse path into a new config, NULL with the reason logged if it has errors (or cannot be read, then quietly) */
+static bot_config* config_parse(const char* path)
+{
+    FILE* in = fopen(path, "r");
+    if (!in)
+        return NULL;
+    bot_config* config = (bot_config*)calloc(1, sizeof(bot_config));
+    if (!config) {
+        fclose(in);
+        return NULL;
+    }
+    config->default_channel        = config_defaults.default_channel;
+    config->afk_channel            = config_defaults.afk_channel;
+    config->inn_channel            = config_defaults.inn_channel;
+    config->dead_stream_timeout_ms = config_defaults.dead_stream_timeout_ms;
+    config->fallback_station       = config_defaults.fallback_station;
+
+    char        line[CONFIG_LINE_BYTES];
+    int         number = 0;
+    const char* error  = NULL;
+    while (!error && fgets(line, sizeof(line), in)) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        size_t line_length = strlen(line);
+        char*  save        = NULL;
+        char* key  = strtok_r(line, " \t\r\n", &save);
+        if (!key)
+            continue;
+        char* first  = strtok_r(NULL, " \t\r\n", &save);
+        char* second = strtok_r(NULL, " \t\r\n", &save);
+        if (strcmp(key, "default_channel") == 0 || strcmp(key, "afk_channel") == 0 || strcmp(key, "inn_channel") == 0) {
+            uint64_t* channel = key[0] == 'd' ? &config->default_channel : key[0] == 'a' ? &config->afk_channel : &config->inn_channel;
+            if (!first || second || config_parse_id(first, channel) != 0)
+                error = "expected a channel id";
+        } else if (strcmp(key, "station") == 0) {
+            /* The name is the rest of the line and may contain spaces */
+            char* name = save;
+            while (name && isspace((unsigned char)*name))
+                name++;
+            size_t length = name ? strlen(name) : 0;
+            while (length && isspace((unsigned char)name[length - 1]))
+                name[--length] = '\0';
+            char*           end;
+            long            index   = second ? strtol(second, &end, 10) : -1;
+            config_station* station = &config->stations[config->station_count];
+            if (config->station_count == CONFIG_MAX_STATIONS)
+                error = "too many stations";
+            else if (!first || config_parse_keyword(first, station->keyword) != 0)
+                error = "expected a keyword starting with !";
+            else if (!second || *end || index < 0 || index > 0xFFFF)
+                error = "expected a track list index";
+            else if (!length || length >= CONFIG_NAME_BYTES)
+                error = "expected a station name";
+            for (size_t i = 0; !error && i < config->station_count; i++) {
+                if (strcmp(config->stations[i].keyword, station->keyword) == 0)
+                    error = "duplicate station keyword";
+            }
+            if (!error) {
+                memcpy(station->name, name, length + 1);
+                station->station = (int)index;
+                station->metric  = config_station_metric(station->keyword);
+                config->station_count++;
+            }
+        } else if (strcmp(key, "dead_stream_timeout_ms") == 0) {
+            char* end;
+            errno                    = 0;
+            unsigned long long value = first ? strtoull(first, &end, 10) : 0;
+            if (!first || second || errno || *end || !isdigit((unsigned char)first[0]))
+                error = "expected a time in milliseconds";
+            else
+                config->dead_stream_timeout_ms = value;
+        } else if (strcmp(key, "fallback_station") == 0) {
+            char* end;
+            long  index = first ? strtol(first, &end, 10) : -1;
+            if (!first || second || *end || index < 0 || index > 0xFFFF)
+                error = "expected a track list index";
+            else
+                config->fallback_station = (int)index;
+        } else if (strcmp(key, "alias") == 0) {
+            config_alias* alias = &config->aliases[config->alias_count];
+            if (config->alias_count == CONFIG_MAX_ALIASES)
+                error = "too many aliases";
+            else if (!first || !second || strtok_r(NULL, " \t\r\n", &save) || config_parse_keyword(first, alias->keyword) != 0 ||
+                     config_parse_keyword(second, alias->target) != 0)
+                error = "expected two keywords starting with !";
+            else
+                config->alias_count++;
+        } else if (strcmp(key, "library") == 0) {
+            /* The directory is the rest of the line and may contain spaces, undo the tokenizing */
+            char*  dir    = first;
+            size_t length = 0;
+            if (dir) {
+                for (char* c = dir; c < line + line_length; c++) {
+                    if (!*c)
+                        *c = ' ';
+                }
+                length = (size_t)(line + line_length - dir);
+                while (length && isspace((unsigned char)dir[length - 1]))
+                    length--;
+                dir[length] = '\0';
+            }
+            if (config->library_root_count == CONFIG_MAX_LIBRARY_ROOTS)
+                error = "too many library directories";
+            else if (!length || dir[0] != '/' || length >= CONFIG_PATH_BYTES)
+                error = "expected an absolute directory path";
+            else
+                memcpy(config->library_roots[config->library_root_count++], dir, length + 1);
+        } else if (strcmp(key, "allow") == 0) {
+            int rule = CONFIG_RULE_COUNT;
+            for (int i = 0; first && i < CONFIG_RULE_COUNT; i++) {
+                if (strcmp(first, config_rule_names[i]) == 0)
+                    rule = i;
+            }
+            if (rule == CONFIG_RULE_COUNT)
+                error = "expected !kick, !join or stations";
+            else if (!second)
+                error = "expected server group ids";
+            for (char* group = second; !error && group; group = strtok_r(NULL, " \t\r\n", &save)) {
+                uint64_t id;
+                size_t   bit = 0;
+                if (config_parse_id(group, &id) != 0) {
+                    error = "expected a server group id";
+                    break;
+                }
+                while (bit < config->rule_group_count && config->rule_groups[bit] != id)
+                    bit++;
+                if (bit == CONFIG_MAX_RULE_GROUPS) {
+                    error = "too many server groups in allow lines";
+                    break;
+                }
+                config->rule_groups[bit] = id;
+                config->rule_group_count += bit == config->rule_group_count;
+                config->rules[rule] |= 1ull << bit;
+            }
+        } else {
+            error = "unknown setting";
+        }
+    }
+    fclose(in);
+
+    if (!error && !config->station_count) {
+        memcpy(config->stations, config_defaults.stations, sizeof(config->stations));
+        config->station_count = config_defaults.station_count;
+        for (size_t i = 0; i < config->station_count; i++)
+            config->stations[i].metric = config_station_metric(config->stations[i].keyword);
+    }
+    if (error) {
+        LOG_ERROR("%s:%d: %s, keeping the current configuration", path, number, error);
+        free(config);
+        return NULL;
+    }
+    return config;
+}
+
+static void config_write_defaults(const char* path)
+{
+    FILE* out = fopen(path, "wx");
+    if (!out)
+        return;
+    fprintf(out, "# MusicBot configuration, changes apply as soon as the file is saved\n");
+    fprintf(out, "default_channel %llu\nafk_channel %llu\ninn_channel %llu\n\n", (unsigned long long)config_defaults.default_channel,
+            (unsigned long long)config_defaults.afk_channel, (unsigned long long)config_defaults.inn_channel);
+    fprintf(out, "# station <keyword> <track list index> <name>\n");
+    for (size_t i = 0; i < config_defaults.station_count; i++)
+        fprintf(out, "station %s %d %s\n", config_defaults.stations[i].keyword, config_defaults.stations[i].station, config_defaults.stations[i].name);
+    fprintf(out, "\n# alias <keyword> <command>, e.g.\n# alias !np !song\n");
+    fprintf(out, "\n# allow !kick|!join|stations <server group id>..., everybody without one, e.g.\n# allow !kick 6\n");
+    fprintf(out, "\n# library <directory>, music files for !play, e.g.\n# library /srv/music\n");
+    fprintf(out, "\n# Fail over to the track list index fallback_station after this much silence, 0 never\n");
+    fprintf(out, "dead_stream_timeout_ms %llu\nfallback_station %d\n", (unsigned long long)config_defaults.dead_stream_timeout_ms, config_defaults.fallback_station);
+    fclose(out);
+    LOG_INFO("Wrote the default configuration to %s", path);
+}
+
+/* Parse and publish the file, returns 0 if it was applied */
+static int config_reload(void)
+{
+    bot_config* next = config_parse(config_path);
+    if (!next) {
+        metrics_inc(config_rejected_metric);
+        return -1;
+    }
+    config_guard guard = config_enter();
+    next->generation   = guard.config->generation + 1;
+    LOG_INFO("Configuration %llu: %zu stations, %zu aliases, %zu server groups in rules, default channel %llu", (unsigned long long)next->generation, next->station_count,
+             next->alias_count, next->rule_group_count, (unsigned long long)next->default_channel);
+    config_leave(&guard);
+    config_publish(next);
+    metrics_inc(config_applied_metric);
+    return 0;
+}
+
+/* Load dir/CONFIG_FILE_NAME synchronously, from ts3plugin_init before anything reads the config */
+void config_load(const char* dir)
+{
+    if (snprintf(config_path, sizeof(config_path), "%s/%s", dir, CONFIG_FILE_NAME) >= (int)sizeof(config_path)) {
+        LOG_ERROR("Configuration directory %s is too long, using the built-in configuration", dir);
+        config_path[0] = '\0';
+        return;
+    }
+    if (access(config_path, F_OK) != 0)
+        config_write_defaults(config_path);
+    config_reload();
+}
+
+static void* config_watch(void* arg)
+{
+    (void)arg;
+    const char* file_name = strrchr(config_path, '/') + 1;
+    int         pending   = 0;
+    while (atomic_load(&config_running)) {
+        struct pollfd fds[2] = {{config_inotify, POLLIN, 0}, {config_stop_fd, POLLIN, 0}};
+        int           ready  = poll(fds, 2, pending ? CONFIG_SETTLE_MS : -1);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents)
+            break;
+        if (ready == 0 && pending) {
+            pending = 0;
+            config_reload();
+            continue;
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        char    events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length = read(config_inotify, events, sizeof(events));
+        for (char* at = events; length > 0 && at < events + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)at;
+            if (event->len && strcmp(event->name, file_name) == 0)
+                pending = 1;
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+/* Watch the file config_load read, reloads run on the watcher thread */
+int config_watch_start(void)
+{
+    if (atomic_load(&config_running) || !config_path[0])
+        return 0;
+    char dir[sizeof(config_path)];
+    snprintf(dir, sizeof(dir), "%s", config_path);
+    *strrchr(dir, '/') = '\0';
+    config_inotify     = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    config_stop_fd     = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (config_inotify < 0 || config_stop_fd < 0 || inotify_add_watch(config_inotify, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        LOG_WARN("Cannot watch %s, configuration changes need a restart", dir);
+        if (config_inotify >= 0)
+            close(config_inotify);
+        if (config_stop_fd >= 0)
+            close(config_stop_fd);
+        config_inotify = config_stop_fd = -1;
+        return -1;
+    }
+    atomic_store(&config_running, 1);
+    pthread_create(&config_thread, NULL, config_watch, NULL);
+    return 0;
+}
+
+/* Stop watching and go back to the built-in config, after every reader thread stopped */
+void config_stop(void)
+{
+    if (atomic_exchange(&config_running, 0)) {
+        uint64_t one = 1;
+        if (write(config_stop_fd, &one, sizeof(one)) != sizeof(one))
+            LOG_WARN("Cannot wake the configuration watcher");
+        pthread_join(config_thread, NULL);
+        close(config_inotify);
+        close(config_stop_fd);
+        config_inotify = config_stop_fd = -1;
+    }
+    config_publish(&config_defaults);
+}
+
+/* Copies of the channel policy, for code that needs one value */
+uint64_t config_default_channel(void)
+{
+    config_guard guard   = config_enter();
+    uint64_t     channel = guard.config->default_channel;
+    config_leave(&guard);
+    return channel;
+}
+
+/* AFK or the entrance channel, the bot does not stay there */
+int config_is_away_channel(uint64_t channel)
+{
+    config_guard guard = config_enter();
+    int          away  = channel == guard.config->afk_channel || channel == guard.config->inn_channel;
+    config_leave(&guard);
+    return away;
+}
+
+/* Copy the station command keyword into station, 0 if there is none */
+int config_find_station(const char* keyword, config_station* station)
+{
+    config_guard guard = config_enter();
+    int          found = 0;
+    for (size_t i = 0; !found && i < guard.config->station_count; i++) {
+        if (strcmp(guard.config->stations[i].keyword, keyword) == 0) {
+            *station = guard.config->stations[i];
+            found    = 1;
+        }
+    }
+    config_leave(&guard);
+    return found;
+}
+
+/* Copy the first station command for track list index into station, 0 if there is none */
+int config_station_of(int index, config_station* station)
+{
+    config_guard guard = config_enter();
+    int          found = 0;
+    for (size_t i = 0; !found && i < guard.config->station_count; i++) {
+        if (guard.config->stations[i].station == index) {
+            *station = guard.config->stations[i];
+            found    = 1;
+        }
+    }
+    config_leave(&guard);
+    return found;
+}
+
+/* The command an alias stands for copied to out, or message itself */
+const char* config_resolve_alias(const char* message, char* out, size_t size)
+{
+    config_guard guard    = config_enter();
+    const char*  resolved = message;
+    for (size_t i = 0; i < guard.config->alias_count; i++) {
+        if (strcmp(guard.config->aliases[i].keyword, message) == 0) {
+            snprintf(out, size, "%s", guard.config->aliases[i].target);
+            resolved = out;
+            break;
+        }
+    }
+    config_leave(&guard);
+    return resolved;
+}
+
+#endif
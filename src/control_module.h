@@ -0,0 +1,401 @@
+#ifndef CONTROL_MODULE_H
+#define CONTROL_MODULE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log_module.h"
+#include "loop_module.h"
+#include "metrics_module.h"
+
+/*
+ * Local control socket for automation (scheduled programming, monitoring).
+ *
+ * A Unix stream socket, CONTROL_SOCKET_PATH unless the plugin is told
+ * otherwise, only usable by the user running the TS3 client: file
+ * permissions are its access control, the allow rules of the config do not
+ * apply. The event loop watches the socket and its connections
+ * (loop_watch), so requests run on the loop thread like chat commands and
+ * nothing here needs a lock. Requests are lines
+ *
+ *   <id> <verb> [argument]
+ *
+ * with an id of the caller's choosing (no spaces, shorter than
+ * CONTROL_ID_BYTES). Requests are pipelined: a client sends as many as it
+ * likes without waiting, they run in the order they arrive and each gets
+ * exactly one response line, in the same order, tagged with its id:
+ *
+ *   <id> ok[ <result>]
+ *   <id> error <code> <message>
+ *
+ * Results of several fields separate them with tabs, since song titles
+ * have spaces. The verbs
+ *
+ *   ping                     ok pong
+ *   station [keyword|index]  switch to a station, given by its chat keyword
+ *                            (the '!' may be left out) or track list index;
+ *                            without argument the station last tuned to.
+ *                            ok <index>\t<name>
+ *   now-playing              ok <index>\t<song>\t<stream title>, index -1 if none
+ *   listeners                ok <listeners>\t<channel id>
+ *   metrics [prefix]         ok <lines>, followed by that many lines of the
+ *                            Prometheus text (metrics_module.h); with prefix
+ *                            only the samples of metrics whose name starts so
+ *
+ * ping and metrics are answered here, the others by the handler given to
+ * control_start. Error codes are bad-request, unknown-verb, unknown-station,
+ * warming-up and unavailable, and with id "-" line-too-long (for a line
+ * longer than CONTROL_LINE_BYTES, whose id is not known) and busy (all
+ * CONTROL_MAX_CLIENTS connections are taken, the socket is closed).
+ *
+ * Responses are queued per connection and written whenever the socket takes
+ * them. Once CONTROL_OUTPUT_LIMIT bytes wait for a client the rest of its
+ * requests wait too, and the connection is not read until it drained.
+ */
+
+#define CONTROL_SOCKET_PATH "/tmp/musicbot-control.sock"
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_LINE_BYTES 4096
+#define CONTROL_ID_BYTES 32
+#define CONTROL_RESULT_BYTES 1024
+#define CONTROL_OUTPUT_LIMIT (256 * 1024)
+
+/* Outcome of a control_handler, see there */
+enum { CONTROL_OK = 0, CONTROL_FAILED, CONTROL_UNKNOWN };
+
+/*
+ * Run verb with argument (NULL if there is none) and write the result to
+ * out. Returns CONTROL_OK, CONTROL_FAILED with "<code> <message>" in out, or
+ * CONTROL_UNKNOWN for a verb (or argument) it does not know.
+ */
+typedef int (*control_handler)(const char* verb, const char* argument, char* out, size_t size);
+
+typedef struct {
+    int    open;
+    int    fd;
+    int    skipping; /* dropping the rest of an overlong line */
+    int    closing;  /* the client closed its side, close once the output is out */
+    size_t input_length;
+    char   input[CONTROL_LINE_BYTES];
+    char*  output;
+    size_t output_length;
+    size_t output_sent;
+    size_t output_capacity;
+} control_client;
+
+static control_client  control_clients[CONTROL_MAX_CLIENTS];
+static control_handler control_handle    = NULL;
+static int             control_listen_fd = -1;
+static char            control_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static int control_ok_metric;
+static int control_failed_metric;
+static int control_refused_metric;
+
+static double control_client_count(int unused)
+{
+    (void)unused;
+    int count = 0;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+        count += control_clients[i].open;
+    return count;
+}
+
+void control_register_metrics(void)
+{
+    control_ok_metric      = metrics_counter("musicbot_control_requests_total", "Control socket requests, by outcome", "result", "ok");
+    control_failed_metric  = metrics_counter("musicbot_control_requests_total", "Control socket requests, by outcome", "result", "failed");
+    control_refused_metric = metrics_counter("musicbot_control_refused_total", "Control socket connections refused because all slots were taken", NULL, NULL);
+    metrics_export("musicbot_control_connections", "Open control socket connections", METRIC_GAUGE, NULL, NULL, control_client_count, 0);
+}
+
+/* Replace tabs, line breaks and other control characters in text by spaces, for a result field */
+static inline char* control_clean(char* text)
+{
+    for (char* c = text; *c; c++) {
+        if ((unsigned char)*c < 0x20)
+            *c = ' ';
+    }
+    return text;
+}
+
+static void control_put(control_client* client, const char* data, size_t length)
+{
+    if (client->output_length + length > client->output_capacity) {
+        size_t capacity = client->output_capacity ? client->output_capacity : 4096;
+        while (capacity < client->output_length + length)
+            capacity *= 2;
+        char* output = (char*)realloc(client->output, capacity);
+        if (!output)
+            return; /* the response is lost, the client sees a gap in the ids */
+        client->output          = output;
+        client->output_capacity = capacity;
+    }
+    memcpy(client->output + client->output_length, data, length);
+    client->output_length += length;
+}
+
+static void control_respond(control_client* client, const char* id, int status, const char* text)
+{
+    char line[CONTROL_ID_BYTES + CONTROL_RESULT_BYTES + 16];
+    int  length = snprintf(line, sizeof(line), "%s %s%s%s", id, status == CONTROL_OK ? "ok" : "error", text && *text ? " " : "", text ? text : "");
+    if (length < 0)
+        return;
+    length = length < (int)sizeof(line) - 1 ? length : (int)sizeof(line) - 2;
+    /* One line whatever the handler wrote, tabs separate fields */
+    for (int i = 0; i < length; i++) {
+        if ((unsigned char)line[i] < 0x20 && line[i] != '\t')
+            line[i] = ' ';
+    }
+    line[length++] = '\n';
+    control_put(client, line, (size_t)length);
+    metrics_inc(status == CONTROL_OK ? control_ok_metric : control_failed_metric);
+}
+
+/* The metrics verb: the count line, then the Prometheus text or, with prefix, its matching samples */
+static void control_metrics(control_client* client, const char* id, const char* prefix)
+{
+    char*  text   = NULL;
+    size_t size   = 0;
+    FILE*  render = open_memstream(&text, &size);
+    if (!render) {
+        control_respond(client, id, CONTROL_FAILED, "unavailable cannot render the metrics");
+        return;
+    }
+    metrics_render(render);
+    fclose(render);
+
+    size_t prefix_length = prefix ? strlen(prefix) : 0;
+    size_t kept          = 0;
+    char*  end           = text;
+    for (char* line = text; line < text + size;) {
+        char* newline = (char*)memchr(line, '\n', (size_t)(text + size - line));
+        if (!newline)
+            break;
+        size_t length = (size_t)(newline - line) + 1;
+        if (!prefix || (line[0] != '#' && strncmp(line, prefix, prefix_length) == 0)) {
+            memmove(end, line, length);
+            end += length;
+            kept++;
+        }
+        line = newline + 1;
+    }
+    char count[32];
+    snprintf(count, sizeof(count), "%zu", kept);
+    control_respond(client, id, CONTROL_OK, count);
+    control_put(client, text, (size_t)(end - text));
+    free(text);
+}
+
+static void control_run(control_client* client, char* line)
+{
+    char*       save     = NULL;
+    const char* id       = strtok_r(line, " ", &save);
+    const char* verb     = strtok_r(NULL, " ", &save);
+    const char* argument = strtok_r(NULL, " ", &save);
+    char        result[CONTROL_RESULT_BYTES];
+    if (!id)
+        return; /* blank line */
+    if (strlen(id) >= CONTROL_ID_BYTES) {
+        control_respond(client, "-", CONTROL_FAILED, "bad-request id too long");
+        return;
+    }
+    if (!verb) {
+        control_respond(client, id, CONTROL_FAILED, "bad-request missing verb");
+        return;
+    }
+
+    int status = CONTROL_UNKNOWN;
+    if (strcmp(verb, "ping") == 0 && !argument) {
+        status = CONTROL_OK;
+        snprintf(result, sizeof(result), "pong");
+    } else if (strcmp(verb, "metrics") == 0) {
+        control_metrics(client, id, argument);
+        return;
+    } else if (control_handle) {
+        result[0] = '\0';
+        status    = control_handle(verb, argument, result, sizeof(result));
+    }
+    if (status == CONTROL_UNKNOWN)
+        snprintf(result, sizeof(result), "unknown-verb %s%s%s", verb, argument ? " " : "", argument ? argument : "");
+    control_respond(client, id, status, result);
+}
+
+/* Run the complete lines of the input, until too much output waits */
+static void control_process(control_client* client)
+{
+    size_t start = 0;
+    while (client->output_length - client->output_sent < CONTROL_OUTPUT_LIMIT) {
+        char* newline = (char*)memchr(client->input + start, '\n', client->input_length - start);
+        if (!newline)
+            break;
+        *newline = '\0';
+        if (newline > client->input + start && newline[-1] == '\r')
+            newline[-1] = '\0';
+        if (!client->skipping)
+            control_run(client, client->input + start);
+        client->skipping = 0;
+        start            = (size_t)(newline - client->input) + 1;
+    }
+    client->input_length -= start;
+    memmove(client->input, client->input + start, client->input_length);
+
+    if (client->input_length == sizeof(client->input) && !memchr(client->input, '\n', client->input_length)) {
+        if (!client->skipping) {
+            char message[64];
+            snprintf(message, sizeof(message), "line-too-long requests are at most %d bytes", CONTROL_LINE_BYTES);
+            control_respond(client, "-", CONTROL_FAILED, message);
+        }
+        client->skipping     = 1;
+        client->input_length = 0;
+    }
+}
+
+static void control_close(control_client* client)
+{
+    loop_unwatch(client->fd);
+    close(client->fd);
+    free(client->output);
+    memset(client, 0, sizeof(*client));
+}
+
+/* Write what the socket takes and wait for what is missing. Returns -1 if the client is gone. */
+static int control_flush(control_client* client)
+{
+    while (client->output_sent < client->output_length) {
+        ssize_t n = send(client->fd, client->output + client->output_sent, client->output_length - client->output_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return -1;
+        client->output_sent += (size_t)n;
+    }
+    if (client->output_sent == client->output_length)
+        client->output_sent = client->output_length = 0;
+
+    size_t   pending = client->output_length - client->output_sent;
+    uint32_t events  = 0;
+    if (!client->closing && pending < CONTROL_OUTPUT_LIMIT)
+        events |= EPOLLIN;
+    if (pending)
+        events |= EPOLLOUT;
+    if (events)
+        loop_watch_events(client->fd, events);
+    return 0;
+}
+
+static void control_client_ready(int fd, uint32_t events, void* context)
+{
+    control_client* client = (control_client*)context;
+    size_t          room   = sizeof(client->input) - client->input_length;
+    if (room && !client->closing && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        ssize_t n = read(fd, client->input + client->input_length, room);
+        if (n > 0) {
+            client->input_length += (size_t)n;
+        } else if (n == 0) {
+            client->closing = 1;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            control_close(client);
+            return;
+        }
+    }
+    /* Run requests while the socket takes their responses */
+    for (;;) {
+        control_process(client);
+        if (control_flush(client) != 0) {
+            control_close(client);
+            return;
+        }
+        if (client->output_length - client->output_sent >= CONTROL_OUTPUT_LIMIT || !memchr(client->input, '\n', client->input_length))
+            break;
+    }
+    if (client->closing && client->output_length == client->output_sent)
+        control_close(client);
+}
+
+static void control_accept(int fd, uint32_t events, void* context)
+{
+    (void)events;
+    (void)context;
+    int client_fd;
+    while ((client_fd = accept(fd, NULL, NULL)) >= 0) {
+        fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(client_fd, F_SETFL, O_NONBLOCK);
+        control_client* client = NULL;
+        for (int i = 0; !client && i < CONTROL_MAX_CLIENTS; i++) {
+            if (!control_clients[i].open)
+                client = &control_clients[i];
+        }
+        if (!client || loop_watch(client_fd, EPOLLIN, control_client_ready, client) != 0) {
+            static const char busy[] = "- error busy too many connections\n";
+            if (send(client_fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL) < 0)
+                LOG_DEBUG("Control client left before it was refused");
+            close(client_fd);
+            metrics_inc(control_refused_metric);
+            LOG_SAMPLED(LOG_LEVEL_WARN, 100, "Control socket refused a connection, all %d slots taken", CONTROL_MAX_CLIENTS);
+            continue;
+        }
+        memset(client, 0, sizeof(*client));
+        client->open = 1;
+        client->fd   = client_fd;
+    }
+}
+
+/*
+ * Listen on path, owner only, and serve it on the event loop with handler
+ * for the verbs beyond ping and metrics. Call it before loop_start (or on
+ * the loop thread). Returns 0, or -1 if the socket cannot be set up.
+ */
+int control_start(const char* path, control_handler handler)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Control socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    control_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (control_listen_fd < 0) {
+        LOG_ERROR("Control socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    /* Nobody can connect before listen, so there is no window with the wider mode */
+    if (bind(control_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0 || listen(control_listen_fd, CONTROL_MAX_CLIENTS) < 0 || loop_watch(control_listen_fd, EPOLLIN, control_accept, NULL) != 0) {
+        LOG_ERROR("Cannot serve the control socket on %s: %s", path, strerror(errno));
+        close(control_listen_fd);
+        control_listen_fd = -1;
+        return -1;
+    }
+    snprintf(control_path, sizeof(control_path), "%s", path);
+    control_handle = handler;
+    LOG_INFO("Serving control requests on %s", path);
+    return 0;
+}
+
+/* Close the socket and every connection, after loop_stop */
+void control_stop(void)
+{
+    if (control_listen_fd < 0)
+        return;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control_clients[i].open)
+            control_close(&control_clients[i]);
+    }
+    loop_unwatch(control_listen_fd);
+    close(control_listen_fd);
+    control_listen_fd = -1;
+    unlink(control_path);
+}
+
+#endif
@@ -1,14 +1,30 @@
+#ifndef DBUS_MODULE_H
+#define DBUS_MODULE_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <dbus/dbus.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
 
+#include "log_module.h"
+#include "metrics_module.h"
+#include "trace_module.h"
+
 #define VLC_BUS_NAME "org.mpris.MediaPlayer2.vlc"
 #define VLC_OBJECT_PATH "/org/mpris/MediaPlayer2"
 #define VLC_TRACKLIST_INTERFACE "org.mpris.MediaPlayer2.TrackList"
 
+/* Bus name of the player that is currently on air, see deck_module.h */
+const char *_Atomic vlc_bus_name = VLC_BUS_NAME;
+/* Station index last tuned on the player on air, -1 before the first switch */
+atomic_int on_air_station = -1;
+
+/* Track list of the player on air, replaced when the player restarts (see player_module.h) */
 char **track_list = NULL;
 size_t track_count = 0;
+pthread_mutex_t track_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
 typedef enum {
     ClubHits = 0,
@@ -45,28 +61,92 @@ typedef enum {
     DiscoHouse
 } RADIO_STATION;
 
-void handle_dbus_error(DBusError *error) {
+/* Calls timed by dbus_call, label values of musicbot_dbus_rtt_seconds */
+enum { DBUS_CALL_TRACKS = 0, DBUS_CALL_GOTO, DBUS_CALL_METADATA, DBUS_CALL_PLAYER, DBUS_CALL_LIST_NAMES, DBUS_CALL_NAME_OWNER, DBUS_CALL_OPEN_URI, DBUS_CALL_COUNT };
+static const char *const dbus_call_names[DBUS_CALL_COUNT] = {"Tracks", "GoTo", "Metadata", "Player", "ListNames", "GetNameOwner", "OpenUri"};
+static const char *const dbus_call_spans[DBUS_CALL_COUNT] = {"dbus Tracks", "dbus GoTo", "dbus Metadata", "dbus Player", "dbus ListNames", "dbus GetNameOwner", "dbus OpenUri"};
+static int dbus_rtt_metric[DBUS_CALL_COUNT];
+static int dbus_error_metric[DBUS_CALL_COUNT];
+
+void dbus_register_metrics(void) {
+    for (int i = 0; i < DBUS_CALL_COUNT; i++) {
+        dbus_rtt_metric[i] = metrics_histogram("musicbot_dbus_rtt_seconds", "Round trip time of blocking D-Bus calls", "method", dbus_call_names[i]);
+    }
+    for (int i = 0; i < DBUS_CALL_COUNT; i++) {
+        dbus_error_metric[i] = metrics_counter("musicbot_dbus_errors_total", "D-Bus calls that returned an error", "method", dbus_call_names[i]);
+    }
+}
+
+/* dbus_connection_send_with_reply_and_block, timed and traced per method */
+DBusMessage *dbus_call(DBusConnection *connection, DBusMessage *message, DBusError *error, int call) {
+    uint64_t start = metrics_now_ns();
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(connection, message, -1, error);
+    uint64_t end = metrics_now_ns();
+    metrics_observe_ns(dbus_rtt_metric[call], end - start);
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        trace_record(dbus_call_spans[call], start, end);
+    }
+    if (!reply) {
+        metrics_inc(dbus_error_metric[call]);
+    }
+    return reply;
+}
+
+/* Log and free error if it is set, returns 1 if it was */
+int handle_dbus_error(DBusError *error) {
     if (dbus_error_is_set(error)) {
-        fprintf(stderr, "DBus Error: %s\n", error->message);
+        LOG_ERROR("DBus Error: %s", error->message);
         dbus_error_free(error);
-        exit(EXIT_FAILURE);
+        return 1;
     }
+    return 0;
 }
 
-void get_track_list(DBusConnection *connection) {
+/*
+ * Append the object paths of a Tracks reply (variant holding ao) to list.
+ * The array grows by doubling, tracklists can have tens of thousands of
+ * entries.
+ */
+void parse_track_list(DBusMessage *reply, char ***list, size_t *count) {
+    DBusMessageIter args, array;
+    if (!dbus_message_iter_init(reply, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_VARIANT) {
+        return;
+    }
+    dbus_message_iter_recurse(&args, &array);
+    if (dbus_message_iter_get_arg_type(&array) != DBUS_TYPE_ARRAY) {
+        return;
+    }
+    size_t capacity = *count;
+    dbus_message_iter_recurse(&array, &args);
+    while (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_OBJECT_PATH) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = (char**)realloc(*list, sizeof(char *) * capacity);
+            if (!grown) {
+                LOG_ERROR("Out of memory reading the tracklist");
+                return;
+            }
+            *list = grown;
+        }
+        const char *path;
+        dbus_message_iter_get_basic(&args, &path);
+        (*list)[(*count)++] = strdup(path);
+        dbus_message_iter_next(&args);
+    }
+}
+
+int fetch_track_list(DBusConnection *connection, const char *bus_name, char ***list, size_t *count, DBusError *error) {
     DBusMessage *message = NULL, *reply = NULL;
-    DBusError error;
-    dbus_error_init(&error);
 
     message = dbus_message_new_method_call(
-        VLC_BUS_NAME,
+        bus_name,
         VLC_OBJECT_PATH,
         "org.freedesktop.DBus.Properties",
         "Get"
         );
     if (!message) {
-        fprintf(stderr, "Failed to create DBus message\n");
-        exit(EXIT_FAILURE);
+        LOG_ERROR("Failed to create DBus message");
+        return -1;
     }
 
     const char *interface_name = VLC_TRACKLIST_INTERFACE;
@@ -78,52 +158,84 @@ void get_track_list(DBusConnection *connection) {
         DBUS_TYPE_INVALID
         );
 
-    reply = dbus_connection_send_with_reply_and_block(connection, message, -1, &error);
+    reply = dbus_call(connection, message, error, DBUS_CALL_TRACKS);
     dbus_message_unref(message);
-    handle_dbus_error(&error);
-
-    DBusMessageIter args, array;
-    if (dbus_message_iter_init(reply, &args)) {
-        if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_VARIANT) {
-            dbus_message_iter_recurse(&args, &array);
-
-            if (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_ARRAY) {
-                dbus_message_iter_recurse(&array, &args);
-
-                while (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_OBJECT_PATH) {
-                    const char *path;
-                    dbus_message_iter_get_basic(&args, &path);
-                    track_list = (char**)realloc(track_list, sizeof(char *) * (track_count + 1));
-                    track_list[track_count++] = strdup(path);
-                    dbus_message_iter_next(&args);
-                }
-            }
-        }
+    if (!reply) {
+        return -1;
     }
 
+    parse_track_list(reply, list, count);
     dbus_message_unref(reply);
+    return 0;
 }
 
-void change_station(DBusConnection *connection, size_t station_index) {
-    if (station_index >= track_count) {
-        fprintf(stderr, "Invalid station index: %zu\n", station_index);
-        return;
+/* Free a list from fetch_track_list */
+void free_track_list(char **list, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+/* Make list the track list on air, taking ownership of it, and free the old one */
+void replace_track_list(char **list, size_t count) {
+    pthread_mutex_lock(&track_list_lock);
+    char **old = track_list;
+    size_t old_count = track_count;
+    track_list = list;
+    track_count = count;
+    pthread_mutex_unlock(&track_list_lock);
+    free_track_list(old, old_count);
+}
+
+/*
+ * Fetch the track list of bus_name and make it the one on air. Returns 0,
+ * or -1 with error set and the old list kept.
+ */
+int get_track_list(DBusConnection *connection, const char *bus_name, DBusError *error) {
+    char **list = NULL;
+    size_t count = 0;
+    if (fetch_track_list(connection, bus_name, &list, &count, error) != 0) {
+        free_track_list(list, count);
+        return -1;
     }
+    replace_track_list(list, count);
+    return 0;
+}
 
-    const char *track_path = track_list[station_index];
-    DBusMessage *message = NULL;
+/* Call a method without arguments on the org.mpris.MediaPlayer2.Player interface, e.g. "Play" or "Stop" */
+int player_command(DBusConnection *connection, const char *bus_name, const char *method) {
     DBusError error;
     dbus_error_init(&error);
 
-    message = dbus_message_new_method_call(
-        VLC_BUS_NAME,
+    DBusMessage *message = dbus_message_new_method_call(bus_name, VLC_OBJECT_PATH, "org.mpris.MediaPlayer2.Player", method);
+    if (!message) {
+        LOG_ERROR("Failed to create DBus message");
+        return -1;
+    }
+
+    DBusMessage *reply = dbus_call(connection, message, &error, DBUS_CALL_PLAYER);
+    dbus_message_unref(message);
+    if (dbus_error_is_set(&error)) {
+        LOG_ERROR("DBus Error: %s", error.message);
+        dbus_error_free(&error);
+        return -1;
+    }
+
+    dbus_message_unref(reply);
+    return 0;
+}
+
+int goto_track(DBusConnection *connection, const char *bus_name, const char *track_path, DBusError *error) {
+    DBusMessage *message = dbus_message_new_method_call(
+        bus_name,
         VLC_OBJECT_PATH,
         VLC_TRACKLIST_INTERFACE,
         "GoTo"
         );
     if (!message) {
-        fprintf(stderr, "Failed to create DBus message\n");
-        exit(EXIT_FAILURE);
+        LOG_ERROR("Failed to create DBus message");
+        return -1;
     }
 
     dbus_message_append_args(
@@ -132,28 +244,119 @@ void change_station(DBusConnection *connection, size_t station_index) {
         DBUS_TYPE_INVALID
         );
 
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(connection, message, -1, &error);
+    DBusMessage *reply = dbus_call(connection, message, error, DBUS_CALL_GOTO);
     dbus_message_unref(message);
-    handle_dbus_error(&error);
+    if (!reply) {
+        return -1;
+    }
+
+    dbus_message_unref(reply);
+    return 0;
+}
+
+void change_station(DBusConnection *connection, size_t station_index) {
+    pthread_mutex_lock(&track_list_lock);
+    char *track_path = station_index < track_count ? strdup(track_list[station_index]) : NULL;
+    pthread_mutex_unlock(&track_list_lock);
+    if (!track_path) {
+        LOG_ERROR("Invalid station index: %zu", station_index);
+        return;
+    }
+
+    DBusError error;
+    dbus_error_init(&error);
 
-    printf("Changed to station: %zu (%s)\n", station_index, track_path);
+    if (goto_track(connection, vlc_bus_name, track_path, &error) != 0) {
+        handle_dbus_error(&error);
+        free(track_path);
+        return;
+    }
+    atomic_store(&on_air_station, (int)station_index);
+
+    LOG_INFO("Changed to station: %zu (%s)", station_index, track_path);
+    free(track_path);
+}
+
+/*
+ * Player.OpenUri on the player on air: VLC adds uri to its playlist and
+ * plays it, the stations keep their track list indexes. Returns 0 on
+ * success, -1 (logged) otherwise.
+ */
+int open_uri(DBusConnection *connection, const char *uri) {
+    DBusError error;
+    dbus_error_init(&error);
+
+    DBusMessage *message = dbus_message_new_method_call(vlc_bus_name, VLC_OBJECT_PATH, "org.mpris.MediaPlayer2.Player", "OpenUri");
+    if (!message) {
+        LOG_ERROR("Failed to create DBus message");
+        return -1;
+    }
+    dbus_message_append_args(message, DBUS_TYPE_STRING, &uri, DBUS_TYPE_INVALID);
 
+    DBusMessage *reply = dbus_call(connection, message, &error, DBUS_CALL_OPEN_URI);
+    dbus_message_unref(message);
+    if (!reply) {
+        handle_dbus_error(&error);
+        return -1;
+    }
     dbus_message_unref(reply);
+    atomic_store(&on_air_station, -1);
+    LOG_INFO("Opened %s", uri);
+    return 0;
 }
 
-char *GetSongName(DBusConnection *connection) {
-    DBusMessage *message = NULL, *reply = NULL;
+/* VLC registers every instance after the first one as org.mpris.MediaPlayer2.vlc.instance<pid> */
+char *find_vlc_instance(DBusConnection *connection) {
     DBusError error;
     dbus_error_init(&error);
 
-    message = dbus_message_new_method_call(
-        "org.mpris.MediaPlayer2.vlc",  // VLC Bus Name
+    DBusMessage *message = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "ListNames");
+    if (!message) {
+        LOG_ERROR("Failed to create DBus message");
+        return NULL;
+    }
+
+    DBusMessage *reply = dbus_call(connection, message, &error, DBUS_CALL_LIST_NAMES);
+    dbus_message_unref(message);
+    if (dbus_error_is_set(&error)) {
+        LOG_ERROR("DBus Error: %s", error.message);
+        dbus_error_free(&error);
+        return NULL;
+    }
+
+    const char *prefix = VLC_BUS_NAME ".instance";
+    char *instance = NULL;
+    DBusMessageIter args, names;
+    if (dbus_message_iter_init(reply, &args) && dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_ARRAY) {
+        dbus_message_iter_recurse(&args, &names);
+        while (dbus_message_iter_get_arg_type(&names) == DBUS_TYPE_STRING) {
+            const char *name;
+            dbus_message_iter_get_basic(&names, &name);
+            if (strncmp(name, prefix, strlen(prefix)) == 0) {
+                instance = strdup(name);
+                break;
+            }
+            dbus_message_iter_next(&names);
+        }
+    }
+
+    dbus_message_unref(reply);
+    return instance;
+}
+
+/* Properties.Get(Player, Metadata) on the player on air, NULL (logged) on failure */
+static DBusMessage *get_metadata(DBusConnection *connection) {
+    DBusError error;
+    dbus_error_init(&error);
+
+    DBusMessage *message = dbus_message_new_method_call(
+        vlc_bus_name,                  // VLC Bus Name
         "/org/mpris/MediaPlayer2",     // VLC Object Path
         "org.freedesktop.DBus.Properties", // Interface
         "Get"                          // Method
         );
     if (!message) {
-        fprintf(stderr, "Failed to create DBus message\n");
+        LOG_ERROR("Failed to create DBus message");
         return NULL;
     }
 
@@ -166,140 +369,208 @@ char *GetSongName(DBusConnection *connection) {
         DBUS_TYPE_INVALID
         );
 
-    reply = dbus_connection_send_with_reply_and_block(connection, message, -1, &error);
+    DBusMessage *reply = dbus_call(connection, message, &error, DBUS_CALL_METADATA);
     dbus_message_unref(message);
     if (dbus_error_is_set(&error)) {
-        fprintf(stderr, "DBus Error: %s\n", error.message);
+        LOG_ERROR("DBus Error: %s", error.message);
         dbus_error_free(&error);
         return NULL;
     }
+    return reply;
+}
 
-    DBusMessageIter args;
-    char *song_name = NULL;
+/*
+ * Walk a Metadata value (variant holding a{sv}) once and pick the song
+ * (vlc:nowplaying) and the station (first xesam:genre). Either output may be
+ * NULL when not wanted; found values are strdup'd, missing ones left NULL.
+ */
+void parse_metadata_value(DBusMessageIter *variant, char **song_name, char **station_name) {
+    DBusMessageIter variant_iter, dict_iter, entry_iter, value_iter;
+    int wanted = (song_name != NULL) + (station_name != NULL);
 
-    if (dbus_message_iter_init(reply, &args) &&
-        dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_VARIANT) {
-        DBusMessageIter variant_iter, dict_iter, entry_iter;
-        dbus_message_iter_recurse(&args, &variant_iter);
-        if (dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_ARRAY) {
-            dbus_message_iter_recurse(&variant_iter, &dict_iter);
-
-            while (dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
-                dbus_message_iter_recurse(&dict_iter, &entry_iter);
-
-                if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
-                    const char *key;
-                    dbus_message_iter_get_basic(&entry_iter, &key);
-
-                    dbus_message_iter_next(&entry_iter);
-                    if (strcmp(key, "vlc:nowplaying") == 0) {
-                        if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_VARIANT) {
-                            DBusMessageIter value_iter;
-                            dbus_message_iter_recurse(&entry_iter, &value_iter);
-
-                            if (dbus_message_iter_get_arg_type(&value_iter) == DBUS_TYPE_STRING) {
-                                dbus_message_iter_get_basic(&value_iter, &song_name);
-                                break;
-                            }
-                        }
+    if (dbus_message_iter_get_arg_type(variant) != DBUS_TYPE_VARIANT) {
+        return;
+    }
+    dbus_message_iter_recurse(variant, &variant_iter);
+    if (dbus_message_iter_get_arg_type(&variant_iter) != DBUS_TYPE_ARRAY) {
+        return;
+    }
+    dbus_message_iter_recurse(&variant_iter, &dict_iter);
+
+    while (wanted > 0 && dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
+        dbus_message_iter_recurse(&dict_iter, &entry_iter);
+        if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
+            const char *key;
+            dbus_message_iter_get_basic(&entry_iter, &key);
+            dbus_message_iter_next(&entry_iter);
+
+            int is_song = song_name && !*song_name && strcmp(key, "vlc:nowplaying") == 0;
+            int is_station = station_name && !*station_name && strcmp(key, "xesam:genre") == 0;
+            if ((is_song || is_station) && dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_VARIANT) {
+                dbus_message_iter_recurse(&entry_iter, &value_iter);
+                if (is_song && dbus_message_iter_get_arg_type(&value_iter) == DBUS_TYPE_STRING) {
+                    const char *value;
+                    dbus_message_iter_get_basic(&value_iter, &value);
+                    *song_name = strdup(value);
+                    wanted--;
+                } else if (is_station && dbus_message_iter_get_arg_type(&value_iter) == DBUS_TYPE_ARRAY) {
+                    DBusMessageIter genre_iter;
+                    dbus_message_iter_recurse(&value_iter, &genre_iter);
+                    if (dbus_message_iter_get_arg_type(&genre_iter) == DBUS_TYPE_STRING) {
+                        const char *value;
+                        dbus_message_iter_get_basic(&genre_iter, &value);
+                        *station_name = strdup(value);
+                        wanted--;
                     }
                 }
-                dbus_message_iter_next(&dict_iter);
             }
         }
+        dbus_message_iter_next(&dict_iter);
     }
+}
 
+/* parse_metadata_value on a Properties.Get(Player, Metadata) reply */
+void parse_metadata(DBusMessage *reply, char **song_name, char **station_name) {
+    DBusMessageIter args;
+    if (dbus_message_iter_init(reply, &args)) {
+        parse_metadata_value(&args, song_name, station_name);
+    }
+}
 
-    dbus_message_unref(reply);
-
-    if (song_name) {
-        return strdup(song_name);
-    } else {
-        fprintf(stderr, "Failed to retrieve song name\n");
-        return NULL;
+/*
+ * parse_metadata_value on a PropertiesChanged(interface, a{sv}, as) signal
+ * of the Player interface. Returns 1 if Metadata was among the changed
+ * properties, 0 for any other signal.
+ */
+int parse_metadata_changed(DBusMessage *signal, char **song_name, char **station_name) {
+    DBusMessageIter args, dict_iter, entry_iter;
+    const char *interface;
+
+    if (!dbus_message_iter_init(signal, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_STRING) {
+        return 0;
+    }
+    dbus_message_iter_get_basic(&args, &interface);
+    if (strcmp(interface, "org.mpris.MediaPlayer2.Player") != 0 || !dbus_message_iter_next(&args) ||
+        dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+        return 0;
+    }
+    dbus_message_iter_recurse(&args, &dict_iter);
+    while (dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
+        const char *key;
+        dbus_message_iter_recurse(&dict_iter, &entry_iter);
+        if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&entry_iter, &key);
+            if (strcmp(key, "Metadata") == 0 && dbus_message_iter_next(&entry_iter)) {
+                parse_metadata_value(&entry_iter, song_name, station_name);
+                return 1;
+            }
+        }
+        dbus_message_iter_next(&dict_iter);
     }
+    return 0;
 }
 
-char *GetStationName(DBusConnection *connection) {
-        DBusMessage *message = NULL, *reply = NULL;
+/* Unique name (":1.42") currently owning name, strdup'd, NULL if it has no owner */
+char *get_name_owner(DBusConnection *connection, const char *name) {
     DBusError error;
     dbus_error_init(&error);
 
-    message = dbus_message_new_method_call(
-        "org.mpris.MediaPlayer2.vlc",  // VLC Bus Name
-        "/org/mpris/MediaPlayer2",     // VLC Object Path
-        "org.freedesktop.DBus.Properties", // Interface
-        "Get"                          // Method
-        );
+    DBusMessage *message = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
     if (!message) {
-        fprintf(stderr, "Failed to create DBus message\n");
+        LOG_ERROR("Failed to create DBus message");
         return NULL;
     }
+    dbus_message_append_args(message, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
 
-    const char *interface_name = "org.mpris.MediaPlayer2.Player";
-    const char *property_name = "Metadata";
-    dbus_message_append_args(
-        message,
-        DBUS_TYPE_STRING, &interface_name,
-        DBUS_TYPE_STRING, &property_name,
-        DBUS_TYPE_INVALID
-        );
-
-    reply = dbus_connection_send_with_reply_and_block(connection, message, -1, &error);
+    DBusMessage *reply = dbus_call(connection, message, &error, DBUS_CALL_NAME_OWNER);
     dbus_message_unref(message);
     if (dbus_error_is_set(&error)) {
-        fprintf(stderr, "DBus Error: %s\n", error.message);
+        /* NameHasNoOwner while the player is down is expected */
+        LOG_DEBUG("DBus Error: %s", error.message);
         dbus_error_free(&error);
         return NULL;
     }
 
-    DBusMessageIter args;
-    char *station_name = NULL;
+    const char *owner = NULL;
+    char *result = NULL;
+    if (dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID)) {
+        result = strdup(owner);
+    }
+    dbus_message_unref(reply);
+    return result;
+}
+
+/* Song and station with a single Metadata call, outputs are NULL when unavailable */
+void GetNowPlaying(DBusConnection *connection, char **song_name, char **station_name) {
+    *song_name = NULL;
+    *station_name = NULL;
+    DBusMessage *reply = get_metadata(connection);
+    if (!reply) {
+        return;
+    }
+    parse_metadata(reply, song_name, station_name);
+    dbus_message_unref(reply);
+}
 
-    if (dbus_message_iter_init(reply, &args) &&
-        dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_VARIANT) {
-        DBusMessageIter variant_iter, dict_iter, entry_iter;
+/* mpris:trackid of what the player on air is playing, strdup'd, NULL if unavailable */
+char *GetTrackId(DBusConnection *connection) {
+    DBusMessage *reply = get_metadata(connection);
+    if (!reply) {
+        return NULL;
+    }
+    char *track_id = NULL;
+    DBusMessageIter args, variant_iter, dict_iter, entry_iter, value_iter;
+    if (dbus_message_iter_init(reply, &args) && dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_VARIANT) {
         dbus_message_iter_recurse(&args, &variant_iter);
-        if (dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_ARRAY) {
-            dbus_message_iter_recurse(&variant_iter, &dict_iter);
-
-            while (dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
-                dbus_message_iter_recurse(&dict_iter, &entry_iter);
-
-                if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
-                    const char *key;
-                    dbus_message_iter_get_basic(&entry_iter, &key);
-
-                    dbus_message_iter_next(&entry_iter);
-                    if (strcmp(key, "xesam:genre") == 0) {
-                        if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_VARIANT) {
-                            DBusMessageIter value_iter;
-                            dbus_message_iter_recurse(&entry_iter, &value_iter);
-
-                            if (dbus_message_iter_get_arg_type(&value_iter) == DBUS_TYPE_ARRAY) {
-                                DBusMessageIter genre_iter;
-                                dbus_message_iter_recurse(&value_iter, &genre_iter);
-
-                                if (dbus_message_iter_get_arg_type(&genre_iter) == DBUS_TYPE_STRING) {
-                                    dbus_message_iter_get_basic(&genre_iter, &station_name);
-                                    break;
-                                }
-                            }
-                        }
-                    }
+    }
+    if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_VARIANT && dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_ARRAY) {
+        dbus_message_iter_recurse(&variant_iter, &dict_iter);
+        while (!track_id && dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
+            const char *key = "";
+            dbus_message_iter_recurse(&dict_iter, &entry_iter);
+            if (dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
+                dbus_message_iter_get_basic(&entry_iter, &key);
+            }
+            if (strcmp(key, "mpris:trackid") == 0 && dbus_message_iter_next(&entry_iter) && dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_VARIANT) {
+                dbus_message_iter_recurse(&entry_iter, &value_iter);
+                int type = dbus_message_iter_get_arg_type(&value_iter);
+                if (type == DBUS_TYPE_OBJECT_PATH || type == DBUS_TYPE_STRING) {
+                    const char *value;
+                    dbus_message_iter_get_basic(&value_iter, &value);
+                    track_id = strdup(value);
                 }
-                dbus_message_iter_next(&dict_iter);
             }
+            dbus_message_iter_next(&dict_iter);
         }
     }
-
-
     dbus_message_unref(reply);
+    return track_id;
+}
 
-    if (station_name) {
-        return strdup(station_name);
-    } else {
-        fprintf(stderr, "Failed to retrieve station\n");
-        return NULL;
+char *GetSongName(DBusConnection *connection) {
+    char *song_name = NULL;
+    DBusMessage *reply = get_metadata(connection);
+    if (reply) {
+        parse_metadata(reply, &song_name, NULL);
+        dbus_message_unref(reply);
+    }
+    if (!song_name) {
+        LOG_ERROR("Failed to retrieve song name");
+    }
+    return song_name;
+}
+
+char *GetStationName(DBusConnection *connection) {
+    char *station_name = NULL;
+    DBusMessage *reply = get_metadata(connection);
+    if (reply) {
+        parse_metadata(reply, NULL, &station_name);
+        dbus_message_unref(reply);
+    }
+    if (!station_name) {
+        LOG_ERROR("Failed to retrieve station");
     }
-}
\ No newline at end of file
+    return station_name;
+}
+
+#endif
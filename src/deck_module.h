@@ -0,0 +1,585 @@
+#ifndef DECK_MODULE_H
+#define DECK_MODULE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_module.h"
+#include "dbus_module.h"
+#include "drift_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+#include "resampler_module.h"
+
+/*
+ * In-process audio decks.
+ *
+ * Each deck is a VLC instance writing WAV into a FIFO, e.g.
+ *   vlc --aout=afile --audiofile-file=/tmp/musicbot-deck0.wav
+ * The first VLC owns org.mpris.MediaPlayer2.vlc, the second one registers as
+ * org.mpris.MediaPlayer2.vlc.instance<pid>. A reader thread per deck pulls the
+ * PCM into a ring, and the captured voice block is replaced by the on-air
+ * deck. With both decks connected a station switch tunes the idle deck, waits
+ * until it has buffered audio and crossfades into it, so there is no gap while
+ * VLC opens the new stream. Everything goes through the polyphase resampler
+ * on the reader thread, which converts 44.1/32 kHz sources to 48 kHz and lets
+ * the drift controller trim the ratio by a few ppm. Without decks the plugin keeps sending whatever
+ * the capture device delivers and switches stations with a hard cut.
+ */
+
+#define DECK_COUNT 2
+#define DECK_FIFO_FORMAT "/tmp/musicbot-deck%d.wav"
+/* Ring capacity in stereo frames, must be a power of two (~5.4 s) */
+#define DECK_RING_FRAMES (1 << 18)
+/*
+ * Reader stops pulling from the FIFO above this fill. Only sources faster
+ * than real time (local files) ever get here, clocked streams are held
+ * around DRIFT_TARGET_MS by the drift controller.
+ */
+#define DECK_MAX_FILL_MS (DRIFT_TARGET_MS + DRIFT_BAND_MS + 100)
+/* A deck counts as connected if it delivered audio within this window */
+#define DECK_LIVE_TIMEOUT_MS 1000
+
+/* How much the new station has to buffer before we start fading, and the fade length */
+#define CROSSFADE_PREROLL_MS 250
+#define CROSSFADE_FADE_MS 2000
+/* Give up and hard switch if the new station does not deliver audio in time */
+#define CROSSFADE_TIMEOUT_MS 15000
+
+/* Largest captured block processed in one go, larger blocks are split */
+#define DECK_BLOCK_FRAMES 2048
+
+/* Single producer (reader thread), single consumer (audio thread) ring of interleaved stereo frames */
+typedef struct {
+    short          data[DECK_RING_FRAMES * 2];
+    _Atomic size_t write_pos;
+    _Atomic size_t read_pos;
+} pcm_ring;
+
+typedef struct {
+    int              index;
+    char             path[64];
+    char*            bus_name;
+    pcm_ring         ring;
+    pthread_t        thread;
+    _Atomic uint64_t last_data_ms;
+    unsigned int     rate;
+    unsigned int     channels;
+    resampler        resampler;
+    drift_controller drift;
+    uint64_t         drift_updated_ns;
+    _Atomic int64_t  drift_ppb;
+    /* Resampler output for one block, worst case is an 8 kHz source sped up by DRIFT_MAX_PPM */
+    short            resampled[(DECK_BLOCK_FRAMES * (AUDIO_SAMPLE_RATE / 8000) + 16) * 2];
+    /* Track list of this deck's VLC while it is off air, swapped with the globals on handover */
+    char**           tracks;
+    size_t           track_count;
+} deck;
+
+enum { XFADE_IDLE = 0, XFADE_WAITING, XFADE_FADING, XFADE_DONE };
+
+static deck            decks[DECK_COUNT];
+static atomic_int      deck_on_air     = 0;
+static atomic_int      decks_running   = 0;
+static atomic_int      xfade_state     = XFADE_IDLE;
+static size_t          xfade_pos       = 0;
+static DBusConnection* deck_connection = NULL;
+
+/* Crossfade statistics, written by the audio thread and reported by the worker */
+static _Atomic uint64_t xfade_request_ns = 0;
+static _Atomic uint64_t xfade_audible_ns = 0;
+static _Atomic uint64_t xfade_mix_ns     = 0;
+static _Atomic uint64_t xfade_mix_blocks = 0;
+
+/* Switch requests for the crossfade worker, latest one wins */
+static pthread_t       xfade_thread;
+static pthread_mutex_t xfade_mutex         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  xfade_cond          = PTHREAD_COND_INITIALIZER;
+static long            xfade_pending       = -1;
+static int             xfade_failed_metric = -1;
+
+static short deck_scratch_a[DECK_BLOCK_FRAMES * 2];
+static short deck_scratch_b[DECK_BLOCK_FRAMES * 2];
+
+static uint64_t deck_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+size_t pcm_ring_fill(pcm_ring* ring)
+{
+    return atomic_load_explicit(&ring->write_pos, memory_order_acquire) - atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+}
+
+/* Producer side, returns the number of frames actually written */
+size_t pcm_ring_write(pcm_ring* ring, const short* frames, size_t count)
+{
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    size_t space = DECK_RING_FRAMES - (write - atomic_load_explicit(&ring->read_pos, memory_order_acquire));
+    if (count > space)
+        count = space;
+
+    size_t offset = write & (DECK_RING_FRAMES - 1);
+    size_t first  = DECK_RING_FRAMES - offset < count ? DECK_RING_FRAMES - offset : count;
+    memcpy(ring->data + offset * 2, frames, first * 2 * sizeof(short));
+    memcpy(ring->data, frames + first * 2, (count - first) * 2 * sizeof(short));
+
+    atomic_store_explicit(&ring->write_pos, write + count, memory_order_release);
+    return count;
+}
+
+/* Consumer side, pads with silence on underrun and returns the number of real frames read */
+size_t pcm_ring_read(pcm_ring* ring, short* frames, size_t count)
+{
+    size_t read  = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    size_t avail = atomic_load_explicit(&ring->write_pos, memory_order_acquire) - read;
+    size_t n     = count < avail ? count : avail;
+
+    size_t offset = read & (DECK_RING_FRAMES - 1);
+    size_t first  = DECK_RING_FRAMES - offset < n ? DECK_RING_FRAMES - offset : n;
+    memcpy(frames, ring->data + offset * 2, first * 2 * sizeof(short));
+    memcpy(frames + first * 2, ring->data, (n - first) * 2 * sizeof(short));
+    memset(frames + n * 2, 0, (count - n) * 2 * sizeof(short));
+
+    atomic_store_explicit(&ring->read_pos, read + n, memory_order_release);
+    return n;
+}
+
+/* Consumer side, drop everything buffered */
+void pcm_ring_discard(pcm_ring* ring)
+{
+    atomic_store_explicit(&ring->read_pos, atomic_load_explicit(&ring->write_pos, memory_order_acquire), memory_order_release);
+}
+
+int deck_is_live(deck* d)
+{
+    uint64_t last = atomic_load_explicit(&d->last_data_ms, memory_order_relaxed);
+    return last != 0 && deck_now_ns() / 1000000 - last < DECK_LIVE_TIMEOUT_MS;
+}
+
+static uint32_t read_le32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#define DECK_HEADER_MORE -1
+#define DECK_HEADER_BAD -2
+
+/*
+ * Parse a streamed WAV header. Returns the offset of the first PCM byte,
+ * DECK_HEADER_MORE if more bytes are needed or DECK_HEADER_BAD if the format
+ * is unusable. Data that does not start with RIFF is taken as raw 48 kHz stereo.
+ */
+static long deck_parse_header(deck* d, const unsigned char* buf, size_t len)
+{
+    if (len < 12)
+        return DECK_HEADER_MORE;
+    if (memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+        d->rate     = AUDIO_SAMPLE_RATE;
+        d->channels = 2;
+        return 0;
+    }
+
+    size_t pos = 12;
+    while (pos + 8 <= len) {
+        uint32_t size = read_le32(buf + pos + 4);
+        if (memcmp(buf + pos, "fmt ", 4) == 0) {
+            if (pos + 8 + 16 > len)
+                return DECK_HEADER_MORE;
+            unsigned int format = buf[pos + 8] | buf[pos + 9] << 8;
+            unsigned int bits   = buf[pos + 22] | buf[pos + 23] << 8;
+            d->channels         = buf[pos + 10] | buf[pos + 11] << 8;
+            d->rate             = read_le32(buf + pos + 12);
+            if (format != 1 || bits != 16 || d->channels == 0) {
+                LOG_ERROR("Deck %d: unsupported WAV format %u/%u bit, use --audiofile-format=s16", d->index, format, bits);
+                return DECK_HEADER_BAD;
+            }
+        } else if (memcmp(buf + pos, "data", 4) == 0) {
+            return d->channels ? (long)(pos + 8) : DECK_HEADER_BAD;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    return DECK_HEADER_MORE;
+}
+
+/* Push stereo frames into the ring, waiting for space. Returns 1 if it had to wait. */
+static int deck_write(deck* d, const short* stereo, size_t frames)
+{
+    size_t done    = 0;
+    int    blocked = 0;
+    while (done < frames && atomic_load(&decks_running)) {
+        if (pcm_ring_fill(&d->ring) >= (size_t)DECK_MAX_FILL_MS * (AUDIO_SAMPLE_RATE / 1000)) {
+            blocked = 1;
+            usleep(5000);
+            continue;
+        }
+        done += pcm_ring_write(&d->ring, stereo + done * 2, frames - done);
+    }
+    atomic_store_explicit(&d->last_data_ms, deck_now_ns() / 1000000, memory_order_relaxed);
+    return blocked;
+}
+
+/*
+ * Steer the resampler ratio from the ring fill. A source that made us wait
+ * for space runs faster than real time and is paced by the ring instead, so
+ * the controller starts over at 0 ppm for it.
+ */
+static void deck_track_drift(deck* d, int blocked)
+{
+    uint64_t now = deck_now_ns();
+    double   ppm = 0.0;
+
+    if (blocked || d->drift_updated_ns == 0) {
+        drift_reset(&d->drift);
+    } else {
+        ppm = drift_update(&d->drift, (double)pcm_ring_fill(&d->ring) / AUDIO_SAMPLE_RATE, (double)(now - d->drift_updated_ns) / 1e9);
+    }
+    d->drift_updated_ns = now;
+    resampler_set_ratio(&d->resampler, ppm);
+    atomic_store_explicit(&d->drift_ppb, (int64_t)(ppm * 1000.0), memory_order_relaxed);
+}
+
+/* Convert interleaved input to 48 kHz stereo and push it into the ring */
+/* pcm is the byte stream from the FIFO, copied out sample by sample since it need not be aligned for int16_t */
+static void deck_push(deck* d, const unsigned char* pcm, size_t frames)
+{
+    int16_t stereo[DECK_BLOCK_FRAMES * 2];
+    size_t  frame_bytes = d->channels * sizeof(int16_t);
+    size_t  right       = d->channels > 1 ? sizeof(int16_t) : 0;
+
+    while (frames > 0 && atomic_load(&decks_running)) {
+        size_t n = frames < DECK_BLOCK_FRAMES ? frames : DECK_BLOCK_FRAMES;
+        for (size_t i = 0; i < n; i++) {
+            memcpy(&stereo[2 * i], pcm + i * frame_bytes, sizeof(int16_t));
+            memcpy(&stereo[2 * i + 1], pcm + i * frame_bytes + right, sizeof(int16_t));
+        }
+
+        size_t out = resampler_process(&d->resampler, stereo, n, d->resampled);
+        deck_track_drift(d, deck_write(d, d->resampled, out));
+
+        pcm += n * frame_bytes;
+        frames -= n;
+    }
+}
+
+static void* deck_reader(void* arg)
+{
+    deck*         d = (deck*)arg;
+    unsigned char buf[16384];
+
+    while (atomic_load(&decks_running)) {
+        int fd = open(d->path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0) {
+            sleep(1);
+            continue;
+        }
+
+        size_t len        = 0;
+        int    in_payload = 0;
+        while (atomic_load(&decks_running)) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+
+            ssize_t got = read(fd, buf + len, sizeof(buf) - len);
+            if (got < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (got <= 0)
+                break; /* writer went away, reopen and expect a new header */
+            len += (size_t)got;
+
+            if (!in_payload) {
+                long offset = deck_parse_header(d, buf, len);
+                if (offset == DECK_HEADER_BAD || (offset == DECK_HEADER_MORE && len == sizeof(buf)))
+                    break;
+                if (offset == DECK_HEADER_MORE)
+                    continue;
+                d->drift_updated_ns = 0;
+                if (resampler_init(&d->resampler, d->rate, AUDIO_SAMPLE_RATE, 2) != 0) {
+                    LOG_ERROR("Deck %d: cannot resample %u Hz", d->index, d->rate);
+                    break;
+                }
+                memmove(buf, buf + offset, len - (size_t)offset);
+                len -= (size_t)offset;
+                in_payload = 1;
+            }
+
+            size_t frame_bytes = d->channels * sizeof(int16_t);
+            size_t frames      = len / frame_bytes;
+            deck_push(d, buf, frames);
+            memmove(buf, buf + frames * frame_bytes, len - frames * frame_bytes);
+            len -= frames * frame_bytes;
+        }
+
+        close(fd);
+        d->rate     = 0;
+        d->channels = 0;
+    }
+    return NULL;
+}
+
+/*
+ * Tune the idle deck to station_index, wait for the audio thread to fade over and release the old deck.
+ * Returns 0 once the station changed, with or without a crossfade, -1 if it did not.
+ */
+static int crossfade_to(size_t station_index)
+{
+    int   old_index = atomic_load(&deck_on_air);
+    deck* old       = &decks[old_index];
+    deck* next      = &decks[1 - old_index];
+
+    if (!deck_is_live(&decks[0]) || !deck_is_live(&decks[1])) {
+        change_station(deck_connection, station_index);
+        return 0;
+    }
+
+    if (!next->bus_name) {
+        next->bus_name = find_vlc_instance(deck_connection);
+        if (!next->bus_name) {
+            LOG_INFO("No second VLC instance found, switching without crossfade");
+            change_station(deck_connection, station_index);
+            return 0;
+        }
+    }
+
+    DBusError error;
+    dbus_error_init(&error);
+    if (!next->tracks && fetch_track_list(deck_connection, next->bus_name, &next->tracks, &next->track_count, &error) != 0) {
+        LOG_ERROR("DBus Error: %s", error.message);
+        dbus_error_free(&error);
+        change_station(deck_connection, station_index);
+        return 0;
+    }
+    if (station_index >= next->track_count) {
+        LOG_ERROR("Deck %d: invalid station index %zu, its player has %zu tracks", next->index, station_index, next->track_count);
+        return -1;
+    }
+
+    atomic_store(&xfade_request_ns, deck_now_ns());
+    if (goto_track(deck_connection, next->bus_name, next->tracks[station_index], &error) != 0) {
+        LOG_ERROR("DBus Error: %s", error.message);
+        dbus_error_free(&error);
+        return -1;
+    }
+    player_command(deck_connection, next->bus_name, "Play");
+    atomic_store(&xfade_state, XFADE_WAITING);
+
+    uint64_t deadline = deck_now_ns() + (uint64_t)CROSSFADE_TIMEOUT_MS * 1000000ULL;
+    while (atomic_load(&xfade_state) != XFADE_DONE) {
+        if (deck_now_ns() > deadline) {
+            int expected = XFADE_WAITING;
+            if (atomic_compare_exchange_strong(&xfade_state, &expected, XFADE_IDLE)) {
+                LOG_INFO("New station did not start within %d ms, switching without crossfade", CROSSFADE_TIMEOUT_MS);
+                player_command(deck_connection, next->bus_name, "Stop");
+                change_station(deck_connection, station_index);
+                return 0;
+            }
+        }
+        usleep(10000);
+    }
+
+    /* The audio thread already put the new deck on air, hand the player over to it */
+    pthread_mutex_lock(&track_list_lock);
+    char** tracks     = track_list;
+    size_t count      = track_count;
+    track_list        = next->tracks;
+    track_count       = next->track_count;
+    pthread_mutex_unlock(&track_list_lock);
+    old->tracks       = tracks;
+    old->track_count  = count;
+    old->bus_name     = old->bus_name ? old->bus_name : strdup(vlc_bus_name);
+    vlc_bus_name      = next->bus_name;
+    atomic_store(&on_air_station, (int)station_index);
+    player_command(deck_connection, old->bus_name, "Stop");
+
+    uint64_t blocks = atomic_exchange(&xfade_mix_blocks, 0);
+    uint64_t mix_ns = atomic_exchange(&xfade_mix_ns, 0);
+    LOG_INFO("Crossfaded to station %zu on %s: audible after %llu ms, mixing %llu ns per block over %llu blocks", station_index, next->bus_name,
+           (unsigned long long)((atomic_load(&xfade_audible_ns) - atomic_load(&xfade_request_ns)) / 1000000), (unsigned long long)(blocks ? mix_ns / blocks : 0),
+           (unsigned long long)blocks);
+    atomic_store(&xfade_state, XFADE_IDLE);
+    return 0;
+}
+
+static void* crossfade_worker(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&xfade_mutex);
+    while (atomic_load(&decks_running)) {
+        if (xfade_pending < 0) {
+            pthread_cond_wait(&xfade_cond, &xfade_mutex);
+            continue;
+        }
+        size_t station_index = (size_t)xfade_pending;
+        xfade_pending        = -1;
+        pthread_mutex_unlock(&xfade_mutex);
+
+        if (crossfade_to(station_index) != 0)
+            metrics_inc(xfade_failed_metric);
+
+        pthread_mutex_lock(&xfade_mutex);
+    }
+    pthread_mutex_unlock(&xfade_mutex);
+    return NULL;
+}
+
+static double deck_fill_seconds(int index)
+{
+    return (double)pcm_ring_fill(&decks[index].ring) / AUDIO_SAMPLE_RATE;
+}
+
+static double deck_drift_ppm(int index)
+{
+    return atomic_load_explicit(&decks[index].drift_ppb, memory_order_relaxed) / 1000.0;
+}
+
+static double deck_crossfade_latency(int unused)
+{
+    (void)unused;
+    uint64_t request = atomic_load(&xfade_request_ns), audible = atomic_load(&xfade_audible_ns);
+    return audible > request ? (audible - request) / 1e9 : 0.0;
+}
+
+void decks_register_metrics(void)
+{
+    static const char* const names[DECK_COUNT] = {"0", "1"};
+    for (int i = 0; i < DECK_COUNT; i++)
+        metrics_export("musicbot_deck_fill_seconds", "Audio buffered in the deck ring", METRIC_GAUGE, "deck", names[i], deck_fill_seconds, i);
+    for (int i = 0; i < DECK_COUNT; i++)
+        metrics_export("musicbot_deck_drift_ppm", "Resampler ratio correction of the drift controller", METRIC_GAUGE, "deck", names[i], deck_drift_ppm, i);
+    metrics_export("musicbot_crossfade_latency_seconds", "Time from the last crossfade request until the new station was audible", METRIC_GAUGE, NULL, NULL, deck_crossfade_latency, 0);
+    xfade_failed_metric = metrics_counter("musicbot_station_switch_failures_total", "Station switches on the crossfade worker that left the station unchanged", NULL, NULL);
+}
+
+void decks_start(DBusConnection* connection)
+{
+    deck_connection = connection;
+    atomic_store(&decks_running, 1);
+    for (int i = 0; i < DECK_COUNT; i++) {
+        decks[i].index = i;
+        snprintf(decks[i].path, sizeof(decks[i].path), DECK_FIFO_FORMAT, i);
+        if (mkfifo(decks[i].path, 0600) != 0 && errno != EEXIST) {
+            LOG_ERROR("Failed to create %s: %s", decks[i].path, strerror(errno));
+        }
+        pthread_create(&decks[i].thread, NULL, deck_reader, &decks[i]);
+    }
+    pthread_create(&xfade_thread, NULL, crossfade_worker, NULL);
+}
+
+void decks_stop(void)
+{
+    if (!atomic_exchange(&decks_running, 0))
+        return;
+    pthread_mutex_lock(&xfade_mutex);
+    pthread_cond_signal(&xfade_cond);
+    pthread_mutex_unlock(&xfade_mutex);
+    pthread_join(xfade_thread, NULL);
+
+    vlc_bus_name = VLC_BUS_NAME;
+    for (int i = 0; i < DECK_COUNT; i++) {
+        pthread_join(decks[i].thread, NULL);
+        resampler_free(&decks[i].resampler);
+        for (size_t t = 0; t < decks[i].track_count; t++)
+            free(decks[i].tracks[t]);
+        free(decks[i].tracks);
+        free(decks[i].bus_name);
+        decks[i].tracks      = NULL;
+        decks[i].track_count = 0;
+        decks[i].bus_name    = NULL;
+    }
+}
+
+/*
+ * Switch stations, crossfading when both decks are connected. Called from
+ * the event loop, the D-Bus work happens on the worker. While the decks run
+ * every switch goes through the worker, so only it swaps track_list with a
+ * deck's; player_module.h replaces it under track_list_lock too.
+ */
+void switch_station(DBusConnection* connection, size_t station_index)
+{
+    if (!atomic_load(&decks_running)) {
+        change_station(connection, station_index);
+        return;
+    }
+
+    pthread_mutex_lock(&xfade_mutex);
+    xfade_pending = (long)station_index;
+    pthread_cond_signal(&xfade_cond);
+    pthread_mutex_unlock(&xfade_mutex);
+}
+
+/*
+ * Replace one captured block with deck audio. Runs on the audio thread.
+ * Returns 1 if the block now holds deck audio, 0 if no deck is on air and the
+ * captured samples should go out as they are.
+ */
+int decks_process(short* samples, int frames, int channels)
+{
+    int   on_air = atomic_load_explicit(&deck_on_air, memory_order_acquire);
+    deck* a      = &decks[on_air];
+    deck* b      = &decks[1 - on_air];
+    int   state  = atomic_load_explicit(&xfade_state, memory_order_acquire);
+
+    if (!atomic_load_explicit(&decks_running, memory_order_relaxed) || (!deck_is_live(a) && state == XFADE_IDLE))
+        return 0;
+
+    if (state == XFADE_IDLE) {
+        /* Whatever the stopped deck still delivers is stale */
+        pcm_ring_discard(&b->ring);
+    } else if (state == XFADE_WAITING && pcm_ring_fill(&b->ring) >= (size_t)CROSSFADE_PREROLL_MS * (AUDIO_SAMPLE_RATE / 1000)) {
+        xfade_pos = 0;
+        atomic_store(&xfade_audible_ns, deck_now_ns());
+        state = XFADE_FADING;
+        atomic_store_explicit(&xfade_state, state, memory_order_release);
+    }
+
+    const size_t fade_frames = (size_t)CROSSFADE_FADE_MS * (AUDIO_SAMPLE_RATE / 1000);
+    while (frames > 0) {
+        size_t n = (size_t)frames < DECK_BLOCK_FRAMES ? (size_t)frames : DECK_BLOCK_FRAMES;
+        pcm_ring_read(&a->ring, deck_scratch_a, n);
+
+        if (state == XFADE_FADING) {
+            uint64_t start = deck_now_ns();
+            pcm_ring_read(&b->ring, deck_scratch_b, n);
+
+            /* Equal power: the gains follow cos/sin of the fade position, linear within the block */
+            size_t end    = xfade_pos + n < fade_frames ? xfade_pos + n : fade_frames;
+            float  theta0 = (float)M_PI_2 * (float)xfade_pos / (float)fade_frames;
+            float  theta1 = (float)M_PI_2 * (float)end / (float)fade_frames;
+            audio_mix_ramp(deck_scratch_a, deck_scratch_a, deck_scratch_b, n * 2, cosf(theta0), cosf(theta1), sinf(theta0), sinf(theta1));
+            xfade_pos = end;
+
+            atomic_fetch_add_explicit(&xfade_mix_ns, deck_now_ns() - start, memory_order_relaxed);
+            atomic_fetch_add_explicit(&xfade_mix_blocks, 1, memory_order_relaxed);
+
+            if (xfade_pos >= fade_frames) {
+                atomic_store_explicit(&deck_on_air, 1 - on_air, memory_order_release);
+                atomic_store_explicit(&xfade_state, XFADE_DONE, memory_order_release);
+                pcm_ring_discard(&a->ring);
+                deck* swap = a;
+                a          = b;
+                b          = swap;
+                state      = XFADE_DONE;
+            }
+        }
+
+        audio_from_stereo(samples, channels, deck_scratch_a, n);
+        samples += n * (size_t)channels;
+        frames -= (int)n;
+    }
+    return 1;
+}
+
+#endif
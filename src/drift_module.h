@@ -0,0 +1,78 @@
+#ifndef DRIFT_MODULE_H
+#define DRIFT_MODULE_H
+
+/*
+ * Clock drift compensation for the deck feeds.
+ *
+ * The VLC writing into a deck runs on the stream's (or the host's) clock,
+ * TeamSpeak consumes the ring on the sound card's capture clock. The two
+ * differ by tens of ppm, which over hours either drains the ring or lets the
+ * latency run away. A PI controller watches the smoothed ring fill and nudges
+ * the resampler ratio by a few ppm so the fill settles on DRIFT_TARGET_MS.
+ *
+ * The loop is deliberately slow (natural period of roughly 20 minutes,
+ * critically damped): the correction stays far below anything audible and
+ * jitter from block sized reads and writes is ignored.
+ */
+
+/* Ring fill the controller steers towards, and the band it is expected to stay in */
+#define DRIFT_TARGET_MS 250
+#define DRIFT_BAND_MS 150
+/* Largest rate correction, 0.1 % is still far from audible pitch change */
+#define DRIFT_MAX_PPM 1000.0
+/* ppm per second of fill error, and ppm per second of error integrated over one second */
+#define DRIFT_KP 10000.0
+#define DRIFT_KI 25.0
+/* Time constant of the fill smoothing */
+#define DRIFT_SMOOTHING_S 2.0
+
+typedef struct {
+    int    primed;
+    double filtered; /* smoothed fill in seconds */
+    double integral; /* integral term in ppm */
+    double ppm;      /* last correction handed to the resampler */
+} drift_controller;
+
+void drift_reset(drift_controller* c)
+{
+    c->primed   = 0;
+    c->filtered = 0.0;
+    c->integral = 0.0;
+    c->ppm      = 0.0;
+}
+
+/*
+ * Feed the current ring fill (seconds) and the time since the last update.
+ * Returns the ratio correction in ppm, positive means the resampler should
+ * consume input faster and so produce fewer output frames.
+ */
+double drift_update(drift_controller* c, double fill, double dt)
+{
+    if (!c->primed) {
+        c->filtered = fill;
+        c->primed   = 1;
+    }
+    c->filtered += dt / (DRIFT_SMOOTHING_S + dt) * (fill - c->filtered);
+
+    const double error    = c->filtered - DRIFT_TARGET_MS / 1000.0;
+    double       integral = c->integral + DRIFT_KI * error * dt;
+    if (integral > DRIFT_MAX_PPM)
+        integral = DRIFT_MAX_PPM;
+    if (integral < -DRIFT_MAX_PPM)
+        integral = -DRIFT_MAX_PPM;
+
+    double ppm = DRIFT_KP * error + integral;
+    if (ppm > DRIFT_MAX_PPM) {
+        ppm = DRIFT_MAX_PPM;
+    } else if (ppm < -DRIFT_MAX_PPM) {
+        ppm = -DRIFT_MAX_PPM;
+    } else {
+        /* Only integrate while the output is not saturated (anti windup) */
+        c->integral = integral;
+    }
+
+    c->ppm = ppm;
+    return ppm;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef DUCKING_MODULE_H
+#define DUCKING_MODULE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "audio_module.h"
+
+/* Music gain while somebody in our channel is talking (about -10 dB) */
+#define DUCK_GAIN 0.3f
+/* Time to ramp from full volume down to DUCK_GAIN and back up again */
+#define DUCK_ATTACK_MS 40
+#define DUCK_RELEASE_MS 600
+
+/*
+ * One bit per anyID. Written from the TeamSpeak event thread, read from the
+ * audio thread through talking_count, so both sides stay lock free.
+ */
+static _Atomic uint64_t talking_clients[65536 / 64];
+static atomic_int       talking_count = 0;
+
+/* Only touched by the audio thread */
+static float duck_gain = 1.0f;
+
+void talk_state_set(uint16_t clientID, int talking)
+{
+    const uint64_t bit  = 1ULL << (clientID & 63);
+    _Atomic uint64_t* word = &talking_clients[clientID >> 6];
+
+    if (talking) {
+        if (!(atomic_fetch_or(word, bit) & bit))
+            atomic_fetch_add(&talking_count, 1);
+    } else {
+        if (atomic_fetch_and(word, ~bit) & bit)
+            atomic_fetch_sub(&talking_count, 1);
+    }
+}
+
+int talk_state_is_talking(uint16_t clientID)
+{
+    return (atomic_load_explicit(&talking_clients[clientID >> 6], memory_order_relaxed) >> (clientID & 63)) & 1;
+}
+
+/* Forget every talker, used whenever the bot itself changes channel */
+void talk_state_clear(void)
+{
+    for (size_t i = 0; i < sizeof(talking_clients) / sizeof(talking_clients[0]); i++) {
+        uint64_t old = atomic_exchange(&talking_clients[i], 0);
+        if (old)
+            atomic_fetch_sub(&talking_count, __builtin_popcountll(old));
+    }
+}
+
+/*
+ * Apply the ducking ramp to one captured block. Returns 1 if the samples were
+ * modified, 0 if the block went through untouched at full volume.
+ */
+int duck_process(short* samples, int frames, int channels)
+{
+    const float target = atomic_load_explicit(&talking_count, memory_order_relaxed) > 0 ? DUCK_GAIN : 1.0f;
+    const float start  = duck_gain;
+
+    if (start == 1.0f && target == 1.0f)
+        return 0;
+
+    float end = target;
+    if (target < start) {
+        const float delta = (1.0f - DUCK_GAIN) * (float)frames / (float)(DUCK_ATTACK_MS * (AUDIO_SAMPLE_RATE / 1000));
+        if (start - target > delta)
+            end = start - delta;
+    } else if (target > start) {
+        const float delta = (1.0f - DUCK_GAIN) * (float)frames / (float)(DUCK_RELEASE_MS * (AUDIO_SAMPLE_RATE / 1000));
+        if (target - start > delta)
+            end = start + delta;
+    }
+
+    audio_gain_ramp(samples, (size_t)frames * (size_t)channels, start, end);
+    duck_gain = end;
+    return 1;
+}
+
+#endif
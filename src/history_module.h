@@ -0,0 +1,222 @@
+#ifndef HISTORY_MODULE_H
+#define HISTORY_MODULE_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log_module.h"
+
+/*
+ * Song history, a memory mapped ring file.
+ *
+ * Every now playing change becomes one 16 byte record (time, station, title
+ * reference) in a ring of HISTORY_RECORDS. Titles are interned into a fixed
+ * open addressing table in the same file, so a song that comes around again
+ * costs no new string space. When a probe sequence is full the least
+ * recently used title in it is replaced; records that pointed at it no longer
+ * match its hash and are shown as expired. The file has a fixed size, lives
+ * in the TS3 config directory and is never synced explicitly, the page cache
+ * writes it back.
+ *
+ * There is a single writer, the event loop thread (loop_module.h), which
+ * appends from the now playing watch (nowplaying_module.h) as the player
+ * announces a change. The watch also fires for refreshes and station only
+ * updates, so a title equal to the newest entry's is not appended again;
+ * that also keeps a restart from logging the song on air twice. Readers on
+ * other threads go straight to the mapping and only look at records below
+ * the published head.
+ */
+
+#define HISTORY_FILE_NAME "musicbot_history.bin"
+#define HISTORY_MAGIC "MBHIST01"
+#define HISTORY_VERSION 1
+/* Powers of two */
+#define HISTORY_RECORDS 65536
+#define HISTORY_TITLES 8192
+#define HISTORY_PROBE_LIMIT 8
+#define HISTORY_TITLE_BYTES 88
+/* Station of songs from the local library (!play, library_module.h), which have no track list index */
+#define HISTORY_STATION_LIBRARY 0xFFFF
+
+typedef struct {
+    char             magic[8];
+    uint32_t         version;
+    uint32_t         record_capacity;
+    uint32_t         title_capacity;
+    uint32_t         reserved;
+    _Atomic uint64_t head; /* records ever appended, the next one goes to head % capacity */
+    uint8_t          padding[32];
+} history_header;
+
+typedef struct {
+    uint32_t time; /* unix seconds */
+    uint16_t station;
+    uint16_t reserved;
+    uint32_t title_slot;
+    uint32_t title_hash;
+} history_record;
+
+typedef struct {
+    uint32_t hash; /* 0 marks a free slot */
+    uint32_t last_used;
+    char     text[HISTORY_TITLE_BYTES];
+} history_title;
+
+typedef struct {
+    history_header header;
+    history_record records[HISTORY_RECORDS];
+    history_title  titles[HISTORY_TITLES];
+} history_file;
+
+static history_file* history      = NULL;
+static uint32_t      history_tick = 0;
+
+/* FNV-1a, never 0 so 0 can mark free slots */
+static uint32_t history_hash(const char* text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text; text++)
+        hash = (hash ^ (uint8_t)*text) * 16777619u;
+    return hash ? hash : 1;
+}
+
+/* Map dir/HISTORY_FILE_NAME, creating or resetting it if needed. Returns 0 on success. */
+int history_open(const char* dir)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, HISTORY_FILE_NAME);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Cannot open song history %s", path);
+        return -1;
+    }
+    struct stat st;
+    int         fresh = fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(history_file);
+    if (fresh && ftruncate(fd, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(history_file)) != 0) {
+        LOG_ERROR("Cannot size song history %s", path);
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, sizeof(history_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Cannot map song history %s", path);
+        return -1;
+    }
+
+    history_file* file = (history_file*)map;
+    if (memcmp(file->header.magic, HISTORY_MAGIC, 8) != 0 || file->header.version != HISTORY_VERSION || file->header.record_capacity != HISTORY_RECORDS ||
+        file->header.title_capacity != HISTORY_TITLES) {
+        /* New file or an incompatible layout, start over */
+        memset(file, 0, sizeof(*file));
+        memcpy(file->header.magic, HISTORY_MAGIC, 8);
+        file->header.version         = HISTORY_VERSION;
+        file->header.record_capacity = HISTORY_RECORDS;
+        file->header.title_capacity  = HISTORY_TITLES;
+    }
+
+    uint64_t head = atomic_load(&file->header.head);
+    history_tick  = head > UINT32_MAX ? UINT32_MAX : (uint32_t)head;
+    history       = file;
+    LOG_INFO("Song history %s: %llu entries", path, (unsigned long long)(head < HISTORY_RECORDS ? head : HISTORY_RECORDS));
+    return 0;
+}
+
+void history_close(void)
+{
+    if (!history)
+        return;
+    munmap(history, sizeof(history_file));
+    history = NULL;
+}
+
+/* Slot of title in the intern table, inserting or evicting as needed */
+static uint32_t history_intern(const char* title, uint32_t hash)
+{
+    uint32_t victim = hash & (HISTORY_TITLES - 1);
+    for (uint32_t i = 0; i < HISTORY_PROBE_LIMIT; i++) {
+        uint32_t       slot  = (hash + i) & (HISTORY_TITLES - 1);
+        history_title* entry = &history->titles[slot];
+        if (entry->hash == hash && strncmp(entry->text, title, HISTORY_TITLE_BYTES - 1) == 0) {
+            entry->last_used = history_tick;
+            return slot;
+        }
+        if (entry->hash == 0) {
+            victim = slot;
+            break;
+        }
+        if (entry->last_used < history->titles[victim].last_used)
+            victim = slot;
+    }
+
+    history_title* entry = &history->titles[victim];
+    entry->hash          = 0;
+    snprintf(entry->text, sizeof(entry->text), "%s", title);
+    entry->last_used = history_tick;
+    entry->hash      = hash;
+    return victim;
+}
+
+/* Append one now playing change unless it repeats the newest title, writer thread only. station < 0 is the library. */
+void history_append(int station, const char* title)
+{
+    if (!history || !title || !title[0])
+        return;
+
+    char truncated[HISTORY_TITLE_BYTES];
+    snprintf(truncated, sizeof(truncated), "%s", title);
+    uint32_t hash = history_hash(truncated);
+
+    uint64_t head = atomic_load_explicit(&history->header.head, memory_order_relaxed);
+    if (head) {
+        const history_record* last  = &history->records[(head - 1) & (HISTORY_RECORDS - 1)];
+        const history_title*  entry = &history->titles[last->title_slot & (HISTORY_TITLES - 1)];
+        if (last->title_hash == hash && entry->hash == hash && strcmp(entry->text, truncated) == 0)
+            return;
+    }
+
+    history_tick++;
+    history_record* record = &history->records[head & (HISTORY_RECORDS - 1)];
+    record->time           = (uint32_t)time(NULL);
+    record->station        = station < 0 ? HISTORY_STATION_LIBRARY : (uint16_t)station;
+    record->title_slot     = history_intern(truncated, hash);
+    record->title_hash     = hash;
+    atomic_store_explicit(&history->header.head, head + 1, memory_order_release);
+}
+
+/*
+ * Walk the history from the newest entry. station < 0 matches every entry.
+ * Calls visit for up to limit matches, returns how many were visited.
+ */
+int history_query(int station, int limit, void (*visit)(const history_record* record, const char* title, void* context), void* context)
+{
+    if (!history)
+        return 0;
+
+    uint64_t head  = atomic_load_explicit(&history->header.head, memory_order_acquire);
+    uint64_t first = head > HISTORY_RECORDS ? head - HISTORY_RECORDS : 0;
+    int      found = 0;
+    for (uint64_t i = head; i > first && found < limit; i--) {
+        const history_record* record = &history->records[(i - 1) & (HISTORY_RECORDS - 1)];
+        if (station >= 0 && record->station != station)
+            continue;
+        const history_title* entry = &history->titles[record->title_slot & (HISTORY_TITLES - 1)];
+        visit(record, entry->hash == record->title_hash ? entry->text : "(expired)", context);
+        found++;
+    }
+    return found;
+}
+
+#endif
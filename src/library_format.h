@@ -0,0 +1,59 @@
+#ifndef LIBRARY_FORMAT_H
+#define LIBRARY_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Library catalog, version 1. Written by the scanner in library_module.h,
+ * memory mapped read only for queries.
+ *
+ *   library_header
+ *   record_count library_record, sorted by path
+ *   string pool of strings_size bytes
+ *
+ * Strings are UTF-8 with a terminating NUL, stored once however many
+ * records use them (albums and artists repeat) and referenced by their
+ * offset into the pool. Offset 0 is the empty string, and the pool ends
+ * with a NUL, so any offset below strings_size is a terminated string.
+ * The search keys are the exception: they come first, one per record in
+ * record order, each ended by a '\n' except the last, which ends with the
+ * NUL. A query runs through them as one string and tells the record of a
+ * hit from the offset.
+ *
+ * The catalog is a cache of the music directories, in native byte order
+ * and layout: a header that does not match this build makes the scanner
+ * start over. A catalog is never changed in place, the scanner writes a
+ * new one next to it and renames it over the old one.
+ */
+
+#define LIBRARY_MAGIC "MBLIB001"
+#define LIBRARY_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size; /* sizeof(library_record) */
+    uint64_t record_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t scanned; /* unix seconds */
+} library_header;
+
+/* 64 bytes, one cache line */
+typedef struct {
+    uint64_t device; /* with inode, what a rescan recognises the file by */
+    uint64_t inode;
+    int64_t  mtime_ns;
+    uint64_t size;
+    uint32_t path;   /* string offsets */
+    uint32_t title;  /* the file name without extension if untagged */
+    uint32_t artist;
+    uint32_t album;
+    uint32_t search; /* lower case "artist title album file name", what !play matches; see above */
+    uint32_t duration_ms; /* 0 if unknown */
+    uint16_t track;
+    uint8_t  format; /* TAGS_MP3, ... of tags_module.h */
+    uint8_t  reserved[5];
+} library_record;
+
+#endif
@@ -0,0 +1,984 @@
+#ifndef LIBRARY_MODULE_H
+#define LIBRARY_MODULE_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "library_format.h"
+#include "log_module.h"
+#include "metrics_module.h"
+#include "tags_module.h"
+
+/*
+ * Local music library for !play.
+ *
+ * The directories of the config's library lines are scanned into a catalog
+ * (library_format.h), dir/LIBRARY_FILE_NAME next to the snapshot, which the
+ * event loop maps read only and searches in place: a query reads the
+ * mapping and allocates nothing, however large the library is.
+ *
+ * A scan fans out over a pool of workers sharing a stack of directories
+ * still to read. A worker lists a directory, pushes its subdirectories and
+ * stats the music files in it (by extension, symlinks to files are
+ * followed, symlinks to directories are not). A file whose device, inode,
+ * mtime and size match a record of the previous catalog keeps that record
+ * without being opened, so rescanning an unchanged library is a walk of its
+ * directories; any other file gets its tags read (tags_module.h) into the
+ * worker's own scratch buffer. Records and their strings collect in a
+ * per-worker arena, workers only meet at the directory stack. At the end
+ * the records are sorted by path, their strings pooled once each, and the
+ * catalog is written next to the old one and renamed over it.
+ *
+ * library_rescan runs a scan on its own thread and calls back when it is
+ * done; the plugin then has the event loop map the new catalog
+ * (library_reload). Only the loop maps and queries, the scanner maps the
+ * old catalog separately for its records, so neither waits for the other.
+ */
+
+#define LIBRARY_FILE_NAME "musicbot_library.bin"
+/* Workers mostly wait for the disk, so there are more of them than cores */
+#define LIBRARY_WORKERS_PER_CPU 2
+#define LIBRARY_MAX_WORKERS 16
+#define LIBRARY_ARENA_BYTES (1024 * 1024)
+#define LIBRARY_PATH_BYTES 4096
+/* Words of a query beyond that are ignored */
+#define LIBRARY_MAX_WORDS 8
+#define LIBRARY_SEARCH_BYTES 1024
+
+typedef struct {
+    uint64_t files;       /* music files in the new catalog */
+    uint64_t parsed;      /* tags read */
+    uint64_t reused;      /* records kept from the previous catalog */
+    uint64_t skipped;     /* unreadable, or not music after all */
+    uint64_t directories;
+    double   seconds;
+} library_scan_stats;
+
+/* Called on the scanner thread, result is 0 if a new catalog was written */
+typedef void (*library_done_handler)(int result, const library_scan_stats* stats);
+
+/* A search result, the strings point into the mapping and are valid until the next library_reload */
+typedef struct {
+    const char* path;
+    const char* title;
+    const char* artist;
+    const char* album;
+    uint32_t    duration_ms;
+} library_match;
+
+/* A mapped catalog */
+typedef struct {
+    void*                 map;
+    size_t                size;
+    const library_record* records;
+    uint64_t              count;
+    const char*           strings;
+    uint64_t              strings_size;
+    const char*           keys;     /* the search keys, '\n' after each but the last */
+    const char*           keys_end; /* the NUL after the last */
+} library_catalog;
+
+/* A file found by a scan, the strings live in a worker arena or the previous catalog */
+typedef struct {
+    uint64_t    device;
+    uint64_t    inode;
+    int64_t     mtime_ns;
+    uint64_t    size;
+    const char* path;
+    const char* title;
+    const char* artist;
+    const char* album;
+    uint32_t    duration_ms;
+    uint16_t    track;
+    uint8_t     format;
+} library_entry;
+
+typedef struct library_chunk {
+    struct library_chunk* next;
+    size_t                used;
+    size_t                size;
+    char                  data[];
+} library_chunk;
+
+/* Directories still to read, shared by the workers of a scan */
+typedef struct {
+    pthread_mutex_t        mutex;
+    pthread_cond_t         cond;
+    char**                 dirs;
+    size_t                 count;
+    size_t                 capacity;
+    int                    busy;     /* workers reading a directory, which may push more */
+    int                    failed;   /* out of memory somewhere */
+    const library_catalog* previous;
+    uint32_t*              index;    /* record index + 1 of previous by device and inode, 0 is free */
+    size_t                 index_mask;
+} library_walk;
+
+typedef struct {
+    pthread_t      thread;
+    library_walk*  walk;
+    library_entry* entries;
+    size_t         count;
+    size_t         capacity;
+    library_chunk* arena;
+    uint8_t*       scratch;
+    uint64_t       parsed;
+    uint64_t       reused;
+    uint64_t       skipped;
+    uint64_t       directories;
+} library_worker;
+
+/* Strings of a catalog being written, each stored once */
+typedef struct {
+    char*     data;
+    size_t    size;
+    size_t    capacity;
+    uint32_t* slots; /* offset of a string, 0 is free */
+    size_t    mask;
+    size_t    used;
+} library_pool;
+
+static const char* const library_extensions[] = {".mp3", ".flac", ".ogg", ".oga", ".opus"};
+
+static char            library_path[LIBRARY_PATH_BYTES];
+static library_catalog library_current; /* the event loop's */
+static _Atomic uint64_t library_tracks = 0;
+static _Atomic uint64_t library_last_scan_ms = 0;
+static atomic_int      library_cancel  = 0;
+static atomic_int      library_running = 0;
+static pthread_mutex_t library_scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t       library_thread;
+static int             library_joinable = 0;
+
+static int library_scans_metric[2];
+static int library_parsed_metric;
+static int library_reused_metric;
+static int library_skipped_metric;
+
+static double library_track_count(int arg)
+{
+    (void)arg;
+    return (double)atomic_load_explicit(&library_tracks, memory_order_relaxed);
+}
+
+static double library_last_scan_seconds(int arg)
+{
+    (void)arg;
+    return (double)atomic_load_explicit(&library_last_scan_ms, memory_order_relaxed) / 1e3;
+}
+
+void library_register_metrics(void)
+{
+    library_scans_metric[0] = metrics_counter("musicbot_library_scans_total", "Library scans, by outcome", "result", "written");
+    library_scans_metric[1] = metrics_counter("musicbot_library_scans_total", "Library scans, by outcome", "result", "failed");
+    library_parsed_metric   = metrics_counter("musicbot_library_files_total", "Music files seen by library scans, by what it took", "how", "parsed");
+    library_reused_metric   = metrics_counter("musicbot_library_files_total", "Music files seen by library scans, by what it took", "how", "reused");
+    library_skipped_metric  = metrics_counter("musicbot_library_files_total", "Music files seen by library scans, by what it took", "how", "skipped");
+    metrics_export("musicbot_library_tracks", "Tracks in the mapped library catalog", METRIC_GAUGE, NULL, NULL, library_track_count, 0);
+    metrics_export("musicbot_library_scan_seconds", "Duration of the last library scan", METRIC_GAUGE, NULL, NULL, library_last_scan_seconds, 0);
+}
+
+/* A string of a mapped catalog, "" for an offset out of range */
+static inline const char* library_string(const library_catalog* catalog, uint32_t offset)
+{
+    return offset < catalog->strings_size ? catalog->strings + offset : "";
+}
+
+static void library_unmap(library_catalog* catalog)
+{
+    if (catalog->map)
+        munmap(catalog->map, catalog->size);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+/* Map and check a catalog, returns 0 or -1 (logged unless the file is missing) */
+static int library_map(const char* path, library_catalog* catalog)
+{
+    memset(catalog, 0, sizeof(*catalog));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            LOG_WARN("Cannot open library catalog %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(library_header)) {
+        LOG_WARN("Library catalog %s is truncated, it will be rebuilt", path);
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_WARN("Cannot map library catalog %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    const library_header* header = (const library_header*)map;
+    uint64_t              size   = (uint64_t)st.st_size;
+    if (memcmp(header->magic, LIBRARY_MAGIC, 8) != 0 || header->version != LIBRARY_VERSION || header->record_size != sizeof(library_record) ||
+        header->record_count > (size - sizeof(library_header)) / sizeof(library_record) ||
+        header->strings_offset != sizeof(library_header) + header->record_count * sizeof(library_record) || header->strings_size == 0 ||
+        header->strings_size != size - header->strings_offset || ((const char*)map)[size - 1] != '\0') {
+        LOG_WARN("Library catalog %s is from another version or damaged, it will be rebuilt", path);
+        munmap(map, (size_t)size);
+        return -1;
+    }
+    catalog->map          = map;
+    catalog->size         = (size_t)size;
+    catalog->records      = (const library_record*)((const char*)map + sizeof(library_header));
+    catalog->count        = header->record_count;
+    catalog->strings      = (const char*)map + header->strings_offset;
+    catalog->strings_size = header->strings_size;
+    catalog->keys = catalog->keys_end = catalog->strings;
+
+    /* Queries find a record by the offset of its search key, they must be in record order */
+    for (uint64_t i = 1; i < catalog->count; i++) {
+        if (catalog->records[i].search <= catalog->records[i - 1].search) {
+            LOG_WARN("Library catalog %s is damaged, it will be rebuilt", path);
+            library_unmap(catalog);
+            return -1;
+        }
+    }
+    if (catalog->count && catalog->records[catalog->count - 1].search < catalog->strings_size) {
+        catalog->keys     = catalog->strings + catalog->records[0].search;
+        catalog->keys_end = catalog->strings + catalog->records[catalog->count - 1].search;
+        catalog->keys_end += strlen(catalog->keys_end);
+    }
+    return 0;
+}
+
+/************************** Scanning ***************************/
+
+static int library_is_music(const char* name)
+{
+    const char* dot = strrchr(name, '.');
+    for (size_t i = 0; dot && i < sizeof(library_extensions) / sizeof(library_extensions[0]); i++) {
+        if (strcasecmp(dot, library_extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static inline size_t library_inode_hash(uint64_t device, uint64_t inode)
+{
+    uint64_t hash = (inode ^ device * 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull;
+    return (size_t)(hash ^ hash >> 31);
+}
+
+/* Index the records of the previous catalog by device and inode, returns -1 without memory */
+static int library_index_previous(library_walk* walk)
+{
+    const library_catalog* previous = walk->previous;
+    size_t                 capacity = 16;
+    while (capacity < previous->count * 2)
+        capacity *= 2;
+    walk->index = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (!walk->index)
+        return -1;
+    walk->index_mask = capacity - 1;
+    for (uint64_t i = 0; i < previous->count; i++) {
+        size_t slot = library_inode_hash(previous->records[i].device, previous->records[i].inode) & walk->index_mask;
+        while (walk->index[slot])
+            slot = (slot + 1) & walk->index_mask;
+        walk->index[slot] = (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+/* The record of the previous catalog for an unchanged file, NULL if it is new or changed */
+static const library_record* library_unchanged(const library_walk* walk, const library_entry* entry)
+{
+    if (!walk->index)
+        return NULL;
+    for (size_t slot = library_inode_hash(entry->device, entry->inode) & walk->index_mask; walk->index[slot]; slot = (slot + 1) & walk->index_mask) {
+        const library_record* record = &walk->previous->records[walk->index[slot] - 1];
+        if (record->device == entry->device && record->inode == entry->inode)
+            return record->mtime_ns == entry->mtime_ns && record->size == entry->size ? record : NULL;
+    }
+    return NULL;
+}
+
+static int library_push_directory(library_walk* walk, const char* dir)
+{
+    char* copy = strdup(dir);
+    pthread_mutex_lock(&walk->mutex);
+    if (copy && walk->count == walk->capacity) {
+        size_t capacity = walk->capacity ? walk->capacity * 2 : 64;
+        char** dirs     = (char**)realloc(walk->dirs, capacity * sizeof(char*));
+        if (dirs) {
+            walk->dirs     = dirs;
+            walk->capacity = capacity;
+        }
+    }
+    if (!copy || walk->count == walk->capacity) {
+        walk->failed = 1;
+        pthread_mutex_unlock(&walk->mutex);
+        free(copy);
+        return -1;
+    }
+    walk->dirs[walk->count++] = copy;
+    pthread_cond_signal(&walk->cond);
+    pthread_mutex_unlock(&walk->mutex);
+    return 0;
+}
+
+/* Copy a string into the worker's arena, NULL without memory */
+static const char* library_arena_copy(library_worker* worker, const char* text, size_t length)
+{
+    library_chunk* chunk = worker->arena;
+    if (!chunk || chunk->size - chunk->used < length + 1) {
+        size_t size = length + 1 > LIBRARY_ARENA_BYTES ? length + 1 : LIBRARY_ARENA_BYTES;
+        chunk       = (library_chunk*)malloc(sizeof(library_chunk) + size);
+        if (!chunk)
+            return NULL;
+        chunk->next   = worker->arena;
+        chunk->used   = 0;
+        chunk->size   = size;
+        worker->arena = chunk;
+    }
+    char* copy = chunk->data + chunk->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+/* Add the music file name of the directory open as dir_fd, st is its stat */
+static void library_add_file(library_worker* worker, int dir_fd, const char* name, const char* path, const struct stat* st)
+{
+    if (worker->count == worker->capacity) {
+        size_t         capacity = worker->capacity ? worker->capacity * 2 : 256;
+        library_entry* entries  = (library_entry*)realloc(worker->entries, capacity * sizeof(library_entry));
+        if (!entries) {
+            worker->walk->failed = 1;
+            return;
+        }
+        worker->entries  = entries;
+        worker->capacity = capacity;
+    }
+    library_entry entry = {
+        .device   = (uint64_t)st->st_dev,
+        .inode    = (uint64_t)st->st_ino,
+        .mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec,
+        .size     = (uint64_t)st->st_size,
+    };
+
+    const library_record* record = library_unchanged(worker->walk, &entry);
+    if (record) {
+        const library_catalog* previous = worker->walk->previous;
+        entry.title       = library_string(previous, record->title);
+        entry.artist      = library_string(previous, record->artist);
+        entry.album       = library_string(previous, record->album);
+        entry.duration_ms = record->duration_ms;
+        entry.track       = record->track;
+        entry.format      = record->format;
+        worker->reused++;
+    } else {
+        tags_info tags;
+        int       fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+        int       ok = fd >= 0 && tags_read(fd, entry.size, worker->scratch, &tags) == 0;
+        if (fd >= 0)
+            close(fd);
+        if (!ok) {
+            worker->skipped++;
+            return;
+        }
+        if (!tags.title[0]) {
+            /* Untagged, the file name without its extension stands in */
+            size_t length = (size_t)(strrchr(name, '.') - name);
+            if (length >= sizeof(tags.title))
+                length = sizeof(tags.title) - 1;
+            memcpy(tags.title, name, length);
+            tags.title[length] = '\0';
+        }
+        entry.title       = library_arena_copy(worker, tags.title, strlen(tags.title));
+        entry.artist      = library_arena_copy(worker, tags.artist, strlen(tags.artist));
+        entry.album       = library_arena_copy(worker, tags.album, strlen(tags.album));
+        entry.duration_ms = tags.duration_ms;
+        entry.track       = tags.track;
+        entry.format      = tags.format;
+        worker->parsed++;
+    }
+    entry.path = library_arena_copy(worker, path, strlen(path));
+    if (!entry.path || !entry.title || !entry.artist || !entry.album) {
+        worker->walk->failed = 1;
+        return;
+    }
+    worker->entries[worker->count++] = entry;
+}
+
+static void library_read_directory(library_worker* worker, const char* dir)
+{
+    DIR* handle = opendir(dir);
+    if (!handle) {
+        LOG_WARN("Cannot read library directory %s: %s", dir, strerror(errno));
+        return;
+    }
+    worker->directories++;
+    int            dir_fd     = dirfd(handle);
+    size_t         dir_length = strlen(dir);
+    char           path[LIBRARY_PATH_BYTES];
+    struct dirent* entry;
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    while (!atomic_load_explicit(&library_cancel, memory_order_relaxed) && (entry = readdir(handle))) {
+        const char* name = entry->d_name;
+        /* Hidden files, "." and ".." */
+        if (name[0] == '.')
+            continue;
+        int music = library_is_music(name);
+        if (!music && entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+            continue;
+        size_t name_length = strlen(name);
+        if (dir_length + 1 + name_length >= sizeof(path))
+            continue;
+        memcpy(path + dir_length + 1, name, name_length + 1);
+
+        /* Directories are told apart without following symlinks, so a link cannot make a loop */
+        struct stat st;
+        int         is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            library_push_directory(worker->walk, path);
+        } else if (music && fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode)) {
+            library_add_file(worker, dir_fd, name, path, &st);
+        }
+    }
+    closedir(handle);
+}
+
+static void* library_work(void* arg)
+{
+    library_worker* worker = (library_worker*)arg;
+    library_walk*   walk   = worker->walk;
+    pthread_mutex_lock(&walk->mutex);
+    for (;;) {
+        while (!walk->count && walk->busy && !atomic_load(&library_cancel))
+            pthread_cond_wait(&walk->cond, &walk->mutex);
+        /* Nothing left and nobody who could push more */
+        if (!walk->count || atomic_load(&library_cancel))
+            break;
+        char* dir = walk->dirs[--walk->count];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->mutex);
+
+        library_read_directory(worker, dir);
+        free(dir);
+
+        pthread_mutex_lock(&walk->mutex);
+        if (--walk->busy == 0 && !walk->count)
+            pthread_cond_broadcast(&walk->cond);
+    }
+    pthread_cond_broadcast(&walk->cond);
+    pthread_mutex_unlock(&walk->mutex);
+    return NULL;
+}
+
+/************************** Writing ***************************/
+
+static uint32_t library_string_hash(const char* text, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+    return hash;
+}
+
+/* Room for bytes more, returns -1 without memory or past 4 GiB */
+static int library_pool_reserve(library_pool* pool, size_t bytes)
+{
+    if (pool->size + bytes > UINT32_MAX)
+        return -1;
+    if (pool->size + bytes <= pool->capacity)
+        return 0;
+    size_t capacity = pool->capacity * 2;
+    while (capacity < pool->size + bytes)
+        capacity *= 2;
+    char* data = (char*)realloc(pool->data, capacity);
+    if (!data)
+        return -1;
+    pool->data     = data;
+    pool->capacity = capacity;
+    return 0;
+}
+
+/* Offset of text in the pool, added if it is not there yet; -1 without memory or past 4 GiB */
+static int64_t library_pool_add(library_pool* pool, const char* text)
+{
+    size_t length = strlen(text);
+    if (!length)
+        return 0;
+    if (pool->used * 2 >= pool->mask) {
+        size_t    capacity = (pool->mask + 1) * 2;
+        uint32_t* slots    = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+        if (!slots)
+            return -1;
+        for (size_t i = 0; i <= pool->mask; i++) {
+            if (!pool->slots[i])
+                continue;
+            const char* old  = pool->data + pool->slots[i];
+            size_t      slot = library_string_hash(old, strlen(old)) & (capacity - 1);
+            while (slots[slot])
+                slot = (slot + 1) & (capacity - 1);
+            slots[slot] = pool->slots[i];
+        }
+        free(pool->slots);
+        pool->slots = slots;
+        pool->mask  = capacity - 1;
+    }
+    size_t slot = library_string_hash(text, length) & pool->mask;
+    for (; pool->slots[slot]; slot = (slot + 1) & pool->mask) {
+        if (strcmp(pool->data + pool->slots[slot], text) == 0)
+            return pool->slots[slot];
+    }
+    if (library_pool_reserve(pool, length + 1) != 0)
+        return -1;
+    uint32_t offset = (uint32_t)pool->size;
+    memcpy(pool->data + offset, text, length + 1);
+    pool->size += length + 1;
+    pool->slots[slot] = offset;
+    pool->used++;
+    return offset;
+}
+
+/* Append length bytes and then end as they are, not shared; returns the offset or -1 */
+static int64_t library_pool_append(library_pool* pool, const char* text, size_t length, char end)
+{
+    if (library_pool_reserve(pool, length + 1) != 0)
+        return -1;
+    uint32_t offset = (uint32_t)pool->size;
+    memcpy(pool->data + offset, text, length);
+    pool->data[offset + length] = end;
+    pool->size += length + 1;
+    return offset;
+}
+
+/* ASCII lower case, the rest of UTF-8 is matched as is */
+static inline char library_lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+/* What !play matches: lower case "artist title album file name" */
+static void library_search_key(const library_entry* entry, char* out, size_t size)
+{
+    const char* name  = strrchr(entry->path, '/');
+    int         count = snprintf(out, size, "%s %s %s %s", entry->artist, entry->title, entry->album, name ? name + 1 : entry->path);
+    size_t      end   = count < 0 ? 0 : (size_t)count < size ? (size_t)count : size - 1;
+    for (size_t i = 0; i < end; i++)
+        out[i] = (unsigned char)out[i] < ' ' ? ' ' : library_lower(out[i]);
+}
+
+static int library_compare_paths(const void* a, const void* b)
+{
+    return strcmp((*(const library_entry* const*)a)->path, (*(const library_entry* const*)b)->path);
+}
+
+/*
+ * Write the catalog of count entries, sorted by path, to path: a temporary
+ * file next to it first, renamed over it once complete. Entries with the
+ * same path as the one before (overlapping library lines) are left out.
+ * Returns the number of records written or -1.
+ */
+long long library_write(const char* path, library_entry** entries, size_t count)
+{
+    qsort(entries, count, sizeof(library_entry*), library_compare_paths);
+    library_record* records = (library_record*)calloc(count ? count : 1, sizeof(library_record));
+    library_pool    pool    = {.data = (char*)malloc(65536), .size = 1, .capacity = 65536, .slots = (uint32_t*)calloc(1024, sizeof(uint32_t)), .mask = 1023};
+    size_t          written = 0;
+    int             failed  = !records || !pool.data || !pool.slots;
+    char            search[LIBRARY_SEARCH_BYTES];
+    if (pool.data)
+        pool.data[0] = '\0';
+
+    /* The search keys first, one block in record order that a query reads front to back */
+    for (size_t i = 0; i < count && !failed; i++) {
+        if (written && strcmp(entries[i]->path, entries[written - 1]->path) == 0)
+            continue;
+        entries[written] = entries[i];
+        library_search_key(entries[i], search, sizeof(search));
+        int64_t offset = library_pool_append(&pool, search, strlen(search), '\n');
+        failed |= offset < 0;
+        records[written++].search = (uint32_t)offset;
+    }
+    if (written && !failed)
+        pool.data[pool.size - 1] = '\0';
+    for (size_t i = 0; i < written && !failed; i++) {
+        const library_entry* entry      = entries[i];
+        int64_t              offsets[4] = {library_pool_add(&pool, entry->path), library_pool_add(&pool, entry->title), library_pool_add(&pool, entry->artist),
+                                           library_pool_add(&pool, entry->album)};
+        for (int o = 0; o < 4; o++)
+            failed |= offsets[o] < 0;
+        records[i] = (library_record){
+            .device      = entry->device,
+            .inode       = entry->inode,
+            .mtime_ns    = entry->mtime_ns,
+            .size        = entry->size,
+            .path        = (uint32_t)offsets[0],
+            .title       = (uint32_t)offsets[1],
+            .artist      = (uint32_t)offsets[2],
+            .album       = (uint32_t)offsets[3],
+            .search      = records[i].search,
+            .duration_ms = entry->duration_ms,
+            .track       = entry->track,
+            .format      = entry->format,
+        };
+    }
+
+    char temporary[LIBRARY_PATH_BYTES + 8];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE* out = failed ? NULL : fopen(temporary, "wb");
+    if (out) {
+        library_header header = {
+            .version        = LIBRARY_VERSION,
+            .record_size    = sizeof(library_record),
+            .record_count   = written,
+            .strings_offset = sizeof(library_header) + written * sizeof(library_record),
+            .strings_size   = pool.size,
+            .scanned        = (uint64_t)time(NULL),
+        };
+        memcpy(header.magic, LIBRARY_MAGIC, 8);
+        failed = fwrite(&header, sizeof(header), 1, out) != 1 || fwrite(records, sizeof(library_record), written, out) != written ||
+                 fwrite(pool.data, 1, pool.size, out) != pool.size || fflush(out) != 0 || fsync(fileno(out)) != 0;
+        failed |= fclose(out) != 0;
+        if (failed || rename(temporary, path) != 0) {
+            LOG_ERROR("Cannot write library catalog %s: %s", path, strerror(errno));
+            unlink(temporary);
+            failed = 1;
+        }
+    } else {
+        LOG_ERROR("Cannot write library catalog %s: %s", temporary, failed ? "out of memory" : strerror(errno));
+        failed = 1;
+    }
+    free(records);
+    free(pool.data);
+    free(pool.slots);
+    return failed ? -1 : (long long)written;
+}
+
+/*
+ * Scan roots into the catalog at path, reusing the records of the catalog
+ * that is there. Blocks until done, library_close cancels it. Returns 0 if
+ * the catalog was written, -1 otherwise, stats tell what it took.
+ */
+int library_scan(const char* path, const char* const* roots, size_t root_count, library_scan_stats* stats)
+{
+    uint64_t        start    = metrics_now_ns();
+    library_catalog previous = {0};
+    library_walk    walk     = {.mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .previous = &previous};
+    memset(stats, 0, sizeof(*stats));
+    if (library_map(path, &previous) == 0 && library_index_previous(&walk) != 0)
+        walk.failed = 1;
+    for (size_t i = 0; i < root_count; i++) {
+        char   root[LIBRARY_PATH_BYTES];
+        size_t length = (size_t)snprintf(root, sizeof(root), "%s", roots[i]);
+        while (length > 1 && root[length - 1] == '/')
+            root[--length] = '\0';
+        library_push_directory(&walk, root);
+    }
+
+    long cpus  = sysconf(_SC_NPROCESSORS_ONLN);
+    int  count = cpus > 0 ? (int)cpus * LIBRARY_WORKERS_PER_CPU : 1;
+    count      = count < LIBRARY_MAX_WORKERS ? count : LIBRARY_MAX_WORKERS;
+    library_worker workers[LIBRARY_MAX_WORKERS];
+    int            started[LIBRARY_MAX_WORKERS] = {0};
+    memset(workers, 0, sizeof(workers));
+    for (int i = 0; i < count; i++) {
+        workers[i].walk    = &walk;
+        workers[i].scratch = (uint8_t*)malloc(TAGS_HEAD_BYTES);
+        if (!workers[i].scratch)
+            walk.failed = 1;
+    }
+    /* The calling thread is worker 0, so a scan works even if no thread can be started */
+    for (int i = 1; i < count && workers[i].scratch; i++)
+        started[i] = pthread_create(&workers[i].thread, NULL, library_work, &workers[i]) == 0;
+    if (workers[0].scratch)
+        library_work(&workers[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(workers[i].thread, NULL);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += workers[i].count;
+        stats->parsed += workers[i].parsed;
+        stats->reused += workers[i].reused;
+        stats->skipped += workers[i].skipped;
+        stats->directories += workers[i].directories;
+    }
+    int result = -1;
+    if (atomic_load(&library_cancel)) {
+        LOG_INFO("Library scan cancelled");
+    } else if (walk.failed) {
+        LOG_ERROR("Library scan ran out of memory");
+    } else {
+        library_entry** entries = (library_entry**)malloc((total ? total : 1) * sizeof(library_entry*));
+        size_t          filled  = 0;
+        for (int i = 0; entries && i < count; i++) {
+            for (size_t e = 0; e < workers[i].count; e++)
+                entries[filled++] = &workers[i].entries[e];
+        }
+        long long written = entries ? library_write(path, entries, total) : -1;
+        if (written >= 0) {
+            stats->files = (uint64_t)written;
+            result       = 0;
+        }
+        free(entries);
+    }
+
+    for (int i = 0; i < count; i++) {
+        while (workers[i].arena) {
+            library_chunk* next = workers[i].arena->next;
+            free(workers[i].arena);
+            workers[i].arena = next;
+        }
+        free(workers[i].entries);
+        free(workers[i].scratch);
+    }
+    for (size_t i = 0; i < walk.count; i++)
+        free(walk.dirs[i]);
+    free(walk.dirs);
+    free(walk.index);
+    library_unmap(&previous);
+
+    stats->seconds = (double)(metrics_now_ns() - start) / 1e9;
+    metrics_inc(library_scans_metric[result == 0 ? 0 : 1]);
+    metrics_add(library_parsed_metric, stats->parsed);
+    metrics_add(library_reused_metric, stats->reused);
+    metrics_add(library_skipped_metric, stats->skipped);
+    atomic_store(&library_last_scan_ms, (uint64_t)(stats->seconds * 1e3));
+    return result;
+}
+
+/************************** Background scans and queries ***************************/
+
+typedef struct {
+    char**               roots;
+    size_t               root_count;
+    library_done_handler done;
+} library_job;
+
+static void library_free_job(library_job* job)
+{
+    for (size_t i = 0; i < job->root_count; i++)
+        free(job->roots[i]);
+    free(job->roots);
+    free(job);
+}
+
+static void* library_scan_thread(void* arg)
+{
+    library_job*       job = (library_job*)arg;
+    library_scan_stats stats;
+    int                result = library_scan(library_path, (const char* const*)job->roots, job->root_count, &stats);
+    if (result == 0)
+        LOG_INFO("Library scan: %llu files (%llu read, %llu unchanged, %llu skipped) in %llu directories, %.2f s", (unsigned long long)stats.files,
+                 (unsigned long long)stats.parsed, (unsigned long long)stats.reused, (unsigned long long)stats.skipped, (unsigned long long)stats.directories,
+                 stats.seconds);
+    if (job->done)
+        job->done(result, &stats);
+    library_free_job(job);
+    atomic_store(&library_running, 0);
+    return NULL;
+}
+
+/* Map the catalog the last scan wrote in place of the current one. Event loop thread. */
+int library_reload(void)
+{
+    library_catalog next;
+    if (library_map(library_path, &next) != 0)
+        return -1;
+    library_unmap(&library_current);
+    library_current = next;
+    atomic_store(&library_tracks, next.count);
+    return 0;
+}
+
+/* Map dir/LIBRARY_FILE_NAME if a previous run left one, returns 0 if it did. From ts3plugin_init. */
+int library_open(const char* dir)
+{
+    snprintf(library_path, sizeof(library_path), "%s/%s", dir, LIBRARY_FILE_NAME);
+    return library_reload();
+}
+
+/*
+ * Scan roots in the background and call done when finished. Returns 0 if
+ * the scan started, -1 if one is still running or the thread cannot start.
+ */
+int library_rescan(const char* const* roots, size_t root_count, library_done_handler done)
+{
+    if (!library_path[0])
+        return -1;
+    pthread_mutex_lock(&library_scan_mutex);
+    if (atomic_load(&library_running)) {
+        pthread_mutex_unlock(&library_scan_mutex);
+        return -1;
+    }
+    if (library_joinable) {
+        pthread_join(library_thread, NULL);
+        library_joinable = 0;
+    }
+    library_job* job = (library_job*)calloc(1, sizeof(library_job));
+    if (!job || !(job->roots = (char**)calloc(root_count ? root_count : 1, sizeof(char*)))) {
+        pthread_mutex_unlock(&library_scan_mutex);
+        free(job);
+        return -1;
+    }
+    for (size_t i = 0; i < root_count; i++) {
+        if ((job->roots[i] = strdup(roots[i])))
+            job->root_count++;
+    }
+    job->done = done;
+    atomic_store(&library_cancel, 0);
+    atomic_store(&library_running, 1);
+    if (job->root_count != root_count || pthread_create(&library_thread, NULL, library_scan_thread, job) != 0) {
+        atomic_store(&library_running, 0);
+        pthread_mutex_unlock(&library_scan_mutex);
+        library_free_job(job);
+        return -1;
+    }
+    library_joinable = 1;
+    pthread_mutex_unlock(&library_scan_mutex);
+    return 0;
+}
+
+static inline int library_scanning(void)
+{
+    return atomic_load(&library_running);
+}
+
+/* Cancel a scan and unmap the catalog, from ts3plugin_shutdown after the event loop stopped */
+void library_close(void)
+{
+    atomic_store(&library_cancel, 1);
+    pthread_mutex_lock(&library_scan_mutex);
+    if (library_joinable) {
+        pthread_join(library_thread, NULL);
+        library_joinable = 0;
+    }
+    pthread_mutex_unlock(&library_scan_mutex);
+    library_unmap(&library_current);
+    atomic_store(&library_tracks, 0);
+}
+
+/* The record whose search key is at or before key, from record first on (galloping, hits come in order) */
+static uint64_t library_record_of_key(const library_catalog* catalog, const char* key, uint64_t first)
+{
+    uint64_t offset = (uint64_t)(key - catalog->strings);
+    uint64_t step   = 1;
+    while (first + step < catalog->count && catalog->records[first + step].search <= offset)
+        step *= 2;
+    uint64_t low  = first + step / 2;
+    uint64_t high = first + step < catalog->count ? first + step : catalog->count;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (catalog->records[middle].search <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+ * Records of catalog whose search key contains every word of query (case
+ * insensitive for ASCII), the first of them in path order in match. Reads
+ * the mapping only.
+ *
+ * The block of search keys is searched for one word after the other with
+ * strstr, always from the key of the candidate record on: a hit in a later
+ * record makes that record the candidate, and a candidate every word was
+ * found in is a match. No word is searched past its last hit more than
+ * once, so a query reads the block about once per word however common the
+ * words are. Returns the number of matches.
+ */
+static uint64_t library_search(const library_catalog* catalog, const char* query, library_match* match)
+{
+    char        text[LIBRARY_SEARCH_BYTES];
+    const char* words[LIBRARY_MAX_WORDS];
+    const char* hits[LIBRARY_MAX_WORDS] = {NULL}; /* the last hit of each word */
+    int         word_count              = 0;
+    char*       save                    = NULL;
+    snprintf(text, sizeof(text), "%s", query);
+    for (char* c = text; *c; c++)
+        *c = library_lower(*c);
+    for (char* word = strtok_r(text, " \t\r\n", &save); word && word_count < LIBRARY_MAX_WORDS; word = strtok_r(NULL, " \t\r\n", &save))
+        words[word_count++] = word;
+    if (!word_count || !catalog->count)
+        return 0;
+
+    uint64_t matches   = 0;
+    uint64_t candidate = 0;
+    int      agreed    = 0;
+    for (int w = 0;; w = (w + 1) % word_count) {
+        const char* from = catalog->strings + catalog->records[candidate].search;
+        if (!hits[w] || hits[w] < from)
+            hits[w] = from < catalog->keys_end ? strstr(from, words[w]) : NULL;
+        if (!hits[w])
+            break;
+        uint64_t record = library_record_of_key(catalog, hits[w], candidate);
+        agreed          = record == candidate ? agreed + 1 : 1;
+        candidate       = record;
+        if (agreed < word_count)
+            continue;
+        if (!matches++) {
+            const library_record* found = &catalog->records[candidate];
+            match->path                 = library_string(catalog, found->path);
+            match->title                = library_string(catalog, found->title);
+            match->artist               = library_string(catalog, found->artist);
+            match->album                = library_string(catalog, found->album);
+            match->duration_ms          = found->duration_ms;
+        }
+        if (++candidate == catalog->count)
+            break;
+        agreed = 0;
+    }
+    return matches;
+}
+
+/* library_search on the mapped catalog, event loop thread */
+uint64_t library_find(const char* query, library_match* match)
+{
+    return library_search(&library_current, query, match);
+}
+
+/* file:// URI of path, percent-encoding all but unreserved characters and '/'. Returns 0, or -1 if it does not fit. */
+int library_file_uri(const char* path, char* out, size_t size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t            used  = (size_t)snprintf(out, size, "file://");
+    for (const unsigned char* c = (const unsigned char*)path; *c; c++) {
+        int plain = (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9') || strchr("-._~/", *c);
+        if (used + (plain ? 1 : 3) >= size)
+            return -1;
+        if (plain) {
+            out[used++] = (char)*c;
+        } else {
+            out[used++] = '%';
+            out[used++] = hex[*c >> 4];
+            out[used++] = hex[*c & 15];
+        }
+    }
+    out[used] = '\0';
+    return 0;
+}
+
+#endif
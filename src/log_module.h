@@ -0,0 +1,505 @@
+#ifndef LOG_MODULE_H
+#define LOG_MODULE_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Asynchronous structured logger.
+ *
+ * LOG_INFO("Moved to %llu", id) does not format anything on the calling
+ * thread. It copies the format pointer, the arguments (strings inline) and a
+ * timestamp into a fixed size record in the calling thread's own single
+ * producer ring, and a flusher thread merges the rings by time, formats the
+ * records and writes them to stdout. A disabled level costs one compare and
+ * branch; a full ring drops the record (counted) instead of blocking.
+ *
+ * Format strings must be literals, they are read again by the flusher. Only
+ * the printf conversions d i u x X o c s p f e g (with flags, width,
+ * precision and the hh h l ll z j t length modifiers) are understood. The
+ * audio thread must not log, the first record of a thread allocates its ring.
+ * A thread's ring goes back to the pool when the thread exits: a pthread key
+ * destructor retires it and the flusher frees the slot once it drained the
+ * ring, so short lived threads (library scans) do not use up LOG_MAX_THREADS.
+ *
+ * LOG_SAMPLED lets at most n records per second through from one call site
+ * and reports how many were suppressed with the next one that passes.
+ */
+
+enum { LOG_LEVEL_TRACE = 0, LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR, LOG_LEVEL_OFF };
+
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO
+/* Records per thread ring, power of two */
+#define LOG_RING_RECORDS 1024
+#define LOG_MAX_THREADS 32
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_BYTES 160
+#define LOG_FLUSH_INTERVAL_MS 20
+
+typedef struct {
+    uint64_t    time_ns; /* CLOCK_REALTIME */
+    const char* format;
+    uint8_t     level;
+    uint8_t     arg_count;
+    uint16_t    string_bytes;
+    uint32_t    suppressed;
+    uint64_t    args[LOG_MAX_ARGS]; /* integers, doubles (bit copy) or offsets into strings */
+    char        strings[LOG_STRING_BYTES];
+} log_record;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t write_pos;
+    _Alignas(64) _Atomic uint64_t read_pos;
+    atomic_int retired; /* the thread exited, free once drained */
+    uint32_t   tid;
+    log_record records[LOG_RING_RECORDS];
+} log_ring;
+
+typedef struct {
+    _Atomic uint64_t second;
+    atomic_uint      count;
+    atomic_uint      suppressed;
+} log_limiter;
+
+static atomic_int log_min_level = LOG_DEFAULT_LEVEL;
+
+static log_ring* _Atomic       log_rings[LOG_MAX_THREADS];
+static _Thread_local log_ring* log_thread_ring      = NULL;
+static pthread_key_t           log_ring_key;
+static atomic_int              log_ring_key_ready   = 0;
+static _Atomic uint64_t        log_dropped          = 0;
+static uint64_t                log_dropped_reported = 0;
+
+static pthread_t  log_thread;
+static atomic_int log_running = 0;
+
+static const char* const log_level_names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+
+#define LOG_ENABLED(level) ((level) >= atomic_load_explicit(&log_min_level, memory_order_relaxed))
+
+#define LOG_AT(level, ...)                                                                                                                                                                                                                                     \
+    do {                                                                                                                                                                                                                                                       \
+        if (LOG_ENABLED(level))                                                                                                                                                                                                                                \
+            log_write(level, 0, __VA_ARGS__);                                                                                                                                                                                                                  \
+    } while (0)
+
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#define LOG_SAMPLED(level, per_second, ...)                                                                                                                                                                                                                    \
+    do {                                                                                                                                                                                                                                                       \
+        static log_limiter log_site_limiter;                                                                                                                                                                                                                   \
+        uint32_t           log_site_suppressed;                                                                                                                                                                                                                \
+        if (LOG_ENABLED(level) && log_limiter_allow(&log_site_limiter, per_second, &log_site_suppressed))                                                                                                                                                      \
+            log_write(level, log_site_suppressed, __VA_ARGS__);                                                                                                                                                                                                \
+    } while (0)
+
+void log_set_level(int level)
+{
+    atomic_store(&log_min_level, level);
+}
+
+/* "trace", "debug", "info", "warn", "error" or "off", returns -1 for anything else */
+int log_parse_level(const char* name)
+{
+    static const char* const names[] = {"trace", "debug", "info", "warn", "error", "off"};
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int log_limiter_allow(log_limiter* limiter, unsigned int per_second, uint32_t* suppressed)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t second = (uint64_t)ts.tv_sec;
+    uint64_t window = atomic_load_explicit(&limiter->second, memory_order_relaxed);
+
+    if (window != second && atomic_compare_exchange_strong(&limiter->second, &window, second))
+        atomic_store_explicit(&limiter->count, 0, memory_order_relaxed);
+    if (atomic_fetch_add_explicit(&limiter->count, 1, memory_order_relaxed) >= per_second) {
+        atomic_fetch_add_explicit(&limiter->suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+    *suppressed = atomic_exchange_explicit(&limiter->suppressed, 0, memory_order_relaxed);
+    return 1;
+}
+
+/* Argument kinds of one conversion, shared by the producer and the flusher */
+enum { LOG_ARG_NONE = 0, LOG_ARG_INT, LOG_ARG_LONG, LOG_ARG_LLONG, LOG_ARG_SIZE, LOG_ARG_DOUBLE, LOG_ARG_STRING, LOG_ARG_POINTER };
+
+typedef struct {
+    const char* start;
+    size_t      length;
+    int         stars; /* '*' width/precision, each takes an int argument first */
+    int         kind;
+} log_spec;
+
+/* Find the next conversion at or after p. Returns the position after it, or NULL at the end of the format. */
+static const char* log_next_spec(const char* p, log_spec* spec)
+{
+    while (*p) {
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        spec->start = p - 1;
+        spec->stars = 0;
+        while (*p && strchr("-+ #0", *p))
+            p++;
+        for (; (*p >= '0' && *p <= '9') || *p == '.' || *p == '*'; p++) {
+            if (*p == '*')
+                spec->stars++;
+        }
+        int length = 0;
+        if (*p == 'h') {
+            p += p[1] == 'h' ? 2 : 1;
+        } else if (*p == 'l') {
+            length = p[1] == 'l' ? 2 : 1;
+            p += length;
+        } else if (*p == 'z' || *p == 't') {
+            length = 3;
+            p++;
+        } else if (*p == 'j') {
+            length = 2;
+            p++;
+        }
+        switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            spec->kind = length == 0 ? LOG_ARG_INT : length == 1 ? LOG_ARG_LONG : length == 2 ? LOG_ARG_LLONG : LOG_ARG_SIZE;
+            break;
+        case 'c':
+            spec->kind = LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            spec->kind = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->kind = LOG_ARG_STRING;
+            break;
+        case 'p':
+            spec->kind = LOG_ARG_POINTER;
+            break;
+        default:
+            spec->kind = LOG_ARG_NONE;
+            break;
+        }
+        if (*p)
+            p++;
+        spec->length = (size_t)(p - spec->start);
+        return p;
+    }
+    return NULL;
+}
+
+/* Key destructor at thread exit, hands the ring to the flusher. Later records of the thread (other destructors) get a new ring. */
+static void log_ring_retire(void* ring)
+{
+    log_thread_ring = NULL;
+    atomic_store_explicit(&((log_ring*)ring)->retired, 1, memory_order_release);
+}
+
+static log_ring* log_ring_for_thread(void)
+{
+    if (log_thread_ring)
+        return log_thread_ring;
+
+    log_ring* ring = (log_ring*)aligned_alloc(64, sizeof(log_ring));
+    if (!ring)
+        return NULL;
+    atomic_init(&ring->write_pos, 0);
+    atomic_init(&ring->read_pos, 0);
+    atomic_init(&ring->retired, 0);
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring* empty = NULL;
+        if (atomic_compare_exchange_strong_explicit(&log_rings[i], &empty, ring, memory_order_release, memory_order_relaxed)) {
+            if (atomic_load(&log_ring_key_ready))
+                pthread_setspecific(log_ring_key, ring);
+            log_thread_ring = ring;
+            return ring;
+        }
+    }
+    free(ring);
+    return NULL;
+}
+
+__attribute__((format(printf, 3, 4))) void log_write(int level, uint32_t suppressed, const char* format, ...)
+{
+    log_ring* ring = log_ring_for_thread();
+    if (!ring) {
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    uint64_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    if (write - atomic_load_explicit(&ring->read_pos, memory_order_acquire) >= LOG_RING_RECORDS) {
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record*     r = &ring->records[write & (LOG_RING_RECORDS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->time_ns      = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    r->format       = format;
+    r->level        = (uint8_t)level;
+    r->suppressed   = suppressed;
+    r->arg_count    = 0;
+    r->string_bytes = 0;
+
+    va_list     args;
+    log_spec    spec;
+    const char* p = format;
+    va_start(args, format);
+    while (r->arg_count < LOG_MAX_ARGS && (p = log_next_spec(p, &spec))) {
+        for (int s = 0; s < spec.stars && r->arg_count < LOG_MAX_ARGS; s++)
+            r->args[r->arg_count++] = (uint64_t)(int64_t)va_arg(args, int);
+        if (r->arg_count == LOG_MAX_ARGS)
+            break;
+
+        uint64_t value = 0;
+        switch (spec.kind) {
+        case LOG_ARG_INT:
+            value = (uint64_t)(int64_t)va_arg(args, int);
+            break;
+        case LOG_ARG_LONG:
+            value = (uint64_t)va_arg(args, long);
+            break;
+        case LOG_ARG_LLONG:
+            value = (uint64_t)va_arg(args, long long);
+            break;
+        case LOG_ARG_SIZE:
+            value = (uint64_t)va_arg(args, size_t);
+            break;
+        case LOG_ARG_DOUBLE: {
+            double d = va_arg(args, double);
+            memcpy(&value, &d, sizeof(value));
+            break;
+        }
+        case LOG_ARG_POINTER:
+            value = (uint64_t)(uintptr_t)va_arg(args, void*);
+            break;
+        case LOG_ARG_STRING: {
+            const char* s     = va_arg(args, const char*);
+            size_t      space = LOG_STRING_BYTES - r->string_bytes;
+            size_t      n     = s ? strnlen(s, space ? space - 1 : 0) : 0;
+            value             = r->string_bytes;
+            if (space) {
+                memcpy(r->strings + r->string_bytes, s ? s : "", n);
+                r->strings[r->string_bytes + n] = '\0';
+                r->string_bytes += (uint16_t)(n + 1);
+            } else {
+                value = LOG_STRING_BYTES;
+            }
+            break;
+        }
+        default:
+            continue;
+        }
+        r->args[r->arg_count++] = value;
+    }
+    va_end(args);
+
+    atomic_store_explicit(&ring->write_pos, write + 1, memory_order_release);
+}
+
+/* Format one record into out (always terminated) */
+static void log_format(const log_record* r, uint32_t tid, char* out, size_t size)
+{
+    time_t    seconds = (time_t)(r->time_ns / 1000000000ull);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    size_t len = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+    len += (size_t)snprintf(out + len, size - len, ".%03u %-5s [%u] ", (unsigned int)(r->time_ns / 1000000 % 1000), log_level_names[r->level], tid);
+
+    const char* p   = r->format;
+    int         arg = 0;
+    log_spec    spec;
+    char        conversion[32];
+    while (len < size - 1) {
+        const char* next  = log_next_spec(p, &spec);
+        const char* until = next ? spec.start : p + strlen(p);
+        /* Literal text, with %% collapsed */
+        for (; p < until && len < size - 1; p++) {
+            out[len++] = *p;
+            if (*p == '%' && p[1] == '%')
+                p++;
+        }
+        if (!next)
+            break;
+        p = next;
+        if (spec.kind == LOG_ARG_NONE || spec.length >= sizeof(conversion))
+            continue;
+
+        memcpy(conversion, spec.start, spec.length);
+        conversion[spec.length] = '\0';
+        int star[2]             = {0, 0};
+        for (int s = 0; s < spec.stars && s < 2; s++)
+            star[s] = arg < r->arg_count ? (int)r->args[arg++] : 0;
+        if (arg >= r->arg_count) {
+            len += (size_t)snprintf(out + len, size - len, "<?>");
+            continue;
+        }
+
+        uint64_t v = r->args[arg++];
+        int      n = 0;
+#define LOG_CONVERT(value)                                                                                                                                                                                                                                     \
+    (spec.stars == 0 ? snprintf(out + len, size - len, conversion, value)                                                                                                                                                                                      \
+                     : spec.stars == 1 ? snprintf(out + len, size - len, conversion, star[0], value) : snprintf(out + len, size - len, conversion, star[0], star[1], value))
+        switch (spec.kind) {
+        case LOG_ARG_INT:
+            n = LOG_CONVERT((int)v);
+            break;
+        case LOG_ARG_LONG:
+            n = LOG_CONVERT((long)v);
+            break;
+        case LOG_ARG_LLONG:
+            n = LOG_CONVERT((long long)v);
+            break;
+        case LOG_ARG_SIZE:
+            n = LOG_CONVERT((size_t)v);
+            break;
+        case LOG_ARG_DOUBLE: {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            n = LOG_CONVERT(d);
+            break;
+        }
+        case LOG_ARG_POINTER:
+            n = LOG_CONVERT((void*)(uintptr_t)v);
+            break;
+        case LOG_ARG_STRING:
+            n = LOG_CONVERT(v < r->string_bytes ? r->strings + v : "<truncated>");
+            break;
+        }
+#undef LOG_CONVERT
+        if (n > 0)
+            len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+    /* The old printf calls carried their own newlines */
+    while (len > 0 && out[len - 1] == '\n')
+        len--;
+    if (r->suppressed && len < size - 1)
+        len += (size_t)snprintf(out + len, size - len, " (%u similar suppressed)", r->suppressed);
+    out[len < size ? len : size - 1] = '\0';
+}
+
+/* Write out everything currently queued, oldest record first across threads */
+static void log_drain(FILE* out)
+{
+    char      line[1024];
+    const int rings = LOG_MAX_THREADS;
+
+    uint64_t end[LOG_MAX_THREADS];
+    for (int i = 0; i < rings; i++) {
+        log_ring* ring = atomic_load_explicit(&log_rings[i], memory_order_acquire);
+        end[i]         = ring ? atomic_load_explicit(&ring->write_pos, memory_order_acquire) : 0;
+    }
+
+    for (;;) {
+        log_ring* oldest = NULL;
+        for (int i = 0; i < rings; i++) {
+            log_ring* ring = atomic_load_explicit(&log_rings[i], memory_order_acquire);
+            if (!ring)
+                continue;
+            uint64_t read = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+            if (read == end[i])
+                continue;
+            if (!oldest || ring->records[read & (LOG_RING_RECORDS - 1)].time_ns <
+                               oldest->records[atomic_load_explicit(&oldest->read_pos, memory_order_relaxed) & (LOG_RING_RECORDS - 1)].time_ns)
+                oldest = ring;
+        }
+        if (!oldest)
+            break;
+
+        uint64_t read = atomic_load_explicit(&oldest->read_pos, memory_order_relaxed);
+        log_format(&oldest->records[read & (LOG_RING_RECORDS - 1)], oldest->tid, line, sizeof(line));
+        atomic_store_explicit(&oldest->read_pos, read + 1, memory_order_release);
+        fputs(line, out);
+        fputc('\n', out);
+    }
+
+    /* The thread of a retired ring is gone, once it is empty nobody writes or reads it any more */
+    for (int i = 0; i < rings; i++) {
+        log_ring* ring = atomic_load_explicit(&log_rings[i], memory_order_acquire);
+        if (ring && atomic_load_explicit(&ring->retired, memory_order_acquire) &&
+            atomic_load_explicit(&ring->read_pos, memory_order_relaxed) == atomic_load_explicit(&ring->write_pos, memory_order_acquire)) {
+            atomic_store_explicit(&log_rings[i], NULL, memory_order_relaxed);
+            free(ring);
+        }
+    }
+
+    uint64_t dropped = atomic_load(&log_dropped);
+    if (dropped != log_dropped_reported) {
+        fprintf(out, "Logger dropped %llu records\n", (unsigned long long)(dropped - log_dropped_reported));
+        log_dropped_reported = dropped;
+    }
+    fflush(out);
+}
+
+static void* log_flusher(void* arg)
+{
+    (void)arg;
+    while (atomic_load(&log_running)) {
+        usleep(LOG_FLUSH_INTERVAL_MS * 1000);
+        log_drain(stdout);
+    }
+    log_drain(stdout);
+    return NULL;
+}
+
+/* metrics_module.h logs through the macros above, so it can only come in here */
+#include "metrics_module.h"
+
+static double log_dropped_records(int unused)
+{
+    (void)unused;
+    return (double)atomic_load(&log_dropped);
+}
+
+void log_register_metrics(void)
+{
+    metrics_export("musicbot_log_dropped_total", "Log records dropped because a thread's ring was full", METRIC_COUNTER, NULL, NULL, log_dropped_records, 0);
+}
+
+/* Start the flusher, MUSICBOT_LOG_LEVEL (trace ... off) overrides LOG_DEFAULT_LEVEL */
+void log_start(void)
+{
+    const char* env = getenv("MUSICBOT_LOG_LEVEL");
+    if (env && log_parse_level(env) >= 0)
+        log_set_level(log_parse_level(env));
+    atomic_store(&log_ring_key_ready, pthread_key_create(&log_ring_key, log_ring_retire) == 0);
+    atomic_store(&log_running, 1);
+    pthread_create(&log_thread, NULL, log_flusher, NULL);
+}
+
+/* Write out everything queued and release the rings, logging is off afterwards */
+void log_stop(void)
+{
+    if (!atomic_exchange(&log_running, 0))
+        return;
+    pthread_join(log_thread, NULL);
+    log_set_level(LOG_LEVEL_OFF);
+    /* No destructor may run once the plugin is unloaded */
+    if (atomic_exchange(&log_ring_key_ready, 0))
+        pthread_key_delete(log_ring_key);
+    for (int i = 0; i < LOG_MAX_THREADS; i++)
+        free(atomic_exchange(&log_rings[i], NULL));
+}
+
+#endif
@@ -0,0 +1,465 @@
+#ifndef LOOP_MODULE_H
+#define LOOP_MODULE_H
+
+#include <dbus/dbus.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "log_module.h"
+#include "metrics_module.h"
+#include "timer_module.h"
+
+/*
+ * The bot's event loop.
+ *
+ * One thread owns the bot state and runs all bot logic. TeamSpeak callbacks
+ * copy their arguments into a small tagged loop_event and push it into a
+ * bounded lock-free MPSC queue (Vyukov's array queue with a sequence number
+ * per cell), then return; the loop thread pops the events in order and
+ * hands them to the handler given to loop_start.
+ *
+ * The loop sleeps in epoll_wait on an eventfd and the D-Bus connection's
+ * socket (dbus_connection_get_unix_fd). Producers only write the eventfd
+ * when the loop announced it is about to sleep, so while the loop is busy a
+ * push costs the producer a copy and a couple of atomics, no system call.
+ * Messages that another thread's blocking D-Bus call read off the socket
+ * wake the loop through the connection's dispatch status function,
+ * incoming D-Bus messages are dispatched on the loop thread.
+ *
+ * Other sockets the loop should serve (the control socket, see
+ * control_module.h) are added with loop_watch; their handlers run on the
+ * loop thread whenever the socket is ready. While events keep the loop busy
+ * it still polls them without sleeping once per round, so a flood of TS3
+ * events cannot starve them.
+ *
+ * Delayed work goes on the timer wheel (timer_module.h), which belongs to
+ * the loop thread too. After every round the loop arms a timerfd for the
+ * wheel's next tick, so it sleeps until then when nothing else happens.
+ *
+ * A full queue drops the event and counts it. Strings are cut to the
+ * buffers in loop_event, which are larger than any command the bot knows.
+ */
+
+/* Power of two */
+#define LOOP_QUEUE_EVENTS 1024
+#define LOOP_NAME_BYTES 128
+#define LOOP_TEXT_BYTES 256
+#define LOOP_UID_BYTES 64
+#define LOOP_MAX_EPOLL_EVENTS 8
+#define LOOP_MAX_WATCHES 32
+
+typedef struct {
+    uint16_t type;   /* defined by the handler */
+    uint16_t client; /* anyID */
+    uint16_t other;  /* mover, kicker, target mode */
+    int32_t  value;  /* status, visibility, length of a binary text */
+    uint64_t server;
+    uint64_t old_channel;
+    uint64_t new_channel;
+    uint64_t group;       /* server group */
+    uint64_t database_id; /* client database id */
+    char     name[LOOP_NAME_BYTES];
+    char     text[LOOP_TEXT_BYTES];
+    char     uid[LOOP_UID_BYTES]; /* client unique identifier */
+} loop_event;
+
+typedef void (*loop_handler)(const loop_event* event);
+/* fd is ready for events (EPOLLIN, EPOLLOUT, EPOLLHUP...) */
+typedef void (*loop_fd_handler)(int fd, uint32_t events, void* context);
+
+typedef struct {
+    int             fd;
+    uint32_t        events;
+    loop_fd_handler handle; /* NULL marks a free entry */
+    void*           context;
+} loop_watch_entry;
+
+/*
+ * A cell is free for the push at position p when its sequence is p and holds
+ * that event when it is p + 1. Sequences are stored minus the cell index so
+ * the zeroed array is a valid empty queue before loop_start.
+ */
+typedef struct {
+    _Atomic uint64_t sequence;
+    loop_event       event;
+} loop_cell;
+
+static loop_cell loop_cells[LOOP_QUEUE_EVENTS];
+static _Alignas(64) _Atomic uint64_t loop_enqueue_position = 0;
+/* Events handled so far, only the loop thread writes it */
+static _Alignas(64) _Atomic uint64_t loop_dequeue_position = 0;
+static _Alignas(64) atomic_int loop_sleeping = 0;
+
+static atomic_int       loop_running = 0;
+static _Atomic uint64_t loop_dropped = 0;
+static pthread_t        loop_thread;
+static int              loop_wake_fd  = -1;
+static int              loop_epoll_fd = -1;
+static int              loop_dbus_fd  = -1;
+static int              loop_timer_fd = -1;
+static uint64_t         loop_timer_tick = TIMER_NONE; /* what loop_timer_fd is armed for */
+static DBusConnection*  loop_connection;
+static loop_handler     loop_handle;
+static loop_watch_entry loop_watches[LOOP_MAX_WATCHES];
+static int              loop_watch_count = 0;
+
+static _Thread_local int loop_is_thread = 0;
+
+/* Copy text into an event buffer, cutting it at size - 1 bytes. NULL copies as "". */
+static inline void loop_copy_string(char* dest, size_t size, const char* text)
+{
+    size_t length = text ? strnlen(text, size - 1) : 0;
+    memcpy(dest, text ? text : "", length);
+    dest[length] = '\0';
+}
+
+static void loop_wake(void)
+{
+    uint64_t one = 1;
+    if (write(loop_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Cannot wake the event loop: %s", strerror(errno));
+    }
+}
+
+/* Copy event into the queue. Returns 0, or -1 if the queue is full. Safe from any thread. */
+int loop_push(const loop_event* event)
+{
+    uint64_t   position = atomic_load_explicit(&loop_enqueue_position, memory_order_relaxed);
+    uint64_t   index;
+    loop_cell* cell;
+    for (;;) {
+        index             = position & (LOOP_QUEUE_EVENTS - 1);
+        cell              = &loop_cells[index];
+        uint64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire) + index;
+        int64_t  diff     = (int64_t)(sequence - position);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&loop_enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&loop_dropped, 1, memory_order_relaxed);
+            LOG_SAMPLED(LOG_LEVEL_WARN, 100, "Event loop queue full, dropped event type %u", (unsigned)event->type);
+            return -1;
+        } else {
+            position = atomic_load_explicit(&loop_enqueue_position, memory_order_relaxed);
+        }
+    }
+    cell->event = *event;
+    atomic_store_explicit(&cell->sequence, position + 1 - index, memory_order_release);
+
+    /* Pairs with the fence in loop_wait: either we see loop_sleeping or the loop sees the event */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&loop_sleeping, memory_order_relaxed) && atomic_exchange(&loop_sleeping, 0)) {
+        loop_wake();
+    }
+    return 0;
+}
+
+/* Pop the next event into event. Returns 1, or 0 if the queue is empty. Loop thread only. */
+static int loop_pop(loop_event* event)
+{
+    uint64_t   position = atomic_load_explicit(&loop_dequeue_position, memory_order_relaxed);
+    uint64_t   index    = position & (LOOP_QUEUE_EVENTS - 1);
+    loop_cell* cell     = &loop_cells[index];
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) + index != position + 1)
+        return 0;
+    *event = cell->event;
+    atomic_store_explicit(&cell->sequence, position + LOOP_QUEUE_EVENTS - index, memory_order_release);
+    return 1;
+}
+
+static inline int loop_queue_ready(void)
+{
+    uint64_t position = atomic_load_explicit(&loop_dequeue_position, memory_order_relaxed);
+    uint64_t index    = position & (LOOP_QUEUE_EVENTS - 1);
+    return atomic_load_explicit(&loop_cells[index].sequence, memory_order_acquire) + index == position + 1;
+}
+
+static int loop_has_work(void)
+{
+    return loop_queue_ready() || (loop_connection && dbus_connection_get_dispatch_status(loop_connection) == DBUS_DISPATCH_DATA_REMAINS);
+}
+
+static void loop_dispatch_status(DBusConnection* connection, DBusDispatchStatus status, void* data)
+{
+    (void)connection;
+    (void)data;
+    if (status == DBUS_DISPATCH_DATA_REMAINS && !loop_is_thread) {
+        loop_wake();
+    }
+}
+
+static void loop_dispatch_dbus(uint32_t events)
+{
+    if (!loop_connection)
+        return;
+    if (events & EPOLLIN) {
+        dbus_connection_read_write(loop_connection, 0);
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        LOG_WARN("D-Bus connection closed, no longer watching it");
+        epoll_ctl(loop_epoll_fd, EPOLL_CTL_DEL, loop_dbus_fd, NULL);
+        loop_dbus_fd = -1;
+    }
+    while (dbus_connection_dispatch(loop_connection) == DBUS_DISPATCH_DATA_REMAINS) {
+    }
+}
+
+/* Fire the due timers and arm the timerfd for the next one */
+static void loop_run_timers(void)
+{
+    if (timer_armed) {
+        timers_run(timer_ticks());
+    }
+    uint64_t next = timers_next_tick();
+    if (next == loop_timer_tick)
+        return;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (next != TIMER_NONE) {
+        spec.it_value = timer_tick_time(next);
+    }
+    if (timerfd_settime(loop_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        LOG_ERROR("Cannot arm the event loop timer: %s", strerror(errno));
+        return;
+    }
+    loop_timer_tick = next;
+}
+
+static loop_watch_entry* loop_find_watch(int fd)
+{
+    for (int i = 0; i < LOOP_MAX_WATCHES; i++) {
+        if (loop_watches[i].handle && loop_watches[i].fd == fd)
+            return &loop_watches[i];
+    }
+    return NULL;
+}
+
+/* Sleep until an event, a D-Bus message, a timer, a wakeup or a watched socket arrives */
+static void loop_wait(void)
+{
+    atomic_store(&loop_sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    int busy = loop_has_work() || !atomic_load(&loop_running);
+    if (busy) {
+        atomic_store(&loop_sleeping, 0);
+        if (!loop_watch_count || !atomic_load(&loop_running))
+            return;
+    }
+
+    struct epoll_event ready[LOOP_MAX_EPOLL_EVENTS];
+    int                count = epoll_wait(loop_epoll_fd, ready, LOOP_MAX_EPOLL_EVENTS, busy ? 0 : -1);
+    atomic_store(&loop_sleeping, 0);
+    for (int i = 0; i < count; i++) {
+        if (ready[i].data.fd == loop_wake_fd || ready[i].data.fd == loop_timer_fd) {
+            uint64_t value;
+            if (read(ready[i].data.fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                LOG_ERROR("Cannot read the event loop wakeup: %s", strerror(errno));
+            }
+        } else if (ready[i].data.fd == loop_dbus_fd) {
+            loop_dispatch_dbus(ready[i].events);
+        } else {
+            /* Looked up again for every fd, an earlier handler may have removed it */
+            loop_watch_entry* watch = loop_find_watch(ready[i].data.fd);
+            if (watch)
+                watch->handle(watch->fd, ready[i].events, watch->context);
+        }
+    }
+}
+
+static void* loop_main(void* arg)
+{
+    (void)arg;
+    loop_event event;
+    loop_is_thread = 1;
+    while (atomic_load(&loop_running)) {
+        while (loop_pop(&event)) {
+            loop_handle(&event);
+            atomic_fetch_add_explicit(&loop_dequeue_position, 1, memory_order_release);
+        }
+        loop_dispatch_dbus(0);
+        loop_run_timers();
+        loop_wait();
+    }
+    /* Handle what was queued before loop_stop */
+    while (loop_pop(&event)) {
+        loop_handle(&event);
+        atomic_fetch_add_explicit(&loop_dequeue_position, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/* Wait until every event pushed before the call has been handled. Not from the loop thread. */
+void loop_sync(void)
+{
+    uint64_t target = atomic_load(&loop_enqueue_position);
+    while (atomic_load_explicit(&loop_running, memory_order_relaxed) && atomic_load_explicit(&loop_dequeue_position, memory_order_acquire) < target) {
+        sched_yield();
+    }
+}
+
+static double loop_metric_value(int which)
+{
+    if (which)
+        return (double)atomic_load_explicit(&loop_dropped, memory_order_relaxed);
+    return (double)(atomic_load_explicit(&loop_enqueue_position, memory_order_relaxed) - atomic_load_explicit(&loop_dequeue_position, memory_order_relaxed));
+}
+
+void loop_register_metrics(void)
+{
+    metrics_export("musicbot_loop_queue_depth", "Events waiting for the event loop", METRIC_GAUGE, NULL, NULL, loop_metric_value, 0);
+    metrics_export("musicbot_loop_dropped_total", "Events dropped because the event loop queue was full", METRIC_COUNTER, NULL, NULL, loop_metric_value, 1);
+}
+
+/*
+ * Dispatch connection's incoming messages on the loop thread from now on.
+ * Call it from the loop thread (a handler or a timer) or before loop_start,
+ * a connection that comes up later is handed to the loop as an event.
+ */
+void loop_attach_dbus(DBusConnection* connection)
+{
+    if (!connection || loop_connection)
+        return;
+    loop_connection = connection;
+    loop_dbus_fd    = -1;
+    if (!dbus_connection_get_unix_fd(connection, &loop_dbus_fd)) {
+        LOG_WARN("D-Bus connection has no socket, incoming messages are not dispatched");
+        loop_dbus_fd = -1;
+        return;
+    }
+    struct epoll_event watch = {.events = EPOLLIN};
+    watch.data.fd            = loop_dbus_fd;
+    epoll_ctl(loop_epoll_fd, EPOLL_CTL_ADD, loop_dbus_fd, &watch);
+    /* The loop dispatches now, a lost session bus must not take the TeamSpeak client down with it */
+    dbus_connection_set_exit_on_disconnect(connection, FALSE);
+    dbus_connection_set_dispatch_status_function(connection, loop_dispatch_status, NULL, NULL);
+}
+
+static int loop_epoll_watch(int operation, int fd, uint32_t events)
+{
+    struct epoll_event watch = {.events = events};
+    watch.data.fd            = fd;
+    if (loop_epoll_fd < 0 || epoll_ctl(loop_epoll_fd, operation, fd, &watch) == 0)
+        return 0;
+    LOG_ERROR("Cannot watch fd %d in the event loop: %s", fd, strerror(errno));
+    return -1;
+}
+
+/*
+ * Call handle on the loop thread whenever fd is ready for events. Like
+ * loop_attach_dbus, call it from the loop thread or before loop_start.
+ * Returns 0, or -1 if there is no room or epoll refused it.
+ */
+int loop_watch(int fd, uint32_t events, loop_fd_handler handle, void* context)
+{
+    loop_watch_entry* entry = NULL;
+    if (loop_find_watch(fd))
+        return -1;
+    for (int i = 0; !entry && i < LOOP_MAX_WATCHES; i++) {
+        if (!loop_watches[i].handle)
+            entry = &loop_watches[i];
+    }
+    if (!entry) {
+        LOG_ERROR("Cannot watch fd %d in the event loop, all %d watches taken", fd, LOOP_MAX_WATCHES);
+        return -1;
+    }
+    if (loop_epoll_watch(EPOLL_CTL_ADD, fd, events) != 0)
+        return -1;
+    *entry = (loop_watch_entry){fd, events, handle, context};
+    loop_watch_count++;
+    return 0;
+}
+
+/* Change what a watched fd waits for, e.g. EPOLLOUT while output is pending. Loop thread only. */
+int loop_watch_events(int fd, uint32_t events)
+{
+    loop_watch_entry* entry = loop_find_watch(fd);
+    if (!entry || entry->events == events)
+        return entry ? 0 : -1;
+    entry->events = events;
+    return loop_epoll_watch(EPOLL_CTL_MOD, fd, events);
+}
+
+/* Stop watching fd, before closing it. Loop thread only, or after loop_stop. */
+void loop_unwatch(int fd)
+{
+    loop_watch_entry* entry = loop_find_watch(fd);
+    if (!entry)
+        return;
+    if (loop_epoll_fd >= 0)
+        epoll_ctl(loop_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    entry->handle = NULL;
+    loop_watch_count--;
+}
+
+/*
+ * Start the loop thread. connection may be NULL, then only queued events
+ * are handled until loop_attach_dbus. Returns 0, or -1 if the loop cannot
+ * be set up.
+ */
+int loop_start(DBusConnection* connection, loop_handler handler)
+{
+    if (atomic_load(&loop_running))
+        return -1;
+    loop_wake_fd  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    loop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    loop_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop_wake_fd < 0 || loop_timer_fd < 0 || loop_epoll_fd < 0) {
+        LOG_ERROR("Cannot create the event loop: %s", strerror(errno));
+        if (loop_wake_fd >= 0)
+            close(loop_wake_fd);
+        if (loop_timer_fd >= 0)
+            close(loop_timer_fd);
+        if (loop_epoll_fd >= 0)
+            close(loop_epoll_fd);
+        loop_wake_fd = loop_timer_fd = loop_epoll_fd = -1;
+        return -1;
+    }
+    struct epoll_event watch = {.events = EPOLLIN};
+    watch.data.fd            = loop_wake_fd;
+    epoll_ctl(loop_epoll_fd, EPOLL_CTL_ADD, loop_wake_fd, &watch);
+    watch.data.fd = loop_timer_fd;
+    epoll_ctl(loop_epoll_fd, EPOLL_CTL_ADD, loop_timer_fd, &watch);
+    loop_timer_tick = TIMER_NONE;
+    /* Sockets watched before the start */
+    for (int i = 0; i < LOOP_MAX_WATCHES; i++) {
+        if (loop_watches[i].handle)
+            loop_epoll_watch(EPOLL_CTL_ADD, loop_watches[i].fd, loop_watches[i].events);
+    }
+
+    loop_connection = NULL;
+    loop_dbus_fd    = -1;
+    loop_attach_dbus(connection);
+
+    loop_handle = handler;
+    atomic_store(&loop_running, 1);
+    pthread_create(&loop_thread, NULL, loop_main, NULL);
+    LOG_INFO("Event loop started");
+    return 0;
+}
+
+/* Handle the queued events, then stop the loop thread */
+void loop_stop(void)
+{
+    if (!atomic_exchange(&loop_running, 0))
+        return;
+    loop_wake();
+    pthread_join(loop_thread, NULL);
+    if (loop_connection && loop_dbus_fd >= 0) {
+        dbus_connection_set_dispatch_status_function(loop_connection, NULL, NULL, NULL);
+    }
+    close(loop_epoll_fd);
+    close(loop_timer_fd);
+    close(loop_wake_fd);
+    loop_epoll_fd = loop_timer_fd = loop_wake_fd = loop_dbus_fd = -1;
+    loop_connection                            = NULL;
+}
+
+#endif
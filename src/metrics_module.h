@@ -0,0 +1,375 @@
+#ifndef METRICS_MODULE_H
+#define METRICS_MODULE_H
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Metrics registry.
+ *
+ * Series are registered once from ts3plugin_init, before any of our threads
+ * run, and identified by a slot index afterwards. Values live in
+ * METRICS_SHARDS cache line aligned shards; every thread increments its own
+ * shard with a relaxed atomic add, so callbacks never contend on a counter
+ * and never take a lock. Histograms occupy METRICS_BUCKETS + 2 consecutive
+ * slots (bucket counts, sum in microseconds, count).
+ *
+ * A background thread serves the sum over all shards in the Prometheus text
+ * format on METRICS_SOCKET_PATH, e.g.
+ *   curl --unix-socket /tmp/musicbot-metrics.sock http://localhost/metrics
+ * Values that other modules already keep as atomics are exported through
+ * reader callbacks evaluated on that thread.
+ */
+
+#define METRICS_SOCKET_PATH "/tmp/musicbot-metrics.sock"
+/* Power of two, threads beyond that share shards (still correct, just contended) */
+#define METRICS_SHARDS 16
+#define METRICS_MAX_SLOTS 1024
+#define METRICS_MAX_SERIES 256
+#define METRICS_BUCKETS 14
+
+typedef enum { METRIC_COUNTER = 0, METRIC_GAUGE, METRIC_HISTOGRAM } metric_type;
+
+typedef struct {
+    const char* name;
+    const char* help;
+    /* Optional single label, e.g. keyword="!song" */
+    const char* label;
+    const char* value;
+    metric_type type;
+    int         slot;
+    /* Exported from elsewhere instead of a slot */
+    double (*read)(int arg);
+    int         arg;
+} metric_series;
+
+/* log_module.h registers its series through this before the definition below, which logs through log_module.h */
+void metrics_export(const char* name, const char* help, metric_type type, const char* label, const char* value, double (*read)(int), int arg);
+
+#include "log_module.h"
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t slots[METRICS_MAX_SLOTS];
+} metrics_shard;
+
+/* Upper bounds of the latency buckets in microseconds, +Inf is implicit */
+static const uint64_t metrics_bucket_us[METRICS_BUCKETS] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+
+static metrics_shard metrics_shards[METRICS_SHARDS];
+static metric_series metrics_series[METRICS_MAX_SERIES];
+static int           metrics_series_count = 0;
+static int           metrics_slot_count   = 0;
+
+static atomic_int        metrics_next_shard   = 0;
+static _Thread_local int metrics_thread_shard = -1;
+
+static pthread_t  metrics_thread;
+static atomic_int metrics_running   = 0;
+static int        metrics_listen_fd = -1;
+
+static inline uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static metric_series* metrics_register(const char* name, const char* help, const char* label, const char* value, metric_type type, int slots)
+{
+    if (metrics_series_count == METRICS_MAX_SERIES || metrics_slot_count + slots > METRICS_MAX_SLOTS) {
+        LOG_ERROR("Metrics registry full, dropping %s", name);
+        return NULL;
+    }
+    metric_series* s = &metrics_series[metrics_series_count++];
+    s->name          = name;
+    s->help          = help;
+    s->label         = label;
+    s->value         = value;
+    s->type          = type;
+    s->slot          = slots ? metrics_slot_count : -1;
+    metrics_slot_count += slots;
+    return s;
+}
+
+/* Register a counter, label may be NULL. Returns the slot or -1. */
+int metrics_counter(const char* name, const char* help, const char* label, const char* value)
+{
+    metric_series* s = metrics_register(name, help, label, value, METRIC_COUNTER, 1);
+    return s ? s->slot : -1;
+}
+
+/* Register a latency histogram with the fixed buckets. Returns the first slot or -1. */
+int metrics_histogram(const char* name, const char* help, const char* label, const char* value)
+{
+    metric_series* s = metrics_register(name, help, label, value, METRIC_HISTOGRAM, METRICS_BUCKETS + 2);
+    return s ? s->slot : -1;
+}
+
+/* Export a value kept elsewhere, read(arg) is called on the metrics thread for every scrape */
+void metrics_export(const char* name, const char* help, metric_type type, const char* label, const char* value, double (*read)(int), int arg)
+{
+    metric_series* s = metrics_register(name, help, label, value, type, 0);
+    if (s) {
+        s->read = read;
+        s->arg  = arg;
+    }
+}
+
+static inline metrics_shard* metrics_local_shard(void)
+{
+    if (metrics_thread_shard < 0)
+        metrics_thread_shard = atomic_fetch_add_explicit(&metrics_next_shard, 1, memory_order_relaxed) & (METRICS_SHARDS - 1);
+    return &metrics_shards[metrics_thread_shard];
+}
+
+static inline void metrics_add(int slot, uint64_t n)
+{
+    if (slot < 0)
+        return;
+    atomic_fetch_add_explicit(&metrics_local_shard()->slots[slot], n, memory_order_relaxed);
+}
+
+static inline void metrics_inc(int slot)
+{
+    metrics_add(slot, 1);
+}
+
+static inline void metrics_observe_ns(int slot, uint64_t ns)
+{
+    if (slot < 0)
+        return;
+    uint64_t       us     = ns / 1000;
+    int            bucket = 0;
+    metrics_shard* shard  = metrics_local_shard();
+    while (bucket < METRICS_BUCKETS && us > metrics_bucket_us[bucket])
+        bucket++;
+    /* The +Inf bucket is derived from the count, observations above the last bound only land there */
+    if (bucket < METRICS_BUCKETS)
+        atomic_fetch_add_explicit(&shard->slots[slot + bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->slots[slot + METRICS_BUCKETS], us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->slots[slot + METRICS_BUCKETS + 1], 1, memory_order_relaxed);
+}
+
+static uint64_t metrics_sum(int slot)
+{
+    uint64_t sum = 0;
+    for (int s = 0; s < METRICS_SHARDS; s++)
+        sum += atomic_load_explicit(&metrics_shards[s].slots[slot], memory_order_relaxed);
+    return sum;
+}
+
+/*
+ * Upper bound in seconds of the bucket holding quantile q over the given
+ * histograms combined. 0 without observations, INFINITY past the last bucket.
+ */
+double metrics_quantile(const int* slots, int count, double q)
+{
+    uint64_t buckets[METRICS_BUCKETS] = {0};
+    uint64_t total                    = 0;
+    for (int i = 0; i < count; i++) {
+        if (slots[i] < 0)
+            continue;
+        for (int b = 0; b < METRICS_BUCKETS; b++)
+            buckets[b] += metrics_sum(slots[i] + b);
+        total += metrics_sum(slots[i] + METRICS_BUCKETS + 1);
+    }
+    if (total == 0)
+        return 0.0;
+
+    uint64_t rank       = (uint64_t)ceil(q * (double)total);
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        cumulative += buckets[b];
+        if (cumulative >= rank)
+            return (double)metrics_bucket_us[b] / 1e6;
+    }
+    return INFINITY;
+}
+
+/* Label values may hold anything (station keywords come from the config), escape what the format requires */
+static void metrics_label_value(FILE* out, const char* value)
+{
+    for (const char* c = value; *c; c++) {
+        if (*c == '\\' || *c == '"')
+            fputc('\\', out);
+        if (*c == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*c, out);
+    }
+}
+
+static void metrics_labels(FILE* out, const metric_series* s, const char* le)
+{
+    if (!s->label && !le)
+        return;
+    fputc('{', out);
+    if (s->label) {
+        fprintf(out, "%s=\"", s->label);
+        metrics_label_value(out, s->value);
+        fprintf(out, "\"%s", le ? "," : "");
+    }
+    if (le)
+        fprintf(out, "le=\"%s\"", le);
+    fputc('}', out);
+}
+
+/* Render every series in the Prometheus text exposition format (version 0.0.4) */
+void metrics_render(FILE* out)
+{
+    static const char* const types[] = {"counter", "gauge", "histogram"};
+
+    for (int i = 0; i < metrics_series_count; i++) {
+        const metric_series* s = &metrics_series[i];
+        if (i == 0 || strcmp(metrics_series[i - 1].name, s->name) != 0) {
+            fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", s->name, s->help, s->name, types[s->type]);
+        }
+
+        if (s->read) {
+            fputs(s->name, out);
+            metrics_labels(out, s, NULL);
+            fprintf(out, " %.9g\n", s->read(s->arg));
+        } else if (s->type != METRIC_HISTOGRAM) {
+            fputs(s->name, out);
+            metrics_labels(out, s, NULL);
+            fprintf(out, " %llu\n", (unsigned long long)metrics_sum(s->slot));
+        } else {
+            uint64_t cumulative = 0;
+            uint64_t count      = metrics_sum(s->slot + METRICS_BUCKETS + 1);
+            char     le[32];
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                cumulative += metrics_sum(s->slot + b);
+                snprintf(le, sizeof(le), "%g", (double)metrics_bucket_us[b] / 1e6);
+                fprintf(out, "%s_bucket", s->name);
+                metrics_labels(out, s, le);
+                fprintf(out, " %llu\n", (unsigned long long)cumulative);
+            }
+            /* Shards are summed one after another, keep the output monotonic */
+            if (count < cumulative)
+                count = cumulative;
+            fprintf(out, "%s_bucket", s->name);
+            metrics_labels(out, s, "+Inf");
+            fprintf(out, " %llu\n%s_sum", (unsigned long long)count, s->name);
+            metrics_labels(out, s, NULL);
+            fprintf(out, " %.6f\n%s_count", (double)metrics_sum(s->slot + METRICS_BUCKETS) / 1e6, s->name);
+            metrics_labels(out, s, NULL);
+            fprintf(out, " %llu\n", (unsigned long long)count);
+        }
+    }
+}
+
+static void metrics_write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+/*
+ * One scrape per connection. HTTP clients get a minimal HTTP/1.0 response,
+ * anything else (socat, nc -U) just the text after the first line it sends.
+ */
+static void metrics_serve(int fd)
+{
+    char          request[512];
+    size_t        len = 0;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    while (len < sizeof(request) - 1 && poll(&pfd, 1, 200) > 0) {
+        ssize_t n = read(fd, request + len, sizeof(request) - 1 - len);
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || (strncmp(request, "GET ", 4) != 0 && memchr(request, '\n', len)))
+            break;
+    }
+    request[len] = '\0';
+
+    char*  body      = NULL;
+    size_t body_size = 0;
+    FILE*  out       = open_memstream(&body, &body_size);
+    if (!out)
+        return;
+    metrics_render(out);
+    fclose(out);
+
+    if (strncmp(request, "GET ", 4) == 0) {
+        char header[160];
+        int  n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_size);
+        metrics_write_all(fd, header, (size_t)n);
+    }
+    metrics_write_all(fd, body, body_size);
+    free(body);
+}
+
+static void* metrics_server(void* arg)
+{
+    (void)arg;
+    struct pollfd pfd = {.fd = metrics_listen_fd, .events = POLLIN};
+
+    while (atomic_load(&metrics_running)) {
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        int fd = accept(metrics_listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        metrics_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Bind METRICS_SOCKET_PATH and start serving. Returns 0 on success, -1 if the socket could not be set up. */
+int metrics_start(void)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, METRICS_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    metrics_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metrics_listen_fd < 0) {
+        LOG_ERROR("Metrics socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(METRICS_SOCKET_PATH);
+    if (bind(metrics_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(metrics_listen_fd, 8) < 0) {
+        LOG_ERROR("Metrics bind %s: %s", METRICS_SOCKET_PATH, strerror(errno));
+        close(metrics_listen_fd);
+        metrics_listen_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&metrics_running, 1);
+    pthread_create(&metrics_thread, NULL, metrics_server, NULL);
+    LOG_INFO("Serving metrics on %s", METRICS_SOCKET_PATH);
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    if (!atomic_exchange(&metrics_running, 0))
+        return;
+    pthread_join(metrics_thread, NULL);
+    close(metrics_listen_fd);
+    metrics_listen_fd = -1;
+    unlink(METRICS_SOCKET_PATH);
+}
+
+#endif
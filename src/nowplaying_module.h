@@ -0,0 +1,282 @@
+#ifndef NOWPLAYING_MODULE_H
+#define NOWPLAYING_MODULE_H
+
+#include <dbus/dbus.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbus_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+#include "timer_module.h"
+
+/*
+ * Now playing publisher.
+ *
+ * Listens for PropertiesChanged(Player, {Metadata}) from the player on air
+ * instead of polling it, renders "station: song" and hands the text to the
+ * apply function given to nowplaying_start (the plugin writes it to the
+ * channel topic, the description or the nickname). Text that equals what was
+ * applied last is not sent again, and apply runs at most once per interval:
+ * an update inside the interval arms a timer for its end, and further
+ * updates until then only replace the song, so a burst of metadata changes
+ * costs one server edit with the newest text.
+ *
+ * A flood rejection of an edit doubles the interval (up to
+ * NOWPLAYING_MAX_INTERVAL_MS) and retries, an edit that gets through brings
+ * it back down step by step. Signals from players other than the one on air
+ * (the idle deck, see deck_module.h) are ignored by sender. A slow refresh
+ * timer, pushed back by every signal, reads the metadata once in a while in
+ * case a signal was missed, e.g. across a deck switch. The function given
+ * to nowplaying_watch sees every change at once, for plugin command
+ * subscribers (remote_module.h) and the song history (history_module.h)
+ * who do not share the edit interval. Without an apply function only the
+ * watch runs, the history is kept when the bot publishes nothing.
+ *
+ * Everything runs on the event loop thread (loop_module.h): signals are
+ * dispatched there, the timers are on its wheel. nowplaying_start runs there
+ * too once the session bus is up, nowplaying_stop after the loop stopped.
+ */
+
+#define NOWPLAYING_INTERVAL_MS 10000
+#define NOWPLAYING_MAX_INTERVAL_MS 300000
+#define NOWPLAYING_REFRESH_MS 120000
+/* Between GetNameOwner calls for signals from an unknown sender */
+#define NOWPLAYING_RESOLVE_MS 5000
+#define NOWPLAYING_BUFSIZE 1024
+#define NOWPLAYING_MATCH_RULE                                                                                                                                                \
+    "type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',path='" VLC_OBJECT_PATH "',arg0='org.mpris.MediaPlayer2.Player'"
+
+/* Applies text, 0 on success. A return code lets a flood rejection find its way back to nowplaying_flooded. */
+typedef int (*nowplaying_apply_fn)(const char* text, char* return_code, size_t return_code_size);
+/* Told the song and stream title (either may be NULL) whenever the player reports them, before any interval */
+typedef void (*nowplaying_changed_fn)(const char* song, const char* station);
+
+static DBusConnection*     nowplaying_connection = NULL;
+static nowplaying_apply_fn nowplaying_apply      = NULL;
+static size_t              nowplaying_max_chars  = 0;
+static size_t              nowplaying_max_bytes  = 0;
+static uint64_t            nowplaying_base_ms    = NOWPLAYING_INTERVAL_MS;
+static uint64_t            nowplaying_interval_ms;
+static char*               nowplaying_song    = NULL;
+static char*               nowplaying_station = NULL;
+static char                nowplaying_applied[NOWPLAYING_BUFSIZE];
+static char                nowplaying_return_code[64];
+static uint64_t            nowplaying_last_push = TIMER_NONE;
+static nowplaying_changed_fn nowplaying_changed = NULL;
+/* Unique name of vlc_bus_name's owner, resolved for nowplaying_owner_of */
+static char*       nowplaying_owner    = NULL;
+static const char* nowplaying_owner_of = NULL;
+static uint64_t    nowplaying_resolved = 0;
+
+static int nowplaying_signals_metric;
+static int nowplaying_pushed_metric;
+static int nowplaying_unchanged_metric;
+static int nowplaying_failed_metric;
+
+static void nowplaying_publish(timer_entry* timer, void* context);
+static void nowplaying_refresh(timer_entry* timer, void* context);
+static timer_entry nowplaying_push_timer    = {.fire = nowplaying_publish};
+static timer_entry nowplaying_refresh_timer = {.fire = nowplaying_refresh};
+
+void nowplaying_register_metrics(void)
+{
+    nowplaying_signals_metric   = metrics_counter("musicbot_now_playing_signals_total", "Metadata changes of the player on air", NULL, NULL);
+    nowplaying_pushed_metric    = metrics_counter("musicbot_now_playing_updates_total", "Now playing texts by outcome", "result", "pushed");
+    nowplaying_unchanged_metric = metrics_counter("musicbot_now_playing_updates_total", "Now playing texts by outcome", "result", "unchanged");
+    nowplaying_failed_metric    = metrics_counter("musicbot_now_playing_updates_total", "Now playing texts by outcome", "result", "failed");
+}
+
+/* Cut text to at most max_chars UTF-8 characters and max_bytes bytes, never inside a character */
+size_t nowplaying_cut(char* text, size_t max_chars, size_t max_bytes)
+{
+    size_t chars = 0, end = 0;
+    for (size_t i = 0;; i++) {
+        if (text[i] && ((unsigned char)text[i] & 0xC0) == 0x80)
+            continue;
+        /* A character boundary, text[0..i) holds chars characters */
+        if (i > max_bytes || chars > max_chars)
+            break;
+        end = i;
+        if (!text[i])
+            break;
+        chars++;
+    }
+    text[end] = '\0';
+    return end;
+}
+
+static void nowplaying_render(char* out, size_t size)
+{
+    if (nowplaying_song && nowplaying_station)
+        snprintf(out, size, "%s: %s", nowplaying_station, nowplaying_song);
+    else
+        snprintf(out, size, "%s", nowplaying_song ? nowplaying_song : nowplaying_station ? nowplaying_station : "");
+    nowplaying_cut(out, nowplaying_max_chars, nowplaying_max_bytes);
+}
+
+/* Render and apply now, unless the text is what is already out there */
+static void nowplaying_publish(timer_entry* timer, void* context)
+{
+    char text[NOWPLAYING_BUFSIZE];
+    nowplaying_render(text, sizeof(text));
+    if (strcmp(text, nowplaying_applied) == 0) {
+        metrics_inc(nowplaying_unchanged_metric);
+        return;
+    }
+    nowplaying_return_code[0] = '\0';
+    if (nowplaying_apply(text, nowplaying_return_code, sizeof(nowplaying_return_code)) != 0) {
+        metrics_inc(nowplaying_failed_metric);
+        return;
+    }
+    metrics_inc(nowplaying_pushed_metric);
+    snprintf(nowplaying_applied, sizeof(nowplaying_applied), "%s", text);
+    nowplaying_last_push = timer_ticks();
+    if (nowplaying_interval_ms > nowplaying_base_ms)
+        nowplaying_interval_ms = nowplaying_interval_ms / 2 > nowplaying_base_ms ? nowplaying_interval_ms / 2 : nowplaying_base_ms;
+    LOG_DEBUG("Now playing: %s", text);
+}
+
+/* Publish now if the last edit is an interval ago, otherwise at the end of the interval */
+static void nowplaying_schedule(void)
+{
+    if (!nowplaying_apply || timer_pending(&nowplaying_push_timer))
+        return;
+    uint64_t due = nowplaying_last_push == TIMER_NONE ? 0 : nowplaying_last_push + (nowplaying_interval_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (due <= timer_ticks())
+        nowplaying_publish(&nowplaying_push_timer, NULL);
+    else
+        timer_arm_at(&nowplaying_push_timer, due);
+}
+
+/* Takes ownership of song and station, NULL keeps the current value */
+static void nowplaying_set(char* song, char* station)
+{
+    if (song) {
+        free(nowplaying_song);
+        nowplaying_song = song;
+    }
+    if (station) {
+        free(nowplaying_station);
+        nowplaying_station = station;
+    }
+    timer_arm(&nowplaying_refresh_timer, NOWPLAYING_REFRESH_MS, NOWPLAYING_REFRESH_MS / 4);
+    if (nowplaying_changed)
+        nowplaying_changed(nowplaying_song, nowplaying_station);
+    nowplaying_schedule();
+}
+
+static void nowplaying_refresh(timer_entry* timer, void* context)
+{
+    char *song, *station;
+    GetNowPlaying(nowplaying_connection, &song, &station);
+    nowplaying_set(song, station);
+}
+
+/* Whether sender owns the bus name on air, asking the bus again at most every NOWPLAYING_RESOLVE_MS */
+static int nowplaying_from_on_air(const char* sender)
+{
+    const char* name = atomic_load(&vlc_bus_name);
+    if (nowplaying_owner && name == nowplaying_owner_of && sender && strcmp(sender, nowplaying_owner) == 0)
+        return 1;
+    uint64_t now = timer_ticks();
+    if (name == nowplaying_owner_of && nowplaying_resolved && now - nowplaying_resolved < NOWPLAYING_RESOLVE_MS / TIMER_TICK_MS)
+        return 0;
+    free(nowplaying_owner);
+    nowplaying_owner    = get_name_owner(nowplaying_connection, name);
+    nowplaying_owner_of = name;
+    nowplaying_resolved = now ? now : 1;
+    return nowplaying_owner && sender && strcmp(sender, nowplaying_owner) == 0;
+}
+
+static DBusHandlerResult nowplaying_filter(DBusConnection* connection, DBusMessage* message, void* data)
+{
+    if (!dbus_message_is_signal(message, "org.freedesktop.DBus.Properties", "PropertiesChanged") || !dbus_message_has_path(message, VLC_OBJECT_PATH))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    char *song = NULL, *station = NULL;
+    if (parse_metadata_changed(message, &song, &station) && nowplaying_from_on_air(dbus_message_get_sender(message))) {
+        metrics_inc(nowplaying_signals_metric);
+        nowplaying_set(song, station);
+    } else {
+        free(song);
+        free(station);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/*
+ * Start publishing to apply, texts cut to max_chars characters and max_bytes
+ * bytes, at most one edit per interval_ms. The first text goes out as soon
+ * as the loop runs. A NULL apply only follows the metadata for the watch.
+ */
+void nowplaying_start(DBusConnection* connection, nowplaying_apply_fn apply, size_t max_chars, size_t max_bytes, uint64_t interval_ms)
+{
+    if (!connection)
+        return;
+    nowplaying_connection  = connection;
+    nowplaying_apply       = apply;
+    nowplaying_max_chars   = max_chars;
+    nowplaying_max_bytes   = max_bytes < NOWPLAYING_BUFSIZE - 1 ? max_bytes : NOWPLAYING_BUFSIZE - 1;
+    nowplaying_base_ms     = interval_ms;
+    nowplaying_interval_ms = interval_ms;
+    dbus_bus_add_match(connection, NOWPLAYING_MATCH_RULE, NULL);
+    dbus_connection_add_filter(connection, nowplaying_filter, NULL, NULL);
+    timer_arm(&nowplaying_refresh_timer, 0, 0);
+    if (apply)
+        LOG_INFO("Publishing now playing, at most every %llu ms", (unsigned long long)interval_ms);
+}
+
+/* Also hand every metadata change to changed, set before nowplaying_start */
+void nowplaying_watch(nowplaying_changed_fn changed)
+{
+    nowplaying_changed = changed;
+}
+
+/* The text applied last, "" before the first edit or after nowplaying_invalidate */
+const char* nowplaying_text(void)
+{
+    return nowplaying_applied;
+}
+
+/* The target changed (the bot moved or reconnected), forget what was applied and publish again */
+void nowplaying_invalidate(void)
+{
+    nowplaying_applied[0] = '\0';
+    nowplaying_schedule();
+}
+
+/* The edit that carried return_code was rejected as flooding: back off and try again after the new interval */
+void nowplaying_flooded(const char* return_code)
+{
+    if (!return_code || !nowplaying_return_code[0] || strcmp(return_code, nowplaying_return_code) != 0)
+        return;
+    nowplaying_interval_ms = nowplaying_interval_ms * 2 < NOWPLAYING_MAX_INTERVAL_MS ? nowplaying_interval_ms * 2 : NOWPLAYING_MAX_INTERVAL_MS;
+    LOG_WARN("Now playing edit hit flood protection, slowing down to one every %llu ms", (unsigned long long)nowplaying_interval_ms);
+    nowplaying_return_code[0] = '\0';
+    nowplaying_applied[0]     = '\0';
+    nowplaying_schedule();
+}
+
+void nowplaying_stop(void)
+{
+    if (!nowplaying_connection)
+        return;
+    dbus_connection_remove_filter(nowplaying_connection, nowplaying_filter, NULL);
+    dbus_bus_remove_match(nowplaying_connection, NOWPLAYING_MATCH_RULE, NULL);
+    timer_cancel(&nowplaying_push_timer);
+    timer_cancel(&nowplaying_refresh_timer);
+    free(nowplaying_song);
+    free(nowplaying_station);
+    free(nowplaying_owner);
+    nowplaying_song       = NULL;
+    nowplaying_station    = NULL;
+    nowplaying_owner      = NULL;
+    nowplaying_owner_of   = NULL;
+    nowplaying_apply      = NULL;
+    nowplaying_changed    = NULL;
+    nowplaying_connection = NULL;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef PLAYER_MODULE_H
+#define PLAYER_MODULE_H
+
+#include <dbus/dbus.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbus_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Session bus and player setup, off the TeamSpeak thread.
+ *
+ * ts3plugin_init only starts this thread. It connects to the session bus
+ * (retrying while there is none), hands the connection to the plugin, then
+ * loads the track list of VLC_BUS_NAME. A NameOwnerChanged match on that
+ * name keeps it in sync: when VLC goes away the player is marked not ready,
+ * when it appears or restarts with new track ids the list is loaded again.
+ * Failed loads are retried with backoff, a missing player is also retried
+ * slowly in case a signal went missing.
+ *
+ * Until the first list is loaded player_is_ready returns 0 and commands
+ * that need the player get a "warming up" reply instead of blocking. A
+ * list from the warm start snapshot (snapshot_module.h) counts as ready
+ * (PLAYER_CACHED) until the live one replaces it.
+ * The NameOwnerChanged filter runs wherever the connection is dispatched
+ * (the event loop), it only flags the thread.
+ */
+
+#define PLAYER_RETRY_MIN_MS 500
+#define PLAYER_RETRY_MAX_MS 30000
+#define PLAYER_OWNER_MATCH_RULE                                                                                                                                              \
+    "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0='" VLC_BUS_NAME "'"
+
+enum { PLAYER_COLD = 0, PLAYER_CACHED, PLAYER_LIVE };
+
+/* Run on the player thread once the session bus is connected, and after every track list load */
+typedef void (*player_connected_fn)(DBusConnection* connection);
+typedef void (*player_loaded_fn)(DBusConnection* connection);
+
+static pthread_t           player_thread;
+static pthread_mutex_t     player_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t      player_cond;
+static int                 player_running   = 0;
+static int                 player_resync    = 1;
+static atomic_int          player_ready     = 0;
+static DBusConnection*     player_bus       = NULL;
+static player_connected_fn player_connected = NULL;
+static player_loaded_fn    player_loaded    = NULL;
+static int                 player_resyncs_metric;
+
+int player_is_ready(void)
+{
+    return atomic_load_explicit(&player_ready, memory_order_acquire) != PLAYER_COLD;
+}
+
+/* A track list from the snapshot is on air, serve commands from it until the live one is loaded */
+void player_assume_ready(void)
+{
+    int cold = PLAYER_COLD;
+    atomic_compare_exchange_strong(&player_ready, &cold, PLAYER_CACHED);
+}
+
+static double player_ready_value(int unused)
+{
+    (void)unused;
+    return atomic_load_explicit(&player_ready, memory_order_relaxed);
+}
+
+void player_register_metrics(void)
+{
+    metrics_export("musicbot_player_ready", "0 before a track list is loaded, 1 with the one from the snapshot, 2 with the live one", METRIC_GAUGE, NULL, NULL, player_ready_value, 0);
+    player_resyncs_metric = metrics_counter("musicbot_player_resyncs_total", "Track list loads after the player appeared or restarted", NULL, NULL);
+}
+
+static DBusHandlerResult player_filter(DBusConnection* connection, DBusMessage* message, void* data)
+{
+    const char *name, *old_owner, *new_owner;
+    if (!dbus_message_is_signal(message, "org.freedesktop.DBus", "NameOwnerChanged") ||
+        !dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID) ||
+        strcmp(name, VLC_BUS_NAME) != 0) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (!new_owner[0]) {
+        LOG_WARN("Player %s went away", VLC_BUS_NAME);
+        atomic_store(&player_ready, PLAYER_COLD);
+    } else {
+        LOG_INFO("Player %s is now %s, reloading the track list", VLC_BUS_NAME, new_owner);
+        pthread_mutex_lock(&player_mutex);
+        player_resync = 1;
+        pthread_cond_signal(&player_cond);
+        pthread_mutex_unlock(&player_mutex);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* Wait on player_cond for up to ms, or until a resync is requested if resync is set. player_mutex held, returns 0 once stopped. */
+static int player_sleep(uint64_t ms, int resync)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)(ms / 1000);
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (player_running && !(resync && player_resync)) {
+        if (pthread_cond_timedwait(&player_cond, &player_mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    return player_running;
+}
+
+static DBusConnection* player_connect(void)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    DBusConnection* connection = dbus_bus_get(DBUS_BUS_SESSION, &error);
+    if (!connection) {
+        LOG_WARN("No session bus yet: %s", dbus_error_is_set(&error) ? error.message : "unknown error");
+        dbus_error_free(&error);
+        return NULL;
+    }
+    /* Whoever dispatches it, a lost session bus must not take the TeamSpeak client down */
+    dbus_connection_set_exit_on_disconnect(connection, FALSE);
+    dbus_connection_add_filter(connection, player_filter, NULL, NULL);
+    dbus_bus_add_match(connection, PLAYER_OWNER_MATCH_RULE, NULL);
+    return connection;
+}
+
+static void* player_main(void* arg)
+{
+    (void)arg;
+    uint64_t retry_ms = PLAYER_RETRY_MIN_MS;
+    pthread_mutex_lock(&player_mutex);
+    while (player_running) {
+        if (!player_bus) {
+            pthread_mutex_unlock(&player_mutex);
+            DBusConnection* connection = player_connect();
+            if (connection)
+                player_connected(connection);
+            pthread_mutex_lock(&player_mutex);
+            player_bus = connection;
+            if (!connection) {
+                player_sleep(retry_ms, 0);
+                retry_ms = retry_ms * 2 < PLAYER_RETRY_MAX_MS ? retry_ms * 2 : PLAYER_RETRY_MAX_MS;
+                continue;
+            }
+            retry_ms = PLAYER_RETRY_MIN_MS;
+        }
+        if (!player_resync) {
+            pthread_cond_wait(&player_cond, &player_mutex);
+            continue;
+        }
+        player_resync = 0;
+        pthread_mutex_unlock(&player_mutex);
+
+        const char* on_air = atomic_load(&vlc_bus_name);
+        if (strcmp(on_air, VLC_BUS_NAME) != 0) {
+            /* After a crossfade VLC_BUS_NAME is the idle deck, the list on air belongs to on_air */
+            LOG_INFO("%s is off air, keeping the track list of %s", VLC_BUS_NAME, on_air);
+            pthread_mutex_lock(&player_mutex);
+            continue;
+        }
+        DBusError error;
+        dbus_error_init(&error);
+        int loaded  = get_track_list(player_bus, VLC_BUS_NAME, &error) == 0;
+        int missing = !loaded && (dbus_error_has_name(&error, DBUS_ERROR_SERVICE_UNKNOWN) || dbus_error_has_name(&error, DBUS_ERROR_NAME_HAS_NO_OWNER));
+        if (loaded) {
+            atomic_store_explicit(&player_ready, PLAYER_LIVE, memory_order_release);
+            metrics_inc(player_resyncs_metric);
+            pthread_mutex_lock(&track_list_lock);
+            LOG_INFO("Player ready with %zu tracks", track_count);
+            pthread_mutex_unlock(&track_list_lock);
+            retry_ms = PLAYER_RETRY_MIN_MS;
+            if (player_loaded)
+                player_loaded(player_bus);
+        } else if (missing) {
+            LOG_INFO("Waiting for %s to appear on the session bus", VLC_BUS_NAME);
+            atomic_store(&player_ready, PLAYER_COLD);
+            dbus_error_free(&error);
+        } else {
+            LOG_WARN("Loading the track list failed, retrying in %llu ms: %s", (unsigned long long)retry_ms, dbus_error_is_set(&error) ? error.message : "unknown error");
+            dbus_error_free(&error);
+        }
+
+        pthread_mutex_lock(&player_mutex);
+        if (!loaded) {
+            /* NameOwnerChanged cuts the wait short, a missing player is asked for again at the slowest pace */
+            if (player_sleep(missing ? PLAYER_RETRY_MAX_MS : retry_ms, 1))
+                player_resync = 1;
+            retry_ms = retry_ms * 2 < PLAYER_RETRY_MAX_MS ? retry_ms * 2 : PLAYER_RETRY_MAX_MS;
+        }
+    }
+    pthread_mutex_unlock(&player_mutex);
+    return NULL;
+}
+
+/* Start connecting in the background, the callbacks run on the player thread */
+void player_start(player_connected_fn connected, player_loaded_fn loaded)
+{
+    if (player_running)
+        return;
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&player_cond, &attributes);
+    pthread_condattr_destroy(&attributes);
+    player_connected = connected;
+    player_loaded    = loaded;
+    player_resync    = 1;
+    player_running   = 1;
+    pthread_create(&player_thread, NULL, player_main, NULL);
+}
+
+/* Waits for a track list load in progress, D-Bus calls time out after 25 s at worst */
+void player_stop(void)
+{
+    pthread_mutex_lock(&player_mutex);
+    if (!player_running) {
+        pthread_mutex_unlock(&player_mutex);
+        return;
+    }
+    player_running = 0;
+    pthread_cond_signal(&player_cond);
+    pthread_mutex_unlock(&player_mutex);
+    pthread_join(player_thread, NULL);
+    pthread_cond_destroy(&player_cond);
+    if (player_bus) {
+        dbus_connection_remove_filter(player_bus, player_filter, NULL);
+        dbus_bus_remove_match(player_bus, PLAYER_OWNER_MATCH_RULE, NULL);
+        player_bus = NULL;
+    }
+    atomic_store(&player_ready, PLAYER_COLD);
+}
+
+#endif
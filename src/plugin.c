@@ -24,15 +24,119 @@
 
 ///// MY SECTION //////////
 #include "dbus_module.h"
-#define DEFAULT_CHANNEL_ID 12304
-#define AFK_CHANNEL_ID 11071
-#define INN_CHANNEL_ID 1
+#include "deck_module.h"
+#include "silence_module.h"
+#include "ducking_module.h"
+#include "metrics_module.h"
+#include "log_module.h"
+#include "trace_module.h"
+#include "status_module.h"
+#include "history_module.h"
+#include "analytics_module.h"
+#include "recorder_module.h"
+#include "loop_module.h"
+#include "nowplaying_module.h"
+#include "player_module.h"
+#include "snapshot_module.h"
+#include "config_module.h"
+#include "acl_module.h"
+#include "remote_module.h"
+#include "control_module.h"
+#include "library_module.h"
+/* Grace period before the bot leaves a channel its last listener left, MUSICBOT_RETURN_DELAY_MS overrides it, 0 leaves at once */
+#define RETURN_DELAY_MS 30000
+/* Bot state, owned by the event loop thread once ts3plugin_init started it */
 uint64_t currentChannelID = 0;
 anyID myClientID;
 uint64_t currentConnHandlerID = 0;
 DBusConnection *connection = NULL;
-DBusError dbus_error;
+/* Set by the player thread, adopted as connection by the loop on BOT_EVENT_BUS */
+static DBusConnection *_Atomic session_bus = NULL;
+/* Copies of the bot's client and channel for other threads, see publish_bot_state */
+static _Atomic uint64_t shared_channel_id = 0;
+static _Atomic anyID shared_client_id = 0;
 
+/* Event types on the loop queue, see handle_bot_event */
+enum {
+    BOT_EVENT_CONNECT = 1,
+    BOT_EVENT_MOVE,
+    BOT_EVENT_MOVED,
+    BOT_EVENT_KICK,
+    BOT_EVENT_TEXT,
+    BOT_EVENT_TALK,
+    BOT_EVENT_FLOODED,
+    BOT_EVENT_BUS,
+    BOT_EVENT_GROUP_ADDED,
+    BOT_EVENT_GROUP_DELETED,
+    BOT_EVENT_GROUP_OF_CLIENT,
+    BOT_EVENT_REMOTE,
+    BOT_EVENT_LIBRARY,
+    BOT_EVENT_FAILOVER,
+};
+static void handle_bot_event(const loop_event* event);
+static void on_session_bus(DBusConnection* bus);
+static void on_player_loaded(DBusConnection* bus);
+static void load_server_uid(uint64 serverConnectionHandlerID);
+static void resume_channel(uint64 serverConnectionHandlerID);
+static int seed_server_groups(uint64_t serverConnectionHandlerID, uint16_t clientID, acl_entry* entry);
+static void send_plugin_command(uint64_t serverConnectionHandlerID, const uint16_t* targets, size_t count, const char* text);
+static int handle_control_request(const char* verb, const char* argument, char* out, size_t size);
+static int scan_library(int only_if_configured);
+
+static uint64_t return_delay_ms = RETURN_DELAY_MS;
+
+static void publish_bot_state(void)
+{
+    atomic_store_explicit(&shared_client_id, myClientID, memory_order_relaxed);
+    atomic_store_explicit(&shared_channel_id, currentChannelID, memory_order_relaxed);
+}
+
+/* Name of a station for replies and exports, valid until the next call on this thread */
+static const char* station_name(int station)
+{
+    static _Thread_local char name[CONFIG_NAME_BYTES];
+    config_station entry;
+    snprintf(name, sizeof(name), "%s", config_station_of(station, &entry) ? entry.name : "unknown station");
+    return name;
+}
+
+/* Commands outside the station table, "unknown" counts everything else */
+enum { CMD_LIST = 0, CMD_HELP, CMD_SONG, CMD_JOIN, CMD_KICK, CMD_HISTORY, CMD_PLAY, CMD_UNKNOWN, BASIC_COMMAND_COUNT };
+static const char* const basic_commands[BASIC_COMMAND_COUNT] = {"!list", "!help", "!song", "!join", "!kick", "!history", "!play", "unknown"};
+
+/* Metric slots, see register_metrics() */
+static int basic_command_metric[BASIC_COMMAND_COUNT];
+static int move_events_metric;
+static int codec_flushes_metric;
+static int messages_sent_metric;
+static int messages_throttled_metric;
+static int messages_dropped_metric;
+
+static void register_metrics(void)
+{
+    for (int i = 0; i < BASIC_COMMAND_COUNT; i++) {
+        basic_command_metric[i] = metrics_counter("musicbot_commands_total", "Text commands handled, by keyword", "keyword", basic_commands[i]);
+    }
+    config_register_metrics();
+    acl_register_metrics();
+    remote_register_metrics();
+    control_register_metrics();
+    library_register_metrics();
+    analytics_register_metrics();
+    move_events_metric        = metrics_counter("musicbot_move_events_total", "Client move events seen by the plugin", NULL, NULL);
+    codec_flushes_metric      = metrics_counter("musicbot_codec_flushes_total", "Channel codec changes flushed to the server", NULL, NULL);
+    messages_sent_metric      = metrics_counter("musicbot_text_messages_sent_total", "Private text messages requested", NULL, NULL);
+    messages_throttled_metric = metrics_counter("musicbot_text_messages_throttled_total", "Private text messages rejected by the server flood protection", NULL, NULL);
+    messages_dropped_metric   = metrics_counter("musicbot_text_messages_dropped_total", "Private text messages to the bot dropped because the event loop queue was full", NULL, NULL);
+    dbus_register_metrics();
+    decks_register_metrics();
+    silence_register_metrics();
+    log_register_metrics();
+    recorder_register_metrics();
+    loop_register_metrics();
+    nowplaying_register_metrics();
+    player_register_metrics();
+}
 
 //END OF MY SECTION
 static struct TS3Functions ts3Functions;
@@ -130,60 +234,118 @@ void ts3plugin_setFunctionPointers(const struct TS3Functions funcs)
 
 int ts3plugin_init()
 {
-    printf("PLUGIN: init\n");
+    log_start();
+    LOG_INFO("PLUGIN: init");
+    status_mark_started();
+    char configPath[PATH_BUFSIZE];
+    ts3Functions.getConfigPath(configPath, PATH_BUFSIZE);
+    const char* delay = getenv("MUSICBOT_RETURN_DELAY_MS");
+    if (delay) {
+        return_delay_ms = strtoull(delay, NULL, 10);
+    }
     unsigned int error;
     int connectionStatus;
-    
+    int established = 1;
+
+    /* Nothing but the log runs before these checks, TS3 unloads a plugin whose init fails without calling shutdown */
     currentConnHandlerID = ts3Functions.getCurrentServerConnectionHandlerID();
     if(currentConnHandlerID != 0) {
         if ((error = ts3Functions.getConnectionStatus(currentConnHandlerID, &connectionStatus)) != ERROR_ok) {
             ts3Functions.logMessage("Error checking connection status", LogLevel_ERROR, "Plugin", 0);
-            printf("Error code is: %d\n", error);
+            LOG_ERROR("Error code is: %d", error);
+            log_stop();
             return 1;
         }
 
         if (connectionStatus != STATUS_CONNECTION_ESTABLISHED) {
             ts3Functions.logMessage("No active connection found", LogLevel_WARNING, "Plugin", 0);
-            printf("No active connection, skipping initialization\n");
-            return 0;
-        }
-
-        
-
-        if ((error = ts3Functions.getClientID(currentConnHandlerID, &myClientID)) != ERROR_ok) {
+            LOG_WARN("No active connection yet, the bot joins once the tab connects");
+            established = 0;
+        } else if ((error = ts3Functions.getClientID(currentConnHandlerID, &myClientID)) != ERROR_ok) {
             ts3Functions.logMessage("Error retrieving client ID", LogLevel_ERROR, "Plugin", 0);
-            printf("Error code is: %d\n", error);
+            LOG_ERROR("Error code is: %d", error);
+            log_stop();
             return 1;
-        }
-
-        if ((error =  ts3Functions.getChannelOfClient(currentConnHandlerID, myClientID, &currentChannelID)) != ERROR_ok) {
+        } else if ((error =  ts3Functions.getChannelOfClient(currentConnHandlerID, myClientID, &currentChannelID)) != ERROR_ok) {
             ts3Functions.logMessage("Error retrieving current channel ID", LogLevel_ERROR, "Plugin", 0);
-            printf("Error code is: %d\n", error);
+            LOG_ERROR("Error code is: %d", error);
+            log_stop();
             return 1;
         }
     } else {
-        printf("Bot is not connected to any server.");
+        LOG_WARN("Bot is not connected to any server.");
+    }
+
+    /* The station keywords of the config name the command metrics */
+    config_load(configPath);
+    register_metrics();
+    config_watch_start();
+    acl_start(seed_server_groups);
+    remote_start(send_plugin_command);
+    metrics_start();
+    /* Served by the loop, whichever loop_start below runs; MUSICBOT_CONTROL_SOCKET="" turns it off */
+    const char* control = getenv("MUSICBOT_CONTROL_SOCKET");
+    if (!control || *control) {
+        control_start(control ? control : CONTROL_SOCKET_PATH, handle_control_request);
+    }
+    /* !play searches the catalog of the last run until the rescan replaces it, the loop maps the new one */
+    library_open(configPath);
+    scan_library(1);
+    /*
+     * Serve station commands from the snapshot until the player thread loaded the live track list.
+     * Autoload at client start runs before the tab connects, handle_connect_status resumes the channel then.
+     */
+    if (snapshot_open(configPath) == 1) {
+        size_t count;
+        char** tracks = snapshot_tracks(&count);
+        if (tracks) {
+            replace_track_list(tracks, count);
+            player_assume_ready();
+        }
+    }
+    history_open(configPath);
+    analytics_start(configPath);
+    if (established && currentConnHandlerID) {
+        load_server_uid(currentConnHandlerID);
+        resume_channel(currentConnHandlerID);
     }
-    printf("Initializing DBus...\n");
-    dbus_error_init(&dbus_error);
-    connection = dbus_bus_get(DBUS_BUS_SESSION, &dbus_error);
-    handle_dbus_error(&dbus_error);
 
-    get_track_list(connection);
+    /* D-Bus and the player come up in the background whether or not the tab is connected yet, see on_session_bus */
+    LOG_INFO("Initializing DBus...");
+    publish_bot_state();
+    loop_start(NULL, handle_bot_event);
+    player_start(on_session_bus, on_player_loaded);
 
-    printf("Initialized with values:\nDefault channel ID: %d\nCurrent channel ID: %ld\nClient ID: %d\nConnection ID: %ld\n", DEFAULT_CHANNEL_ID, currentChannelID, myClientID, currentConnHandlerID);
+    LOG_INFO("Initialized with values: default_channel=%llu current_channel=%llu client=%d connection=%llu", (unsigned long long)config_default_channel(), (unsigned long long)currentChannelID, myClientID, (unsigned long long)currentConnHandlerID);
     return 0;
 }
 
 /* Custom code called right before the plugin is unloaded */
 void ts3plugin_shutdown()
 {
-    printf("PLUGIN: shutdown\n");
-    free(track_list);
+    LOG_INFO("PLUGIN: shutdown");
+    loop_stop();
+    control_stop();
+    library_close();
+    player_stop();
+    snapshot_close();
+    nowplaying_stop();
+    status_stop();
+    history_close();
+    analytics_stop();
+    config_stop();
+    recorder_close();
+    silence_stop();
+    decks_stop();
+    metrics_stop();
+    free_track_list(track_list, track_count);
+    track_list = NULL;
+    track_count = 0;
     if (pluginID) {
         free(pluginID);
         pluginID = NULL;
     }
+    log_stop();
 }
 
 /****************************** Optional functions ********************************/
@@ -199,7 +361,7 @@ int ts3plugin_offersConfigure()
 /* Client changed current server connection handler */
 void ts3plugin_currentServerConnectionChanged(uint64 serverConnectionHandlerID)
 {
-    printf("PLUGIN: currentServerConnectionChanged %llu (%llu)\n", (long long unsigned int)serverConnectionHandlerID, (long long unsigned int)ts3Functions.getCurrentServerConnectionHandlerID());
+    LOG_INFO("PLUGIN: currentServerConnectionChanged %llu (%llu)", (long long unsigned int)serverConnectionHandlerID, (long long unsigned int)ts3Functions.getCurrentServerConnectionHandlerID());
 }
 
 
@@ -215,6 +377,132 @@ int ts3plugin_requestAutoload()
     return 1; /* 1 = request autoloaded, 0 = do not request autoload */
 }
 
+/* Info panel of the bot client and its channel, see status_module.h */
+const char* ts3plugin_infoTitle()
+{
+    return "Music Bot";
+}
+
+void ts3plugin_infoData(uint64 serverConnectionHandlerID, uint64 id, enum PluginItemType type, char** data)
+{
+    if (!((type == PLUGIN_CLIENT && id == atomic_load(&shared_client_id)) || (type == PLUGIN_CHANNEL && id == atomic_load(&shared_channel_id)))) {
+        *data = NULL; /* Not ours, no info section */
+        return;
+    }
+
+    bot_status status;
+    status_read(&status);
+    *data = (char*)malloc(STATUS_INFO_BUFSIZE * sizeof(char));
+    if (!*data) {
+        return; /* No info section this time */
+    }
+    status_format(&status, *data, STATUS_INFO_BUFSIZE);
+}
+
+/* Console command, e.g. "/musicbot trace on" */
+const char* ts3plugin_commandKeyword()
+{
+    return "musicbot";
+}
+
+/* Start a recording with the bot's client, channel and channel members so a replay knows where it is */
+static void record_snapshot(uint64 serverConnectionHandlerID, anyID self, uint64 channel)
+{
+    anyID* clients;
+    if (!recorder_active() || !self || ts3Functions.getChannelClientList(serverConnectionHandlerID, channel, &clients) != ERROR_ok) {
+        return;
+    }
+    size_t count = 0;
+    while (clients[count]) {
+        count++;
+    }
+    recorder_snapshot(serverConnectionHandlerID, self, channel, clients, count);
+    ts3Functions.freeMemory(clients);
+}
+
+/* Returns 0 if the command was handled, 1 otherwise */
+int ts3plugin_processCommand(uint64 serverConnectionHandlerID, const char* command)
+{
+    char  buffer[COMMAND_BUFSIZE];
+    char  reply[PATH_BUFSIZE];
+    char* save = NULL;
+    _strcpy(buffer, COMMAND_BUFSIZE, command);
+    const char* verb     = strtok_r(buffer, " ", &save);
+    const char* argument = strtok_r(NULL, " ", &save);
+    const char* extra    = strtok_r(NULL, " ", &save);
+
+    if (verb && strcmp(verb, "trace") == 0) {
+        if (argument && strcmp(argument, "on") == 0) {
+            trace_set_enabled(1);
+            snprintf(reply, sizeof(reply), "Tracing enabled");
+        } else if (argument && strcmp(argument, "off") == 0) {
+            trace_set_enabled(0);
+            snprintf(reply, sizeof(reply), "Tracing disabled");
+        } else if (argument && strcmp(argument, "dump") == 0) {
+            const char* path  = extra ? extra : TRACE_DEFAULT_PATH;
+            long        spans = trace_dump(path);
+            if (spans < 0) {
+                snprintf(reply, sizeof(reply), "Could not write %s", path);
+            } else {
+                snprintf(reply, sizeof(reply), "Wrote %ld spans to %s", spans, path);
+            }
+        } else {
+            snprintf(reply, sizeof(reply), "Usage: /musicbot trace on|off|dump [path] (tracing is %s)", atomic_load(&trace_enabled) ? "on" : "off");
+        }
+    } else if (verb && strcmp(verb, "record") == 0 && argument && strcmp(argument, "on") == 0) {
+        const char* path = extra ? extra : RECORDER_DEFAULT_PATH;
+        if (recorder_open(path) == 0) {
+            record_snapshot(serverConnectionHandlerID, atomic_load(&shared_client_id), atomic_load(&shared_channel_id));
+            snprintf(reply, sizeof(reply), "Recording callbacks to %s", path);
+        } else {
+            snprintf(reply, sizeof(reply), "Could not start recording to %s (already recording?)", path);
+        }
+    } else if (verb && strcmp(verb, "record") == 0 && argument && strcmp(argument, "off") == 0) {
+        snprintf(reply, sizeof(reply), "Recording stopped, %llu records written", (unsigned long long)recorder_close());
+    } else if (verb && strcmp(verb, "listeners") == 0 && (!argument || analytics_parse_period(argument) >= 0)) {
+        int    period = argument ? analytics_parse_period(argument) : ANALYTICS_DAILY;
+        char*  csv    = NULL;
+        size_t size   = 0;
+        FILE*  out    = extra ? fopen(extra, "w") : open_memstream(&csv, &size);
+        long   rows   = out ? analytics_export(out, period, station_name) : -1;
+        if (out)
+            fclose(out);
+        if (rows < 0) {
+            snprintf(reply, sizeof(reply), "Could not export listener statistics%s%s", extra ? " to " : "", extra ? extra : "");
+        } else if (extra) {
+            snprintf(reply, sizeof(reply), "Wrote %ld %s rows to %s", rows, argument, extra);
+        } else {
+            /* Printed as is, the CSV can be copied out of the tab */
+            ts3Functions.printMessageToCurrentTab(csv);
+            snprintf(reply, sizeof(reply), "%ld %s rows", rows, analytics_period_names[period]);
+        }
+        free(csv);
+    } else if (verb && strcmp(verb, "library") == 0 && (!argument || strcmp(argument, "scan") == 0)) {
+        if (!argument) {
+            snprintf(reply, sizeof(reply), "%llu tracks in the library%s", (unsigned long long)atomic_load(&library_tracks), library_scanning() ? ", scanning" : "");
+        } else if (scan_library(0) == 0) {
+            snprintf(reply, sizeof(reply), "Scanning the library");
+        } else {
+            snprintf(reply, sizeof(reply), "Could not start a library scan (one is still running?)");
+        }
+    } else if (verb && strcmp(verb, "log") == 0 && argument && log_parse_level(argument) >= 0) {
+        log_set_level(log_parse_level(argument));
+        snprintf(reply, sizeof(reply), "Log level set to %s", argument);
+    } else {
+        return 1;
+    }
+
+    ts3Functions.printMessageToCurrentTab(reply);
+    return 0;
+}
+
+/* Needed for return codes, see send_private_message */
+void ts3plugin_registerPluginID(const char* id)
+{
+    pluginID = strdup(id);
+    LOG_INFO("PLUGIN: registerPluginID: %s", pluginID);
+}
+
 
 /************************** TeamSpeak callbacks ***************************/
 /*
@@ -224,150 +512,696 @@ int ts3plugin_requestAutoload()
 
 /* Clientlib */
 
-void ts3plugin_onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber)
+/*
+ * Now playing, see nowplaying_module.h. MUSICBOT_NOW_PLAYING picks where it
+ * goes: topic (default), description, nickname or off.
+ * MUSICBOT_NOW_PLAYING_INTERVAL_MS is the least time between two edits.
+ */
+enum { NOW_PLAYING_OFF, NOW_PLAYING_TOPIC, NOW_PLAYING_DESCRIPTION, NOW_PLAYING_NICKNAME };
+/* Servers reject longer nicknames */
+#define NICKNAME_MAX_CHARS 30
+#define NICKNAME_SEPARATOR " | "
+static int now_playing_target = NOW_PLAYING_OFF;
+static char base_nickname[TS3_MAX_SIZE_CLIENT_NICKNAME * 4 + 1];
+
+static int apply_now_playing(const char* text, char* returnCode, size_t returnCodeSize)
+{
+    if (!currentConnHandlerID || !currentChannelID) {
+        return 1;
+    }
+    if (pluginID) {
+        ts3Functions.createReturnCode(pluginID, returnCode, returnCodeSize);
+    }
+    if (now_playing_target == NOW_PLAYING_NICKNAME) {
+        char nickname[sizeof(base_nickname) + NOWPLAYING_BUFSIZE];
+        snprintf(nickname, sizeof(nickname), "%s%s%s", base_nickname, text[0] ? NICKNAME_SEPARATOR : "", text);
+        nowplaying_cut(nickname, NICKNAME_MAX_CHARS, sizeof(nickname) - 1);
+        if (TRACE_CALL("setClientSelfVariableAsString", ts3Functions.setClientSelfVariableAsString(currentConnHandlerID, CLIENT_NICKNAME, nickname)) != ERROR_ok) {
+            return 1;
+        }
+        return TRACE_CALL("flushClientSelfUpdates", ts3Functions.flushClientSelfUpdates(currentConnHandlerID, returnCode)) != ERROR_ok;
+    }
+    size_t flag = now_playing_target == NOW_PLAYING_TOPIC ? CHANNEL_TOPIC : CHANNEL_DESCRIPTION;
+    if (TRACE_CALL("setChannelVariableAsString", ts3Functions.setChannelVariableAsString(currentConnHandlerID, currentChannelID, flag, text)) != ERROR_ok) {
+        return 1;
+    }
+    return TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(currentConnHandlerID, currentChannelID, returnCode)) != ERROR_ok;
+}
+
+/* The bot left oldChannelID: take the text out of the channel it left and write it into the new one */
+static void now_playing_moved(uint64 serverConnectionHandlerID, uint64 oldChannelID)
+{
+    if ((now_playing_target == NOW_PLAYING_TOPIC || now_playing_target == NOW_PLAYING_DESCRIPTION) && oldChannelID && nowplaying_text()[0]) {
+        size_t flag = now_playing_target == NOW_PLAYING_TOPIC ? CHANNEL_TOPIC : CHANNEL_DESCRIPTION;
+        if (TRACE_CALL("setChannelVariableAsString", ts3Functions.setChannelVariableAsString(serverConnectionHandlerID, oldChannelID, flag, "")) == ERROR_ok) {
+            TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, ""));
+        }
+    }
+    nowplaying_invalidate();
+}
+
+/* Each string of a NOW_PLAYING body, so that both fit the u8 body length */
+#define NOW_PLAYING_FIELD_BYTES ((REMOTE_MAX_STRING - 2) / 2 - 1)
+
+/* The station last tuned to, -1 if none */
+static int tuned_station(void)
+{
+    int station = snapshot_station();
+    return station >= 0 ? station : atomic_load(&on_air_station);
+}
+
+/* The NOW_PLAYING body of remote_format.h from the info panel status, no D-Bus call */
+static size_t now_playing_body(uint8_t* out)
+{
+    bot_status status;
+    status_read(&status);
+    size_t length = remote_put_u16(out, (uint16_t)tuned_station());
+    length += remote_put_string(out + length, status.song, nowplaying_cut(status.song, SIZE_MAX, NOW_PLAYING_FIELD_BYTES));
+    return length + remote_put_string(out + length, status.station, nowplaying_cut(status.station, SIZE_MAX, NOW_PLAYING_FIELD_BYTES));
+}
+
+/* Subscribers hear about a new station right away and about songs as the player reports them */
+static void notify_now_playing(void)
+{
+    uint8_t body[REMOTE_MAX_STRING];
+    remote_notify(REMOTE_OP_NOW_PLAYING, body, now_playing_body(body));
+}
+
+/* Switch the player to station and remember it, the caller made sure the player is ready */
+static void tune_station(int station)
+{
+    uint64_t t = trace_begin();
+    switch_station(connection, (size_t)station);
+    trace_end("switch_station", t);
+    snapshot_set_station(station);
+    notify_now_playing();
+}
+
+/* On the scanner thread, the loop maps the new catalog on BOT_EVENT_LIBRARY */
+static void on_library_scanned(int result, const library_scan_stats* stats)
+{
+    (void)stats;
+    if (result == 0) {
+        loop_event event = {.type = BOT_EVENT_LIBRARY};
+        loop_push(&event);
+    }
+}
+
+/* On the silence watchdog thread, the loop tunes the fallback on BOT_EVENT_FAILOVER */
+static void on_dead_stream(int station)
+{
+    loop_event event = {.type = BOT_EVENT_FAILOVER, .value = station};
+    if (loop_push(&event) != 0) {
+        LOG_ERROR("Event loop queue full, dropped the failover to station %d", station);
+    }
+}
+
+/* Rescan the library lines of the current config in the background, returns 0 if a scan started */
+static int scan_library(int only_if_configured)
+{
+    char         roots[CONFIG_MAX_LIBRARY_ROOTS][CONFIG_PATH_BYTES];
+    const char*  pointers[CONFIG_MAX_LIBRARY_ROOTS];
+    config_guard guard = config_enter();
+    size_t       count = guard.config->library_root_count;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(roots[i], guard.config->library_roots[i], CONFIG_PATH_BYTES);
+        pointers[i] = roots[i];
+    }
+    config_leave(&guard);
+    if (!count && only_if_configured) {
+        return -1;
+    }
+    return library_rescan(pointers, count, on_library_scanned);
+}
+
+static void now_playing_changed(const char* song, const char* station)
+{
+    status_set_now_playing(song, station);
+    if (song) {
+        history_append(atomic_load(&on_air_station), song);
+    }
+    notify_now_playing();
+}
+
+/* On the loop thread once the session bus is up, see BOT_EVENT_BUS */
+static void start_now_playing(void)
+{
+    const char* target = getenv("MUSICBOT_NOW_PLAYING");
+    const char* interval = getenv("MUSICBOT_NOW_PLAYING_INTERVAL_MS");
+    if (!target || strcmp(target, "topic") == 0) {
+        now_playing_target = NOW_PLAYING_TOPIC;
+    } else if (strcmp(target, "description") == 0) {
+        now_playing_target = NOW_PLAYING_DESCRIPTION;
+    } else if (strcmp(target, "nickname") == 0) {
+        now_playing_target = NOW_PLAYING_NICKNAME;
+    } else {
+        if (strcmp(target, "off") != 0) {
+            LOG_WARN("Unknown MUSICBOT_NOW_PLAYING=%s, now playing is off", target);
+        }
+        now_playing_target = NOW_PLAYING_OFF;
+    }
+    uint64_t interval_ms = interval ? strtoull(interval, NULL, 10) : NOWPLAYING_INTERVAL_MS;
+
+    size_t max_chars = TS3_MAX_SIZE_CHANNEL_TOPIC, max_bytes = TS3_MAX_SIZE_CHANNEL_TOPIC;
+    if (now_playing_target == NOW_PLAYING_DESCRIPTION) {
+        max_chars = max_bytes = TS3_MAX_SIZE_CHANNEL_DESCRIPTION;
+    } else if (now_playing_target == NOW_PLAYING_NICKNAME) {
+        char* nickname = NULL;
+        if (ts3Functions.getClientSelfVariableAsString(currentConnHandlerID, CLIENT_NICKNAME, &nickname) != ERROR_ok) {
+            LOG_ERROR("Failed to read the bot's nickname, now playing is off");
+            now_playing_target = NOW_PLAYING_OFF;
+        } else {
+            /* A previous run may have left its suffix */
+            char* suffix = strstr(nickname, NICKNAME_SEPARATOR);
+            if (suffix) {
+                *suffix = '\0';
+            }
+            snprintf(base_nickname, sizeof(base_nickname), "%s", nickname);
+            ts3Functions.freeMemory(nickname);
+            size_t base_chars = 0;
+            for (const char* c = base_nickname; *c; c++) {
+                base_chars += ((unsigned char)*c & 0xC0) != 0x80;
+            }
+            size_t used = base_chars + strlen(NICKNAME_SEPARATOR);
+            max_chars = used < NICKNAME_MAX_CHARS ? NICKNAME_MAX_CHARS - used : 0;
+            max_bytes = NOWPLAYING_BUFSIZE - 1;
+        }
+    }
+    /* Off still follows the metadata, for the history and the subscribers */
+    nowplaying_watch(now_playing_changed);
+    nowplaying_start(connection, now_playing_target == NOW_PLAYING_OFF ? NULL : apply_now_playing, max_chars, max_bytes, interval_ms);
+}
+
+/* Runs on the player thread (player_module.h) once the session bus is connected, the loop takes the connection from there */
+static void on_session_bus(DBusConnection* bus)
+{
+    LOG_INFO("DBus connected, waiting for the player");
+    decks_start(bus);
+    silence_start(on_dead_stream);
+    status_start(bus);
+    atomic_store(&session_bus, bus);
+    loop_event event = {.type = BOT_EVENT_BUS};
+    if (loop_push(&event) != 0) {
+        LOG_ERROR("Event loop queue full, D-Bus messages are not dispatched");
+    }
+}
+
+/* Unique identifier of the server the bot is on, the key for its channel in the snapshot */
+static char server_uid[SNAPSHOT_UID_BYTES];
+
+static void load_server_uid(uint64 serverConnectionHandlerID)
+{
+    char* uid = NULL;
+    server_uid[0] = '\0';
+    if (ts3Functions.getServerVariableAsString(serverConnectionHandlerID, VIRTUALSERVER_UNIQUE_IDENTIFIER, &uid) == ERROR_ok && uid) {
+        snprintf(server_uid, sizeof(server_uid), "%s", uid);
+        ts3Functions.freeMemory(uid);
+    }
+}
+
+/* Go back to the channel the bot was in on this server before the restart, if it starts out in the default one */
+static void resume_channel(uint64 serverConnectionHandlerID)
+{
+    uint64_t channel = snapshot_channel(server_uid);
+    if (!channel || channel == currentChannelID || currentChannelID != config_default_channel() || config_is_away_channel(channel)) {
+        return;
+    }
+    LOG_INFO("Resuming in channel %llu", (unsigned long long)channel);
+    if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, channel, "", "")) != ERROR_ok) {
+        ts3Functions.logMessage("Failed to move back to the previous channel", LogLevel_WARNING, "Plugin", serverConnectionHandlerID);
+    }
+}
+
+/*
+ * Seed function of acl_module.h: the groups the client already knows for a
+ * client in view, and a request to the server whose answers come back
+ * through onServerGroupByClientIDEvent for clients it does not know yet.
+ */
+static int seed_server_groups(uint64_t serverConnectionHandlerID, uint16_t clientID, acl_entry* entry)
+{
+    char* groups = NULL;
+    if (ts3Functions.getClientVariableAsUInt64(serverConnectionHandlerID, clientID, CLIENT_DATABASE_ID, &entry->database_id) != ERROR_ok) {
+        return -1;
+    }
+    if (ts3Functions.getClientVariableAsString(serverConnectionHandlerID, clientID, CLIENT_SERVERGROUPS, &groups) == ERROR_ok && groups) {
+        char* save = NULL;
+        for (char* group = strtok_r(groups, ",", &save); group && entry->group_count < ACL_MAX_GROUPS; group = strtok_r(NULL, ",", &save)) {
+            uint64_t id = strtoull(group, NULL, 10);
+            if (id) {
+                entry->groups[entry->group_count++] = id;
+            }
+        }
+        ts3Functions.freeMemory(groups);
+    }
+    if (!entry->group_count && TRACE_CALL("requestServerGroupsByClientID", ts3Functions.requestServerGroupsByClientID(serverConnectionHandlerID, entry->database_id, "")) != ERROR_ok) {
+        ts3Functions.logMessage("Failed to request the server groups of a client", LogLevel_WARNING, "Plugin", serverConnectionHandlerID);
+    }
+    return entry->group_count ? 0 : -1;
+}
+
+/*
+ * Runs on the player thread after every live track list load: revalidate
+ * the snapshot against it and retune the player to the last station if it
+ * is not playing it (it restarted, or the snapshot's track ids were stale).
+ */
+static void on_player_loaded(DBusConnection* bus)
+{
+    pthread_mutex_lock(&track_list_lock);
+    uint64_t fingerprint = track_list_fingerprint(track_list, track_count);
+    if (fingerprint != snapshot_fingerprint()) {
+        LOG_INFO("Track list changed since the snapshot, updating it");
+        snapshot_set_tracks(track_list, track_count);
+    }
+    int station = snapshot_station();
+    char* track = station >= 0 && (size_t)station < track_count ? strdup(track_list[station]) : NULL;
+    pthread_mutex_unlock(&track_list_lock);
+    if (!track) {
+        return;
+    }
+
+    char* playing = GetTrackId(bus);
+    if (snapshot_station() != station) {
+        /* Somebody picked a station while we asked the player */
+    } else if (playing && strcmp(playing, track) == 0) {
+        atomic_store(&on_air_station, station);
+    } else {
+        LOG_INFO("Resuming station %d", station);
+        switch_station(bus, (size_t)station);
+    }
+    free(playing);
+    free(track);
+}
+
+/* Clients in the bot's channel including the bot, the others are published as listeners for the info panel */
+static unsigned int count_channel_clients(uint64 serverConnectionHandlerID, size_t* clientCount)
+{
+    anyID* clientsInChannel;
+    unsigned int error;
+    if ((error = TRACE_CALL("getChannelClientList", ts3Functions.getChannelClientList(serverConnectionHandlerID, currentChannelID, &clientsInChannel))) != ERROR_ok) {
+        ts3Functions.logMessage("Error getting client list for current channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
+        return error;
+    }
+    *clientCount = 0;
+    for (int i = 0; clientsInChannel[i]; i++) {
+        (*clientCount)++;
+    }
+    ts3Functions.freeMemory(clientsInChannel);
+    status_set_listeners(*clientCount > 0 ? (int)*clientCount - 1 : 0);
+    analytics_set_listeners(*clientCount > 0 ? (int)*clientCount - 1 : 0);
+    return ERROR_ok;
+}
+
+/* Fires return_delay_ms after the last listener left the bot's channel, see handle_client_move */
+static void return_to_default(timer_entry* timer, void* context)
+{
+    size_t clientCount;
+    uint64_t defaultChannelID = config_default_channel();
+    if (currentChannelID == defaultChannelID || count_channel_clients(currentConnHandlerID, &clientCount) != ERROR_ok || clientCount != 1) {
+        return;
+    }
+    LOG_INFO("Nobody came back within %llu s. Moving to default channel (ID: %llu)...", (unsigned long long)(return_delay_ms / 1000), (unsigned long long)defaultChannelID);
+    if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(currentConnHandlerID, myClientID, defaultChannelID, "", "")) != ERROR_ok) {
+        ts3Functions.logMessage("Failed to move to default channel", LogLevel_ERROR, "Plugin", currentConnHandlerID);
+    }
+}
+static timer_entry return_timer = {.fire = return_to_default};
+
+static void handle_connect_status(uint64 serverConnectionHandlerID, int newStatus)
 {
     /* Some example code following to show how to use the information query functions. */
 
     if (newStatus == STATUS_CONNECTION_ESTABLISHED) { /* connection established and we have client and channels available */
         currentConnHandlerID = serverConnectionHandlerID;
+        acl_clear();
+        remote_clear();
 
         if (ts3Functions.getClientID(serverConnectionHandlerID, &myClientID) != ERROR_ok) {
             ts3Functions.logMessage("Error querying client ID", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
             return;
         }
 
-        if (ts3Functions.getChannelOfClient(serverConnectionHandlerID, myClientID, &currentChannelID) != ERROR_ok) {
+        if (TRACE_CALL("getChannelOfClient", ts3Functions.getChannelOfClient(serverConnectionHandlerID, myClientID, &currentChannelID)) != ERROR_ok) {
                 ts3Functions.logMessage("Error querying channel ID", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
+                return;
         }
+        publish_bot_state();
+        nowplaying_invalidate();
+        load_server_uid(serverConnectionHandlerID);
+        resume_channel(serverConnectionHandlerID);
+        size_t clientCount;
+        count_channel_clients(serverConnectionHandlerID, &clientCount);
+        record_snapshot(serverConnectionHandlerID, myClientID, currentChannelID);
+    } else if (newStatus == STATUS_DISCONNECTED) {
+        /* Nobody is listening to a disconnected bot */
+        timer_cancel(&return_timer);
+        acl_clear();
+        remote_clear();
+        status_set_listeners(0);
+        analytics_set_listeners(0);
     }
 }
 
-void ts3plugin_onClientMoveEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char* moveMessage) {
-    printf("on client move event\nclient id: %d\nold channel id: %ld\nnew channel id: %ld\nmy client id: %d\n", clientID, oldChannelID, newChannelID, myClientID);
+void ts3plugin_onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber)
+{
+    recorder_connect_status(serverConnectionHandlerID, newStatus, errorNumber);
+    loop_event event = {.type = BOT_EVENT_CONNECT, .value = newStatus, .server = serverConnectionHandlerID};
+    loop_push(&event);
+}
+
+static void handle_client_move(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID) {
+    TRACE_SPAN("onClientMoveEvent");
+    metrics_inc(move_events_metric);
+    LOG_SAMPLED(LOG_LEVEL_DEBUG, 10, "on client move event: client=%d old_channel=%llu new_channel=%llu me=%d", clientID, (unsigned long long)oldChannelID, (unsigned long long)newChannelID, myClientID);
     int error;
     if(clientID == myClientID) {
-        printf("Hehe i got to another channel manually!\n");
-        printf("Setting old channel codec to voice..\n");
+        LOG_INFO("Moved to channel %llu manually", (unsigned long long)newChannelID);
+        LOG_DEBUG("Setting old channel codec to voice..");
         if (oldChannelID != 0) {
-            if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE)) != ERROR_ok) {
+            if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE))) != ERROR_ok) {
                 ts3Functions.logMessage("Failed to set old channel codec to voice", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-                printf("At client move event error num: %d\n", error);
+                LOG_ERROR("At client move event error num: %d", error);
             } else {
-                ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, "");
-                printf("Old channel codec set to voice.\n");
+                TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, ""));
+                metrics_inc(codec_flushes_metric);
+                LOG_DEBUG("Old channel codec set to voice.");
             }
         }
 
-        printf("Setting new channel codec to music..\n");
-        if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, newChannelID, CHANNEL_CODEC, CODEC_OPUS_MUSIC)) != ERROR_ok) {
+        LOG_DEBUG("Setting new channel codec to music..");
+        if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, newChannelID, CHANNEL_CODEC, CODEC_OPUS_MUSIC))) != ERROR_ok) {
             ts3Functions.logMessage("Failed to set new channel codec to music", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-            printf("At client move event error num: %d\n", error);
+            LOG_ERROR("At client move event error num: %d", error);
         } else {
-            ts3Functions.flushChannelUpdates(serverConnectionHandlerID, newChannelID, "");
-            printf("New channel codec set to music.\n");
+            TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, newChannelID, ""));
+            metrics_inc(codec_flushes_metric);
+            LOG_DEBUG("New channel codec set to music.");
         }
 
 
         currentChannelID = newChannelID;
+        publish_bot_state();
+        snapshot_set_channel(server_uid, currentChannelID);
+        now_playing_moved(serverConnectionHandlerID, oldChannelID);
+        timer_cancel(&return_timer);
+        talk_state_clear();
+        size_t clientCount;
+        count_channel_clients(serverConnectionHandlerID, &clientCount);
     } else {
-        printf("Somebody else moved... perhaps i'm alone in current channel??\n");
-        anyID *clientsInChannel;
-        if (ts3Functions.getChannelClientList(serverConnectionHandlerID, currentChannelID, &clientsInChannel) != ERROR_ok) {
-            ts3Functions.logMessage("Error getting client list for current channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-            return;
+        LOG_SAMPLED(LOG_LEVEL_DEBUG, 10, "Somebody else moved... perhaps i'm alone in current channel??");
+        if (!newChannelID) {
+            remote_forget(serverConnectionHandlerID, clientID); /* left the server */
         }
-        size_t clientCount = 0;
-        for (int i = 0; clientsInChannel[i]; i++) {
-            clientCount++;
+        if (oldChannelID == currentChannelID) {
+            talk_state_set(clientID, 0);
         }
-        
-        ts3Functions.freeMemory(clientsInChannel); 
-        printf("Client count in current channel: %ld\n", clientCount);
-        if ((clientCount == 1 && currentChannelID != DEFAULT_CHANNEL_ID) || currentChannelID == AFK_CHANNEL_ID || currentChannelID == INN_CHANNEL_ID) {  
-            printf("I'm alone in the channel (or moved to afk....). Moving to default channel (ID: %d)...\n", DEFAULT_CHANNEL_ID);
-            if (ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, DEFAULT_CHANNEL_ID, "", "") != ERROR_ok) {
+        size_t clientCount;
+        if (count_channel_clients(serverConnectionHandlerID, &clientCount) != ERROR_ok) {
+            return;
+        }
+        LOG_SAMPLED(LOG_LEVEL_DEBUG, 10, "Client count in current channel: %zu", clientCount);
+        uint64_t defaultChannelID = config_default_channel();
+        int alone = clientCount == 1 && currentChannelID != defaultChannelID;
+        if ((alone && !return_delay_ms) || config_is_away_channel(currentChannelID)) {
+            LOG_INFO("I'm alone in the channel (or moved to afk....). Moving to default channel (ID: %llu)...", (unsigned long long)defaultChannelID);
+            if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, defaultChannelID, "", "")) != ERROR_ok) {
                 ts3Functions.logMessage("Failed to move to default channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
             }
-            printf("Created move request!\n");
+            LOG_DEBUG("Created move request!");
+        } else if (alone) {
+            if (!timer_pending(&return_timer)) {
+                LOG_INFO("I'm alone in the channel, moving to default channel in %llu s unless somebody joins", (unsigned long long)(return_delay_ms / 1000));
+                timer_arm(&return_timer, return_delay_ms, return_delay_ms / 10); /* to the second is not needed */
+            }
         } else {
-            printf("Not alone or already in default, no need to move.\n");
+            timer_cancel(&return_timer);
+            LOG_SAMPLED(LOG_LEVEL_DEBUG, 10, "Not alone or already in default, no need to move.");
         }
     }
 }
 
-void ts3plugin_onClientMoveMovedEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID moverID, const char *moverName, const char *moverUniqueIdentifier, const char *moveMessage) {
+void ts3plugin_onClientMoveEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char* moveMessage) {
+    recorder_client_move(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility, moveMessage);
+    loop_event event = {.type = BOT_EVENT_MOVE, .client = clientID, .value = visibility, .server = serverConnectionHandlerID, .old_channel = oldChannelID, .new_channel = newChannelID};
+    loop_push(&event);
+}
+
+static void handle_client_moved(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, const char *moverName) {
+    TRACE_SPAN("onClientMoveMovedEvent");
+    metrics_inc(move_events_metric);
     if(clientID == myClientID) {
-        printf("Hey! I'm moved!\n");
+        LOG_INFO("Moved to channel %llu by %s", (unsigned long long)newChannelID, moverName);
         currentChannelID = newChannelID;
-        if (currentChannelID == AFK_CHANNEL_ID || currentChannelID == INN_CHANNEL_ID) {  
-            printf("I'm alone in the channel (or moved to afk....). Moving to default channel (ID: %d)...\n", DEFAULT_CHANNEL_ID);
-            if (ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, DEFAULT_CHANNEL_ID, "", "") != ERROR_ok) {
+        publish_bot_state();
+        snapshot_set_channel(server_uid, currentChannelID);
+        now_playing_moved(serverConnectionHandlerID, oldChannelID);
+        talk_state_clear();
+        size_t clientCount;
+        count_channel_clients(serverConnectionHandlerID, &clientCount);
+        if (config_is_away_channel(currentChannelID)) {
+            uint64_t defaultChannelID = config_default_channel();
+            LOG_INFO("I'm alone in the channel (or moved to afk....). Moving to default channel (ID: %llu)...", (unsigned long long)defaultChannelID);
+            if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, defaultChannelID, "", "")) != ERROR_ok) {
                 ts3Functions.logMessage("Failed to move to default channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
             }
-            printf("Created move request!\n");
+            LOG_DEBUG("Created move request!");
             return;
         } else {
-            printf("Not alone or already in default, no need to move.\n");
+            LOG_SAMPLED(LOG_LEVEL_DEBUG, 10, "Not alone or already in default, no need to move.");
         }
         int error;
-        printf("Setting old channel codec to voice..\n");
+        LOG_DEBUG("Setting old channel codec to voice..");
         if (oldChannelID != 0) {
-            if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE)) != ERROR_ok) {
+            if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE))) != ERROR_ok) {
                 ts3Functions.logMessage("Failed to set old channel codec to voice", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-                printf("At client move event error num: %d\n", error);
+                LOG_ERROR("At client move event error num: %d", error);
             } else {
-                ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, "");
-                printf("Old channel codec set to voice.\n");
+                TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, ""));
+                metrics_inc(codec_flushes_metric);
+                LOG_DEBUG("Old channel codec set to voice.");
             }
         }
 
-        printf("Setting new channel codec to music..\n");
-        if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, newChannelID, CHANNEL_CODEC, CODEC_OPUS_MUSIC)) != ERROR_ok) {
+        LOG_DEBUG("Setting new channel codec to music..");
+        if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, newChannelID, CHANNEL_CODEC, CODEC_OPUS_MUSIC))) != ERROR_ok) {
             ts3Functions.logMessage("Failed to set new channel codec to music", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-            printf("At client move event error num: %d\n", error);
+            LOG_ERROR("At client move event error num: %d", error);
         } else {
-            ts3Functions.flushChannelUpdates(serverConnectionHandlerID, newChannelID, "");
-            printf("New channel codec set to music.\n");
+            TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, newChannelID, ""));
+            metrics_inc(codec_flushes_metric);
+            LOG_DEBUG("New channel codec set to music.");
         }
     }
 }
 
+void ts3plugin_onClientMoveMovedEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID moverID, const char *moverName, const char *moverUniqueIdentifier, const char *moveMessage) {
+    recorder_client_moved_by(RECORDING_CLIENT_MOVE_MOVED, serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility, moverID, moverName, moverUniqueIdentifier, moveMessage);
+    loop_event event = {.type = BOT_EVENT_MOVED, .client = clientID, .other = moverID, .value = visibility, .server = serverConnectionHandlerID, .old_channel = oldChannelID, .new_channel = newChannelID};
+    loop_copy_string(event.name, sizeof(event.name), moverName);
+    loop_push(&event);
+}
+
 
-int ts3plugin_onTextMessageEvent(uint64 serverConnectionHandlerID, anyID targetMode, anyID toID, anyID fromID, const char* fromName, const char* fromUniqueIdentifier, const char* message, int ffIgnored)
+#define HISTORY_REPLY_BUFSIZE 1024
+#define HISTORY_DEFAULT_COUNT 5
+#define HISTORY_MAX_COUNT 20
+
+typedef struct {
+    char*  out;
+    size_t size;
+    size_t length;
+} history_reply_context;
+
+static const char* history_station_name(int station)
 {
-    printf("PLUGIN: onTextMessageEvent %llu %d %d %s %s %d\n", 
-           (long long unsigned int)serverConnectionHandlerID, targetMode, fromID, fromName, message, ffIgnored);
-    
-    if(fromID == myClientID) return 1;
+    return station == HISTORY_STATION_LIBRARY ? "library" : station_name(station);
+}
 
-    if (ffIgnored) {
-        return 1;
+static void history_reply_line(const history_record* record, const char* title, void* context)
+{
+    history_reply_context* reply = (history_reply_context*)context;
+    time_t when = (time_t)record->time;
+    struct tm tm;
+    char stamp[16];
+    localtime_r(&when, &tm);
+    strftime(stamp, sizeof(stamp), "%H:%M", &tm);
+    if (reply->length < reply->size) {
+        reply->length += snprintf(reply->out + reply->length, reply->size - reply->length, "\n[b]%s[/b] %s [i](%s)[/i]", stamp, title, history_station_name(record->station));
     }
+}
 
-    if (targetMode != TextMessageTarget_CLIENT) {
-        return 1;
+/* "!history", "!history 10" or "!history chill", arguments is whatever follows the keyword */
+static void history_reply(const char* arguments, char* out, size_t size)
+{
+    while (*arguments == ' ') {
+        arguments++;
+    }
+
+    int station = -1;
+    int count = HISTORY_DEFAULT_COUNT;
+    if (*arguments >= '0' && *arguments <= '9') {
+        count = atoi(arguments);
+        if (count < 1) {
+            count = 1;
+        } else if (count > HISTORY_MAX_COUNT) {
+            count = HISTORY_MAX_COUNT;
+        }
+    } else if (strcasecmp(arguments, "library") == 0) {
+        station = HISTORY_STATION_LIBRARY;
+        count = HISTORY_MAX_COUNT / 2;
+    } else if (*arguments) {
+        config_guard guard = config_enter();
+        for (size_t i = 0; i < guard.config->station_count; i++) {
+            const config_station* entry = &guard.config->stations[i];
+            if (strcmp(arguments, entry->keyword + 1) == 0 || strcmp(arguments, entry->keyword) == 0 || strcasecmp(arguments, entry->name) == 0) {
+                station = entry->station;
+                break;
+            }
+        }
+        config_leave(&guard);
+        if (station < 0) {
+            snprintf(out, size, "Unknown station \"%s\", use the station command without the !, e.g. !history chill", arguments);
+            return;
+        }
+        count = HISTORY_MAX_COUNT / 2;
+    }
+
+    history_reply_context reply = {out, size, 0};
+    reply.length = snprintf(out, size, station < 0 ? "[b]Recently played:[/b]" : "[b]Recently played on %s:[/b]", station < 0 ? "" : history_station_name(station));
+    if (history_query(station, count, history_reply_line, &reply) == 0) {
+        snprintf(out, size, "Nothing played yet.");
+    }
+}
+
+#define HELP_REPLY_BUFSIZE 2048
+
+/* !list and !help, the stations come from the current config */
+static void help_reply(char* out, size_t size)
+{
+    size_t length = (size_t)snprintf(out, size,
+        "Available commands:\n"
+        "!list or !help - Display this help message\n"
+        "!song - Current song name\n"
+        "!join - Make MUSICBOT join your channel\n"
+        "!kick - Kick bot\n"
+        "!history [n] - Last n songs (default 5)\n"
+        "!history <station> - Last songs on a station, e.g. !history chill\n"
+        "!history library - Last songs played with !play\n"
+        "!play <words> - Play a track from the music library, e.g. !play daft punk");
+    config_guard guard = config_enter();
+    for (size_t i = 0; i < guard.config->station_count && length < size; i++) {
+        length += (size_t)snprintf(out + length, size - length, "\n%s - %s station", guard.config->stations[i].keyword, guard.config->stations[i].name);
+    }
+    for (size_t i = 0; i < guard.config->alias_count && length < size; i++) {
+        length += (size_t)snprintf(out + length, size - length, "\n%s - Same as %s", guard.config->aliases[i].keyword, guard.config->aliases[i].target);
+    }
+    config_leave(&guard);
+}
+
+#define PLAY_REPLY_BUFSIZE 512
+
+/* "!play <words>": the first track in the library whose tags or file name contain all the words */
+static void play_from_library(const char* query, char* out, size_t size)
+{
+    while (*query == ' ') {
+        query++;
+    }
+    if (!*query) {
+        snprintf(out, size, "Usage: !play <words from the title, artist, album or file name>");
+        return;
+    }
+    library_match match;
+    uint64_t      t       = trace_begin();
+    uint64_t      matches = library_find(query, &match);
+    trace_end("library_find", t);
+    if (!matches) {
+        snprintf(out, size, library_scanning() ? "Nothing matches \"%s\" yet, the library is still being scanned." : "Nothing in the library matches \"%s\".", query);
+        return;
+    }
+    char uri[LIBRARY_PATH_BYTES * 3 + 8];
+    if (library_file_uri(match.path, uri, sizeof(uri)) != 0 || open_uri(connection, uri) != 0) {
+        snprintf(out, size, "Sorry, the player could not open %s", match.title);
+        return;
+    }
+    /* Not a station, a warm start does not resume it */
+    snapshot_set_station(-1);
+    notify_now_playing();
+    size_t length = (size_t)snprintf(out, size, "Playing [i]%s[/i]", match.title);
+    if (match.artist[0] && length < size) {
+        length += (size_t)snprintf(out + length, size - length, " by %s", match.artist);
+    }
+    if (matches > 1 && length < size) {
+        snprintf(out + length, size - length, " (first of %llu matches)", (unsigned long long)matches);
+    }
+}
+
+/* Private message tagged with a return code, so a flood rejection comes back through onServerErrorEvent */
+static void send_private_message(uint64 serverConnectionHandlerID, const char* text, anyID toID)
+{
+    char        returnCode[RETURNCODE_BUFSIZE];
+    const char* code = NULL;
+    if (pluginID) {
+        ts3Functions.createReturnCode(pluginID, returnCode, RETURNCODE_BUFSIZE);
+        code = returnCode;
+    }
+    if (TRACE_CALL("requestSendPrivateTextMsg", ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, text, toID, code)) == ERROR_ok) {
+        metrics_inc(messages_sent_metric);
+    }
+}
+
+/* Commands that talk to the player answer right away until it is ready, returns 1 if it replied */
+static int reply_if_warming_up(uint64 serverConnectionHandlerID, anyID fromID)
+{
+    if (connection && player_is_ready()) {
+        return 0;
     }
+    send_private_message(serverConnectionHandlerID, "Warming up, the player is not ready yet. Try again in a few seconds.", fromID);
+    return 1;
+}
+
+/* Commands limited to some server groups by an allow rule, returns 1 if it replied */
+static int reply_if_denied(int rule, uint64 serverConnectionHandlerID, anyID fromID, const char* fromUID)
+{
+    if (acl_check(rule, serverConnectionHandlerID, fromID, fromUID)) {
+        return 0;
+    }
+    char reply[128];
+    snprintf(reply, sizeof(reply), "Sorry, %s is limited to some server groups.", rule == CONFIG_RULE_STATIONS ? "changing the station" : config_rule_names[rule]);
+    send_private_message(serverConnectionHandlerID, reply, fromID);
+    return 1;
+}
+
+/* A private message to the bot, the callback below already dropped everything else */
+static void handle_text_message(uint64 serverConnectionHandlerID, anyID fromID, const char* fromName, const char* fromUID, const char* message)
+{
+    TRACE_SPAN("onTextMessageEvent");
+    LOG_INFO("PLUGIN: onTextMessageEvent %llu %d %s %s", (long long unsigned int)serverConnectionHandlerID, fromID, fromName, message);
+    char alias[CONFIG_KEYWORD_BYTES];
+    message = config_resolve_alias(message, alias, sizeof(alias));
 
     uint64 senderChannelID;
-    if (ts3Functions.getChannelOfClient(serverConnectionHandlerID, fromID, &senderChannelID) != ERROR_ok) {
+    if (TRACE_CALL("getChannelOfClient", ts3Functions.getChannelOfClient(serverConnectionHandlerID, fromID, &senderChannelID)) != ERROR_ok) {
         ts3Functions.logMessage("Error querying sender channel ID", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-        return 1;
+        return;
     }
 
     if(strcmp(message, "!join") == 0) {
-        if(currentChannelID == DEFAULT_CHANNEL_ID) {
-            printf("Join command detected from cid: %d!\n", fromID);
+        metrics_inc(basic_command_metric[CMD_JOIN]);
+        if (reply_if_denied(CONFIG_RULE_JOIN, serverConnectionHandlerID, fromID, fromUID)) {
+            return;
+        }
+        if(currentChannelID == config_default_channel()) {
+            LOG_INFO("Join command detected from cid: %d!", fromID);
             uint64 channelID;
-            if(ts3Functions.getChannelOfClient(serverConnectionHandlerID, fromID, &channelID) == ERROR_ok) {
-                printf("Requested to move bot to channel %lu\n", channelID);
-                if (ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, channelID, "", "") != ERROR_ok) {
+            if(TRACE_CALL("getChannelOfClient", ts3Functions.getChannelOfClient(serverConnectionHandlerID, fromID, &channelID)) == ERROR_ok) {
+                LOG_INFO("Requested to move bot to channel %llu", (unsigned long long)channelID);
+                if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, channelID, "", "")) != ERROR_ok) {
                     ts3Functions.logMessage("Failed to move to client channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
                 }
             }
-            return 0;
+            return;
         } else {
-            ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Sorry, I can join user's channel only when I am in default (MUSIC) channel", fromID, NULL);
-            return 0;
+            send_private_message(serverConnectionHandlerID, "Sorry, I can join user's channel only when I am in default (MUSIC) channel", fromID);
+            return;
         }
     } 
 
@@ -375,211 +1209,437 @@ int ts3plugin_onTextMessageEvent(uint64 serverConnectionHandlerID, anyID targetM
         char sorryMessage[256];
         snprintf(sorryMessage, sizeof(sorryMessage), 
                  "Sorry %s, I can only respond to clients in the same room.", fromName);
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, sorryMessage, fromID, NULL);
-        return 0; 
+        send_private_message(serverConnectionHandlerID, sorryMessage, fromID);
+        return;
     }
 
     // Command handling
     if (strcmp(message, "!list") == 0 || strcmp(message, "!help") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID,
-            "Available commands:\n"
-            "!list or !help - Display this help message\n"
-            "!song - Current song name\n"
-            "!join - Make MUSICBOT join your channel\n"
-            "!kick - Kick bot\n"
-            "!00 - 00 Club Hits Station\n"
-            "!breaks - Breaks Station\n"
-            "!slap_house - Slap House Station\n"
-            "!house - House Station\n"
-            "!deep_organic_house - Deep Organic House Station\n"
-            "!bassline - Bassline Station\n"
-            "!future_garage - Future Garage station\n"
-            "!bnj - Bass & Jackin' House station\n"
-            "!fb - Future Bass station\n"
-            "!cnth - Chill & Tropical House station\n"
-            "!ew - Electro Swing station\n"
-            "!cb - Club Dubstep station\n"
-            "!vl - Vocal Lounge station\n"
-            "!vc - Vocal Chillout station\n"
-            "!ld - Liquid Dubstep station\n"
-            "!ldnb - Liquid DnB station\n"
-            "!lh - Latin House station\n"
-            "!jung - Jungle station\n"
-            "!jh - Jazz House station\n"
-            "!dub - Dubstep station\n"
-            "!drum - DrumStep station\n"
-            "!chill - Chillout station\n"
-            "!ab - Atmospheric Breaks station\n"
-            "!cs - Chillstep station\n"
-            "!dnb - Drum and Bass station\n"
-            "!mix - Dj Mixes station\n"
-            "!lounge - Lounge station\n"
-            "!ambient - Ambient station\n"
-            "!funky - Funky House station\n"
-            "!space - Space Dreams station\n"
-            "!cd - Chillout Dreams station\n"
-            "!disco - Disco House station", 
-            fromID, NULL);
+        metrics_inc(basic_command_metric[message[1] == 'l' ? CMD_LIST : CMD_HELP]);
+        char help[HELP_REPLY_BUFSIZE];
+        help_reply(help, sizeof(help));
+        send_private_message(serverConnectionHandlerID, help, fromID);
     } else if (strcmp(message, "!song") == 0) {
-        char message[256];
-        printf("Get current song request, getting...");
-        char *song_name = GetSongName(connection);
+        metrics_inc(basic_command_metric[CMD_SONG]);
+        if (reply_if_warming_up(serverConnectionHandlerID, fromID)) {
+            return;
+        }
+        char message[256] = "";
+        LOG_DEBUG("Get current song request, getting...");
+        char *song_name;
+        char *station;
+        GetNowPlaying(connection, &song_name, &station);
         if (song_name) {
-            printf("Currently playing: %s\n", song_name);
+            LOG_INFO("Currently playing: %s", song_name);
             snprintf(message, sizeof(message), "[b]Currently playing:[/b] [i]%s[/i]", song_name);
         }
 
-        char *station = GetStationName(connection);
         if(station) {
-            printf("Station: %s\n", station);
+            LOG_INFO("Station: %s", station);
             size_t len = strlen(message);
             snprintf(message + len, sizeof(message) - len, " [b]at:[/b] [i]%s[/i]", station);
         }
 
+        status_set_now_playing(song_name, station);
         if(!song_name && !station) {
-            ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Sorry, got unexcepted error while getting current song :c", fromID, NULL);
+            send_private_message(serverConnectionHandlerID, "Sorry, got unexcepted error while getting current song :c", fromID);
     
         } else {
-            ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, message, fromID, NULL);
+            send_private_message(serverConnectionHandlerID, message, fromID);
         }
         free(song_name);
         free(station);
+    } else if (strncmp(message, "!history", 8) == 0 && (message[8] == '\0' || message[8] == ' ')) {
+        metrics_inc(basic_command_metric[CMD_HISTORY]);
+        char reply[HISTORY_REPLY_BUFSIZE];
+        history_reply(message + 8, reply, sizeof(reply));
+        send_private_message(serverConnectionHandlerID, reply, fromID);
+    } else if (strncmp(message, "!play", 5) == 0 && (message[5] == '\0' || message[5] == ' ')) {
+        metrics_inc(basic_command_metric[CMD_PLAY]);
+        if (reply_if_denied(CONFIG_RULE_STATIONS, serverConnectionHandlerID, fromID, fromUID) || reply_if_warming_up(serverConnectionHandlerID, fromID)) {
+            return;
+        }
+        char reply[PLAY_REPLY_BUFSIZE];
+        play_from_library(message + 5, reply, sizeof(reply));
+        send_private_message(serverConnectionHandlerID, reply, fromID);
     } else if(strcmp(message, "!kick") == 0) {
-        printf("Moving to default channel (ID: %d)...\n", DEFAULT_CHANNEL_ID);
-        if (ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, DEFAULT_CHANNEL_ID, "", "") != ERROR_ok) {
+        metrics_inc(basic_command_metric[CMD_KICK]);
+        if (reply_if_denied(CONFIG_RULE_KICK, serverConnectionHandlerID, fromID, fromUID)) {
+            return;
+        }
+        uint64_t defaultChannelID = config_default_channel();
+        LOG_INFO("Moving to default channel (ID: %llu)...", (unsigned long long)defaultChannelID);
+        if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, defaultChannelID, "", "")) != ERROR_ok) {
             ts3Functions.logMessage("Failed to move to default channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
         }
-        printf("Created move request!\n");
-    } else if (strcmp(message, "!00") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into 00s Club Hits station!", fromID, NULL);
-        change_station(connection, ClubHits);
-    } else if (strcmp(message, "!breaks") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Breaks station!", fromID, NULL);
-        change_station(connection, Breaks);
-    } else if (strcmp(message, "!slap_house") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Slap House station!", fromID, NULL);
-        change_station(connection, SlapHouse);
-    } else if (strcmp(message, "!house") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into House station!", fromID, NULL);
-        change_station(connection, House);
-    } else if (strcmp(message, "!deep_organic_house") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Deep Organic House station!", fromID, NULL);
-        change_station(connection, DeepOrganicHouse);
-    } else if (strcmp(message, "!bassline") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Bassline station!", fromID, NULL);
-        change_station(connection, Bassline);
-    } else if (strcmp(message, "!future_garage") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Future Garage station!", fromID, NULL);
-        change_station(connection, FutureGarage);
-    } else if (strcmp(message, "!bnj") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Bass & Jackin' House station!", fromID, NULL);
-        change_station(connection, BassAndJackingHouse);
-    } else if (strcmp(message, "!fb") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Future Bass station!", fromID, NULL);
-        change_station(connection, FutureBass);
-    } else if (strcmp(message, "!cnth") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Chill & Tropical House station!", fromID, NULL);
-        change_station(connection, ChillAndTropicalHouse);
-    } else if (strcmp(message, "!ew") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Electro Swing station!", fromID, NULL);
-        change_station(connection, ElectroSwing);
-    } else if (strcmp(message, "!cb") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Club Dubstep station!", fromID, NULL);
-        change_station(connection, ClubDubstep);
-    } else if (strcmp(message, "!vl") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Vocal Lounge station!", fromID, NULL);
-        change_station(connection, VocalLounge);
-    } else if (strcmp(message, "!vc") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Vocal Chillout station!", fromID, NULL);
-        change_station(connection, VocalChillout);
-    } else if (strcmp(message, "!ld") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Liquid Dubstep station!", fromID, NULL);
-        change_station(connection, LiquidDubstep);
-    } else if (strcmp(message, "!ldnb") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Liquid DnB station!", fromID, NULL);
-        change_station(connection, LiquidDnB);
-    } else if (strcmp(message, "!lh") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Latin House station!", fromID, NULL);
-        change_station(connection, LatinHouse);
-    } else if (strcmp(message, "!jung") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Jungle station!", fromID, NULL);
-        change_station(connection, Jungle);
-    } else if (strcmp(message, "!jh") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Jazz House station!", fromID, NULL);
-        change_station(connection, JazzHouse);
-    } else if (strcmp(message, "!dub") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Dubstep station!", fromID, NULL);
-        change_station(connection, Dubstep);
-    } else if (strcmp(message, "!drum") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Drumstep station!", fromID, NULL);
-        change_station(connection, Drumstep);
-    } else if (strcmp(message, "!chill") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Chillout station!", fromID, NULL);
-        change_station(connection, Chillout);
-    } else if (strcmp(message, "!ab") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Atmospheric Breaks station!", fromID, NULL);
-        change_station(connection, AtmosphericBreaks);
-    } else if (strcmp(message, "!cs") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Chillstep station!", fromID, NULL);
-        change_station(connection, Chillstep);
-    } else if (strcmp(message, "!dnb") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Drum and Bass station!", fromID, NULL);
-        change_station(connection, DrumAndBass);
-    } else if (strcmp(message, "!mix") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into DJ Mixes station!", fromID, NULL);
-        change_station(connection, DJMixes);
-    } else if (strcmp(message, "!lounge") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Lounge station!", fromID, NULL);
-        change_station(connection, Lounge);
-    } else if (strcmp(message, "!ambient") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Ambient station!", fromID, NULL);
-        change_station(connection, Ambient);
-    } else if (strcmp(message, "!funky") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Funky House station!", fromID, NULL);
-        change_station(connection, FunkyHouse);
-    } else if (strcmp(message, "!space") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Space Dreams station!", fromID, NULL);
-        change_station(connection, SpaceDreams);
-    } else if (strcmp(message, "!cd") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Chillout Dreams station!", fromID, NULL);
-        change_station(connection, ChilloutDreams);
-    } else if (strcmp(message, "!disco") == 0) {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, "Tuning into Disco House station!", fromID, NULL);
-        change_station(connection, DiscoHouse);
-    }
-    else {
-        ts3Functions.requestSendPrivateTextMsg(serverConnectionHandlerID, 
-            "Unknown command. Type !list or !help to see available commands.", fromID, NULL);
+        LOG_DEBUG("Created move request!");
+    } else {
+        config_station station;
+        if (config_find_station(message, &station)) {
+            char reply[128];
+            metrics_inc(station.metric);
+            if (reply_if_denied(CONFIG_RULE_STATIONS, serverConnectionHandlerID, fromID, fromUID) || reply_if_warming_up(serverConnectionHandlerID, fromID)) {
+                return;
+            }
+            snprintf(reply, sizeof(reply), "Tuning into %s station!", station.name);
+            send_private_message(serverConnectionHandlerID, reply, fromID);
+            tune_station(station.station);
+        } else {
+            metrics_inc(basic_command_metric[CMD_UNKNOWN]);
+            send_private_message(serverConnectionHandlerID, 
+                "Unknown command. Type !list or !help to see available commands.", fromID);
+        }
     }
+}
 
+int ts3plugin_onTextMessageEvent(uint64 serverConnectionHandlerID, anyID targetMode, anyID toID, anyID fromID, const char* fromName, const char* fromUniqueIdentifier, const char* message, int ffIgnored)
+{
+    recorder_text_message(serverConnectionHandlerID, targetMode, toID, fromID, fromName, fromUniqueIdentifier, message, ffIgnored);
+    if (ffIgnored || targetMode != TextMessageTarget_CLIENT || fromID == atomic_load_explicit(&shared_client_id, memory_order_relaxed)) {
+        return 1;
+    }
+
+    loop_event event = {.type = BOT_EVENT_TEXT, .client = fromID, .server = serverConnectionHandlerID};
+    loop_copy_string(event.name, sizeof(event.name), fromName);
+    loop_copy_string(event.text, sizeof(event.text), message);
+    loop_copy_string(event.uid, sizeof(event.uid), fromUniqueIdentifier);
+    /* A dropped command is not answered, the message still shows up in the client */
+    if (loop_push(&event) != 0) {
+        metrics_inc(messages_dropped_metric);
+    }
     return 0;
 }
 
-void ts3plugin_onClientKickFromChannelEvent (uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID kickerID, const char *kickerName, const char *kickerUniqueIdentifier, const char *kickMessage) {
-    printf("Client kicked from channel!!!\n");
-    printf("Setting old channel codec to voice..\n");
+/* Plugin commands go to the given clients, see remote_module.h */
+static void send_plugin_command(uint64_t serverConnectionHandlerID, const uint16_t* targets, size_t count, const char* text)
+{
+    anyID clients[REMOTE_MAX_SUBSCRIBERS + 1];
+    count = count < REMOTE_MAX_SUBSCRIBERS ? count : REMOTE_MAX_SUBSCRIBERS;
+    memcpy(clients, targets, count * sizeof(anyID));
+    clients[count] = 0;
+    if (pluginID) {
+        ts3Functions.sendPluginCommand(serverConnectionHandlerID, pluginID, text, PluginCommandTarget_CLIENT, clients, NULL);
+    }
+}
+
+/* STATION of remote_format.h: the checks of the chat command, without its replies */
+static int run_remote_station(uint64 serverConnectionHandlerID, anyID fromID, const char* fromUID, remote_cursor* request, uint8_t* body, size_t* bodyLength)
+{
+    int            index = remote_u16(request);
+    uint64         senderChannelID;
+    config_station station;
+    if (request->failed) {
+        return REMOTE_BAD_REQUEST;
+    }
+    if (TRACE_CALL("getChannelOfClient", ts3Functions.getChannelOfClient(serverConnectionHandlerID, fromID, &senderChannelID)) != ERROR_ok || senderChannelID != currentChannelID) {
+        return REMOTE_NOT_HERE;
+    }
+    if (!config_station_of(index, &station)) {
+        return REMOTE_UNKNOWN_STATION;
+    }
+    if (!acl_check(CONFIG_RULE_STATIONS, serverConnectionHandlerID, fromID, fromUID)) {
+        return REMOTE_DENIED;
+    }
+    if (!connection || !player_is_ready()) {
+        return REMOTE_WARMING_UP;
+    }
+    tune_station(index);
+    *bodyLength = remote_put_string(body, station.name, REMOTE_MAX_STRING);
+    return REMOTE_OK;
+}
+
+/* A request decoded by ts3plugin_onPluginCommandEvent, length -1 if it was broken, answered in as few plugin commands as fit */
+static void handle_remote_command(uint64 serverConnectionHandlerID, anyID fromID, const char* fromUID, const uint8_t* payload, long length)
+{
+    TRACE_SPAN("onPluginCommandEvent");
+    remote_writer    writer;
+    remote_cursor    request;
+    remote_operation operation;
+    uint16_t         count;
+    remote_begin(&writer, serverConnectionHandlerID, fromID, REMOTE_ANSWER);
+    if (length < 0 || remote_open(&request, payload, (size_t)length, &count) != 0) {
+        remote_flush(&writer, 1);
+        return;
+    }
+    for (uint16_t i = 0; i < count && remote_next(&request, &operation); i++) {
+        uint8_t body[REMOTE_MAX_STRING];
+        size_t  bodyLength = 0;
+        int     status     = REMOTE_OK;
+        switch (operation.op) {
+        case REMOTE_OP_STATION:
+            status = run_remote_station(serverConnectionHandlerID, fromID, fromUID, &operation.body, body, &bodyLength);
+            break;
+        case REMOTE_OP_NOW_PLAYING:
+            bodyLength = now_playing_body(body);
+            break;
+        case REMOTE_OP_SUBSCRIBE: {
+            uint8_t on = remote_u8(&operation.body);
+            status     = operation.body.failed ? REMOTE_BAD_REQUEST : remote_subscribe(serverConnectionHandlerID, fromID, on);
+            break;
+        }
+        default:
+            status = REMOTE_UNKNOWN_OP;
+            break;
+        }
+        remote_answer(&writer, operation.id, operation.op, status, body, bodyLength);
+    }
+    if (request.failed) {
+        remote_answer(&writer, 0, 0, REMOTE_BAD_REQUEST, NULL, 0); /* cut short, the operations before were run */
+    }
+    remote_flush(&writer, 0);
+}
+
+void ts3plugin_onPluginCommandEvent(uint64 serverConnectionHandlerID, const char* pluginName, const char* pluginCommand, anyID invokerClientID, const char* invokerName, const char* invokerUniqueIdentity)
+{
+    recorder_plugin_command(serverConnectionHandlerID, pluginName, pluginCommand, invokerClientID, invokerName, invokerUniqueIdentity);
+    loop_event event = {.type = BOT_EVENT_REMOTE, .client = invokerClientID, .server = serverConnectionHandlerID};
+    /* The binary request travels in the text field, value holds its length */
+    event.value = (int32_t)remote_decode(pluginCommand, (uint8_t*)event.text, sizeof(event.text) < REMOTE_MAX_REQUEST ? sizeof(event.text) : REMOTE_MAX_REQUEST);
+    if (event.value == 0) {
+        return; /* some other plugin's command */
+    }
+    loop_copy_string(event.uid, sizeof(event.uid), invokerUniqueIdentity);
+    loop_push(&event);
+}
+
+/* station of control_module.h: a chat keyword (with or without its '!') or a track list index */
+static int run_control_station(const char* argument, char* out, size_t size)
+{
+    config_station station;
+    char*          end;
+    long           index = strtol(argument, &end, 10);
+    int            found;
+    if (*argument && !*end) {
+        found = index >= 0 && index == (int)index && config_station_of((int)index, &station);
+    } else {
+        char keyword[CONFIG_KEYWORD_BYTES];
+        char alias[CONFIG_KEYWORD_BYTES];
+        snprintf(keyword, sizeof(keyword), "%s%s", argument[0] == '!' ? "" : "!", argument);
+        found = config_find_station(config_resolve_alias(keyword, alias, sizeof(alias)), &station);
+    }
+    if (!found) {
+        snprintf(out, size, "unknown-station %s", argument);
+        return CONTROL_FAILED;
+    }
+    if (!connection || !player_is_ready()) {
+        snprintf(out, size, "warming-up the player is not ready yet");
+        return CONTROL_FAILED;
+    }
+    tune_station(station.station);
+    snprintf(out, size, "%d\t%s", station.station, control_clean(station.name));
+    return CONTROL_OK;
+}
+
+/* The verbs of the control socket beyond ping and metrics, on the loop thread */
+static int handle_control_request(const char* verb, const char* argument, char* out, size_t size)
+{
+    TRACE_SPAN("controlRequest");
+    if (strcmp(verb, "station") == 0 && argument) {
+        return run_control_station(argument, out, size);
+    }
+    if (strcmp(verb, "station") == 0) {
+        int station = tuned_station();
+        snprintf(out, size, "%d\t%s", station, station >= 0 ? station_name(station) : "");
+        return CONTROL_OK;
+    }
+    if (strcmp(verb, "now-playing") == 0 && !argument) {
+        bot_status status;
+        status_read(&status);
+        snprintf(out, size, "%d\t%s\t%s", tuned_station(), control_clean(status.song), control_clean(status.station));
+        return CONTROL_OK;
+    }
+    if (strcmp(verb, "listeners") == 0 && !argument) {
+        bot_status status;
+        status_read(&status);
+        snprintf(out, size, "%d\t%llu", status.listeners, (unsigned long long)currentChannelID);
+        return CONTROL_OK;
+    }
+    return CONTROL_UNKNOWN;
+}
+
+int ts3plugin_onServerErrorEvent(uint64 serverConnectionHandlerID, const char* errorMessage, unsigned int error, const char* returnCode, const char* extraMessage)
+{
+    recorder_server_error(serverConnectionHandlerID, errorMessage, error, returnCode, extraMessage);
+    /* Only requests sent with one of our return codes arrive here with a return code */
+    if (!returnCode || !returnCode[0]) {
+        return 0;
+    }
+    if (error == ERROR_client_is_flooding) {
+        metrics_inc(messages_throttled_metric);
+        /* Could be a now playing edit, only the loop thread knows */
+        loop_event event = {.type = BOT_EVENT_FLOODED, .server = serverConnectionHandlerID};
+        loop_copy_string(event.text, sizeof(event.text), returnCode);
+        loop_push(&event);
+    }
+    if (error != ERROR_ok) {
+        LOG_WARN("PLUGIN: request %s failed: %s (%u) %s", returnCode, errorMessage, error, extraMessage ? extraMessage : "");
+    }
+    return 1; /* handled, the client does not need to show it */
+}
+
+static void handle_talk_status(uint64 serverConnectionHandlerID, int status, anyID clientID)
+{
+    TRACE_SPAN("onTalkStatusChangeEvent");
+    if (clientID == myClientID || serverConnectionHandlerID != currentConnHandlerID) {
+        return;
+    }
+
+    if (status == STATUS_TALKING) {
+        uint64 channelID;
+        if (TRACE_CALL("getChannelOfClient", ts3Functions.getChannelOfClient(serverConnectionHandlerID, clientID, &channelID)) != ERROR_ok || channelID != currentChannelID) {
+            return;
+        }
+        talk_state_set(clientID, 1);
+    } else {
+        talk_state_set(clientID, 0);
+    }
+}
+
+void ts3plugin_onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper, anyID clientID)
+{
+    recorder_talk_status(serverConnectionHandlerID, status, isReceivedWhisper, clientID);
+    if (isReceivedWhisper) {
+        return;
+    }
+    loop_event event = {.type = BOT_EVENT_TALK, .client = clientID, .value = status, .server = serverConnectionHandlerID};
+    loop_push(&event);
+}
+
+void ts3plugin_onEditCapturedVoiceDataEvent(uint64 serverConnectionHandlerID, short* samples, int sampleCount, int channels, int* edited)
+{
+    TRACE_SPAN("onEditCapturedVoiceDataEvent");
+    recorder_captured_voice(serverConnectionHandlerID, sampleCount, channels);
+    if (decks_process(samples, sampleCount, channels)) {
+        *edited |= 1;
+    }
+    if (duck_process(samples, sampleCount, channels)) {
+        *edited |= 1;
+    }
+    if (!silence_process(samples, sampleCount, channels)) {
+        *edited &= ~2;
+    }
+}
+
+static void handle_client_kick(uint64 serverConnectionHandlerID, uint64 oldChannelID, const char *kickerName) {
+    TRACE_SPAN("onClientKickFromChannelEvent");
+    LOG_INFO("Client kicked from channel by %s", kickerName);
+    LOG_DEBUG("Setting old channel codec to voice..");
     int error;
     if (oldChannelID != 0) {
-        if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE)) != ERROR_ok) {
+        if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, oldChannelID, CHANNEL_CODEC, CODEC_OPUS_VOICE))) != ERROR_ok) {
             ts3Functions.logMessage("Failed to set old channel codec to voice", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-            printf("At client move event error num: %d\n", error);
+            LOG_ERROR("At client move event error num: %d", error);
         } else {
-            ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, "");
-            printf("Old channel codec set to voice.\n");
+            TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, oldChannelID, ""));
+            metrics_inc(codec_flushes_metric);
+            LOG_DEBUG("Old channel codec set to voice.");
         }
     }
 
-    printf("Moving to default channel (ID: %d)...\n", DEFAULT_CHANNEL_ID);
-    if (ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, DEFAULT_CHANNEL_ID, "", "") != ERROR_ok) {
+    uint64_t defaultChannelID = config_default_channel();
+    LOG_INFO("Moving to default channel (ID: %llu)...", (unsigned long long)defaultChannelID);
+    if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(serverConnectionHandlerID, myClientID, defaultChannelID, "", "")) != ERROR_ok) {
         ts3Functions.logMessage("Failed to move to default channel", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
     }
-    printf("Created move request!\n");
+    LOG_DEBUG("Created move request!");
 
-    if ((error = ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, DEFAULT_CHANNEL_ID, CHANNEL_CODEC, CODEC_OPUS_MUSIC)) != ERROR_ok) {
+    if ((error = TRACE_CALL("setChannelVariableAsInt", ts3Functions.setChannelVariableAsInt(serverConnectionHandlerID, defaultChannelID, CHANNEL_CODEC, CODEC_OPUS_MUSIC))) != ERROR_ok) {
         ts3Functions.logMessage("Failed to set old channel codec to voice", LogLevel_ERROR, "Plugin", serverConnectionHandlerID);
-        printf("At client move event error num: %d\n", error);
+        LOG_ERROR("At client move event error num: %d", error);
     } else {
-        ts3Functions.flushChannelUpdates(serverConnectionHandlerID, DEFAULT_CHANNEL_ID, "");
-        printf("Old channel codec set to voice.\n");
+        TRACE_CALL("flushChannelUpdates", ts3Functions.flushChannelUpdates(serverConnectionHandlerID, defaultChannelID, ""));
+        metrics_inc(codec_flushes_metric);
+        LOG_DEBUG("Old channel codec set to voice.");
     }
-}
\ No newline at end of file
+}
+
+void ts3plugin_onClientKickFromChannelEvent (uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID kickerID, const char *kickerName, const char *kickerUniqueIdentifier, const char *kickMessage) {
+    recorder_client_moved_by(RECORDING_CLIENT_KICK_CHANNEL, serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility, kickerID, kickerName, kickerUniqueIdentifier, kickMessage);
+    loop_event event = {.type = BOT_EVENT_KICK, .client = clientID, .other = kickerID, .value = visibility, .server = serverConnectionHandlerID, .old_channel = oldChannelID, .new_channel = newChannelID};
+    loop_copy_string(event.name, sizeof(event.name), kickerName);
+    loop_push(&event);
+}
+
+/* Server group changes and answers to requestServerGroupsByClientID, for acl_module.h */
+void ts3plugin_onServerGroupByClientIDEvent(uint64 serverConnectionHandlerID, const char* name, uint64 serverGroupList, uint64 clientDatabaseID)
+{
+    recorder_server_group_by_client(serverConnectionHandlerID, name, serverGroupList, clientDatabaseID);
+    loop_event event = {.type = BOT_EVENT_GROUP_OF_CLIENT, .server = serverConnectionHandlerID, .group = serverGroupList, .database_id = clientDatabaseID};
+    loop_push(&event);
+}
+
+void ts3plugin_onServerGroupClientAddedEvent(uint64 serverConnectionHandlerID, anyID clientID, const char* clientName, const char* clientUniqueIdentity, uint64 serverGroupID, anyID invokerClientID, const char* invokerName, const char* invokerUniqueIdentity)
+{
+    recorder_server_group_client(RECORDING_SERVER_GROUP_ADDED, serverConnectionHandlerID, clientID, clientName, clientUniqueIdentity, serverGroupID, invokerClientID, invokerName, invokerUniqueIdentity);
+    loop_event event = {.type = BOT_EVENT_GROUP_ADDED, .client = clientID, .server = serverConnectionHandlerID, .group = serverGroupID};
+    loop_copy_string(event.uid, sizeof(event.uid), clientUniqueIdentity);
+    loop_push(&event);
+}
+
+void ts3plugin_onServerGroupClientDeletedEvent(uint64 serverConnectionHandlerID, anyID clientID, const char* clientName, const char* clientUniqueIdentity, uint64 serverGroupID, anyID invokerClientID, const char* invokerName, const char* invokerUniqueIdentity)
+{
+    recorder_server_group_client(RECORDING_SERVER_GROUP_DELETED, serverConnectionHandlerID, clientID, clientName, clientUniqueIdentity, serverGroupID, invokerClientID, invokerName, invokerUniqueIdentity);
+    loop_event event = {.type = BOT_EVENT_GROUP_DELETED, .client = clientID, .server = serverConnectionHandlerID, .group = serverGroupID};
+    loop_copy_string(event.uid, sizeof(event.uid), clientUniqueIdentity);
+    loop_push(&event);
+}
+
+/* Runs on the event loop thread, the only place that changes the bot state */
+static void handle_bot_event(const loop_event* event)
+{
+    switch (event->type) {
+    case BOT_EVENT_CONNECT:
+        handle_connect_status(event->server, event->value);
+        break;
+    case BOT_EVENT_MOVE:
+        handle_client_move(event->server, event->client, event->old_channel, event->new_channel);
+        break;
+    case BOT_EVENT_MOVED:
+        handle_client_moved(event->server, event->client, event->old_channel, event->new_channel, event->name);
+        break;
+    case BOT_EVENT_KICK:
+        handle_client_kick(event->server, event->old_channel, event->name);
+        break;
+    case BOT_EVENT_TEXT:
+        handle_text_message(event->server, event->client, event->name, event->uid, event->text);
+        break;
+    case BOT_EVENT_TALK:
+        handle_talk_status(event->server, event->value, event->client);
+        break;
+    case BOT_EVENT_FLOODED:
+        nowplaying_flooded(event->text);
+        break;
+    case BOT_EVENT_GROUP_ADDED:
+        acl_group_added(event->uid, event->group);
+        break;
+    case BOT_EVENT_GROUP_DELETED:
+        acl_group_deleted(event->uid, event->group);
+        break;
+    case BOT_EVENT_GROUP_OF_CLIENT:
+        acl_group_of_database_id(event->database_id, event->group);
+        break;
+    case BOT_EVENT_REMOTE:
+        handle_remote_command(event->server, event->client, event->uid, (const uint8_t*)event->text, event->value);
+        break;
+    case BOT_EVENT_LIBRARY:
+        if (library_reload() == 0) {
+            LOG_INFO("Library catalog mapped, %llu tracks", (unsigned long long)atomic_load(&library_tracks));
+        }
+        break;
+    case BOT_EVENT_FAILOVER:
+        if (connection && player_is_ready()) {
+            tune_station(event->value);
+        } else {
+            LOG_WARN("Player not ready, no failover to station %d", event->value);
+        }
+        break;
+    case BOT_EVENT_BUS:
+        connection = atomic_load(&session_bus);
+        loop_attach_dbus(connection);
+        start_now_playing();
+        break;
+    default:
+        LOG_WARN("Unknown event type %u on the loop queue", (unsigned)event->type);
+        break;
+    }
+}
@@ -0,0 +1,402 @@
+#ifndef RECORDER_MODULE_H
+#define RECORDER_MODULE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log_module.h"
+#include "metrics_module.h"
+#include "recording_format.h"
+
+/*
+ * Opt-in recorder for the callbacks the plugin receives.
+ *
+ * While a recording is open every ts3plugin_on* callback calls one of the
+ * recorder_* functions below, which encodes its arguments (see
+ * recording_format.h) into a stack buffer and copies it into a shared byte
+ * ring. Producers, including the audio thread, claim space with a
+ * compare-and-swap on the head and publish the record by storing its length
+ * word last; a full ring drops the record and counts it. A writer thread
+ * drains the ring in claim order every RECORDER_DRAIN_MS, zeroing what it
+ * consumed so an unpublished record always reads as length 0, and appends
+ * it to the file. With no recording open every recorder_* call is one
+ * relaxed load and a branch. A producer counts itself in flight while it
+ * encodes and commits, recorder_close waits for those before the final
+ * drain so no record is left in the ring for the next recording.
+ *
+ * Replay a recording with tools/fakehost.
+ */
+
+/* Power of two */
+#define RECORDER_RING_BYTES (4u << 20)
+#define RECORDER_DRAIN_MS 10
+#define RECORDER_DEFAULT_PATH "/tmp/musicbot-events.bin"
+/* Cap on the clients listed in a snapshot, keeps it within RECORDING_MAX_RECORD */
+#define RECORDER_SNAPSHOT_CLIENTS 1024
+
+static _Alignas(64) uint8_t recorder_ring[RECORDER_RING_BYTES];
+static _Alignas(64) _Atomic uint64_t recorder_head = 0;
+static _Alignas(64) _Atomic uint64_t recorder_tail = 0;
+
+static atomic_int       recorder_enabled  = 0;
+static atomic_int       recorder_inflight = 0;
+static _Atomic uint64_t recorder_dropped  = 0;
+static _Atomic uint64_t recorder_written  = 0;
+static uint64_t         recorder_start_ns = 0;
+static FILE*            recorder_file     = NULL;
+static pthread_t        recorder_thread;
+static atomic_int       recorder_running = 0;
+
+typedef struct {
+    uint8_t data[RECORDING_MAX_RECORD];
+    size_t  size;
+} recorder_buffer;
+
+static uint64_t recorder_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline int recorder_active(void)
+{
+    return __builtin_expect(atomic_load_explicit(&recorder_enabled, memory_order_relaxed), 0);
+}
+
+/* Enter as a producer, 0 if the recording is still open. A 0 return must be followed by recorder_commit. */
+static int recorder_begin(recorder_buffer* buffer, uint16_t type)
+{
+    atomic_fetch_add(&recorder_inflight, 1);
+    if (!atomic_load(&recorder_enabled)) {
+        atomic_fetch_sub(&recorder_inflight, 1);
+        return -1;
+    }
+    recording_record_header header = {0, type, 0, recorder_clock_ns(CLOCK_MONOTONIC) - recorder_start_ns};
+    memcpy(buffer->data, &header, sizeof(header));
+    buffer->size = sizeof(header);
+    return 0;
+}
+
+static void recorder_put(recorder_buffer* buffer, const void* data, size_t size)
+{
+    if (buffer->size + size > sizeof(buffer->data))
+        return;
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+#define RECORDER_PUT(buffer, type, value)                                                                                                                                                                                                                      \
+    do {                                                                                                                                                                                                                                                       \
+        type recorder_value = (type)(value);                                                                                                                                                                                                                   \
+        recorder_put((buffer), &recorder_value, sizeof(recorder_value));                                                                                                                                                                                       \
+    } while (0)
+
+static void recorder_put_string(recorder_buffer* buffer, const char* text)
+{
+    size_t length = text ? strnlen(text, RECORDING_MAX_STRING) : 0;
+    RECORDER_PUT(buffer, uint16_t, length);
+    recorder_put(buffer, text, length);
+}
+
+static void recorder_ring_copy(uint64_t position, const uint8_t* data, size_t size)
+{
+    size_t offset = (size_t)(position & (RECORDER_RING_BYTES - 1));
+    size_t first  = size < RECORDER_RING_BYTES - offset ? size : RECORDER_RING_BYTES - offset;
+    memcpy(recorder_ring + offset, data, first);
+    memcpy(recorder_ring, data + first, size - first);
+}
+
+/* Claim ring space and publish the record, drops it if the writer is behind. Leaves the producer count. */
+static void recorder_commit(recorder_buffer* buffer)
+{
+    uint32_t length = (uint32_t)((buffer->size + 7) & ~(size_t)7);
+    memset(buffer->data + buffer->size, 0, length - buffer->size);
+
+    uint64_t head = atomic_load_explicit(&recorder_head, memory_order_relaxed);
+    do {
+        if (head + length - atomic_load_explicit(&recorder_tail, memory_order_acquire) > RECORDER_RING_BYTES) {
+            atomic_fetch_add_explicit(&recorder_dropped, 1, memory_order_relaxed);
+            atomic_fetch_sub_explicit(&recorder_inflight, 1, memory_order_release);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&recorder_head, &head, head + length, memory_order_relaxed, memory_order_relaxed));
+
+    /* Records are 8 byte aligned, so the length word never wraps */
+    recorder_ring_copy(head + sizeof(uint32_t), buffer->data + sizeof(uint32_t), length - sizeof(uint32_t));
+    atomic_store_explicit((_Atomic uint32_t*)(recorder_ring + (head & (RECORDER_RING_BYTES - 1))), length, memory_order_release);
+    atomic_fetch_sub_explicit(&recorder_inflight, 1, memory_order_release);
+}
+
+/* Write out every published record in claim order, stops at the first unpublished one */
+static void recorder_drain(void)
+{
+    uint64_t tail = atomic_load_explicit(&recorder_tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&recorder_head, memory_order_acquire);
+    while (tail < head) {
+        size_t   offset = (size_t)(tail & (RECORDER_RING_BYTES - 1));
+        uint32_t length = atomic_load_explicit((_Atomic uint32_t*)(recorder_ring + offset), memory_order_acquire);
+        if (length == 0)
+            break;
+        size_t first = length < RECORDER_RING_BYTES - offset ? length : RECORDER_RING_BYTES - offset;
+        fwrite(recorder_ring + offset, 1, first, recorder_file);
+        fwrite(recorder_ring, 1, length - first, recorder_file);
+        memset(recorder_ring + offset, 0, first);
+        memset(recorder_ring, 0, length - first);
+        tail += length;
+        atomic_store_explicit(&recorder_tail, tail, memory_order_release);
+        atomic_fetch_add_explicit(&recorder_written, 1, memory_order_relaxed);
+    }
+    fflush(recorder_file);
+}
+
+static void* recorder_writer(void* arg)
+{
+    (void)arg;
+    while (atomic_load(&recorder_running)) {
+        usleep(RECORDER_DRAIN_MS * 1000);
+        recorder_drain();
+    }
+    recorder_drain();
+    return NULL;
+}
+
+/* Start recording into path, replacing it. Returns 0 on success, -1 if already recording or the file cannot be created. */
+int recorder_open(const char* path)
+{
+    if (atomic_load(&recorder_running))
+        return -1;
+    recorder_file = fopen(path, "wb");
+    if (!recorder_file) {
+        LOG_ERROR("Cannot create recording %s", path);
+        return -1;
+    }
+    recording_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version           = RECORDING_VERSION;
+    header.header_size       = sizeof(header);
+    header.start_ns          = recorder_clock_ns(CLOCK_MONOTONIC);
+    header.start_realtime_ns = recorder_clock_ns(CLOCK_REALTIME);
+    fwrite(&header, sizeof(header), 1, recorder_file);
+    recorder_start_ns = header.start_ns;
+
+    atomic_store(&recorder_running, 1);
+    pthread_create(&recorder_thread, NULL, recorder_writer, NULL);
+    atomic_store(&recorder_enabled, 1);
+    LOG_INFO("Recording callbacks to %s", path);
+    return 0;
+}
+
+/* Stop recording and close the file. Returns the number of records written by this recording. */
+uint64_t recorder_close(void)
+{
+    atomic_store(&recorder_enabled, 0);
+    /* A producer that got past recorder_begin still commits, the final drain has to see its record */
+    while (atomic_load(&recorder_inflight))
+        sched_yield();
+    if (!atomic_exchange(&recorder_running, 0))
+        return 0;
+    pthread_join(recorder_thread, NULL);
+    fclose(recorder_file);
+    recorder_file = NULL;
+    return atomic_exchange(&recorder_written, 0);
+}
+
+static double recorder_metric_value(int which)
+{
+    return (double)atomic_load_explicit(which ? &recorder_dropped : &recorder_written, memory_order_relaxed);
+}
+
+void recorder_register_metrics(void)
+{
+    metrics_export("musicbot_recorder_records", "Callback records written by the current recording", METRIC_GAUGE, NULL, NULL, recorder_metric_value, 0);
+    metrics_export("musicbot_recorder_dropped_total", "Callback records dropped because the recording ring was full", METRIC_COUNTER, NULL, NULL, recorder_metric_value, 1);
+}
+
+/************************** Records, see recording_format.h ***************************/
+
+void recorder_snapshot(uint64_t server, uint16_t self, uint64_t channel, const uint16_t* clients, size_t count)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (count > RECORDER_SNAPSHOT_CLIENTS)
+        count = RECORDER_SNAPSHOT_CLIENTS;
+    if (recorder_begin(&buffer, RECORDING_SNAPSHOT) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, self);
+    RECORDER_PUT(&buffer, uint64_t, channel);
+    RECORDER_PUT(&buffer, uint16_t, count);
+    recorder_put(&buffer, clients, count * sizeof(uint16_t));
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_connect_status(uint64_t server, int status, unsigned int error)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_CONNECT_STATUS) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, int32_t, status);
+    RECORDER_PUT(&buffer, uint32_t, error);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_client_move(uint64_t server, uint16_t client, uint64_t old_channel, uint64_t new_channel, int visibility, const char* message)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_CLIENT_MOVE) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, client);
+    RECORDER_PUT(&buffer, uint64_t, old_channel);
+    RECORDER_PUT(&buffer, uint64_t, new_channel);
+    RECORDER_PUT(&buffer, int32_t, visibility);
+    recorder_put_string(&buffer, message);
+    recorder_commit(&buffer);
+}
+
+/* CLIENT_MOVE_MOVED and CLIENT_KICK_CHANNEL share their layout */
+static inline void recorder_client_moved_by(uint16_t type, uint64_t server, uint16_t client, uint64_t old_channel, uint64_t new_channel, int visibility, uint16_t by, const char* by_name,
+                                            const char* by_uid, const char* message)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, type) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, client);
+    RECORDER_PUT(&buffer, uint64_t, old_channel);
+    RECORDER_PUT(&buffer, uint64_t, new_channel);
+    RECORDER_PUT(&buffer, int32_t, visibility);
+    RECORDER_PUT(&buffer, uint16_t, by);
+    recorder_put_string(&buffer, by_name);
+    recorder_put_string(&buffer, by_uid);
+    recorder_put_string(&buffer, message);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_text_message(uint64_t server, uint16_t target_mode, uint16_t to, uint16_t from, const char* from_name, const char* from_uid, const char* message, int ff_ignored)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_TEXT_MESSAGE) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, target_mode);
+    RECORDER_PUT(&buffer, uint16_t, to);
+    RECORDER_PUT(&buffer, uint16_t, from);
+    RECORDER_PUT(&buffer, int32_t, ff_ignored);
+    recorder_put_string(&buffer, from_name);
+    recorder_put_string(&buffer, from_uid);
+    recorder_put_string(&buffer, message);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_server_error(uint64_t server, const char* error_message, unsigned int error, const char* return_code, const char* extra)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_SERVER_ERROR) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint32_t, error);
+    recorder_put_string(&buffer, error_message);
+    recorder_put_string(&buffer, return_code);
+    recorder_put_string(&buffer, extra);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_talk_status(uint64_t server, int status, int whisper, uint16_t client)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_TALK_STATUS) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, int32_t, status);
+    RECORDER_PUT(&buffer, int32_t, whisper);
+    RECORDER_PUT(&buffer, uint16_t, client);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_captured_voice(uint64_t server, int sample_count, int channels)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_CAPTURED_VOICE) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, int32_t, sample_count);
+    RECORDER_PUT(&buffer, int32_t, channels);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_plugin_command(uint64_t server, const char* plugin_name, const char* command, uint16_t invoker, const char* invoker_name, const char* invoker_uid)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_PLUGIN_COMMAND) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, invoker);
+    recorder_put_string(&buffer, plugin_name);
+    recorder_put_string(&buffer, invoker_name);
+    recorder_put_string(&buffer, invoker_uid);
+    recorder_put_string(&buffer, command);
+    recorder_commit(&buffer);
+}
+
+static inline void recorder_server_group_by_client(uint64_t server, const char* name, uint64_t group, uint64_t database_id)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, RECORDING_SERVER_GROUP_BY_CLIENT) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint64_t, group);
+    RECORDER_PUT(&buffer, uint64_t, database_id);
+    recorder_put_string(&buffer, name);
+    recorder_commit(&buffer);
+}
+
+/* SERVER_GROUP_ADDED and SERVER_GROUP_DELETED share their layout */
+static inline void recorder_server_group_client(uint16_t type, uint64_t server, uint16_t client, const char* client_name, const char* client_uid, uint64_t group, uint16_t invoker,
+                                                const char* invoker_name, const char* invoker_uid)
+{
+    if (!recorder_active())
+        return;
+    recorder_buffer buffer;
+    if (recorder_begin(&buffer, type) != 0)
+        return;
+    RECORDER_PUT(&buffer, uint64_t, server);
+    RECORDER_PUT(&buffer, uint16_t, client);
+    RECORDER_PUT(&buffer, uint64_t, group);
+    RECORDER_PUT(&buffer, uint16_t, invoker);
+    recorder_put_string(&buffer, client_name);
+    recorder_put_string(&buffer, client_uid);
+    recorder_put_string(&buffer, invoker_name);
+    recorder_put_string(&buffer, invoker_uid);
+    recorder_commit(&buffer);
+}
+
+#endif
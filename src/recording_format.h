@@ -0,0 +1,88 @@
+#ifndef RECORDING_FORMAT_H
+#define RECORDING_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Callback recording file format, version 1.
+ *
+ * Written by recorder_module.h, replayed by tools/fakehost.c. All integers
+ * are little endian.
+ *
+ * The file starts with a recording_header, followed by records until the end
+ * of the file. Every record starts with a recording_record_header:
+ *
+ *   length     total record size in bytes including this header and the
+ *              padding, always a multiple of 8
+ *   type       one of the RECORDING_* values below
+ *   flags      0
+ *   time_ns    CLOCK_MONOTONIC nanoseconds since recording_header.start_ns
+ *
+ * and continues with the fields of its type, packed without alignment, then
+ * zero padding. Strings are a u16 byte count followed by that many bytes, no
+ * terminator; long strings are cut at RECORDING_MAX_STRING bytes. Readers
+ * skip records of unknown types by their length, so new types can be added
+ * without a version change. Changing an existing layout bumps the version.
+ *
+ *   SNAPSHOT              u64 server, u16 self, u64 channel, u16 count, u16 client[count]
+ *                         state when recording started (or on connect): the bot's
+ *                         client, its channel and the clients in that channel
+ *   CONNECT_STATUS        u64 server, i32 status, u32 error
+ *   CLIENT_MOVE           u64 server, u16 client, u64 old, u64 new, i32 visibility, str message
+ *   CLIENT_MOVE_MOVED     u64 server, u16 client, u64 old, u64 new, i32 visibility,
+ *                         u16 mover, str mover name, str mover uid, str message
+ *   CLIENT_KICK_CHANNEL   u64 server, u16 client, u64 old, u64 new, i32 visibility,
+ *                         u16 kicker, str kicker name, str kicker uid, str message
+ *   TEXT_MESSAGE          u64 server, u16 target mode, u16 to, u16 from, i32 ffIgnored,
+ *                         str from name, str from uid, str message
+ *   SERVER_ERROR          u64 server, u32 error, str error message, str return code, str extra
+ *   TALK_STATUS           u64 server, i32 status, i32 whisper, u16 client
+ *   CAPTURED_VOICE        u64 server, i32 sample count, i32 channels
+ *                         (the samples themselves are not recorded)
+ *   PLUGIN_COMMAND        u64 server, u16 invoker, str plugin name, str invoker name,
+ *                         str invoker uid, str command
+ *   SERVER_GROUP_BY_CLIENT u64 server, u64 group, u64 client database id, str group name
+ *   SERVER_GROUP_ADDED    u64 server, u16 client, u64 group, u16 invoker, str client name,
+ *                         str client uid, str invoker name, str invoker uid
+ *   SERVER_GROUP_DELETED  same as SERVER_GROUP_ADDED
+ */
+
+#define RECORDING_MAGIC "MBEVENTS"
+#define RECORDING_VERSION 1
+#define RECORDING_MAX_STRING 1024
+/* Room for the largest record, four strings of RECORDING_MAX_STRING and the fixed fields */
+#define RECORDING_MAX_RECORD 8192
+
+enum {
+    RECORDING_SNAPSHOT = 1,
+    RECORDING_CONNECT_STATUS,
+    RECORDING_CLIENT_MOVE,
+    RECORDING_CLIENT_MOVE_MOVED,
+    RECORDING_CLIENT_KICK_CHANNEL,
+    RECORDING_TEXT_MESSAGE,
+    RECORDING_SERVER_ERROR,
+    RECORDING_TALK_STATUS,
+    RECORDING_CAPTURED_VOICE,
+    RECORDING_PLUGIN_COMMAND,
+    RECORDING_SERVER_GROUP_BY_CLIENT,
+    RECORDING_SERVER_GROUP_ADDED,
+    RECORDING_SERVER_GROUP_DELETED,
+};
+
+typedef struct {
+    char     magic[8];
+    uint16_t version;
+    uint16_t header_size; /* sizeof(recording_header), records start here */
+    uint32_t flags;
+    uint64_t start_ns;          /* CLOCK_MONOTONIC when recording started */
+    uint64_t start_realtime_ns; /* CLOCK_REALTIME at the same moment */
+} recording_header;
+
+typedef struct {
+    uint32_t length;
+    uint16_t type;
+    uint16_t flags;
+    uint64_t time_ns;
+} recording_record_header;
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef REMOTE_FORMAT_H
+#define REMOTE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Plugin command protocol, version 1.
+ *
+ * Companion tools (dashboards, other bots) drive the bot with TS3 plugin
+ * commands instead of chat: sendPluginCommand to the bot's client, answers
+ * come back the same way. Plugin commands are text, so a message is
+ * REMOTE_PREFIX followed by the base64 (RFC 4648, padded) of a binary
+ * payload. Used by remote_module.h and tools/fakehost.c. All integers are
+ * little endian.
+ *
+ * A payload is a header (u8 version, u8 kind, u16 count) followed by count
+ * operations, each one
+ *
+ *   id       u32, chosen by the caller, copied into the answer
+ *   op       one of the REMOTE_OP_* values below
+ *   status   REMOTE_OK in requests, the outcome in answers
+ *   length   u8 byte count of the body that follows
+ *
+ * packed without alignment. Strings in bodies are a u8 byte count followed
+ * by that many bytes, no terminator. Operations run in order and every one
+ * gets its answer, batched into as few messages as fit REMOTE_MAX_PAYLOAD;
+ * requests are at most REMOTE_MAX_REQUEST bytes. Unknown ops get
+ * REMOTE_UNKNOWN_OP and the rest of the batch still runs.
+ * A payload of another version is answered with an empty REMOTE_ANSWER
+ * carrying the version the bot speaks.
+ *
+ *   STATION       request: u16 station (track list index, as in the config)
+ *                 answer:  str station name
+ *   NOW_PLAYING   request: empty
+ *                 answer:  i16 station last tuned to (-1 if none), str song, str stream title
+ *   SUBSCRIBE     request: u8 1 to subscribe, 0 to unsubscribe
+ *                 answer:  empty; subscribers then get REMOTE_NOTIFY payloads
+ *                 with a NOW_PLAYING operation (id 0) whenever it changes
+ */
+
+#define REMOTE_PREFIX "musicbot:"
+#define REMOTE_VERSION 1
+/* Binary payload sizes, longer requests are refused */
+#define REMOTE_MAX_REQUEST 256
+#define REMOTE_MAX_PAYLOAD 768
+#define REMOTE_MAX_STRING 255
+#define REMOTE_HEADER_BYTES 4
+#define REMOTE_OP_HEADER_BYTES 7
+
+enum { REMOTE_REQUEST = 1, REMOTE_ANSWER, REMOTE_NOTIFY };
+
+enum {
+    REMOTE_OP_STATION = 1,
+    REMOTE_OP_NOW_PLAYING,
+    REMOTE_OP_SUBSCRIBE,
+};
+
+enum {
+    REMOTE_OK = 0,
+    REMOTE_UNKNOWN_OP,
+    REMOTE_BAD_REQUEST,
+    REMOTE_DENIED,         /* an allow rule of the config */
+    REMOTE_NOT_HERE,       /* the caller is not in the bot's channel */
+    REMOTE_WARMING_UP,     /* the player is not ready yet */
+    REMOTE_UNKNOWN_STATION,
+    REMOTE_FULL,           /* no room for another subscriber */
+};
+
+/* Reads a payload, every read past the end sets failed and returns zeros */
+typedef struct {
+    const uint8_t* data;
+    size_t         length;
+    size_t         offset;
+    int            failed;
+} remote_cursor;
+
+static inline const uint8_t* remote_take(remote_cursor* cursor, size_t bytes)
+{
+    if (cursor->failed || cursor->length - cursor->offset < bytes) {
+        cursor->failed = 1;
+        return NULL;
+    }
+    cursor->offset += bytes;
+    return cursor->data + cursor->offset - bytes;
+}
+
+static inline uint8_t remote_u8(remote_cursor* cursor)
+{
+    const uint8_t* byte = remote_take(cursor, 1);
+    return byte ? byte[0] : 0;
+}
+
+static inline uint16_t remote_u16(remote_cursor* cursor)
+{
+    const uint8_t* byte = remote_take(cursor, 2);
+    return byte ? (uint16_t)(byte[0] | byte[1] << 8) : 0;
+}
+
+static inline uint32_t remote_u32(remote_cursor* cursor)
+{
+    const uint8_t* byte = remote_take(cursor, 4);
+    return byte ? (uint32_t)byte[0] | (uint32_t)byte[1] << 8 | (uint32_t)byte[2] << 16 | (uint32_t)byte[3] << 24 : 0;
+}
+
+/* Copy a string into out (terminated, cut to size), returns its length in the payload */
+static inline size_t remote_string(remote_cursor* cursor, char* out, size_t size)
+{
+    size_t         length = remote_u8(cursor);
+    const uint8_t* bytes  = remote_take(cursor, length);
+    size_t         copy   = bytes ? (length < size - 1 ? length : size - 1) : 0;
+    memcpy(out, bytes ? (const char*)bytes : "", copy);
+    out[copy] = '\0';
+    return length;
+}
+
+static inline size_t remote_put_u16(uint8_t* out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    return 2;
+}
+
+static inline size_t remote_put_u32(uint8_t* out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+    return 4;
+}
+
+/* A string of at most max bytes (up to REMOTE_MAX_STRING), needs 1 + max bytes of out */
+static inline size_t remote_put_string(uint8_t* out, const char* text, size_t max)
+{
+    size_t length = text ? strlen(text) : 0;
+    length        = length < max ? length : max;
+    out[0]        = (uint8_t)length;
+    memcpy(out + 1, text ? text : "", length);
+    return 1 + length;
+}
+
+static const char remote_base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Needs 4 * ((length + 2) / 3) + 1 bytes of out, returns the text length */
+static inline size_t remote_base64_encode(const uint8_t* data, size_t length, char* out)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)data[i] << 16 | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+        out[written++] = remote_base64_alphabet[group >> 18 & 63];
+        out[written++] = remote_base64_alphabet[group >> 12 & 63];
+        out[written++] = i + 1 < length ? remote_base64_alphabet[group >> 6 & 63] : '=';
+        out[written++] = i + 2 < length ? remote_base64_alphabet[group & 63] : '=';
+    }
+    out[written] = '\0';
+    return written;
+}
+
+static inline int remote_base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    return c == '+' ? 62 : c == '/' ? 63 : -1;
+}
+
+/* Decode text into at most size bytes, returns the byte count or -1 if it is not base64 or does not fit */
+static inline long remote_base64_decode(const char* text, uint8_t* out, size_t size)
+{
+    size_t length = strlen(text);
+    size_t bytes  = 0;
+    if (length % 4)
+        return -1;
+    for (size_t i = 0; i < length; i += 4) {
+        int a = remote_base64_value(text[i]), b = remote_base64_value(text[i + 1]);
+        int c = text[i + 2] == '=' && i + 4 == length ? 0 : remote_base64_value(text[i + 2]);
+        int d = text[i + 3] == '=' && i + 4 == length ? 0 : remote_base64_value(text[i + 3]);
+        if (a < 0 || b < 0 || c < 0 || d < 0 || (text[i + 2] == '=' && text[i + 3] != '='))
+            return -1;
+        uint32_t group = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+        size_t   count = text[i + 2] == '=' ? 1 : text[i + 3] == '=' ? 2 : 3;
+        if (bytes + count > size)
+            return -1;
+        out[bytes++] = (uint8_t)(group >> 16);
+        if (count > 1)
+            out[bytes++] = (uint8_t)(group >> 8);
+        if (count > 2)
+            out[bytes++] = (uint8_t)group;
+    }
+    return (long)bytes;
+}
+
+#endif
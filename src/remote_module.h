@@ -0,0 +1,258 @@
+#ifndef REMOTE_MODULE_H
+#define REMOTE_MODULE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log_module.h"
+#include "metrics_module.h"
+#include "remote_format.h"
+
+/*
+ * Plugin command control, see remote_format.h for the wire format.
+ *
+ * ts3plugin_onPluginCommandEvent decodes the base64 on the TeamSpeak thread
+ * and queues the binary request, the plugin runs its operations on the
+ * event loop with remote_next and collects the answers in a remote_writer,
+ * which sends them as few plugin commands as fit (one for a whole batch of
+ * small answers). The plugin supplies the send function, since only it has
+ * the TS3 functions.
+ *
+ * Subscribers are kept in a small table by server and client. A notification
+ * goes out as one plugin command to all subscribers of a server, and only if
+ * it differs from the last one. Clients are dropped when they leave the
+ * server, everything on (dis)connect. Everything runs on the event loop
+ * thread.
+ */
+
+#define REMOTE_MAX_SUBSCRIBERS 32
+/* REMOTE_PREFIX and the base64 of a full payload */
+#define REMOTE_TEXT_BYTES (sizeof(REMOTE_PREFIX) + 4 * ((REMOTE_MAX_PAYLOAD + 2) / 3))
+
+/* Send text as a plugin command to targets (count client ids) on server */
+typedef void (*remote_send_fn)(uint64_t server, const uint16_t* targets, size_t count, const char* text);
+
+typedef struct {
+    uint64_t server;
+    uint16_t client; /* 0 marks a free entry */
+} remote_subscriber;
+
+/* One operation of a request, body points into the request */
+typedef struct {
+    uint32_t      id;
+    uint8_t       op;
+    remote_cursor body;
+} remote_operation;
+
+/* Answers to one caller, flushed whenever the next one does not fit */
+typedef struct {
+    uint64_t server;
+    uint16_t client;
+    uint8_t  kind;
+    uint16_t count;
+    size_t   length;
+    uint8_t  payload[REMOTE_MAX_PAYLOAD];
+} remote_writer;
+
+static remote_send_fn    remote_send = NULL;
+static remote_subscriber remote_subscribers[REMOTE_MAX_SUBSCRIBERS];
+static uint8_t           remote_last_notify[REMOTE_HEADER_BYTES + REMOTE_OP_HEADER_BYTES + REMOTE_MAX_STRING];
+static size_t            remote_last_notify_length = 0;
+
+static int remote_requests_metric;
+static int remote_answers_metric;
+static int remote_ok_metric;
+static int remote_failed_metric;
+static int remote_rejected_metric;
+static int remote_notifications_metric;
+
+static double remote_subscriber_count(int unused)
+{
+    (void)unused;
+    int count = 0;
+    for (int i = 0; i < REMOTE_MAX_SUBSCRIBERS; i++)
+        count += remote_subscribers[i].client != 0;
+    return count;
+}
+
+void remote_register_metrics(void)
+{
+    remote_requests_metric      = metrics_counter("musicbot_remote_messages_total", "Plugin command messages, by direction", "direction", "in");
+    remote_answers_metric       = metrics_counter("musicbot_remote_messages_total", "Plugin command messages, by direction", "direction", "out");
+    remote_ok_metric            = metrics_counter("musicbot_remote_operations_total", "Plugin command operations, by outcome", "result", "ok");
+    remote_failed_metric        = metrics_counter("musicbot_remote_operations_total", "Plugin command operations, by outcome", "result", "failed");
+    remote_rejected_metric      = metrics_counter("musicbot_remote_rejected_total", "Plugin command messages that were not valid requests", NULL, NULL);
+    remote_notifications_metric = metrics_counter("musicbot_remote_notifications_total", "Now playing changes sent to subscribers", NULL, NULL);
+    metrics_export("musicbot_remote_subscribers", "Clients subscribed to now playing changes", METRIC_GAUGE, NULL, NULL, remote_subscriber_count, 0);
+}
+
+void remote_start(remote_send_fn send)
+{
+    remote_send = send;
+}
+
+/*
+ * text is a plugin command, decode its payload into out. Returns the payload
+ * length, 0 if it is not for us, -1 if it is ours but broken or too long.
+ */
+long remote_decode(const char* text, uint8_t* out, size_t size)
+{
+    if (strncmp(text, REMOTE_PREFIX, sizeof(REMOTE_PREFIX) - 1) != 0)
+        return 0;
+    long length = remote_base64_decode(text + sizeof(REMOTE_PREFIX) - 1, out, size);
+    if (length < REMOTE_HEADER_BYTES) {
+        metrics_inc(remote_rejected_metric);
+        return -1;
+    }
+    return length;
+}
+
+/* Start reading a request, 0 if it is one of our version */
+int remote_open(remote_cursor* cursor, const uint8_t* payload, size_t length, uint16_t* count)
+{
+    *cursor         = (remote_cursor){payload, length, 0, 0};
+    uint8_t version = remote_u8(cursor);
+    uint8_t kind    = remote_u8(cursor);
+    *count          = remote_u16(cursor);
+    metrics_inc(remote_requests_metric);
+    if (version != REMOTE_VERSION || kind != REMOTE_REQUEST) {
+        metrics_inc(remote_rejected_metric);
+        return -1;
+    }
+    return 0;
+}
+
+/* The next operation, 0 at the end or when the rest of the request is cut short */
+int remote_next(remote_cursor* cursor, remote_operation* operation)
+{
+    operation->id      = remote_u32(cursor);
+    operation->op      = remote_u8(cursor);
+    remote_u8(cursor); /* status, unused in requests */
+    size_t         length = remote_u8(cursor);
+    const uint8_t* body   = remote_take(cursor, length);
+    operation->body       = (remote_cursor){body, body ? length : 0, 0, 0};
+    return !cursor->failed;
+}
+
+void remote_begin(remote_writer* writer, uint64_t server, uint16_t client, uint8_t kind)
+{
+    writer->server = server;
+    writer->client = client;
+    writer->kind   = kind;
+    writer->count  = 0;
+    writer->length = REMOTE_HEADER_BYTES;
+}
+
+static void remote_send_payload(uint64_t server, const uint16_t* targets, size_t count, const uint8_t* payload, size_t length)
+{
+    char text[REMOTE_TEXT_BYTES];
+    memcpy(text, REMOTE_PREFIX, sizeof(REMOTE_PREFIX) - 1);
+    remote_base64_encode(payload, length, text + sizeof(REMOTE_PREFIX) - 1);
+    if (remote_send)
+        remote_send(server, targets, count, text);
+    metrics_inc(remote_answers_metric);
+}
+
+/* Send what was collected, with always also an empty payload (it carries the version) */
+void remote_flush(remote_writer* writer, int always)
+{
+    if (!writer->count && !always)
+        return;
+    writer->payload[0] = REMOTE_VERSION;
+    writer->payload[1] = writer->kind;
+    remote_put_u16(writer->payload + 2, writer->count);
+    remote_send_payload(writer->server, &writer->client, 1, writer->payload, writer->length);
+    writer->count  = 0;
+    writer->length = REMOTE_HEADER_BYTES;
+}
+
+static size_t remote_put_operation(uint8_t* out, uint32_t id, uint8_t op, uint8_t status, const uint8_t* body, size_t body_length)
+{
+    remote_put_u32(out, id);
+    out[4] = op;
+    out[5] = status;
+    out[6] = (uint8_t)body_length;
+    if (body_length)
+        memcpy(out + REMOTE_OP_HEADER_BYTES, body, body_length);
+    return REMOTE_OP_HEADER_BYTES + body_length;
+}
+
+/* Add an answer, body_length is at most 255 */
+void remote_answer(remote_writer* writer, uint32_t id, uint8_t op, uint8_t status, const uint8_t* body, size_t body_length)
+{
+    if (writer->length + REMOTE_OP_HEADER_BYTES + body_length > REMOTE_MAX_PAYLOAD)
+        remote_flush(writer, 0);
+    writer->length += remote_put_operation(writer->payload + writer->length, id, op, status, body, body_length);
+    writer->count++;
+    metrics_inc(status == REMOTE_OK ? remote_ok_metric : remote_failed_metric);
+}
+
+/* REMOTE_OK, or REMOTE_FULL if there is no room for another subscriber */
+int remote_subscribe(uint64_t server, uint16_t client, int on)
+{
+    remote_subscriber* free_entry = NULL;
+    for (int i = 0; i < REMOTE_MAX_SUBSCRIBERS; i++) {
+        remote_subscriber* entry = &remote_subscribers[i];
+        if (entry->client == client && entry->server == server) {
+            if (!on)
+                entry->client = 0;
+            return REMOTE_OK;
+        }
+        if (!entry->client && !free_entry)
+            free_entry = entry;
+    }
+    if (!on)
+        return REMOTE_OK;
+    if (!free_entry)
+        return REMOTE_FULL;
+    *free_entry = (remote_subscriber){server, client};
+    return REMOTE_OK;
+}
+
+/* client left server */
+void remote_forget(uint64_t server, uint16_t client)
+{
+    remote_subscribe(server, client, 0);
+}
+
+void remote_clear(void)
+{
+    memset(remote_subscribers, 0, sizeof(remote_subscribers));
+    remote_last_notify_length = 0;
+}
+
+/* Tell every subscriber about a change of op with body, unless it is what they were told last */
+void remote_notify(uint8_t op, const uint8_t* body, size_t body_length)
+{
+    uint8_t payload[REMOTE_HEADER_BYTES + REMOTE_OP_HEADER_BYTES + REMOTE_MAX_STRING];
+    payload[0]    = REMOTE_VERSION;
+    payload[1]    = REMOTE_NOTIFY;
+    size_t length = remote_put_u16(payload + 2, 1) + 2;
+    length += remote_put_operation(payload + length, 0, op, REMOTE_OK, body, body_length);
+    if (length == remote_last_notify_length && memcmp(payload, remote_last_notify, length) == 0)
+        return;
+    memcpy(remote_last_notify, payload, length);
+    remote_last_notify_length = length;
+
+    /* One message per server, to all of its subscribers at once */
+    int sent[REMOTE_MAX_SUBSCRIBERS] = {0};
+    for (int i = 0; i < REMOTE_MAX_SUBSCRIBERS; i++) {
+        if (!remote_subscribers[i].client || sent[i])
+            continue;
+        uint16_t targets[REMOTE_MAX_SUBSCRIBERS + 1];
+        size_t   count  = 0;
+        uint64_t server = remote_subscribers[i].server;
+        for (int j = i; j < REMOTE_MAX_SUBSCRIBERS; j++) {
+            if (remote_subscribers[j].client && remote_subscribers[j].server == server) {
+                targets[count++] = remote_subscribers[j].client;
+                sent[j]          = 1;
+            }
+        }
+        targets[count] = 0;
+        remote_send_payload(server, targets, count, payload, length);
+        metrics_inc(remote_notifications_metric);
+    }
+}
+
+#endif
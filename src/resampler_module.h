@@ -0,0 +1,237 @@
+#ifndef RESAMPLER_MODULE_H
+#define RESAMPLER_MODULE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(RESAMPLER_SCALAR)
+/* Forced scalar build, used to compare against the vector paths */
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "audio_module.h"
+
+/*
+ * Polyphase FIR resampler for the deck feeds (44.1/32 kHz stations into the
+ * 48 kHz capture path).
+ *
+ * The filter is a Kaiser windowed sinc, precomputed as RESAMPLER_PHASES + 1
+ * phases of RESAMPLER_TAPS coefficients when the source rate is set. For
+ * every output frame the two phases around the exact position are applied
+ * and interpolated linearly, so any ratio works, including the ppm-level
+ * adjustments of the drift controller. History is kept planar in floats so
+ * the dot products run over contiguous memory.
+ */
+
+/* Multiple of 8 so the AVX2/NEON loops need no tail */
+#define RESAMPLER_TAPS 48
+#define RESAMPLER_PHASE_BITS 8
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASE_BITS)
+#define RESAMPLER_KAISER_BETA 8.0
+/* Passband edge relative to the lower Nyquist frequency */
+#define RESAMPLER_CUTOFF 0.92
+#define RESAMPLER_MAX_CHANNELS 2
+/* Largest input block accepted by resampler_process, in frames */
+#define RESAMPLER_MAX_INPUT 4096
+
+typedef struct {
+    unsigned int in_rate;
+    unsigned int out_rate;
+    int          channels;
+    /* 32.32 fixed point input position of the first tap and step per output frame */
+    uint64_t     position;
+    uint64_t     step;
+    /* (RESAMPLER_PHASES + 1) * RESAMPLER_TAPS coefficients */
+    float*       bank;
+    /* Planar history, RESAMPLER_TAPS + RESAMPLER_MAX_INPUT samples per channel */
+    float*       history[RESAMPLER_MAX_CHANNELS];
+    size_t       length;
+} resampler;
+
+static double resampler_bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+void resampler_free(resampler* r)
+{
+    free(r->bank);
+    for (int c = 0; c < RESAMPLER_MAX_CHANNELS; c++)
+        free(r->history[c]);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Set the nominal ratio and fine tune it by ppm (positive consumes input faster) */
+void resampler_set_ratio(resampler* r, double ppm)
+{
+    r->step = (uint64_t)((double)r->in_rate / (double)r->out_rate * (1.0 + ppm * 1e-6) * 4294967296.0);
+}
+
+/* Build the filter bank for in_rate -> out_rate. Returns 0 on success, -1 on bad rates or allocation failure. */
+int resampler_init(resampler* r, unsigned int in_rate, unsigned int out_rate, int channels)
+{
+    resampler_free(r);
+    if (in_rate < 8000 || in_rate > 192000 || out_rate == 0 || channels < 1 || channels > RESAMPLER_MAX_CHANNELS)
+        return -1;
+
+    r->in_rate  = in_rate;
+    r->out_rate = out_rate;
+    r->channels = channels;
+    r->bank     = (float*)aligned_alloc(32, sizeof(float) * (RESAMPLER_PHASES + 1) * RESAMPLER_TAPS);
+    if (!r->bank) {
+        resampler_free(r);
+        return -1;
+    }
+    for (int c = 0; c < channels; c++) {
+        r->history[c] = (float*)aligned_alloc(32, sizeof(float) * (RESAMPLER_TAPS + RESAMPLER_MAX_INPUT));
+        if (!r->history[c]) {
+            resampler_free(r);
+            return -1;
+        }
+    }
+
+    /* Cutoff in cycles per input sample, below the Nyquist frequency of the slower side */
+    const double cutoff = 0.5 * RESAMPLER_CUTOFF * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+    const double half   = RESAMPLER_TAPS / 2.0;
+    const double norm   = resampler_bessel_i0(RESAMPLER_KAISER_BETA);
+    for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+        float* phase = r->bank + p * RESAMPLER_TAPS;
+        double sum   = 0.0;
+        for (int k = 0; k < RESAMPLER_TAPS; k++) {
+            /* Distance from the output position to tap k */
+            double x   = (double)(RESAMPLER_TAPS / 2 - 1 - k) + (double)p / RESAMPLER_PHASES;
+            double w   = x / half;
+            double win = fabs(w) >= 1.0 ? 0.0 : resampler_bessel_i0(RESAMPLER_KAISER_BETA * sqrt(1.0 - w * w)) / norm;
+            double arg = 2.0 * M_PI * cutoff * x;
+            double h   = (x == 0.0 ? 2.0 * cutoff : sin(arg) / (M_PI * x)) * win;
+            phase[k]   = (float)h;
+            sum += h;
+        }
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+            phase[k] = (float)(phase[k] / sum);
+    }
+
+    /* Start with half a filter of silence so the first output is centred on the first input frame */
+    for (int c = 0; c < channels; c++)
+        memset(r->history[c], 0, sizeof(float) * RESAMPLER_TAPS);
+    r->length   = RESAMPLER_TAPS / 2 - 1;
+    r->position = 0;
+    resampler_set_ratio(r, 0.0);
+    return 0;
+}
+
+/* Dot products of one history window with two neighbouring phases */
+static inline void resampler_dot2(const float* x, const float* c0, const float* c1, float* d0, float* d1)
+{
+    int k = 0;
+#if defined(RESAMPLER_SCALAR)
+    float s0 = 0.0f, s1 = 0.0f;
+#elif defined(__AVX2__)
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    for (; k < RESAMPLER_TAPS; k += 8) {
+        __m256 v = _mm256_loadu_ps(x + k);
+#if defined(__FMA__)
+        a0 = _mm256_fmadd_ps(v, _mm256_load_ps(c0 + k), a0);
+        a1 = _mm256_fmadd_ps(v, _mm256_load_ps(c1 + k), a1);
+#else
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(v, _mm256_load_ps(c0 + k)));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(v, _mm256_load_ps(c1 + k)));
+#endif
+    }
+    __m128 h0 = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+    __m128 h1 = _mm_add_ps(_mm256_castps256_ps128(a1), _mm256_extractf128_ps(a1, 1));
+    float  l0[4], l1[4];
+    _mm_storeu_ps(l0, h0);
+    _mm_storeu_ps(l1, h1);
+    float s0 = l0[0] + l0[1] + l0[2] + l0[3];
+    float s1 = l1[0] + l1[1] + l1[2] + l1[3];
+#elif defined(__SSE2__)
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    for (; k < RESAMPLER_TAPS; k += 4) {
+        __m128 v = _mm_loadu_ps(x + k);
+        a0       = _mm_add_ps(a0, _mm_mul_ps(v, _mm_load_ps(c0 + k)));
+        a1       = _mm_add_ps(a1, _mm_mul_ps(v, _mm_load_ps(c1 + k)));
+    }
+    float l0[4], l1[4];
+    _mm_storeu_ps(l0, a0);
+    _mm_storeu_ps(l1, a1);
+    float s0 = l0[0] + l0[1] + l0[2] + l0[3];
+    float s1 = l1[0] + l1[1] + l1[2] + l1[3];
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+    for (; k < RESAMPLER_TAPS; k += 4) {
+        float32x4_t v = vld1q_f32(x + k);
+        a0            = vfmaq_f32(a0, v, vld1q_f32(c0 + k));
+        a1            = vfmaq_f32(a1, v, vld1q_f32(c1 + k));
+    }
+    float s0 = vaddvq_f32(a0);
+    float s1 = vaddvq_f32(a1);
+#else
+    float s0 = 0.0f, s1 = 0.0f;
+#endif
+    for (; k < RESAMPLER_TAPS; k++) {
+        s0 += x[k] * c0[k];
+        s1 += x[k] * c1[k];
+    }
+    *d0 = s0;
+    *d1 = s1;
+}
+
+/*
+ * Resample frames interleaved input frames (at most RESAMPLER_MAX_INPUT) into
+ * out, which must hold frames * out_rate / in_rate + 2 frames (plus headroom
+ * for any ppm adjustment). Returns the number of frames written.
+ */
+size_t resampler_process(resampler* r, const short* in, size_t frames, short* out)
+{
+    const int channels = r->channels;
+
+    for (int c = 0; c < channels; c++) {
+        float* h = r->history[c] + r->length;
+        for (size_t i = 0; i < frames; i++)
+            h[i] = (float)in[i * channels + c];
+    }
+    r->length += frames;
+
+    size_t produced = 0;
+    while ((r->position >> 32) + RESAMPLER_TAPS <= r->length) {
+        size_t       start = (size_t)(r->position >> 32);
+        uint32_t     frac  = (uint32_t)r->position;
+        unsigned int phase = frac >> (32 - RESAMPLER_PHASE_BITS);
+        float        mix   = (float)(frac & ((1U << (32 - RESAMPLER_PHASE_BITS)) - 1)) / (float)(1U << (32 - RESAMPLER_PHASE_BITS));
+        const float* c0    = r->bank + phase * RESAMPLER_TAPS;
+        const float* c1    = c0 + RESAMPLER_TAPS;
+
+        for (int c = 0; c < channels; c++) {
+            float d0, d1;
+            resampler_dot2(r->history[c] + start, c0, c1, &d0, &d1);
+            out[produced * channels + c] = audio_clip(d0 + (d1 - d0) * mix);
+        }
+        produced++;
+        r->position += r->step;
+    }
+
+    /* Drop history that no future output can reach */
+    size_t consumed = (size_t)(r->position >> 32);
+    if (consumed > r->length)
+        consumed = r->length;
+    for (int c = 0; c < channels; c++)
+        memmove(r->history[c], r->history[c] + consumed, sizeof(float) * (r->length - consumed));
+    r->length -= consumed;
+    r->position -= (uint64_t)consumed << 32;
+    return produced;
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SILENCE_MODULE_H
+#define SILENCE_MODULE_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_module.h"
+#include "config_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Dead stream detection on the outgoing audio.
+ *
+ * Every captured block is metered after mixing. Blocks of pure digital
+ * silence are not transmitted at all. If the level stays below
+ * SILENCE_THRESHOLD_DBFS for the config's dead_stream_timeout_ms the stream
+ * is considered dead and the watchdog thread hands its fallback_station to
+ * the failover callback, which queues the switch for the event loop (the
+ * station is bot state like any other). The watchdog re-arms once audible
+ * audio came back, so a silent fallback does not cause a switching loop.
+ */
+
+#define SILENCE_THRESHOLD_DBFS -60.0
+#define SILENCE_WATCHDOG_INTERVAL_MS 500
+
+/* Runs on the watchdog thread with the track list index to fail over to */
+typedef void (*silence_failover_fn)(int station);
+
+/* Counters for the metrics export */
+static _Atomic uint64_t silence_blocks_skipped   = 0;
+static _Atomic uint64_t dead_stream_events       = 0;
+static _Atomic uint64_t failover_latency_last_ms = 0;
+static _Atomic int      output_level_centi_dbfs  = -9600;
+
+/*
+ * Last time the audio thread metered a block at all and last time it saw
+ * something above the threshold, plus the start of a pending failover
+ */
+static _Atomic uint64_t last_block_ms     = 0;
+static _Atomic uint64_t last_audible_ms   = 0;
+static _Atomic uint64_t failover_start_ms = 0;
+
+static pthread_t           silence_thread;
+static atomic_int          silence_running  = 0;
+static silence_failover_fn silence_failover = NULL;
+
+static uint64_t silence_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Meter one outgoing block on the audio thread. Returns 0 if the block is
+ * digital silence and should not be sent.
+ */
+int silence_process(const short* samples, int frames, int channels)
+{
+    size_t   count = (size_t)frames * (size_t)channels;
+    uint64_t sum_squares;
+    int      peak;
+
+    if (count == 0)
+        return 1;
+
+    audio_measure(samples, count, &sum_squares, &peak);
+
+    uint64_t now = silence_now_ms();
+    atomic_store_explicit(&last_block_ms, now, memory_order_relaxed);
+
+    double rms  = sqrt((double)sum_squares / (double)count) / 32768.0;
+    double dbfs = rms > 0.0 ? 20.0 * log10(rms) : -96.0;
+    atomic_store_explicit(&output_level_centi_dbfs, (int)(dbfs * 100.0), memory_order_relaxed);
+
+    if (dbfs > SILENCE_THRESHOLD_DBFS) {
+        uint64_t start = atomic_exchange_explicit(&failover_start_ms, 0, memory_order_relaxed);
+        if (start) {
+            atomic_store_explicit(&failover_latency_last_ms, now - start, memory_order_relaxed);
+        }
+        atomic_store_explicit(&last_audible_ms, now, memory_order_relaxed);
+    }
+
+    if (peak == 0) {
+        atomic_fetch_add_explicit(&silence_blocks_skipped, 1, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+static void* silence_watchdog(void* arg)
+{
+    (void)arg;
+    int armed = 1;
+
+    while (atomic_load(&silence_running)) {
+        usleep(SILENCE_WATCHDOG_INTERVAL_MS * 1000);
+
+        config_guard guard    = config_enter();
+        uint64_t     timeout  = guard.config->dead_stream_timeout_ms;
+        int          fallback = guard.config->fallback_station;
+        config_leave(&guard);
+
+        uint64_t now  = silence_now_ms();
+        uint64_t last = atomic_load(&last_audible_ms);
+        if (now - atomic_load(&last_block_ms) > SILENCE_WATCHDOG_INTERVAL_MS * 4) {
+            /* Nothing is being captured (not connected, no device), so there is no stream to judge */
+            atomic_store(&last_audible_ms, now);
+            continue;
+        }
+        if (!timeout || now - last < timeout) {
+            armed = 1;
+            continue;
+        }
+        if (!armed)
+            continue;
+
+        armed = 0;
+        atomic_fetch_add(&dead_stream_events, 1);
+        LOG_INFO("Stream silent for %llu ms, failing over to station %d", (unsigned long long)(now - last), fallback);
+        atomic_store(&failover_start_ms, now);
+        silence_failover(fallback);
+    }
+    return NULL;
+}
+
+static double silence_metric_value(int which)
+{
+    switch (which) {
+    case 0:
+        return (double)atomic_load_explicit(&silence_blocks_skipped, memory_order_relaxed);
+    case 1:
+        return (double)atomic_load_explicit(&dead_stream_events, memory_order_relaxed);
+    case 2:
+        return atomic_load_explicit(&failover_latency_last_ms, memory_order_relaxed) / 1000.0;
+    default:
+        return atomic_load_explicit(&output_level_centi_dbfs, memory_order_relaxed) / 100.0;
+    }
+}
+
+void silence_register_metrics(void)
+{
+    metrics_export("musicbot_silent_blocks_skipped_total", "Captured blocks of digital silence that were not sent", METRIC_COUNTER, NULL, NULL, silence_metric_value, 0);
+    metrics_export("musicbot_dead_stream_events_total", "Failovers to the fallback station after a silent stream", METRIC_COUNTER, NULL, NULL, silence_metric_value, 1);
+    metrics_export("musicbot_failover_latency_seconds", "Time from the last failover to audible audio", METRIC_GAUGE, NULL, NULL, silence_metric_value, 2);
+    metrics_export("musicbot_output_level_dbfs", "RMS level of the last outgoing block", METRIC_GAUGE, NULL, NULL, silence_metric_value, 3);
+}
+
+void silence_start(silence_failover_fn on_dead_stream)
+{
+    silence_failover = on_dead_stream;
+    atomic_store(&last_audible_ms, silence_now_ms());
+    atomic_store(&silence_running, 1);
+    pthread_create(&silence_thread, NULL, silence_watchdog, NULL);
+}
+
+void silence_stop(void)
+{
+    if (!atomic_exchange(&silence_running, 0))
+        return;
+    pthread_join(silence_thread, NULL);
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef SNAPSHOT_MODULE_H
+#define SNAPSHOT_MODULE_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log_module.h"
+
+/*
+ * Warm start snapshot, a small memory mapped file next to the song history.
+ *
+ * Holds what the bot needs to pick up where it left off: the last station
+ * asked for, the bot's channel per server (by server unique identifier),
+ * and the track list of the player with its fingerprint. Every change is
+ * written into the mapping in place and flushed asynchronously, the last
+ * one with msync on close. Writes bump a sequence number to odd before and
+ * to even after and store a checksum over the body, so a snapshot torn by
+ * a crash in the middle of a write is recognised and ignored.
+ *
+ * ts3plugin_init maps it before anything else: the cached track list lets
+ * station commands work at once while player_module.h fetches the live
+ * list in the background and compares fingerprints. Writers are the event
+ * loop (station, channel) and the player thread (tracks), under
+ * snapshot_mutex.
+ */
+
+#define SNAPSHOT_FILE_NAME "musicbot_snapshot.bin"
+#define SNAPSHOT_MAGIC "MBSNAP01"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_SERVERS 8
+#define SNAPSHOT_TRACKS 256
+#define SNAPSHOT_PATH_BYTES 64
+#define SNAPSHOT_UID_BYTES 64
+
+typedef struct {
+    char     uid[SNAPSHOT_UID_BYTES]; /* "" marks a free entry */
+    uint64_t channel;
+    uint64_t saved; /* unix seconds, the oldest entry is replaced when all are taken */
+} snapshot_server;
+
+typedef struct {
+    char             magic[8];
+    uint32_t         version;
+    uint32_t         size;
+    _Atomic uint32_t sequence; /* odd while a write is in progress */
+    uint32_t         checksum; /* FNV-1a over everything after it */
+    int32_t          station;  /* -1 before the first station command */
+    uint32_t         track_count;
+    uint64_t         track_fingerprint;
+    uint64_t         saved;
+    snapshot_server  servers[SNAPSHOT_SERVERS];
+    char             tracks[SNAPSHOT_TRACKS][SNAPSHOT_PATH_BYTES]; /* empty if the list did not fit */
+} snapshot_file;
+
+static snapshot_file*  snapshot       = NULL;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t snapshot_checksum(const snapshot_file* file)
+{
+    const uint8_t* byte = (const uint8_t*)&file->checksum + sizeof(file->checksum);
+    const uint8_t* end  = (const uint8_t*)file + sizeof(*file);
+    uint32_t       hash = 2166136261u;
+    for (; byte < end; byte++)
+        hash = (hash ^ *byte) * 16777619u;
+    return hash;
+}
+
+/* FNV-1a 64 over the track paths, order matters since stations are indexes */
+uint64_t track_list_fingerprint(char** list, size_t count)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < count; i++) {
+        for (const char* c = list[i]; *c; c++)
+            hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+        hash = (hash ^ 0xFF) * 1099511628211ull; /* separator, no path contains it */
+    }
+    return hash;
+}
+
+static void snapshot_reset(snapshot_file* file)
+{
+    memset(file, 0, sizeof(*file));
+    memcpy(file->magic, SNAPSHOT_MAGIC, 8);
+    file->version  = SNAPSHOT_VERSION;
+    file->size     = sizeof(snapshot_file);
+    file->station  = -1;
+    file->checksum = snapshot_checksum(file);
+}
+
+/*
+ * Map dir/SNAPSHOT_FILE_NAME. Returns 1 if it holds a usable snapshot, 0 if
+ * it was missing, torn or from another version and starts empty, -1 if it
+ * cannot be mapped (the bot then runs without one).
+ */
+int snapshot_open(const char* dir)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, SNAPSHOT_FILE_NAME);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Cannot open snapshot %s", path);
+        return -1;
+    }
+    struct stat st;
+    int         fresh = fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(snapshot_file);
+    if ((fresh && ftruncate(fd, 0) != 0) || ftruncate(fd, sizeof(snapshot_file)) != 0) {
+        LOG_ERROR("Cannot size snapshot %s", path);
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, sizeof(snapshot_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Cannot map snapshot %s", path);
+        return -1;
+    }
+
+    snapshot_file* file  = (snapshot_file*)map;
+    int            valid = memcmp(file->magic, SNAPSHOT_MAGIC, 8) == 0 && file->version == SNAPSHOT_VERSION && file->size == sizeof(snapshot_file) &&
+                !(atomic_load(&file->sequence) & 1) && file->checksum == snapshot_checksum(file) && file->track_count <= SNAPSHOT_TRACKS;
+    if (!valid) {
+        if (!fresh)
+            LOG_WARN("Snapshot %s is torn or from another version, starting without it", path);
+        snapshot_reset(file);
+    } else {
+        LOG_INFO("Snapshot %s from %llu: station %d, %u tracks", path, (unsigned long long)file->saved, file->station, file->track_count);
+    }
+    snapshot = file;
+    return valid;
+}
+
+void snapshot_close(void)
+{
+    if (!snapshot)
+        return;
+    pthread_mutex_lock(&snapshot_mutex);
+    msync(snapshot, sizeof(snapshot_file), MS_SYNC);
+    munmap(snapshot, sizeof(snapshot_file));
+    snapshot = NULL;
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+/* Open a write, snapshot_mutex held. Returns 0 without a snapshot. */
+static int snapshot_begin(void)
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    if (!snapshot) {
+        pthread_mutex_unlock(&snapshot_mutex);
+        return 0;
+    }
+    atomic_fetch_add_explicit(&snapshot->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return 1;
+}
+
+static void snapshot_commit(void)
+{
+    snapshot->saved    = (uint64_t)time(NULL);
+    snapshot->checksum = snapshot_checksum(snapshot);
+    atomic_fetch_add_explicit(&snapshot->sequence, 1, memory_order_release);
+    msync(snapshot, sizeof(snapshot_file), MS_ASYNC);
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+int snapshot_station(void)
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    int station = snapshot ? snapshot->station : -1;
+    pthread_mutex_unlock(&snapshot_mutex);
+    return station;
+}
+
+void snapshot_set_station(int station)
+{
+    if (snapshot_begin()) {
+        snapshot->station = station;
+        snapshot_commit();
+    }
+}
+
+/* Channel the bot was last in on the server with unique identifier uid, 0 if unknown */
+uint64_t snapshot_channel(const char* uid)
+{
+    uint64_t channel = 0;
+    pthread_mutex_lock(&snapshot_mutex);
+    for (int i = 0; snapshot && uid[0] && i < SNAPSHOT_SERVERS; i++) {
+        if (strncmp(snapshot->servers[i].uid, uid, SNAPSHOT_UID_BYTES - 1) == 0)
+            channel = snapshot->servers[i].channel;
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+    return channel;
+}
+
+void snapshot_set_channel(const char* uid, uint64_t channel)
+{
+    if (!uid[0] || !snapshot_begin())
+        return;
+    /* Free entries have saved 0, so the oldest one is free if there is any */
+    snapshot_server* entry = &snapshot->servers[0];
+    for (int i = 0; i < SNAPSHOT_SERVERS; i++) {
+        snapshot_server* server = &snapshot->servers[i];
+        if (strncmp(server->uid, uid, SNAPSHOT_UID_BYTES - 1) == 0) {
+            entry = server;
+            break;
+        }
+        if (server->saved < entry->saved)
+            entry = server;
+    }
+    snprintf(entry->uid, sizeof(entry->uid), "%s", uid);
+    entry->channel = channel;
+    entry->saved   = (uint64_t)time(NULL);
+    snapshot_commit();
+}
+
+uint64_t snapshot_fingerprint(void)
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    uint64_t fingerprint = snapshot ? snapshot->track_fingerprint : 0;
+    pthread_mutex_unlock(&snapshot_mutex);
+    return fingerprint;
+}
+
+/* A copy of the cached track list for replace_track_list, NULL if there is none */
+char** snapshot_tracks(size_t* count)
+{
+    char** list = NULL;
+    *count      = 0;
+    pthread_mutex_lock(&snapshot_mutex);
+    if (snapshot && snapshot->track_count && (list = (char**)calloc(snapshot->track_count, sizeof(char*)))) {
+        for (uint32_t i = 0; i < snapshot->track_count; i++)
+            list[i] = strndup(snapshot->tracks[i], SNAPSHOT_PATH_BYTES - 1);
+        *count = snapshot->track_count;
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+    return list;
+}
+
+/* Store list as the cached track list, only its fingerprint if it does not fit */
+void snapshot_set_tracks(char** list, size_t count)
+{
+    uint64_t fingerprint = track_list_fingerprint(list, count);
+    int      fits        = count <= SNAPSHOT_TRACKS;
+    for (size_t i = 0; fits && i < count; i++)
+        fits = strlen(list[i]) < SNAPSHOT_PATH_BYTES;
+    if (!snapshot_begin())
+        return;
+    memset(snapshot->tracks, 0, sizeof(snapshot->tracks));
+    snapshot->track_count       = fits ? (uint32_t)count : 0;
+    snapshot->track_fingerprint = fingerprint;
+    for (size_t i = 0; fits && i < count; i++)
+        memcpy(snapshot->tracks[i], list[i], strlen(list[i]));
+    snapshot_commit();
+}
+
+#endif
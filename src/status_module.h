@@ -0,0 +1,167 @@
+#ifndef STATUS_MODULE_H
+#define STATUS_MODULE_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbus_module.h"
+#include "log_module.h"
+#include "metrics_module.h"
+
+/*
+ * Bot status for the TS3 info panel.
+ *
+ * The client calls ts3plugin_infoData over and over while the panel is open,
+ * so it only copies this snapshot. Writers (the event thread for the
+ * listener count, the refresh thread for now playing and the D-Bus latency)
+ * are serialised by a mutex and publish through a sequence lock; readers
+ * never block and simply retry if they raced with a writer.
+ */
+
+#define STATUS_TEXT_BUFSIZE 128
+#define STATUS_INFO_BUFSIZE 512
+/* How often the refresh thread asks VLC for the current metadata */
+#define STATUS_REFRESH_MS 5000
+
+typedef struct {
+    char   song[STATUS_TEXT_BUFSIZE];
+    char   station[STATUS_TEXT_BUFSIZE];
+    int    listeners;
+    double dbus_p99; /* seconds, 0 without calls yet */
+} bot_status;
+
+static bot_status       status_shared;
+static _Atomic uint32_t status_sequence    = 0;
+static pthread_mutex_t  status_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t         status_started_s   = 0;
+
+static pthread_t       status_thread;
+static atomic_int      status_running    = 0;
+static DBusConnection* status_connection = NULL;
+
+static uint64_t status_now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void status_write_begin(void)
+{
+    pthread_mutex_lock(&status_write_mutex);
+    atomic_fetch_add_explicit(&status_sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void status_write_end(void)
+{
+    atomic_fetch_add_explicit(&status_sequence, 1, memory_order_release);
+    pthread_mutex_unlock(&status_write_mutex);
+}
+
+/* Copy a consistent snapshot, never blocks */
+void status_read(bot_status* out)
+{
+    for (;;) {
+        uint32_t before = atomic_load_explicit(&status_sequence, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(out, &status_shared, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&status_sequence, memory_order_relaxed) == before)
+            return;
+    }
+}
+
+/* NULL leaves the field unchanged */
+void status_set_now_playing(const char* song, const char* station)
+{
+    status_write_begin();
+    if (song)
+        snprintf(status_shared.song, sizeof(status_shared.song), "%s", song);
+    if (station)
+        snprintf(status_shared.station, sizeof(status_shared.station), "%s", station);
+    status_write_end();
+}
+
+void status_set_listeners(int listeners)
+{
+    status_write_begin();
+    status_shared.listeners = listeners;
+    status_write_end();
+}
+
+/* BB-code text for the info panel */
+void status_format(const bot_status* status, char* out, size_t size)
+{
+    uint64_t uptime = status_now_s() - status_started_s;
+    char     latency[32];
+
+    if (status->dbus_p99 == 0.0) {
+        snprintf(latency, sizeof(latency), "n/a");
+    } else if (isinf(status->dbus_p99)) {
+        snprintf(latency, sizeof(latency), "> %g ms", metrics_bucket_us[METRICS_BUCKETS - 1] / 1000.0);
+    } else {
+        snprintf(latency, sizeof(latency), "<= %g ms", status->dbus_p99 * 1000.0);
+    }
+
+    snprintf(out, size,
+             "[b]Now playing:[/b] %s\n"
+             "[b]Station:[/b] %s\n"
+             "[b]Listeners:[/b] %d\n"
+             "[b]Uptime:[/b] %llud %02lluh %02llum\n"
+             "[b]D-Bus p99:[/b] %s",
+             status->song[0] ? status->song : "-", status->station[0] ? status->station : "-", status->listeners, (unsigned long long)(uptime / 86400),
+             (unsigned long long)(uptime / 3600 % 24), (unsigned long long)(uptime / 60 % 60), latency);
+}
+
+static void* status_refresh(void* arg)
+{
+    (void)arg;
+    while (atomic_load(&status_running)) {
+        char* song;
+        char* station;
+        GetNowPlaying(status_connection, &song, &station);
+        status_set_now_playing(song, station);
+        free(song);
+        free(station);
+
+        double p99 = metrics_quantile(dbus_rtt_metric, DBUS_CALL_COUNT, 0.99);
+        status_write_begin();
+        status_shared.dbus_p99 = p99;
+        status_write_end();
+
+        for (int waited = 0; waited < STATUS_REFRESH_MS && atomic_load(&status_running); waited += 100)
+            usleep(100 * 1000);
+    }
+    return NULL;
+}
+
+/* From ts3plugin_init, the panel's uptime counts from the plugin load and not from the session bus */
+void status_mark_started(void)
+{
+    status_started_s = status_now_s();
+}
+
+void status_start(DBusConnection* connection)
+{
+    status_connection = connection;
+    atomic_store(&status_running, 1);
+    pthread_create(&status_thread, NULL, status_refresh, NULL);
+}
+
+void status_stop(void)
+{
+    if (!atomic_exchange(&status_running, 0))
+        return;
+    pthread_join(status_thread, NULL);
+}
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef TAGS_MODULE_H
+#define TAGS_MODULE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+ * Tag readers for the library scanner (library_module.h).
+ *
+ * ID3v2.2 to 2.4 with an ID3v1 fallback for MP3, Vorbis comments for FLAC,
+ * Ogg Vorbis and Ogg Opus. Only title, artist, album, track number and
+ * duration are read, every text converted to UTF-8. The format comes from
+ * the content, not the file name.
+ *
+ * Reads go through pread into a scratch buffer of TAGS_HEAD_BYTES the
+ * caller owns, so scanner threads share nothing. A reader looks at the
+ * start of the file and, for FLAC, at the metadata blocks it needs (an
+ * embedded picture is skipped without being read); a tag longer than the
+ * buffer gives the fields before the cut. Everything is bounds checked, a
+ * broken file gives empty fields and nothing worse.
+ *
+ * Durations come from FLAC's STREAMINFO, from the granule position of the
+ * last Ogg page, or for MP3 from a TLEN frame if the tag has one; 0 means
+ * unknown.
+ */
+
+#define TAGS_TEXT_BYTES 256
+#define TAGS_HEAD_BYTES (256 * 1024)
+/* Where the last Ogg page is looked for */
+#define TAGS_TAIL_BYTES (64 * 1024)
+#define TAGS_MAX_FLAC_BLOCKS 64
+
+enum { TAGS_UNKNOWN = 0, TAGS_MP3, TAGS_FLAC, TAGS_VORBIS, TAGS_OPUS };
+
+typedef struct {
+    char     title[TAGS_TEXT_BYTES];
+    char     artist[TAGS_TEXT_BYTES];
+    char     album[TAGS_TEXT_BYTES];
+    uint32_t duration_ms;
+    uint16_t track;
+    uint8_t  format;
+} tags_info;
+
+static inline uint32_t tags_be32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint32_t tags_le32(const uint8_t* p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline uint32_t tags_syncsafe(const uint8_t* p)
+{
+    return (uint32_t)(p[0] & 0x7F) << 21 | (uint32_t)(p[1] & 0x7F) << 14 | (uint32_t)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+}
+
+/* pread until size bytes or the end of the file, returns the byte count */
+static size_t tags_pread(int fd, uint8_t* out, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, out + done, size - done, (off_t)(offset + done));
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    return done;
+}
+
+/* Append code point c as UTF-8 if it fits, the text stays terminated */
+static size_t tags_put_code_point(char* out, size_t used, uint32_t c)
+{
+    uint8_t bytes[4];
+    size_t  count;
+    if (c < 0x80) {
+        bytes[0] = (uint8_t)c;
+        count    = 1;
+    } else if (c < 0x800) {
+        bytes[0] = (uint8_t)(0xC0 | c >> 6);
+        bytes[1] = (uint8_t)(0x80 | (c & 0x3F));
+        count    = 2;
+    } else if (c < 0x10000) {
+        bytes[0] = (uint8_t)(0xE0 | c >> 12);
+        bytes[1] = (uint8_t)(0x80 | (c >> 6 & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | (c & 0x3F));
+        count    = 3;
+    } else {
+        bytes[0] = (uint8_t)(0xF0 | c >> 18);
+        bytes[1] = (uint8_t)(0x80 | (c >> 12 & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | (c >> 6 & 0x3F));
+        bytes[3] = (uint8_t)(0x80 | (c & 0x3F));
+        count    = 4;
+    }
+    if (used + count >= TAGS_TEXT_BYTES)
+        return used;
+    memcpy(out + used, bytes, count);
+    out[used + count] = '\0';
+    return used + count;
+}
+
+/* Copy UTF-8 text of length bytes, up to a NUL, cut at a whole character */
+static void tags_set_utf8(char* out, const uint8_t* text, size_t length)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < length && text[i]; i++) {
+        size_t count = text[i] < 0x80 ? 1 : (text[i] & 0xE0) == 0xC0 ? 2 : (text[i] & 0xF0) == 0xE0 ? 3 : 4;
+        if (used + count >= TAGS_TEXT_BYTES || i + count > length)
+            break;
+        memcpy(out + used, text + i, count);
+        used += count;
+        i += count - 1;
+    }
+    out[used] = '\0';
+}
+
+static void tags_set_latin1(char* out, const uint8_t* text, size_t length)
+{
+    size_t used = 0;
+    out[0]      = '\0';
+    for (size_t i = 0; i < length && text[i]; i++)
+        used = tags_put_code_point(out, used, text[i]);
+}
+
+/* UTF-16 with a byte order mark, or big endian without one (ID3 encoding 2) */
+static void tags_set_utf16(char* out, const uint8_t* text, size_t length, int big_endian)
+{
+    size_t used = 0;
+    size_t i    = 0;
+    out[0]      = '\0';
+    if (length >= 2 && ((text[0] == 0xFF && text[1] == 0xFE) || (text[0] == 0xFE && text[1] == 0xFF))) {
+        big_endian = text[0] == 0xFE;
+        i          = 2;
+    }
+    for (; i + 1 < length; i += 2) {
+        uint32_t unit = big_endian ? (uint32_t)text[i] << 8 | text[i + 1] : (uint32_t)text[i + 1] << 8 | text[i];
+        if (!unit)
+            break;
+        if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < length) {
+            uint32_t low = big_endian ? (uint32_t)text[i + 2] << 8 | text[i + 3] : (uint32_t)text[i + 3] << 8 | text[i + 2];
+            if (low >= 0xDC00 && low < 0xE000) {
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+        }
+        used = tags_put_code_point(out, used, unit);
+    }
+}
+
+/* An ID3v2 text frame body: encoding byte, then the text (the first of several values) */
+static void tags_id3_text(char* out, const uint8_t* body, size_t length)
+{
+    if (!length)
+        return;
+    switch (body[0]) {
+    case 0:
+        tags_set_latin1(out, body + 1, length - 1);
+        break;
+    case 1:
+    case 2:
+        tags_set_utf16(out, body + 1, length - 1, body[0] == 2);
+        break;
+    default:
+        tags_set_utf8(out, body + 1, length - 1);
+        break;
+    }
+}
+
+/* Fill empty fields from an ID3v2 tag at the start of data, returns the bytes it takes in the file (0 if there is none) */
+static uint64_t tags_id3v2(uint8_t* data, size_t length, tags_info* tags)
+{
+    if (length < 10 || memcmp(data, "ID3", 3) != 0 || data[3] < 2 || data[3] > 4)
+        return 0;
+    int      version = data[3];
+    uint8_t  flags   = data[5];
+    uint64_t size    = 10 + (uint64_t)tags_syncsafe(data + 6) + (version == 4 && (flags & 0x10) ? 10 : 0);
+    size_t   end     = size < length ? (size_t)size : length;
+    size_t   at      = 10;
+
+    /* Unsynchronisation of the whole tag (v2.4 does it per frame, which is rare and not undone) */
+    if ((flags & 0x80) && version < 4) {
+        size_t out = 10;
+        for (size_t i = 10; i < end; i++) {
+            data[out++] = data[i];
+            if (data[i] == 0xFF && i + 1 < end && data[i + 1] == 0x00)
+                i++;
+        }
+        end = out;
+    }
+    if ((flags & 0x40) && version > 2 && at + 4 <= end)
+        at += version == 3 ? 4 + (size_t)tags_be32(data + at) : (size_t)tags_syncsafe(data + at);
+
+    size_t header    = version == 2 ? 6 : 10;
+    size_t id_length = version == 2 ? 3 : 4;
+    char   number[TAGS_TEXT_BYTES];
+    while (at + header <= end && data[at]) {
+        const uint8_t* frame = data + at;
+        uint64_t       frame_size;
+        uint16_t       frame_flags = 0;
+        if (version == 2) {
+            frame_size = (uint32_t)frame[3] << 16 | (uint32_t)frame[4] << 8 | frame[5];
+        } else {
+            frame_size  = version == 3 ? tags_be32(frame + 4) : tags_syncsafe(frame + 4);
+            frame_flags = (uint16_t)(frame[8] << 8 | frame[9]);
+        }
+        size_t         available = end - at - header;
+        size_t         body_size = frame_size < available ? (size_t)frame_size : available;
+        const uint8_t* body      = frame + header;
+        int            packed    = version == 3 ? (frame_flags & 0x00C0) != 0 : version == 4 && (frame_flags & 0x000C) != 0;
+        if (version == 4 && (frame_flags & 0x0001) && body_size >= 4) {
+            body += 4; /* data length indicator */
+            body_size -= 4;
+        }
+        char* field = NULL;
+        if (!packed) {
+            if (memcmp(frame, version == 2 ? "TT2" : "TIT2", id_length) == 0)
+                field = tags->title;
+            else if (memcmp(frame, version == 2 ? "TP1" : "TPE1", id_length) == 0)
+                field = tags->artist;
+            else if (memcmp(frame, version == 2 ? "TAL" : "TALB", id_length) == 0)
+                field = tags->album;
+        }
+        if (field && !field[0]) {
+            tags_id3_text(field, body, body_size);
+        } else if (!packed && (memcmp(frame, version == 2 ? "TRK" : "TRCK", id_length) == 0 || memcmp(frame, version == 2 ? "TLE" : "TLEN", id_length) == 0)) {
+            number[0] = '\0';
+            tags_id3_text(number, body, body_size < 16 ? body_size : 16);
+            if (frame[1] == 'R' && !tags->track)
+                tags->track = (uint16_t)strtoul(number, NULL, 10);
+            else if (frame[1] == 'L' && !tags->duration_ms)
+                tags->duration_ms = (uint32_t)strtoul(number, NULL, 10);
+        }
+        if (frame_size > available)
+            break;
+        at += header + (size_t)frame_size;
+    }
+    return size;
+}
+
+/* ID3v1 at the end of the file, for the fields ID3v2 left empty */
+static void tags_id3v1(int fd, uint64_t file_size, tags_info* tags)
+{
+    uint8_t tag[128];
+    if (file_size < sizeof(tag) || tags_pread(fd, tag, sizeof(tag), file_size - sizeof(tag)) != sizeof(tag) || memcmp(tag, "TAG", 3) != 0)
+        return;
+    if (!tags->title[0])
+        tags_set_latin1(tags->title, tag + 3, 30);
+    if (!tags->artist[0])
+        tags_set_latin1(tags->artist, tag + 33, 30);
+    if (!tags->album[0])
+        tags_set_latin1(tags->album, tag + 63, 30);
+    if (!tags->track && tag[125] == 0)
+        tags->track = tag[126];
+    /* Fields are padded with spaces as often as with NULs */
+    char* fields[] = {tags->title, tags->artist, tags->album};
+    for (int i = 0; i < 3; i++) {
+        size_t length = strlen(fields[i]);
+        while (length && fields[i][length - 1] == ' ')
+            fields[i][--length] = '\0';
+    }
+}
+
+/* A Vorbis comment block (vendor, then KEY=value fields), as FLAC and Ogg carry it */
+static void tags_vorbis_comment(const uint8_t* data, size_t length, tags_info* tags)
+{
+    if (length < 8)
+        return;
+    uint64_t at = 4 + (uint64_t)tags_le32(data);
+    if (at + 4 > length)
+        return;
+    uint32_t count = tags_le32(data + at);
+    at += 4;
+    for (uint32_t i = 0; i < count && at + 4 <= length; i++) {
+        uint64_t field_length = tags_le32(data + at);
+        at += 4;
+        size_t         available = length - (size_t)at;
+        size_t         size      = field_length < available ? (size_t)field_length : available;
+        const uint8_t* field     = data + at;
+        const uint8_t* equals    = (const uint8_t*)memchr(field, '=', size);
+        if (equals) {
+            size_t         key_length   = (size_t)(equals - field);
+            const uint8_t* value        = equals + 1;
+            size_t         value_length = size - key_length - 1;
+            char*          out          = NULL;
+            if (key_length == 5 && strncasecmp((const char*)field, "TITLE", 5) == 0)
+                out = tags->title;
+            else if (key_length == 6 && strncasecmp((const char*)field, "ARTIST", 6) == 0)
+                out = tags->artist;
+            else if (key_length == 5 && strncasecmp((const char*)field, "ALBUM", 5) == 0)
+                out = tags->album;
+            if (out && !out[0]) {
+                tags_set_utf8(out, value, value_length);
+            } else if (key_length == 11 && strncasecmp((const char*)field, "TRACKNUMBER", 11) == 0 && !tags->track) {
+                char number[TAGS_TEXT_BYTES];
+                tags_set_utf8(number, value, value_length < 16 ? value_length : 16);
+                tags->track = (uint16_t)strtoul(number, NULL, 10);
+            }
+        }
+        if (field_length > available)
+            break;
+        at += field_length;
+    }
+}
+
+/* FLAC metadata blocks after the "fLaC" at offset */
+static void tags_flac(int fd, uint64_t offset, uint64_t file_size, uint8_t* scratch, tags_info* tags)
+{
+    offset += 4;
+    for (int block = 0; block < TAGS_MAX_FLAC_BLOCKS && offset + 4 <= file_size; block++) {
+        uint8_t header[4];
+        if (tags_pread(fd, header, 4, offset) != 4)
+            return;
+        int      type   = header[0] & 0x7F;
+        uint32_t length = (uint32_t)header[1] << 16 | (uint32_t)header[2] << 8 | header[3];
+        offset += 4;
+        if (type == 0 && length >= 18) {
+            uint8_t info[18];
+            if (tags_pread(fd, info, sizeof(info), offset) == sizeof(info)) {
+                uint32_t rate    = (uint32_t)info[10] << 12 | (uint32_t)info[11] << 4 | info[12] >> 4;
+                uint64_t samples = (uint64_t)(info[13] & 0x0F) << 32 | tags_be32(info + 14);
+                if (rate)
+                    tags->duration_ms = (uint32_t)(samples * 1000 / rate);
+            }
+        } else if (type == 4) {
+            size_t size = length < TAGS_HEAD_BYTES ? length : TAGS_HEAD_BYTES;
+            tags_vorbis_comment(scratch, tags_pread(fd, scratch, size, offset), tags);
+        }
+        if (header[0] & 0x80)
+            return; /* last block */
+        offset += length;
+    }
+}
+
+/*
+ * The first two packets of an Ogg stream from the pages in data, which is
+ * rewritten to hold them one after the other. Returns the length of the
+ * first, *second_end where the second ends (cut short at the end of data).
+ */
+static size_t tags_ogg_packets(uint8_t* data, size_t length, size_t* second_end)
+{
+    size_t   in = 0, out = 0, first_end = 0;
+    int      packets = 0;
+    uint32_t serial  = length >= 18 ? tags_le32(data + 14) : 0;
+    while (packets < 2 && in + 27 <= length && memcmp(data + in, "OggS", 4) == 0) {
+        uint8_t lacing[255];
+        size_t  segments = data[in + 26];
+        size_t  payload  = in + 27 + segments;
+        if (payload > length)
+            break;
+        memcpy(lacing, data + in + 27, segments);
+        int      ours = tags_le32(data + in + 14) == serial;
+        size_t   next = payload;
+        for (size_t s = 0; s < segments; s++)
+            next += lacing[s];
+        for (size_t s = 0; ours && s < segments && packets < 2; s++) {
+            size_t size = lacing[s] < length - payload ? lacing[s] : length - payload;
+            memmove(data + out, data + payload, size);
+            out += size;
+            payload += size;
+            if (lacing[s] < 255 && size == lacing[s]) {
+                if (++packets == 1)
+                    first_end = out;
+            }
+        }
+        in = next;
+    }
+    *second_end = out;
+    return packets ? first_end : 0;
+}
+
+/* Ogg Vorbis or Opus, the head of the file is in data */
+static void tags_ogg(int fd, uint64_t file_size, uint8_t* data, size_t length, tags_info* tags)
+{
+    size_t second_end;
+    size_t first_end = tags_ogg_packets(data, length, &second_end);
+    uint32_t rate    = 0;
+    uint32_t skip    = 0;
+    if (first_end >= 16 && memcmp(data, "\x01vorbis", 7) == 0) {
+        tags->format = TAGS_VORBIS;
+        rate         = tags_le32(data + 12);
+        if (second_end > first_end + 7 && memcmp(data + first_end, "\x03vorbis", 7) == 0)
+            tags_vorbis_comment(data + first_end + 7, second_end - first_end - 7, tags);
+    } else if (first_end >= 12 && memcmp(data, "OpusHead", 8) == 0) {
+        tags->format = TAGS_OPUS;
+        rate         = 48000; /* granule positions always count 48 kHz */
+        skip         = (uint32_t)(data[10] | data[11] << 8);
+        if (second_end > first_end + 8 && memcmp(data + first_end, "OpusTags", 8) == 0)
+            tags_vorbis_comment(data + first_end + 8, second_end - first_end - 8, tags);
+    }
+    if (!rate)
+        return;
+
+    /* The granule position of the last page is the length in samples */
+    uint64_t offset = file_size > TAGS_TAIL_BYTES ? file_size - TAGS_TAIL_BYTES : 0;
+    size_t   tail   = tags_pread(fd, data, TAGS_TAIL_BYTES, offset);
+    for (size_t at = tail >= 14 ? tail - 14 : 0; tail >= 14; at--) {
+        if (memcmp(data + at, "OggS", 4) == 0 && data[at + 4] == 0) {
+            uint64_t granule = (uint64_t)tags_le32(data + at + 6) | (uint64_t)tags_le32(data + at + 10) << 32;
+            if (granule != UINT64_MAX && granule > skip)
+                tags->duration_ms = (uint32_t)((granule - skip) * 1000 / rate);
+            break;
+        }
+        if (!at)
+            break;
+    }
+}
+
+/*
+ * Read the tags of the open file fd of file_size bytes, scratch holds
+ * TAGS_HEAD_BYTES. Returns 0 with tags filled (fields may be empty) if it
+ * is MP3, FLAC, Ogg Vorbis or Opus, -1 otherwise.
+ */
+int tags_read(int fd, uint64_t file_size, uint8_t* scratch, tags_info* tags)
+{
+    memset(tags, 0, sizeof(*tags));
+    size_t length = tags_pread(fd, scratch, TAGS_HEAD_BYTES, 0);
+    if (length < 4)
+        return -1;
+    if (memcmp(scratch, "OggS", 4) == 0) {
+        tags_ogg(fd, file_size, scratch, length, tags);
+        return tags->format ? 0 : -1;
+    }
+
+    uint64_t after = tags_id3v2(scratch, length, tags);
+    uint8_t  magic[4];
+    if (tags_pread(fd, magic, 4, after) == 4 && memcmp(magic, "fLaC", 4) == 0) {
+        tags->format = TAGS_FLAC;
+        tags_flac(fd, after, file_size, scratch, tags);
+        return 0;
+    }
+    /* An ID3 tag or an MPEG audio frame sync */
+    if (after || (scratch[0] == 0xFF && (scratch[1] & 0xE0) == 0xE0)) {
+        tags->format = TAGS_MP3;
+        tags_id3v1(fd, file_size, tags);
+        return 0;
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef TIMER_MODULE_H
+#define TIMER_MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Hierarchical timer wheel for delayed and periodic bot work.
+ *
+ * TIMER_LEVELS wheels of TIMER_SLOTS slots each: level 0 holds the timers
+ * due within the next TIMER_SLOTS ticks, level 1 those within
+ * TIMER_SLOTS^2 ticks and so on, one intrusive doubly linked list per slot.
+ * Arming and cancelling are O(1); when level 0 wraps around, the next slot
+ * of level 1 is cascaded down into level 0 (and likewise further up), so
+ * every timer is moved at most TIMER_LEVELS - 1 times before it fires.
+ * Timers further away than the top level park in its farthest slot and are
+ * re-sorted when that slot cascades.
+ *
+ * An occupancy bitmap per level gives the next tick with work in
+ * O(TIMER_LEVELS) (timers_next_tick), the event loop arms its timerfd for
+ * exactly that tick and skips idle stretches, so a wheel with only long
+ * timers in it wakes up rarely. All timers due in the same TIMER_TICK_MS
+ * tick fire from one wakeup; timer_arm's slack rounds the expiry up to a
+ * coarser boundary so timers that do not need to be exact line up with
+ * others and fire together too.
+ *
+ * Not thread safe, the wheel belongs to the event loop thread (see
+ * loop_module.h). Callbacks run there and may arm or cancel any timer,
+ * including their own.
+ */
+
+#define TIMER_TICK_MS 10
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+#define TIMER_NONE UINT64_MAX
+
+typedef struct timer_entry timer_entry;
+typedef void (*timer_callback)(timer_entry* timer, void* context);
+
+struct timer_entry {
+    timer_entry*   next;
+    timer_entry**  link;    /* the pointer to this entry, NULL while not armed */
+    uint64_t       expires; /* tick */
+    uint8_t        level;   /* where it is linked, TIMER_FIRING while its slot fires */
+    uint8_t        slot;
+    timer_callback fire;
+    void*          context;
+};
+
+#define TIMER_FIRING TIMER_LEVELS
+
+static timer_entry* timer_slots[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t     timer_occupied[TIMER_LEVELS];
+/* The slot being fired, timers in it stay cancellable from callbacks */
+static timer_entry* timer_firing = NULL;
+/* Next tick to process, every tick before it has fired */
+static uint64_t timer_current  = 0;
+static size_t   timer_armed    = 0;
+static uint64_t timer_epoch_ns = 0;
+
+/* Ticks of TIMER_TICK_MS since the first call */
+static uint64_t timer_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    if (!timer_epoch_ns)
+        timer_epoch_ns = now;
+    return (now - timer_epoch_ns) / (TIMER_TICK_MS * 1000000ull);
+}
+
+/* CLOCK_MONOTONIC time at which tick starts, for timerfd_settime */
+static struct timespec timer_tick_time(uint64_t tick)
+{
+    uint64_t        ns = timer_epoch_ns + tick * TIMER_TICK_MS * 1000000ull;
+    struct timespec ts = {(time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull)};
+    return ts;
+}
+
+void timer_init(timer_entry* timer, timer_callback fire, void* context)
+{
+    timer->next    = NULL;
+    timer->link    = NULL;
+    timer->expires = 0;
+    timer->level   = 0;
+    timer->slot    = 0;
+    timer->fire    = fire;
+    timer->context = context;
+}
+
+static inline int timer_pending(const timer_entry* timer)
+{
+    return timer->link != NULL;
+}
+
+static void timer_push(timer_entry** head, timer_entry* timer)
+{
+    timer->next = *head;
+    if (*head)
+        (*head)->link = &timer->next;
+    *head       = timer;
+    timer->link = head;
+}
+
+static void timer_unlink(timer_entry* timer)
+{
+    *timer->link = timer->next;
+    if (timer->next)
+        timer->next->link = timer->link;
+    timer->link = NULL;
+    timer->next = NULL;
+    if (timer->level != TIMER_FIRING && !timer_slots[timer->level][timer->slot])
+        timer_occupied[timer->level] &= ~(1ull << timer->slot);
+}
+
+/* Link timer into the slot for its expiry, relative to timer_current */
+static void timer_insert(timer_entry* timer)
+{
+    uint64_t expires = timer->expires < timer_current ? timer_current : timer->expires;
+    uint64_t delta   = expires - timer_current;
+    if (delta >= 1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) {
+        /* Beyond the wheel, park in the slot that cascades last and sort it again from there */
+        delta   = (1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+        expires = timer_current + delta;
+    }
+    int level = 0;
+    while (delta >= 1ull << (TIMER_SLOT_BITS * (level + 1)))
+        level++;
+    timer->level = (uint8_t)level;
+    timer->slot  = (uint8_t)((expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    timer_push(&timer_slots[level][timer->slot], timer);
+    timer_occupied[level] |= 1ull << timer->slot;
+}
+
+void timer_cancel(timer_entry* timer)
+{
+    if (!timer->link)
+        return;
+    timer_unlink(timer);
+    timer_armed--;
+}
+
+/* Arm (or re-arm) timer to fire at tick expires, or on the next tick if that has passed */
+void timer_arm_at(timer_entry* timer, uint64_t expires)
+{
+    timer_cancel(timer);
+    timer->expires = expires;
+    timer_insert(timer);
+    timer_armed++;
+}
+
+/*
+ * Arm (or re-arm) timer to fire in delay_ms. With slack_ms > 0 it may fire
+ * up to slack_ms later, on a boundary it shares with other slack timers.
+ */
+void timer_arm(timer_entry* timer, uint64_t delay_ms, uint64_t slack_ms)
+{
+    uint64_t expires = timer_ticks() + (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    uint64_t slack   = slack_ms / TIMER_TICK_MS;
+    if (slack) {
+        uint64_t boundary = 1ull << (63 - __builtin_clzll(slack));
+        expires           = (expires + boundary - 1) & ~(boundary - 1);
+    }
+    timer_arm_at(timer, expires);
+}
+
+/* Distance from slot start to the first occupied slot at least from_distance away, TIMER_SLOTS if none */
+static unsigned timer_next_slot(uint64_t occupied, unsigned start, unsigned from_distance)
+{
+    uint64_t rotated = start ? (occupied >> start) | (occupied << (TIMER_SLOTS - start)) : occupied;
+    rotated &= ~0ull << from_distance;
+    return rotated ? (unsigned)__builtin_ctzll(rotated) : TIMER_SLOTS;
+}
+
+/* The next tick at which a timer fires or a level cascades, TIMER_NONE for an empty wheel */
+uint64_t timers_next_tick(void)
+{
+    if (!timer_armed)
+        return TIMER_NONE;
+    uint64_t next = TIMER_NONE;
+    if (timer_occupied[0]) {
+        next = timer_current + timer_next_slot(timer_occupied[0], timer_current & (TIMER_SLOTS - 1), 0);
+    }
+    for (int l = 1; l < TIMER_LEVELS; l++) {
+        if (!timer_occupied[l])
+            continue;
+        /*
+         * A level l slot cascades when the levels below wrap to it. The
+         * current slot only does if timer_current is on that boundary,
+         * otherwise it waits a full turn.
+         */
+        int      shift    = TIMER_SLOT_BITS * l;
+        uint64_t position = timer_current >> shift;
+        int      aligned  = (timer_current & ((1ull << shift) - 1)) == 0;
+        unsigned distance = timer_next_slot(timer_occupied[l], (unsigned)(position & (TIMER_SLOTS - 1)), aligned ? 0 : 1);
+        uint64_t tick     = (position + distance) << shift;
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+/* Move the timers of one slot into the lower levels */
+static void timer_cascade(int level, unsigned slot)
+{
+    timer_entry* list         = timer_slots[level][slot];
+    timer_slots[level][slot]  = NULL;
+    timer_occupied[level]    &= ~(1ull << slot);
+    while (list) {
+        timer_entry* timer = list;
+        list               = timer->next;
+        timer_insert(timer);
+    }
+}
+
+/* Fire every timer due up to and including tick now, skipping idle ticks. Returns the number fired. */
+size_t timers_run(uint64_t now)
+{
+    size_t fired = 0;
+    while (timer_current <= now) {
+        uint64_t next = timers_next_tick();
+        if (next > now) {
+            timer_current = now + 1;
+            break;
+        }
+        timer_current = next;
+        for (int l = 1; l < TIMER_LEVELS; l++) {
+            int shift = TIMER_SLOT_BITS * l;
+            if (timer_current & ((1ull << shift) - 1))
+                break;
+            timer_cascade(l, (unsigned)((timer_current >> shift) & (TIMER_SLOTS - 1)));
+        }
+
+        /* Fire from a separate list, a callback that re-arms for "now" lands in the next tick */
+        unsigned index = (unsigned)(timer_current & (TIMER_SLOTS - 1));
+        timer_firing   = timer_slots[0][index];
+        if (timer_firing)
+            timer_firing->link = &timer_firing;
+        for (timer_entry* timer = timer_firing; timer; timer = timer->next)
+            timer->level = TIMER_FIRING;
+        timer_slots[0][index] = NULL;
+        timer_occupied[0] &= ~(1ull << index);
+        timer_current++;
+
+        timer_entry* timer;
+        while ((timer = timer_firing)) {
+            timer_unlink(timer);
+            timer_armed--;
+            fired++;
+            timer->fire(timer, timer->context);
+        }
+    }
+    return fired;
+}
+
+#endif
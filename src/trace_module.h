@@ -0,0 +1,145 @@
+#ifndef TRACE_MODULE_H
+#define TRACE_MODULE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Span tracing for command handling and event processing.
+ *
+ *   TRACE_SPAN("onTextMessageEvent");          whole scope, ends on return
+ *   uint64_t t = trace_begin();
+ *   ts3Functions.getChannelOfClient(...);
+ *   trace_end("getChannelOfClient", t);        one stage
+ *   if (TRACE_CALL("requestClientMove", ts3Functions.requestClientMove(...)) != ERROR_ok)
+ *
+ * Finished spans go into a global flight recorder ring of TRACE_RING_EVENTS
+ * slots that silently overwrites the oldest ones. A writer claims a slot
+ * with one fetch_add and publishes it with a sequence number, so the dump
+ * can skip slots that are being rewritten. With tracing off trace_begin is
+ * one predictable branch and returns 0, which trace_end ignores. Span names
+ * must be string literals (or otherwise live as long as the plugin).
+ *
+ * trace_dump writes the ring as Chrome trace-event JSON, open it in
+ * chrome://tracing or ui.perfetto.dev. Controlled with /musicbot trace.
+ */
+
+/* Power of two */
+#define TRACE_RING_EVENTS 65536
+#define TRACE_DEFAULT_PATH "/tmp/musicbot-trace.json"
+
+typedef struct {
+    _Atomic uint64_t sequence; /* claim index + 1 once complete, 0 while being written */
+    const char*      name;
+    uint64_t         start_ns;
+    uint64_t         duration_ns;
+    uint32_t         tid;
+} trace_event;
+
+static trace_event       trace_ring[TRACE_RING_EVENTS];
+static _Atomic uint64_t  trace_head       = 0;
+static atomic_int        trace_enabled    = 0;
+static _Thread_local int trace_thread_tid = 0;
+
+static inline uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t trace_begin(void)
+{
+    if (__builtin_expect(!atomic_load_explicit(&trace_enabled, memory_order_relaxed), 1))
+        return 0;
+    return trace_now_ns();
+}
+
+static void trace_record(const char* name, uint64_t start, uint64_t end)
+{
+    if (!trace_thread_tid)
+        trace_thread_tid = (int)syscall(SYS_gettid);
+
+    uint64_t     claim = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    trace_event* e     = &trace_ring[claim & (TRACE_RING_EVENTS - 1)];
+    atomic_store_explicit(&e->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->name        = name;
+    e->start_ns    = start;
+    e->duration_ns = end - start;
+    e->tid         = (uint32_t)trace_thread_tid;
+    atomic_store_explicit(&e->sequence, claim + 1, memory_order_release);
+}
+
+static inline void trace_end(const char* name, uint64_t start)
+{
+    if (__builtin_expect(start != 0, 0))
+        trace_record(name, start, trace_now_ns());
+}
+
+typedef struct {
+    const char* name;
+    uint64_t    start;
+} trace_span;
+
+static inline void trace_span_end(trace_span* span)
+{
+    trace_end(span->name, span->start);
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) trace_span TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(trace_span_end))) = {(name), trace_begin()}
+/* Evaluates to the result of call, which must not be void */
+#define TRACE_CALL(name, call)                                                                                                                                                                                                                                 \
+    ({                                                                                                                                                                                                                                                         \
+        uint64_t        trace_call_start  = trace_begin();                                                                                                                                                                                                     \
+        __typeof__(call) trace_call_result = (call);                                                                                                                                                                                                           \
+        trace_end((name), trace_call_start);                                                                                                                                                                                                                   \
+        trace_call_result;                                                                                                                                                                                                                                     \
+    })
+
+void trace_set_enabled(int enabled)
+{
+    atomic_store(&trace_enabled, enabled);
+}
+
+/* Write the ring as Chrome trace-event JSON. Returns the number of spans written, -1 if the file could not be created. */
+long trace_dump(const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (!out)
+        return -1;
+
+    uint64_t head  = atomic_load(&trace_head);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    long     count = 0;
+    int      pid   = (int)getpid();
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    for (uint64_t i = first; i < head; i++) {
+        trace_event* e        = &trace_ring[i & (TRACE_RING_EVENTS - 1)];
+        uint64_t     sequence = atomic_load_explicit(&e->sequence, memory_order_acquire);
+        const char*  name     = e->name;
+        uint64_t     start    = e->start_ns;
+        uint64_t     duration = e->duration_ns;
+        uint32_t     tid      = e->tid;
+        atomic_thread_fence(memory_order_acquire);
+        /* Still being written, or already overwritten by a newer span */
+        if (sequence != i + 1 || atomic_load_explicit(&e->sequence, memory_order_relaxed) != sequence)
+            continue;
+
+        fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"musicbot\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", count ? "," : "", name, pid, tid,
+                (double)start / 1000.0, (double)duration / 1000.0);
+        count++;
+    }
+    fputs("\n]}\n", out);
+    fclose(out);
+    return count;
+}
+
+#endif
@@ -0,0 +1,634 @@
+/*
+ * Microbenchmarks for the plugin's hot paths, results as JSON on stdout.
+ *
+ *   make bench                      build and run
+ *   ./musicbot_bench [filter] > run.json
+ *
+ * The plugin is compiled into this program (it is one translation unit), so
+ * the benchmarks call the real static functions. TS3 is replaced by a few
+ * stub functions and D-Bus replies are built offline in the shape VLC 3
+ * sends them, nothing here needs a server, a bus or a player. Logging is
+ * off while measuring.
+ *
+ * Each benchmark runs batches until BENCH_MIN_SECONDS have passed, then
+ * BENCH_SAMPLES timed batches of that size; ns_per_op is the median
+ * sample and ns_per_op_min the fastest. Entries with a value and a unit
+ * instead are derived on a simulated clock and do not vary between runs.
+ */
+
+#include "../src/plugin.c"
+
+/*
+ * The resampler a second time with the vector paths compiled out, so one run
+ * compares both. Everything it defines is renamed to *_scalar.
+ */
+#undef RESAMPLER_MODULE_H
+#define RESAMPLER_SCALAR
+#define resampler resampler_scalar
+#define resampler_bessel_i0 resampler_scalar_bessel_i0
+#define resampler_free resampler_scalar_free
+#define resampler_set_ratio resampler_scalar_set_ratio
+#define resampler_init resampler_scalar_init
+#define resampler_dot2 resampler_scalar_dot2
+#define resampler_process resampler_scalar_process
+#include "../src/resampler_module.h"
+#undef resampler
+#undef resampler_bessel_i0
+#undef resampler_free
+#undef resampler_set_ratio
+#undef resampler_init
+#undef resampler_dot2
+#undef resampler_process
+
+#define BENCH_MIN_SECONDS 0.05
+#define BENCH_SAMPLES 7
+#define BENCH_CHANNEL_CLIENTS 8
+#define BENCH_TIMERS 100000
+/* Timer delays up to ~33 minutes in ticks, spread over the three lower levels of the wheel */
+#define BENCH_TIMER_SPAN 200000
+#define BENCH_REMOTE_OPS 16
+#define BENCH_LIBRARY_TRACKS 200000
+#define BENCH_LIBRARY_PATH "/tmp/musicbot_bench_library.bin"
+/* One captured block the way TS3 hands it over, 20 ms of 48 kHz stereo */
+#define BENCH_VOICE_FRAMES 960
+/* Input block of the resampler cases, what deck_push hands over at most */
+#define BENCH_RESAMPLER_FRAMES DECK_BLOCK_FRAMES
+
+/************************** TS3 stubs ***************************/
+
+static int bench_channel_clients = BENCH_CHANNEL_CLIENTS;
+
+static unsigned int bench_freeMemory(void* pointer)
+{
+    free(pointer);
+    return ERROR_ok;
+}
+
+static unsigned int bench_logMessage(const char* logMessage, enum LogLevel severity, const char* channel, uint64 logID)
+{
+    return ERROR_ok;
+}
+
+static unsigned int bench_getChannelOfClient(uint64 serverConnectionHandlerID, anyID clientID, uint64* result)
+{
+    *result = CONFIG_DEFAULT_CHANNEL_ID;
+    return ERROR_ok;
+}
+
+static unsigned int bench_getChannelClientList(uint64 serverConnectionHandlerID, uint64 channelID, anyID** result)
+{
+    anyID* list = (anyID*)malloc(sizeof(anyID) * (size_t)(bench_channel_clients + 1));
+    for (int i = 0; i < bench_channel_clients; i++)
+        list[i] = (anyID)(i + 1);
+    list[bench_channel_clients] = 0;
+    *result                     = list;
+    return ERROR_ok;
+}
+
+static unsigned int bench_requestSendPrivateTextMsg(uint64 serverConnectionHandlerID, const char* message, anyID targetClientID, const char* returnCode)
+{
+    return ERROR_ok;
+}
+
+static unsigned int bench_requestClientMove(uint64 serverConnectionHandlerID, anyID clientID, uint64 newChannelID, const char* password, const char* returnCode)
+{
+    return ERROR_ok;
+}
+
+static void bench_sendPluginCommand(uint64 serverConnectionHandlerID, const char* pluginID, const char* command, int targetMode, const anyID* targetIDs, const char* returnCode)
+{
+}
+
+static void bench_createReturnCode(const char* pluginID, char* returnCode, size_t maxLen)
+{
+    snprintf(returnCode, maxLen, "PR:bench");
+}
+
+static void bench_setup_plugin(void)
+{
+    struct TS3Functions functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.freeMemory                = bench_freeMemory;
+    functions.logMessage                = bench_logMessage;
+    functions.getChannelOfClient        = bench_getChannelOfClient;
+    functions.getChannelClientList      = bench_getChannelClientList;
+    functions.requestSendPrivateTextMsg = bench_requestSendPrivateTextMsg;
+    functions.requestClientMove         = bench_requestClientMove;
+    functions.createReturnCode          = bench_createReturnCode;
+    functions.sendPluginCommand         = bench_sendPluginCommand;
+    ts3plugin_setFunctionPointers(functions);
+
+    log_set_level(LOG_LEVEL_OFF);
+    register_metrics();
+    remote_start(send_plugin_command);
+    pluginID             = strdup("bench");
+    currentConnHandlerID = 1;
+    myClientID           = 1;
+    currentChannelID     = CONFIG_DEFAULT_CHANNEL_ID;
+}
+
+/************************** Offline D-Bus replies ***************************/
+
+static DBusMessage* bench_reply(void)
+{
+    DBusMessage* reply = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    dbus_message_set_reply_serial(reply, 1);
+    return reply;
+}
+
+static void bench_append_entry(DBusMessageIter* dict, const char* key, int type, const void* value)
+{
+    DBusMessageIter entry, variant;
+    char            signature[2] = {(char)type, '\0'};
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void bench_append_string_array_entry(DBusMessageIter* dict, const char* key, const char* value)
+{
+    DBusMessageIter entry, variant, array;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+    dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &value);
+    dbus_message_iter_close_container(&variant, &array);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* Properties.Get(Player, Metadata) reply of a VLC 3 playing a radio stream, keys in VLC's order */
+static DBusMessage* bench_metadata_reply(void)
+{
+    DBusMessage*    reply = bench_reply();
+    DBusMessageIter args, variant, dict;
+    const char*     trackid   = "/org/videolan/vlc/playlist/27";
+    const char*     url       = "http://prem2.di.fm:80/discohouse_hi?listen_key=0123456789abcdef";
+    const char*     title     = "DI.FM - Disco House";
+    const char*     publisher = "Digitally Imported";
+    const char*     encoder   = "Lavf58.76.100";
+    const char*     playing   = "Purple Disco Machine - Hypnotized (Extended Mix)";
+    const char*     genre     = "Disco House";
+    const char*     art       = "file:///home/musicbot/.cache/vlc/art/arturl/0f1e2d3c/art.jpg";
+    int64_t         length    = 0;
+    int32_t         track     = 27;
+
+    dbus_message_iter_init_append(reply, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    bench_append_entry(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, &trackid);
+    bench_append_entry(&dict, "xesam:url", DBUS_TYPE_STRING, &url);
+    bench_append_entry(&dict, "xesam:title", DBUS_TYPE_STRING, &title);
+    bench_append_entry(&dict, "vlc:publisher", DBUS_TYPE_STRING, &publisher);
+    bench_append_entry(&dict, "vlc:encodedby", DBUS_TYPE_STRING, &encoder);
+    bench_append_entry(&dict, "mpris:length", DBUS_TYPE_INT64, &length);
+    bench_append_entry(&dict, "xesam:trackNumber", DBUS_TYPE_INT32, &track);
+    bench_append_entry(&dict, "mpris:artUrl", DBUS_TYPE_STRING, &art);
+    bench_append_entry(&dict, "vlc:nowplaying", DBUS_TYPE_STRING, &playing);
+    bench_append_string_array_entry(&dict, "xesam:genre", genre);
+    dbus_message_iter_close_container(&variant, &dict);
+    dbus_message_iter_close_container(&args, &variant);
+    return reply;
+}
+
+/* Properties.Get(TrackList, Tracks) reply with count entries */
+static DBusMessage* bench_tracks_reply(size_t count)
+{
+    DBusMessage*    reply = bench_reply();
+    DBusMessageIter args, variant, array;
+    char            path[64];
+    dbus_message_iter_init_append(reply, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, "ao", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "o", &array);
+    for (size_t i = 0; i < count; i++) {
+        const char* value = path;
+        snprintf(path, sizeof(path), "/org/videolan/vlc/playlist/%zu", i + 1);
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_OBJECT_PATH, &value);
+    }
+    dbus_message_iter_close_container(&variant, &array);
+    dbus_message_iter_close_container(&args, &variant);
+    return reply;
+}
+
+/************************** Harness ***************************/
+
+typedef void (*bench_function)(void* context);
+
+static int         bench_count  = 0;
+static const char* bench_filter = NULL;
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* As bench_run, for an operation that consumes frames input frames; adds frames_per_sec */
+static void bench_run_frames(const char* name, bench_function function, void* context, size_t frames)
+{
+    if (bench_filter && !strstr(name, bench_filter))
+        return;
+
+    uint64_t batch = 1;
+    for (;;) {
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < batch; i++)
+            function(context);
+        if ((bench_now_ns() - start) / 1e9 >= BENCH_MIN_SECONDS / BENCH_SAMPLES || batch >= (1ull << 40))
+            break;
+        batch *= 2;
+    }
+
+    double samples[BENCH_SAMPLES];
+    for (int sample = 0; sample < BENCH_SAMPLES; sample++) {
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < batch; i++)
+            function(context);
+        samples[sample] = (double)(bench_now_ns() - start) / (double)batch;
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(double), bench_compare);
+    double median = samples[BENCH_SAMPLES / 2];
+
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ops_per_sec\": %.0f", bench_count ? "," : "", name,
+           (unsigned long long)(batch * BENCH_SAMPLES), median, samples[0], median > 0 ? 1e9 / median : 0.0);
+    if (frames)
+        printf(", \"frames_per_sec\": %.0f", median > 0 ? 1e9 * (double)frames / median : 0.0);
+    printf("}");
+    fflush(stdout);
+    bench_count++;
+}
+
+static void bench_run(const char* name, bench_function function, void* context)
+{
+    bench_run_frames(name, function, context, 0);
+}
+
+/************************** Benchmarks ***************************/
+
+/* What the event loop runs for a private message */
+static void bench_text_message(void* context)
+{
+    handle_text_message(1, 2, "alice", "alice=", (const char*)context);
+}
+
+/* A plugin command of BENCH_REMOTE_OPS now playing queries, from the base64 to the encoded answer */
+static void bench_remote_batch(void* context)
+{
+    uint8_t payload[REMOTE_MAX_REQUEST];
+    long    length = remote_decode((const char*)context, payload, sizeof(payload));
+    handle_remote_command(1, 2, "alice=", payload, length);
+}
+
+/* What every reader of the configuration pays, a station lookup included */
+static void bench_config_find_station(void* context)
+{
+    config_station station;
+    config_find_station((const char*)context, &station);
+}
+
+static void bench_parse_song(void* context)
+{
+    char* song = NULL;
+    parse_metadata((DBusMessage*)context, &song, NULL);
+    free(song);
+}
+
+static void bench_parse_now_playing(void* context)
+{
+    char* song    = NULL;
+    char* station = NULL;
+    parse_metadata((DBusMessage*)context, &song, &station);
+    free(song);
+    free(station);
+}
+
+static void bench_parse_tracks(void* context)
+{
+    char** list  = NULL;
+    size_t count = 0;
+    parse_track_list((DBusMessage*)context, &list, &count);
+    for (size_t i = 0; i < count; i++)
+        free(list[i]);
+    free(list);
+}
+
+static void bench_count_clients(void* context)
+{
+    size_t count;
+    count_channel_clients(1, &count);
+}
+
+/* Somebody else moves between two other channels, the bot checks whether it is alone */
+static void bench_alone_check(void* context)
+{
+    handle_client_move(1, 2, 500, 501);
+}
+
+static timer_entry bench_timers[BENCH_TIMERS];
+static uint64_t    bench_random = 88172645463325252ull;
+static size_t      bench_timer_next = 0;
+
+static uint64_t bench_xorshift(void)
+{
+    bench_random ^= bench_random << 13;
+    bench_random ^= bench_random >> 7;
+    bench_random ^= bench_random << 17;
+    return bench_random;
+}
+
+static void bench_timer_fired(timer_entry* timer, void* context)
+{
+}
+
+static void bench_arm_timers(void)
+{
+    for (size_t i = 0; i < BENCH_TIMERS; i++) {
+        timer_arm_at(&bench_timers[i], timer_current + 1 + bench_xorshift() % BENCH_TIMER_SPAN);
+    }
+}
+
+/* Move one of the armed timers somewhere else, a cancel and an insert */
+static void bench_timer_rearm(void* context)
+{
+    timer_entry* timer = &bench_timers[bench_timer_next++ % BENCH_TIMERS];
+    timer_arm_at(timer, timer_current + 1 + bench_xorshift() % BENCH_TIMER_SPAN);
+}
+
+static void bench_timer_next_tick(void* context)
+{
+    timers_next_tick();
+}
+
+/* Arm every timer, then run the wheel until all fired, cascades included */
+static void bench_timer_fire_all(void* context)
+{
+    bench_arm_timers();
+    timers_run(timer_current + BENCH_TIMER_SPAN + 1);
+}
+
+static void bench_loop_ignore(const loop_event* event)
+{
+}
+
+/* A TS3 callback: copy the event into the loop queue. Waits for the loop every half queue so nothing is dropped. */
+static void bench_loop_push(void* context)
+{
+    static unsigned pushed = 0;
+    ts3plugin_onClientMoveEvent(1, 2, 500, 501, RETAIN_VISIBILITY, "");
+    if (++pushed % (LOOP_QUEUE_EVENTS / 2) == 0)
+        loop_sync();
+}
+
+/* Push and wait until the loop thread handled the event, includes waking it up */
+static void bench_loop_round_trip(void* context)
+{
+    ts3plugin_onClientMoveEvent(1, 2, 500, 501, RETAIN_VISIBILITY, "");
+    loop_sync();
+}
+
+static library_catalog bench_library;
+
+/* A catalog of BENCH_LIBRARY_TRACKS made up tracks, 20 per album and 10 albums per artist, mapped the way the plugin maps one */
+static int bench_library_catalog(void)
+{
+    typedef struct {
+        char path[72], title[32], artist[24], album[24];
+    } bench_track_text;
+    library_entry*    entries  = (library_entry*)calloc(BENCH_LIBRARY_TRACKS, sizeof(library_entry));
+    library_entry**   pointers = (library_entry**)calloc(BENCH_LIBRARY_TRACKS, sizeof(library_entry*));
+    bench_track_text* text     = (bench_track_text*)calloc(BENCH_LIBRARY_TRACKS, sizeof(bench_track_text));
+    long long         written  = -1;
+    if (entries && pointers && text) {
+        for (int i = 0; i < BENCH_LIBRARY_TRACKS; i++) {
+            snprintf(text[i].artist, sizeof(text[i].artist), "Artist %d", i / 200);
+            snprintf(text[i].album, sizeof(text[i].album), "Album %d", i / 20);
+            snprintf(text[i].title, sizeof(text[i].title), "Track %d", i);
+            snprintf(text[i].path, sizeof(text[i].path), "/music/Artist %d/Album %d/%02d Track %d.flac", i / 200, i / 20, i % 20 + 1, i);
+            entries[i]  = (library_entry){.inode = (uint64_t)i + 1, .path = text[i].path, .title = text[i].title, .artist = text[i].artist, .album = text[i].album, .format = TAGS_FLAC};
+            pointers[i] = &entries[i];
+        }
+        written = library_write(BENCH_LIBRARY_PATH, pointers, BENCH_LIBRARY_TRACKS);
+    }
+    free(entries);
+    free(pointers);
+    free(text);
+    int mapped = written == BENCH_LIBRARY_TRACKS && library_map(BENCH_LIBRARY_PATH, &bench_library) == 0;
+    unlink(BENCH_LIBRARY_PATH);
+    return mapped ? 0 : -1;
+}
+
+/* !play's search, a full pass over the mapped records */
+static void bench_library_find(void* context)
+{
+    library_match match;
+    library_search(&bench_library, (const char*)context, &match);
+}
+
+static short bench_resampler_in[BENCH_RESAMPLER_FRAMES * 2];
+static short bench_resampler_out[(BENCH_RESAMPLER_FRAMES * 2 + 16) * 2];
+
+/* One deck_push block through the resampler built for this machine */
+static void bench_resample(void* context)
+{
+    resampler_process((resampler*)context, bench_resampler_in, BENCH_RESAMPLER_FRAMES, bench_resampler_out);
+}
+
+/* The same with RESAMPLER_SCALAR */
+static void bench_resample_scalar(void* context)
+{
+    resampler_scalar_process((resampler_scalar*)context, bench_resampler_in, BENCH_RESAMPLER_FRAMES, bench_resampler_out);
+}
+
+static void bench_resamplers(void)
+{
+    static const unsigned int rates[] = {44100, 32000};
+    for (size_t i = 0; i < BENCH_RESAMPLER_FRAMES * 2; i++)
+        bench_resampler_in[i] = (short)(12000.0 * sin(i * 0.07));
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        resampler        vector;
+        resampler_scalar scalar;
+        char             name[64];
+        memset(&vector, 0, sizeof(vector));
+        memset(&scalar, 0, sizeof(scalar));
+        if (resampler_init(&vector, rates[i], AUDIO_SAMPLE_RATE, 2) == 0) {
+            snprintf(name, sizeof(name), "resampler/%u_block_%d", rates[i], BENCH_RESAMPLER_FRAMES);
+            bench_run_frames(name, bench_resample, &vector, BENCH_RESAMPLER_FRAMES);
+        }
+        if (resampler_scalar_init(&scalar, rates[i], AUDIO_SAMPLE_RATE, 2) == 0) {
+            snprintf(name, sizeof(name), "resampler/%u_block_%d_scalar", rates[i], BENCH_RESAMPLER_FRAMES);
+            bench_run_frames(name, bench_resample_scalar, &scalar, BENCH_RESAMPLER_FRAMES);
+        }
+        resampler_free(&vector);
+        resampler_scalar_free(&scalar);
+    }
+}
+
+/* Print a result that is a property of the code rather than a timing, e.g. a latency in audio time */
+static void bench_report(const char* name, const char* unit, double value)
+{
+    if (bench_filter && !strstr(name, bench_filter))
+        return;
+    printf("%s\n    {\"name\": \"%s\", \"value\": %.2f, \"unit\": \"%s\"}", bench_count ? "," : "", name, value, unit);
+    fflush(stdout);
+    bench_count++;
+}
+
+static short bench_voice[BENCH_VOICE_FRAMES * 2];
+
+/* Mark both decks live and give them as much audio as the fade needs, without reader threads */
+static void bench_decks_fill(size_t frames_a, size_t frames_b)
+{
+    int on_air = atomic_load(&deck_on_air);
+    atomic_store(&decks[on_air].ring.read_pos, 0);
+    atomic_store(&decks[on_air].ring.write_pos, frames_a);
+    atomic_store(&decks[1 - on_air].ring.read_pos, 0);
+    atomic_store(&decks[1 - on_air].ring.write_pos, frames_b);
+    for (int i = 0; i < DECK_COUNT; i++)
+        atomic_store(&decks[i].last_data_ms, deck_now_ns() / 1000000);
+}
+
+static void bench_decks_setup(void)
+{
+    for (size_t i = 0; i < DECK_RING_FRAMES * 2; i++) {
+        decks[0].ring.data[i] = (short)(8000.0 * sin(i * 0.031));
+        decks[1].ring.data[i] = (short)(8000.0 * sin(i * 0.047));
+    }
+    atomic_store(&decks_running, 1);
+    atomic_store(&xfade_state, XFADE_IDLE);
+}
+
+/*
+ * One captured block in the middle of a crossfade: both rings read, equal
+ * power mix, conversion to the captured layout. When the fade completes the
+ * rings are topped up again (pointer moves only) and the next one starts.
+ */
+static void bench_crossfade_block(void* context)
+{
+    (void)context;
+    if (atomic_load_explicit(&xfade_state, memory_order_relaxed) != XFADE_FADING) {
+        bench_decks_fill(DECK_RING_FRAMES / 2, DECK_RING_FRAMES / 2);
+        atomic_store(&xfade_state, XFADE_WAITING);
+    }
+    decks_process(bench_voice, BENCH_VOICE_FRAMES, 2);
+}
+
+/*
+ * A switch on the audio clock: the new deck starts empty and receives one
+ * block's worth per block, as a real time stream does once VLC plays it. Reports
+ * the time from the request until the new station is mixed in and until the
+ * fade has finished. The time VLC needs to open the stream comes on top.
+ */
+static void bench_crossfade_latency(void)
+{
+    const size_t fade_full = (size_t)DECK_RING_FRAMES / 2;
+    int          audible = -1, blocks = 0;
+
+    bench_decks_fill(fade_full, 0);
+    atomic_store(&xfade_state, XFADE_WAITING);
+    int on_air = atomic_load(&deck_on_air);
+    for (; blocks < 10000 && atomic_load(&xfade_state) != XFADE_DONE; blocks++) {
+        deck* next = &decks[1 - on_air];
+        atomic_fetch_add(&next->ring.write_pos, BENCH_VOICE_FRAMES);
+        decks_process(bench_voice, BENCH_VOICE_FRAMES, 2);
+        if (audible < 0 && atomic_load(&xfade_state) != XFADE_WAITING)
+            audible = blocks;
+    }
+    atomic_store(&xfade_state, XFADE_IDLE);
+
+    const double block_ms = 1000.0 * BENCH_VOICE_FRAMES / AUDIO_SAMPLE_RATE;
+    bench_report("crossfade/preroll_to_audible", "ms", audible < 0 ? -1.0 : (audible + 1) * block_ms);
+    bench_report("crossfade/request_to_done", "ms", blocks * block_ms);
+}
+
+int main(int argc, char** argv)
+{
+    bench_filter = argc > 1 ? argv[1] : NULL;
+    bench_setup_plugin();
+
+    time_t now = time(NULL);
+    char   stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    printf("{\n  \"suite\": \"musicbot\",\n  \"timestamp\": \"%s\",\n  \"compiler\": \"%s\",\n  \"benchmarks\": [", stamp, __VERSION__);
+
+    /* Command dispatch, from the first string compare to the last station in the table */
+    bench_run("dispatch/list", bench_text_message, (void*)"!list");
+    bench_run("dispatch/history", bench_text_message, (void*)"!history 5");
+    bench_run("dispatch/unknown", bench_text_message, (void*)"!definitely_not_a_station");
+    bench_run("config/find_last_station", bench_config_find_station, (void*)"!disco");
+
+    uint8_t batch[REMOTE_HEADER_BYTES + BENCH_REMOTE_OPS * REMOTE_OP_HEADER_BYTES] = {REMOTE_VERSION, REMOTE_REQUEST};
+    char    batch_text[REMOTE_TEXT_BYTES];
+    remote_put_u16(batch + 2, BENCH_REMOTE_OPS);
+    for (int i = 0; i < BENCH_REMOTE_OPS; i++) {
+        uint8_t* op = batch + REMOTE_HEADER_BYTES + i * REMOTE_OP_HEADER_BYTES;
+        remote_put_u32(op, (uint32_t)i + 1);
+        op[4] = REMOTE_OP_NOW_PLAYING;
+    }
+    memcpy(batch_text, REMOTE_PREFIX, strlen(REMOTE_PREFIX));
+    remote_base64_encode(batch, sizeof(batch), batch_text + strlen(REMOTE_PREFIX));
+    bench_run("remote/now_playing_batch_16", bench_remote_batch, batch_text);
+
+    DBusMessage* metadata = bench_metadata_reply();
+    bench_run("metadata/song", bench_parse_song, metadata);
+    bench_run("metadata/song_and_station", bench_parse_now_playing, metadata);
+    dbus_message_unref(metadata);
+
+    static const size_t track_counts[] = {10, 1000, 100000};
+    for (size_t i = 0; i < sizeof(track_counts) / sizeof(track_counts[0]); i++) {
+        char         name[64];
+        DBusMessage* tracks = bench_tracks_reply(track_counts[i]);
+        snprintf(name, sizeof(name), "tracklist/%zu", track_counts[i]);
+        bench_run(name, bench_parse_tracks, tracks);
+        dbus_message_unref(tracks);
+    }
+
+    bench_channel_clients = BENCH_CHANNEL_CLIENTS;
+    bench_run("alone_check/count_clients", bench_count_clients, NULL);
+    bench_run("alone_check/move_event", bench_alone_check, NULL);
+
+    for (size_t i = 0; i < BENCH_TIMERS; i++) {
+        timer_init(&bench_timers[i], bench_timer_fired, NULL);
+    }
+    bench_arm_timers();
+    bench_run("timers/rearm_100k_armed", bench_timer_rearm, NULL);
+    bench_run("timers/next_tick_100k_armed", bench_timer_next_tick, NULL);
+    for (size_t i = 0; i < BENCH_TIMERS; i++) {
+        timer_cancel(&bench_timers[i]);
+    }
+    bench_run("timers/arm_and_fire_100k", bench_timer_fire_all, NULL);
+
+    bench_resamplers();
+
+    bench_decks_setup();
+    bench_run("crossfade/block_960", bench_crossfade_block, NULL);
+    bench_crossfade_latency();
+    atomic_store(&decks_running, 0);
+
+    if (bench_library_catalog() == 0) {
+        bench_run("library/find_200k_one_match", bench_library_find, (void*)"artist 420 track 84123");
+        bench_run("library/find_200k_no_match", bench_library_find, (void*)"zebra");
+        bench_run("library/find_200k_all_match", bench_library_find, (void*)"track");
+        library_unmap(&bench_library);
+    }
+
+    if (loop_start(NULL, bench_loop_ignore) == 0) {
+        bench_run("loop/push", bench_loop_push, NULL);
+        bench_run("loop/round_trip", bench_loop_round_trip, NULL);
+        loop_stop();
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Throughput of the control socket (src/control_module.h), JSON on stdout.
+ *
+ *   make controlbench
+ *   ./controlbench [-s socket] [-c connections] [-d depth] [-n requests] [request...] > run.json
+ *
+ * Needs a running plugin, e.g. fakehost with a script that waits long
+ * enough. Every request ("ping", "now-playing", "station 21", ...; ping,
+ * now-playing and listeners if none are given) is its own benchmark: n
+ * requests spread over c connections, each of which keeps up to depth of
+ * them in flight (depth 1 is one request per round trip). Responses must
+ * come back in order with the id of their request, anything else counts as
+ * an error. Latency is from writing a request to reading its response, so
+ * with a deep pipeline it includes the wait behind the requests before it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* CONTROL_SOCKET_PATH and CONTROL_MAX_CLIENTS of src/control_module.h */
+#define BENCH_SOCKET "/tmp/musicbot-control.sock"
+#define BENCH_MAX_CONNECTIONS 16
+#define BENCH_BUFFER_BYTES 65536
+#define BENCH_TIMEOUT_MS 5000
+
+typedef struct {
+    int      fd;
+    uint64_t next_response; /* id of the response expected next */
+    uint64_t in_flight;
+    uint64_t body_lines;    /* lines of a metrics response still to skip */
+    size_t   input_length;
+    char     input[BENCH_BUFFER_BYTES];
+    size_t   output_length;
+    size_t   output_sent;
+    char     output[BENCH_BUFFER_BYTES];
+} bench_connection;
+
+static bench_connection connections[BENCH_MAX_CONNECTIONS];
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_connect(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "controlbench: cannot connect to %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+/*
+ * Run total requests over count connections with depth in flight each.
+ * Request i of connection c has id c * total + i, so ids tell the
+ * connection and sent_ns[id % total] the time it was written.
+ */
+static int bench_run(const char* request, int count, uint64_t depth, uint64_t total, uint64_t* latencies, uint64_t* errors, double* seconds)
+{
+    int      is_metrics = strncmp(request, "metrics", 7) == 0 && (request[7] == '\0' || request[7] == ' ');
+    uint64_t per        = total / (uint64_t)count;
+    uint64_t done       = 0;
+    uint64_t* sent_ns   = (uint64_t*)calloc(total, sizeof(uint64_t));
+    uint64_t* next_id   = (uint64_t*)calloc((size_t)count, sizeof(uint64_t));
+    struct pollfd fds[BENCH_MAX_CONNECTIONS];
+    if (!sent_ns || !next_id)
+        return -1;
+    for (int c = 0; c < count; c++) {
+        connections[c].next_response = connections[c].in_flight = connections[c].body_lines = 0;
+        connections[c].input_length = connections[c].output_length = connections[c].output_sent = 0;
+    }
+    *errors        = 0;
+    uint64_t start = now_ns();
+
+    while (done < per * (uint64_t)count) {
+        for (int c = 0; c < count; c++) {
+            bench_connection* connection = &connections[c];
+            /* Top the pipeline up */
+            while (connection->in_flight < depth && next_id[c] < per && connection->output_length + 128 + strlen(request) < sizeof(connection->output)) {
+                uint64_t index = (uint64_t)c * per + next_id[c]++;
+                connection->output_length += (size_t)snprintf(connection->output + connection->output_length, sizeof(connection->output) - connection->output_length, "%llu %s\n", (unsigned long long)index, request);
+                sent_ns[index] = now_ns();
+                connection->in_flight++;
+            }
+            fds[c] = (struct pollfd){.fd = connection->fd, .events = POLLIN | (connection->output_sent < connection->output_length ? POLLOUT : 0)};
+        }
+        if (poll(fds, (nfds_t)count, BENCH_TIMEOUT_MS) <= 0) {
+            fprintf(stderr, "controlbench: no response for %d ms, %llu of %llu done\n", BENCH_TIMEOUT_MS, (unsigned long long)done, (unsigned long long)(per * (uint64_t)count));
+            free(sent_ns);
+            free(next_id);
+            return -1;
+        }
+        for (int c = 0; c < count; c++) {
+            bench_connection* connection = &connections[c];
+            if (fds[c].revents & POLLOUT) {
+                ssize_t n = write(connection->fd, connection->output + connection->output_sent, connection->output_length - connection->output_sent);
+                if (n > 0)
+                    connection->output_sent += (size_t)n;
+                if (connection->output_sent == connection->output_length)
+                    connection->output_sent = connection->output_length = 0;
+            }
+            if (!(fds[c].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n = read(connection->fd, connection->input + connection->input_length, sizeof(connection->input) - connection->input_length);
+            if (n <= 0) {
+                fprintf(stderr, "controlbench: connection %d closed\n", c);
+                free(sent_ns);
+                free(next_id);
+                return -1;
+            }
+            connection->input_length += (size_t)n;
+            uint64_t read_ns = now_ns();
+            char*    line    = connection->input;
+            char*    newline;
+            while ((newline = memchr(line, '\n', (size_t)(connection->input + connection->input_length - line)))) {
+                *newline = '\0';
+                if (connection->body_lines) {
+                    connection->body_lines--;
+                } else {
+                    uint64_t expected = (uint64_t)c * per + connection->next_response++;
+                    char*    rest;
+                    uint64_t id = strtoull(line, &rest, 10);
+                    if (id != expected || strncmp(rest, " ok", 3) != 0) {
+                        if (*errors < 3)
+                            fprintf(stderr, "controlbench: expected an ok for %llu, got \"%s\"\n", (unsigned long long)expected, line);
+                        (*errors)++;
+                    }
+                    if (is_metrics && strncmp(rest, " ok ", 4) == 0)
+                        connection->body_lines = strtoull(rest + 4, NULL, 10);
+                    latencies[done++] = read_ns - sent_ns[expected];
+                    connection->in_flight--;
+                }
+                line = newline + 1;
+            }
+            connection->input_length -= (size_t)(line - connection->input);
+            memmove(connection->input, line, connection->input_length);
+        }
+    }
+    *seconds = (double)(now_ns() - start) / 1e9;
+    free(sent_ns);
+    free(next_id);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path     = getenv("MUSICBOT_CONTROL_SOCKET");
+    int         count    = 4;
+    uint64_t    depth    = 64;
+    uint64_t    total    = 200000;
+    int         opt;
+    path                 = path && *path ? path : BENCH_SOCKET;
+    while ((opt = getopt(argc, argv, "s:c:d:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        case 'd':
+            depth = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            total = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-c connections] [-d depth] [-n requests] [request...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count < 1 || count > BENCH_MAX_CONNECTIONS || depth < 1 || total < (uint64_t)count) {
+        fprintf(stderr, "controlbench: need 1..%d connections, a depth of at least 1 and a request per connection\n", BENCH_MAX_CONNECTIONS);
+        return 2;
+    }
+    static const char* const defaults[] = {"ping", "now-playing", "listeners"};
+    const char* const*       requests   = optind < argc ? (const char* const*)argv + optind : defaults;
+    int                      request_count = optind < argc ? argc - optind : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
+    for (int c = 0; c < count; c++) {
+        if ((connections[c].fd = bench_connect(path)) < 0)
+            return 1;
+    }
+    total               -= total % (uint64_t)count;
+    uint64_t* latencies = (uint64_t*)malloc(total * sizeof(uint64_t));
+    if (!latencies)
+        return 1;
+
+    time_t    now = time(NULL);
+    char      stamp[32];
+    struct tm utc;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &utc));
+    printf("{\n  \"suite\": \"musicbot_control\",\n  \"timestamp\": \"%s\",\n  \"connections\": %d,\n  \"depth\": %llu,\n  \"benchmarks\": [", stamp, count,
+           (unsigned long long)depth);
+    int failed = 0;
+    for (int r = 0; r < request_count; r++) {
+        uint64_t errors;
+        double   seconds;
+        if (bench_run(requests[r], count, depth, total, latencies, &errors, &seconds) != 0) {
+            failed = 1;
+            break;
+        }
+        qsort(latencies, total, sizeof(uint64_t), compare_u64);
+        printf("%s\n    {\"name\": \"control/%s\", \"requests\": %llu, \"errors\": %llu, \"seconds\": %.3f, \"requests_per_sec\": %.0f, \"latency_us_p50\": %.1f, \"latency_us_p99\": %.1f}",
+               r ? "," : "", requests[r], (unsigned long long)total, (unsigned long long)errors, seconds, (double)total / seconds, latencies[total / 2] / 1e3,
+               latencies[total * 99 / 100] / 1e3);
+        fflush(stdout);
+        failed |= errors != 0;
+    }
+    printf("\n  ]\n}\n");
+    free(latencies);
+    for (int c = 0; c < count; c++)
+        close(connections[c].fd);
+    return failed;
+}
@@ -0,0 +1,214 @@
+/*
+ * Deterministic checks of the deck signal path, exits non-zero on failure.
+ *
+ *   make check
+ *   ./dspcheck [-v]
+ *
+ * Everything runs on synthetic signals and a simulated clock, so the
+ * results are the same on every run and machine (up to float rounding of
+ * the vector paths) and nothing needs a player, a bus or a sound card.
+ *
+ * resampler/thdn_*: a 1 kHz sine at -1 dBFS is resampled to 48 kHz and a
+ * sine of the same frequency is fitted to one second of output by least
+ * squares. What the fit does not explain is distortion plus noise (THD+N),
+ * which has to stay below CHECK_THDN_MAX_DB relative to the fitted tone.
+ *
+ * drift/<rate>_<ppm>: 24 hours of a deck. A producer whose clock is off by up to
+ * +-300 ppm writes blocks at jittered times, they go through the resampler's
+ * position arithmetic (without filtering, the frame counts are what
+ * matters) and drift_update after every write, the way deck_push does.
+ * The audio thread takes 20 ms blocks on the reference clock once
+ * CHECK_DRIFT_PREROLL_MS is buffered. The ring fill must stay within
+ * DRIFT_TARGET_MS +- DRIFT_BAND_MS from then on and never run dry.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/drift_module.h"
+#include "../src/resampler_module.h"
+
+/* Limit for the resampler, the int16 output alone sits around -97 dB */
+#define CHECK_THDN_MAX_DB -85.0
+#define CHECK_TONE_HZ 1000.0
+#define CHECK_TONE_LEVEL (0.891 * 32767.0)
+/* Output skipped before measuring while the filter fills, and the measured length */
+#define CHECK_SETTLE_FRAMES 4800
+#define CHECK_MEASURE_FRAMES AUDIO_SAMPLE_RATE
+#define CHECK_BLOCK_FRAMES 1024
+
+#define CHECK_DRIFT_SECONDS (24.0 * 3600.0)
+/* CROSSFADE_PREROLL_MS of src/deck_module.h, the fill a deck goes on air with */
+#define CHECK_DRIFT_PREROLL_MS 250
+/* Source frames per write, and the most a write is late on its schedule */
+#define CHECK_DRIFT_WRITE_FRAMES 1024
+#define CHECK_DRIFT_JITTER_MS 30.0
+/* Frames the audio thread takes per block */
+#define CHECK_DRIFT_READ_FRAMES 960
+
+static int check_verbose  = 0;
+static int check_failures = 0;
+
+static void check_result(const char* name, int ok, const char* format, double value)
+{
+    if (!ok)
+        check_failures++;
+    if (!ok || check_verbose) {
+        printf("%-28s %s ", name, ok ? "ok  " : "FAIL");
+        printf(format, value);
+        printf("\n");
+    }
+}
+
+/* THD+N in dB of a CHECK_TONE_HZ sine at in_rate after resampling to 48 kHz */
+static double check_resampler_thdn(unsigned int in_rate)
+{
+    resampler r;
+    memset(&r, 0, sizeof(r));
+    if (resampler_init(&r, in_rate, AUDIO_SAMPLE_RATE, 2) != 0)
+        return 0.0;
+
+    const size_t total = CHECK_SETTLE_FRAMES + CHECK_MEASURE_FRAMES;
+    short*       out   = (short*)malloc(sizeof(short) * 2 * (total + 2 * CHECK_BLOCK_FRAMES));
+    short        in[CHECK_BLOCK_FRAMES * 2];
+    size_t       produced = 0;
+    for (size_t frame = 0; produced < total; frame += CHECK_BLOCK_FRAMES) {
+        for (size_t i = 0; i < CHECK_BLOCK_FRAMES; i++) {
+            short s       = (short)lrint(CHECK_TONE_LEVEL * sin(2.0 * M_PI * CHECK_TONE_HZ * (double)(frame + i) / in_rate));
+            in[2 * i]     = s;
+            in[2 * i + 1] = s;
+        }
+        produced += resampler_process(&r, in, CHECK_BLOCK_FRAMES, out + produced * 2);
+    }
+    resampler_free(&r);
+
+    /* Least squares fit of dc + a sin + b cos, the measured span holds whole periods so the basis is orthogonal */
+    const short* x = out + CHECK_SETTLE_FRAMES * 2;
+    double       dc = 0.0, a = 0.0, b = 0.0;
+    for (size_t i = 0; i < CHECK_MEASURE_FRAMES; i++) {
+        double w = 2.0 * M_PI * CHECK_TONE_HZ * (double)i / AUDIO_SAMPLE_RATE;
+        dc += x[2 * i];
+        a += x[2 * i] * sin(w);
+        b += x[2 * i] * cos(w);
+    }
+    dc /= CHECK_MEASURE_FRAMES;
+    a *= 2.0 / CHECK_MEASURE_FRAMES;
+    b *= 2.0 / CHECK_MEASURE_FRAMES;
+
+    double residual = 0.0;
+    for (size_t i = 0; i < CHECK_MEASURE_FRAMES; i++) {
+        double w = 2.0 * M_PI * CHECK_TONE_HZ * (double)i / AUDIO_SAMPLE_RATE;
+        double e = x[2 * i] - dc - a * sin(w) - b * cos(w);
+        residual += e * e;
+    }
+    free(out);
+    residual /= CHECK_MEASURE_FRAMES;
+    return 10.0 * log10(residual / ((a * a + b * b) / 2.0));
+}
+
+static uint64_t check_random = 88172645463325252ull;
+
+/* Uniform in [0, 1), xorshift so every run sees the same jitter */
+static double check_uniform(void)
+{
+    check_random ^= check_random << 13;
+    check_random ^= check_random >> 7;
+    check_random ^= check_random << 17;
+    return (double)(check_random >> 11) / 9007199254740992.0;
+}
+
+/* Output frames resampler_process would produce for frames more input, same fixed point steps without the filter */
+static size_t check_resampled_frames(resampler* r, size_t frames)
+{
+    size_t produced = 0;
+    r->length += frames;
+    if (r->length >= RESAMPLER_TAPS) {
+        uint64_t last = ((uint64_t)(r->length - RESAMPLER_TAPS + 1) << 32) - 1;
+        if (r->position <= last) {
+            produced = (size_t)((last - r->position) / r->step) + 1;
+            r->position += (uint64_t)produced * r->step;
+        }
+    }
+    size_t consumed = (size_t)(r->position >> 32);
+    if (consumed > r->length)
+        consumed = r->length;
+    r->length -= consumed;
+    r->position -= (uint64_t)consumed << 32;
+    return produced;
+}
+
+/* Simulate CHECK_DRIFT_SECONDS of a deck whose producer is ppm off */
+static void check_drift(const char* name, unsigned int in_rate, double ppm)
+{
+    resampler        r = {.in_rate = in_rate, .out_rate = AUDIO_SAMPLE_RATE, .length = RESAMPLER_TAPS / 2 - 1};
+    drift_controller controller;
+    drift_reset(&controller);
+    resampler_set_ratio(&r, 0.0);
+
+    const double period   = CHECK_DRIFT_WRITE_FRAMES / (in_rate * (1.0 + ppm * 1e-6));
+    const double low      = (DRIFT_TARGET_MS - DRIFT_BAND_MS) / 1000.0 * AUDIO_SAMPLE_RATE;
+    const double high     = (DRIFT_TARGET_MS + DRIFT_BAND_MS) / 1000.0 * AUDIO_SAMPLE_RATE;
+    uint64_t     writes   = 0, underruns = 0;
+    double       fill     = 0.0, min_fill = 1e9, max_fill = 0.0;
+    double       write_at = 0.0, last_write = -1.0, read_at = -1.0;
+
+    while (write_at < CHECK_DRIFT_SECONDS) {
+        if (read_at < 0.0 || write_at <= read_at) {
+            fill += (double)check_resampled_frames(&r, CHECK_DRIFT_WRITE_FRAMES);
+            /* deck_track_drift: the first write only starts the clock */
+            if (last_write >= 0.0)
+                resampler_set_ratio(&r, drift_update(&controller, fill / AUDIO_SAMPLE_RATE, write_at - last_write));
+            last_write = write_at;
+            writes++;
+            if (read_at < 0.0 && fill >= CHECK_DRIFT_PREROLL_MS / 1000.0 * AUDIO_SAMPLE_RATE)
+                read_at = write_at;
+            /* Late by up to the jitter, never before the previous write */
+            double next = (double)writes * period + check_uniform() * CHECK_DRIFT_JITTER_MS / 1000.0;
+            write_at    = next > write_at ? next : write_at;
+        } else {
+            if (fill < CHECK_DRIFT_READ_FRAMES) {
+                underruns++;
+                fill = 0.0;
+            } else {
+                fill -= CHECK_DRIFT_READ_FRAMES;
+            }
+            read_at += (double)CHECK_DRIFT_READ_FRAMES / AUDIO_SAMPLE_RATE;
+        }
+        if (read_at >= 0.0) {
+            min_fill = fill < min_fill ? fill : min_fill;
+            max_fill = fill > max_fill ? fill : max_fill;
+        }
+    }
+
+    int ok = underruns == 0 && min_fill >= low && max_fill <= high;
+    if (!ok || check_verbose) {
+        printf("%-28s %s fill %.0f..%.0f ms, %llu underruns, correction %.1f ppm\n", name, ok ? "ok  " : "FAIL", min_fill * 1000.0 / AUDIO_SAMPLE_RATE,
+               max_fill * 1000.0 / AUDIO_SAMPLE_RATE, (unsigned long long)underruns, controller.ppm);
+    }
+    if (!ok)
+        check_failures++;
+}
+
+int main(int argc, char** argv)
+{
+    check_verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    static const unsigned int rates[] = {44100, 32000};
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        char   name[64];
+        double thdn = check_resampler_thdn(rates[i]);
+        snprintf(name, sizeof(name), "resampler/thdn_%u", rates[i]);
+        check_result(name, thdn < CHECK_THDN_MAX_DB, "%.1f dB", thdn);
+    }
+
+    check_drift("drift/44100_plus_300ppm", 44100, 300.0);
+    check_drift("drift/44100_minus_300ppm", 44100, -300.0);
+    check_drift("drift/44100_exact", 44100, 0.0);
+    check_drift("drift/32000_plus_300ppm", 32000, 300.0);
+    check_drift("drift/48000_minus_300ppm", 48000, -300.0);
+
+    printf("%d check%s failed\n", check_failures, check_failures == 1 ? "" : "s");
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,1369 @@
+/*
+ * Fake TeamSpeak 3 host for MusicBot.so
+ *
+ * Loads the plugin, hands it a TS3Functions table backed by an in-memory
+ * server (channels with codecs, clients with channels) and drives the
+ * ts3plugin_* callbacks from a script as fast as they return. Prints
+ * callbacks per second and per callback latency, and checks expectations
+ * on the bot's replies so a script doubles as a regression test.
+ *
+ *   make fakehost
+ *   dbus-run-session -- ./fakehost [-n repeat] [-t] [-v] [-c configdir] [-C self:channel] ./MusicBot.so script.txt|recording.bin
+ *
+ * -C makes the fake server connected from the start with the bot as client
+ * self in channel, otherwise the script connects it. Either way the plugin
+ * talks to VLC over the session bus, so start one (or tools/mockvlc) on that
+ * bus first. The player comes up in the background
+ * (src/player_module.h), until then station commands and !song get a
+ * "warming up" reply, so scripts that need it start with a short wait.
+ * The warm start snapshot (src/snapshot_module.h) is kept across runs only
+ * with -c, run twice with the same configdir to test a restart.
+ * Script lines, '#' starts a comment:
+ *
+ *   channel <id>                      add a channel
+ *   client <id> <channel> [name]      add or place a client, no event
+ *   self <id> <channel>               the bot's own client
+ *   connect | disconnect              onConnectStatusChangeEvent
+ *   say <from> <text...>              private text message to the bot
+ *   move <client> <channel>           client moved itself, onClientMoveEvent
+ *   moved <client> <channel> <mover>  onClientMoveMovedEvent
+ *   kick <client> <channel>           client kicked to channel, onClientKickFromChannelEvent
+ *   talk <client> 0|1                 onTalkStatusChangeEvent
+ *   groups <client> <id,...> [hidden] set the client's server groups, no event; hidden
+ *                                     ones are only told by requestServerGroupsByClientID
+ *   group-add <client> <group>        onServerGroupClientAddedEvent
+ *   group-del <client> <group>        onServerGroupClientDeletedEvent
+ *   remote <client> <op[:arg]>...     one plugin command request (src/remote_format.h) with
+ *                                     ids 1..n: station:<index>, now-playing, subscribe:0|1
+ *                                     or op:<number> for an unknown op
+ *   remote-raw <client> <text>        a plugin command as is
+ *   voice <frames>                    onEditCapturedVoiceDataEvent, 20 ms of 48 kHz stereo each
+ *   command <text...>                 /musicbot <text...>, processCommand
+ *   info client|channel <id>          infoData
+ *   flood                             the next private message is rejected by flood protection
+ *   wait <ms>                         sleep, the plugin's timers fire meanwhile
+ *   expect <text...>                  the last private message from the bot contains text
+ *   expect-topic <channel> <text...>  the channel's topic contains text
+ *   expect-nickname <text...>         the bot's nickname contains text
+ *   expect-channel <client> <channel> the client is in channel
+ *   expect-remote <text...>           the last answer to a plugin command, decoded as
+ *                                     "to <clients>: answer v<version> | <id> <op> <status> <body>...",
+ *                                     contains text
+ *   expect-notify <text...>           the last notification to subscribers contains text
+ *   control <id> <verb> [arg]         one request on the control socket (src/control_module.h),
+ *                                     waits for its response
+ *   expect-control <text...>          the last control response (with the lines of metrics) contains text
+ *
+ * Client n has unique identifier "uid-n" and database id n. control connects
+ * once to MUSICBOT_CONTROL_SOCKET, or the plugin's default path.
+ *
+ * Requests the plugin makes (requestClientMove, requestServerGroupsByClientID,
+ * flood rejections) are answered like the server would, with their own
+ * callbacks right after the one that made them. Those count in the statistics too. The whole script runs -n
+ * times, setup lines simply set the same state again.
+ *
+ * The plugin handles events on its own loop thread (src/loop_module.h); after
+ * every callback fakehost waits in the plugin's loop_sync until the event was
+ * handled, so expectations see its effects. Timers the plugin arms fire on
+ * its loop thread while the script waits for it, see server_lock. The report shows the time until the callback
+ * returned and until the event was handled.
+ *
+ * A file recorded with /musicbot record on (see src/recording_format.h) is
+ * replayed instead: its snapshot sets up the bot's channel, every record
+ * becomes the same callback, and the server answers come from the recording
+ * rather than from the fake server. With -t records are delivered at their
+ * recorded times, otherwise as fast as possible.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/public_rare_definitions.h"
+#include "ts3_functions.h"
+#include "recording_format.h"
+#include "remote_format.h"
+
+#define FAKEHOST_SERVER 1
+#define FAKEHOST_MAX_CHANNELS 256
+#define FAKEHOST_MAX_CLIENTS 1024
+#define FAKEHOST_MAX_PENDING 64
+#define FAKEHOST_LINE_BUFSIZE 1024
+#define FAKEHOST_MESSAGE_BUFSIZE 2048
+#define FAKEHOST_VOICE_SAMPLES 960
+#define FAKEHOST_MAX_GROUPS 16
+/* CONTROL_SOCKET_PATH of src/control_module.h */
+#define FAKEHOST_CONTROL_SOCKET "/tmp/musicbot-control.sock"
+#define FAKEHOST_CONTROL_TIMEOUT_MS 5000
+
+/************************** In-memory server ***************************/
+
+typedef struct {
+    uint64 id;
+    int    codec;
+    char   topic[TS3_MAX_SIZE_CHANNEL_TOPIC + 1];
+    char   description[FAKEHOST_MESSAGE_BUFSIZE];
+} fake_channel;
+
+typedef struct {
+    anyID  id;
+    uint64 channel;
+    char   name[64];
+    uint64 groups[FAKEHOST_MAX_GROUPS];
+    int    group_count;
+    int    groups_hidden; /* CLIENT_SERVERGROUPS is not known to the client */
+} fake_client;
+
+static fake_channel channels[FAKEHOST_MAX_CHANNELS];
+static int          channel_count = 0;
+static fake_client  clients[FAKEHOST_MAX_CLIENTS];
+static int          client_count = 0;
+static anyID        self_id      = 0;
+static int          connected    = 0;
+static int          flood_next   = 0;
+static int          verbose      = 0;
+static int          replaying    = 0;
+static char         config_path[512];
+static char         last_message[FAKEHOST_MESSAGE_BUFSIZE];
+static char         last_answer[FAKEHOST_MESSAGE_BUFSIZE];
+static char         last_notify[FAKEHOST_MESSAGE_BUFSIZE];
+static char         last_control[FAKEHOST_MESSAGE_BUFSIZE * 8];
+static int          control_fd = -1;
+static unsigned     plugin_commands = 0;
+static unsigned     return_codes  = 0;
+static unsigned     messages_sent = 0;
+static unsigned     codec_changes = 0;
+static unsigned     channel_edits = 0;
+static unsigned     nickname_edits = 0;
+static char         self_nickname[TS3_MAX_SIZE_CLIENT_NICKNAME * 4 + 1] = "MusicBot";
+
+/* Server side answers to requests, delivered after the current callback */
+enum { PENDING_MOVE, PENDING_ERROR, PENDING_GROUPS };
+typedef struct {
+    int    kind;
+    anyID  client;
+    uint64 from;
+    uint64 to;
+    char   return_code[64];
+} fake_pending;
+
+static fake_pending pending[FAKEHOST_MAX_PENDING];
+static int          pending_count = 0;
+
+/*
+ * The script thread holds server_lock except while it waits for the plugin
+ * (loop_sync, wait), the TS3Functions below take it too, so the plugin's
+ * timers can fire from its loop thread without racing the script.
+ */
+static pthread_mutex_t server_lock;
+
+static pthread_mutex_t* server_acquire(void)
+{
+    pthread_mutex_lock(&server_lock);
+    return &server_lock;
+}
+
+static void server_release(pthread_mutex_t** lock)
+{
+    pthread_mutex_unlock(*lock);
+}
+
+#define SERVER_LOCKED pthread_mutex_t* server_guard __attribute__((cleanup(server_release), unused)) = server_acquire()
+
+static fake_channel* find_channel(uint64 id)
+{
+    for (int i = 0; i < channel_count; i++) {
+        if (channels[i].id == id)
+            return &channels[i];
+    }
+    return NULL;
+}
+
+static fake_client* find_client(anyID id)
+{
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i].id == id)
+            return &clients[i];
+    }
+    return NULL;
+}
+
+static fake_channel* add_channel(uint64 id)
+{
+    fake_channel* channel = find_channel(id);
+    if (!channel && channel_count < FAKEHOST_MAX_CHANNELS) {
+        channel        = &channels[channel_count++];
+        channel->id    = id;
+        channel->codec = CODEC_OPUS_VOICE;
+    }
+    return channel;
+}
+
+static fake_client* add_client(anyID id, uint64 channel, const char* name)
+{
+    fake_client* client = find_client(id);
+    if (!client && client_count < FAKEHOST_MAX_CLIENTS) {
+        client     = &clients[client_count++];
+        client->id = id;
+        snprintf(client->name, sizeof(client->name), "client%u", (unsigned)id);
+    }
+    if (client) {
+        client->channel = channel;
+        if (name)
+            snprintf(client->name, sizeof(client->name), "%s", name);
+        add_channel(channel);
+    }
+    return client;
+}
+
+static void queue_pending(fake_pending item)
+{
+    if (pending_count < FAKEHOST_MAX_PENDING)
+        pending[pending_count++] = item;
+}
+
+/************************** TS3Functions ***************************/
+
+static unsigned int fake_freeMemory(void* pointer)
+{
+    free(pointer);
+    return ERROR_ok;
+}
+
+static unsigned int fake_logMessage(const char* logMessage, enum LogLevel severity, const char* channel, uint64 logID)
+{
+    if (verbose)
+        fprintf(stderr, "[log %d] %s: %s\n", (int)severity, channel, logMessage);
+    return ERROR_ok;
+}
+
+static uint64 fake_getCurrentServerConnectionHandlerID(void)
+{
+    return FAKEHOST_SERVER;
+}
+
+static unsigned int fake_getConnectionStatus(uint64 serverConnectionHandlerID, int* result)
+{
+    SERVER_LOCKED;
+    *result = connected ? STATUS_CONNECTION_ESTABLISHED : STATUS_DISCONNECTED;
+    return ERROR_ok;
+}
+
+static unsigned int fake_getClientID(uint64 serverConnectionHandlerID, anyID* result)
+{
+    SERVER_LOCKED;
+    if (!connected)
+        return ERROR_not_connected;
+    *result = self_id;
+    return ERROR_ok;
+}
+
+static unsigned int fake_getChannelOfClient(uint64 serverConnectionHandlerID, anyID clientID, uint64* result)
+{
+    SERVER_LOCKED;
+    fake_client* client = find_client(clientID);
+    if (!client)
+        return ERROR_client_invalid_id;
+    *result = client->channel;
+    return ERROR_ok;
+}
+
+static unsigned int fake_getChannelClientList(uint64 serverConnectionHandlerID, uint64 channelID, anyID** result)
+{
+    SERVER_LOCKED;
+    if (!find_channel(channelID))
+        return ERROR_channel_invalid_id;
+    anyID* list  = (anyID*)malloc(sizeof(anyID) * (size_t)(client_count + 1));
+    int    count = 0;
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i].channel == channelID)
+            list[count++] = clients[i].id;
+    }
+    list[count] = 0;
+    *result     = list;
+    return ERROR_ok;
+}
+
+static unsigned int fake_getClientVariableAsUInt64(uint64 serverConnectionHandlerID, anyID clientID, size_t flag, uint64* result)
+{
+    SERVER_LOCKED;
+    if (flag != CLIENT_DATABASE_ID)
+        return ERROR_parameter_invalid;
+    if (!find_client(clientID))
+        return ERROR_client_invalid_id;
+    *result = clientID;
+    return ERROR_ok;
+}
+
+static unsigned int fake_getClientVariableAsString(uint64 serverConnectionHandlerID, anyID clientID, size_t flag, char** result)
+{
+    SERVER_LOCKED;
+    fake_client* client = find_client(clientID);
+    char         value[FAKEHOST_MAX_GROUPS * 21 + 1] = "";
+    if (!client)
+        return ERROR_client_invalid_id;
+    if (flag == CLIENT_UNIQUE_IDENTIFIER) {
+        snprintf(value, sizeof(value), "uid-%u", (unsigned)clientID);
+    } else if (flag == CLIENT_SERVERGROUPS && !client->groups_hidden) {
+        for (int i = 0; i < client->group_count; i++)
+            snprintf(value + strlen(value), sizeof(value) - strlen(value), "%s%llu", i ? "," : "", (unsigned long long)client->groups[i]);
+    } else {
+        return ERROR_parameter_invalid;
+    }
+    *result = strdup(value);
+    return ERROR_ok;
+}
+
+static unsigned int fake_requestServerGroupsByClientID(uint64 serverConnectionHandlerID, uint64 clientDatabaseID, const char* returnCode)
+{
+    SERVER_LOCKED;
+    if (!replaying)
+        queue_pending((fake_pending){PENDING_GROUPS, (anyID)clientDatabaseID, 0, 0, ""});
+    return ERROR_ok;
+}
+
+static unsigned int fake_setChannelVariableAsInt(uint64 serverConnectionHandlerID, uint64 channelID, size_t flag, int value)
+{
+    SERVER_LOCKED;
+    fake_channel* channel = find_channel(channelID);
+    if (!channel)
+        return ERROR_channel_invalid_id;
+    if (flag == CHANNEL_CODEC) {
+        channel->codec = value;
+        codec_changes++;
+    }
+    return ERROR_ok;
+}
+
+static unsigned int fake_setChannelVariableAsString(uint64 serverConnectionHandlerID, uint64 channelID, size_t flag, const char* value)
+{
+    SERVER_LOCKED;
+    fake_channel* channel = find_channel(channelID);
+    if (!channel)
+        return ERROR_channel_invalid_id;
+    if (flag == CHANNEL_TOPIC) {
+        if (strlen(value) > TS3_MAX_SIZE_CHANNEL_TOPIC)
+            return ERROR_parameter_invalid;
+        snprintf(channel->topic, sizeof(channel->topic), "%s", value);
+    } else if (flag == CHANNEL_DESCRIPTION) {
+        snprintf(channel->description, sizeof(channel->description), "%s", value);
+    } else {
+        return ERROR_parameter_invalid;
+    }
+    channel_edits++;
+    if (verbose)
+        fprintf(stderr, "[channel %llu] %s: %s\n", (unsigned long long)channelID, flag == CHANNEL_TOPIC ? "topic" : "description", value);
+    return ERROR_ok;
+}
+
+static unsigned int fake_flushChannelUpdates(uint64 serverConnectionHandlerID, uint64 channelID, const char* returnCode)
+{
+    SERVER_LOCKED;
+    return find_channel(channelID) ? ERROR_ok : ERROR_channel_invalid_id;
+}
+
+static unsigned int fake_getServerVariableAsString(uint64 serverConnectionHandlerID, size_t flag, char** result)
+{
+    if (flag != VIRTUALSERVER_UNIQUE_IDENTIFIER)
+        return ERROR_parameter_invalid;
+    *result = strdup("fakehost=");
+    return ERROR_ok;
+}
+
+static unsigned int fake_getClientSelfVariableAsString(uint64 serverConnectionHandlerID, size_t flag, char** result)
+{
+    SERVER_LOCKED;
+    if (flag != CLIENT_NICKNAME)
+        return ERROR_parameter_invalid;
+    *result = strdup(self_nickname);
+    return ERROR_ok;
+}
+
+static unsigned int fake_setClientSelfVariableAsString(uint64 serverConnectionHandlerID, size_t flag, const char* value)
+{
+    SERVER_LOCKED;
+    if (flag != CLIENT_NICKNAME)
+        return ERROR_parameter_invalid;
+    snprintf(self_nickname, sizeof(self_nickname), "%s", value);
+    nickname_edits++;
+    if (verbose)
+        fprintf(stderr, "[nickname] %s\n", value);
+    return ERROR_ok;
+}
+
+static unsigned int fake_flushClientSelfUpdates(uint64 serverConnectionHandlerID, const char* returnCode)
+{
+    return ERROR_ok;
+}
+
+static unsigned int fake_requestClientMove(uint64 serverConnectionHandlerID, anyID clientID, uint64 newChannelID, const char* password, const char* returnCode)
+{
+    SERVER_LOCKED;
+    fake_client* client = find_client(clientID);
+    if (!client)
+        return ERROR_client_invalid_id;
+    if (!find_channel(newChannelID))
+        add_channel(newChannelID);
+    if (client->channel == newChannelID)
+        return ERROR_ok;
+    if (!replaying)
+        queue_pending((fake_pending){PENDING_MOVE, clientID, client->channel, newChannelID, ""});
+    client->channel = newChannelID;
+    return ERROR_ok;
+}
+
+static unsigned int fake_requestSendPrivateTextMsg(uint64 serverConnectionHandlerID, const char* message, anyID targetClientID, const char* returnCode)
+{
+    SERVER_LOCKED;
+    if (flood_next && !replaying) {
+        flood_next       = 0;
+        fake_pending item = {PENDING_ERROR, targetClientID, 0, 0, ""};
+        snprintf(item.return_code, sizeof(item.return_code), "%s", returnCode ? returnCode : "");
+        queue_pending(item);
+        return ERROR_ok;
+    }
+    snprintf(last_message, sizeof(last_message), "%s", message);
+    messages_sent++;
+    if (verbose)
+        fprintf(stderr, "[to %u] %s\n", (unsigned)targetClientID, message);
+    return ERROR_ok;
+}
+
+static const char* const remote_op_names[]     = {"", "station", "now-playing", "subscribe"};
+static const char* const remote_status_names[] = {"ok", "unknown-op", "bad-request", "denied", "not-here", "warming-up", "unknown-station", "full"};
+
+/* Decode a plugin command of the bot for expect-remote */
+static void render_plugin_command(const char* command, const anyID* targets, char* out, size_t size)
+{
+    uint8_t       payload[REMOTE_MAX_PAYLOAD];
+    long          length = strncmp(command, REMOTE_PREFIX, strlen(REMOTE_PREFIX)) == 0 ? remote_base64_decode(command + strlen(REMOTE_PREFIX), payload, sizeof(payload)) : -1;
+    remote_cursor cursor = {payload, length > 0 ? (size_t)length : 0, 0, 0};
+    size_t        used   = (size_t)snprintf(out, size, "to");
+    for (int i = 0; targets[i]; i++)
+        used += (size_t)snprintf(out + used, size - used, "%s%u", i ? "," : " ", (unsigned)targets[i]);
+    if (length < REMOTE_HEADER_BYTES) {
+        snprintf(out + used, size - used, ": not a remote payload: %s", command);
+        return;
+    }
+    uint8_t  version = remote_u8(&cursor);
+    uint8_t  kind    = remote_u8(&cursor);
+    uint16_t count   = remote_u16(&cursor);
+    used += (size_t)snprintf(out + used, size - used, ": %s v%u", kind == REMOTE_ANSWER ? "answer" : kind == REMOTE_NOTIFY ? "notify" : "request", version);
+    for (uint16_t i = 0; i < count && !cursor.failed && used < size; i++) {
+        uint32_t      id         = remote_u32(&cursor);
+        uint8_t       op         = remote_u8(&cursor);
+        uint8_t       status     = remote_u8(&cursor);
+        uint8_t       body_bytes = remote_u8(&cursor);
+        remote_cursor body       = {remote_take(&cursor, body_bytes), body_bytes, 0, 0};
+        char          song[REMOTE_MAX_STRING + 1], title[REMOTE_MAX_STRING + 1];
+        used += (size_t)snprintf(out + used, size - used, " | %u ", id);
+        if (used < size)
+            used += (size_t)(op && op <= REMOTE_OP_SUBSCRIBE ? snprintf(out + used, size - used, "%s", remote_op_names[op]) : snprintf(out + used, size - used, "op%u", op));
+        if (used < size)
+            used += (size_t)snprintf(out + used, size - used, " %s", status <= REMOTE_FULL ? remote_status_names[status] : "status?");
+        if (used >= size || cursor.failed || !body_bytes)
+            continue;
+        if (op == REMOTE_OP_STATION) {
+            remote_string(&body, song, sizeof(song));
+            used += (size_t)snprintf(out + used, size - used, " %s", song);
+        } else if (op == REMOTE_OP_NOW_PLAYING) {
+            int16_t station = (int16_t)remote_u16(&body);
+            remote_string(&body, song, sizeof(song));
+            remote_string(&body, title, sizeof(title));
+            used += (size_t)snprintf(out + used, size - used, " station=%d song=%s title=%s", station, song, title);
+        }
+    }
+}
+
+static void fake_sendPluginCommand(uint64 serverConnectionHandlerID, const char* pluginID, const char* command, int targetMode, const anyID* targetIDs, const char* returnCode)
+{
+    SERVER_LOCKED;
+    static const anyID none[] = {0};
+    char               text[FAKEHOST_MESSAGE_BUFSIZE];
+    render_plugin_command(command, targetMode == PluginCommandTarget_CLIENT && targetIDs ? targetIDs : none, text, sizeof(text));
+    snprintf(strstr(text, ": notify") ? last_notify : last_answer, FAKEHOST_MESSAGE_BUFSIZE, "%s", text);
+    plugin_commands++;
+    if (verbose)
+        fprintf(stderr, "[plugin] %s\n", text);
+}
+
+static void fake_getConfigPath(char* path, size_t maxLen)
+{
+    snprintf(path, maxLen, "%s", config_path);
+}
+
+static void fake_printMessageToCurrentTab(const char* message)
+{
+    if (verbose)
+        fprintf(stderr, "[tab] %s\n", message);
+}
+
+static void fake_createReturnCode(const char* pluginID, char* returnCode, size_t maxLen)
+{
+    SERVER_LOCKED;
+    snprintf(returnCode, maxLen, "PR:%s:%u", pluginID, ++return_codes);
+}
+
+/************************** Plugin ***************************/
+
+typedef struct {
+    void* handle;
+    void (*setFunctionPointers)(const struct TS3Functions funcs);
+    int (*init)(void);
+    void (*shutdown)(void);
+    void (*registerPluginID)(const char* id);
+    int (*processCommand)(uint64 serverConnectionHandlerID, const char* command);
+    void (*infoData)(uint64 serverConnectionHandlerID, uint64 id, enum PluginItemType type, char** data);
+    void (*freeMemory)(void* data);
+    void (*onConnectStatusChangeEvent)(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber);
+    void (*onClientMoveEvent)(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char* moveMessage);
+    void (*onClientMoveMovedEvent)(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID moverID, const char* moverName,
+                                   const char* moverUniqueIdentifier, const char* moveMessage);
+    void (*onClientKickFromChannelEvent)(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID kickerID, const char* kickerName,
+                                         const char* kickerUniqueIdentifier, const char* kickMessage);
+    int (*onTextMessageEvent)(uint64 serverConnectionHandlerID, anyID targetMode, anyID toID, anyID fromID, const char* fromName, const char* fromUniqueIdentifier, const char* message,
+                              int ffIgnored);
+    int (*onServerErrorEvent)(uint64 serverConnectionHandlerID, const char* errorMessage, unsigned int error, const char* returnCode, const char* extraMessage);
+    void (*onTalkStatusChangeEvent)(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper, anyID clientID);
+    void (*onEditCapturedVoiceDataEvent)(uint64 serverConnectionHandlerID, short* samples, int sampleCount, int channels, int* edited);
+    void (*onServerGroupByClientIDEvent)(uint64 serverConnectionHandlerID, const char* name, uint64 serverGroupList, uint64 clientDatabaseID);
+    void (*onServerGroupClientAddedEvent)(uint64 serverConnectionHandlerID, anyID clientID, const char* clientName, const char* clientUniqueIdentity, uint64 serverGroupID,
+                                          anyID invokerClientID, const char* invokerName, const char* invokerUniqueIdentity);
+    void (*onServerGroupClientDeletedEvent)(uint64 serverConnectionHandlerID, anyID clientID, const char* clientName, const char* clientUniqueIdentity, uint64 serverGroupID,
+                                            anyID invokerClientID, const char* invokerName, const char* invokerUniqueIdentity);
+    void (*onPluginCommandEvent)(uint64 serverConnectionHandlerID, const char* pluginName, const char* pluginCommand, anyID invokerClientID, const char* invokerName,
+                                 const char* invokerUniqueIdentity);
+    void (*loop_sync)(void); /* not a TS3 export, see src/loop_module.h */
+} fake_plugin;
+
+static fake_plugin plugin;
+
+/* Missing optional callbacks stay NULL and their script lines are skipped */
+static int load_plugin(const char* path)
+{
+    plugin.handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!plugin.handle) {
+        fprintf(stderr, "fakehost: %s\n", dlerror());
+        return -1;
+    }
+#define FAKEHOST_SYMBOL(field) *(void**)&plugin.field = dlsym(plugin.handle, "ts3plugin_" #field)
+    FAKEHOST_SYMBOL(setFunctionPointers);
+    FAKEHOST_SYMBOL(init);
+    FAKEHOST_SYMBOL(shutdown);
+    FAKEHOST_SYMBOL(registerPluginID);
+    FAKEHOST_SYMBOL(processCommand);
+    FAKEHOST_SYMBOL(infoData);
+    FAKEHOST_SYMBOL(freeMemory);
+    FAKEHOST_SYMBOL(onConnectStatusChangeEvent);
+    FAKEHOST_SYMBOL(onClientMoveEvent);
+    FAKEHOST_SYMBOL(onClientMoveMovedEvent);
+    FAKEHOST_SYMBOL(onClientKickFromChannelEvent);
+    FAKEHOST_SYMBOL(onTextMessageEvent);
+    FAKEHOST_SYMBOL(onServerErrorEvent);
+    FAKEHOST_SYMBOL(onTalkStatusChangeEvent);
+    FAKEHOST_SYMBOL(onEditCapturedVoiceDataEvent);
+    FAKEHOST_SYMBOL(onServerGroupByClientIDEvent);
+    FAKEHOST_SYMBOL(onServerGroupClientAddedEvent);
+    FAKEHOST_SYMBOL(onServerGroupClientDeletedEvent);
+    FAKEHOST_SYMBOL(onPluginCommandEvent);
+#undef FAKEHOST_SYMBOL
+    *(void**)&plugin.loop_sync = dlsym(plugin.handle, "loop_sync");
+    if (!plugin.setFunctionPointers || !plugin.init || !plugin.shutdown) {
+        fprintf(stderr, "fakehost: %s is not a TS3 plugin\n", path);
+        return -1;
+    }
+
+    struct TS3Functions functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.freeMemory                          = fake_freeMemory;
+    functions.logMessage                          = fake_logMessage;
+    functions.getCurrentServerConnectionHandlerID = fake_getCurrentServerConnectionHandlerID;
+    functions.getConnectionStatus                 = fake_getConnectionStatus;
+    functions.getClientID                         = fake_getClientID;
+    functions.getChannelOfClient                  = fake_getChannelOfClient;
+    functions.getChannelClientList                = fake_getChannelClientList;
+    functions.getClientVariableAsUInt64           = fake_getClientVariableAsUInt64;
+    functions.getClientVariableAsString           = fake_getClientVariableAsString;
+    functions.requestServerGroupsByClientID       = fake_requestServerGroupsByClientID;
+    functions.sendPluginCommand                   = fake_sendPluginCommand;
+    functions.setChannelVariableAsInt             = fake_setChannelVariableAsInt;
+    functions.setChannelVariableAsString          = fake_setChannelVariableAsString;
+    functions.flushChannelUpdates                 = fake_flushChannelUpdates;
+    functions.getServerVariableAsString           = fake_getServerVariableAsString;
+    functions.getClientSelfVariableAsString       = fake_getClientSelfVariableAsString;
+    functions.setClientSelfVariableAsString       = fake_setClientSelfVariableAsString;
+    functions.flushClientSelfUpdates              = fake_flushClientSelfUpdates;
+    functions.requestClientMove                   = fake_requestClientMove;
+    functions.requestSendPrivateTextMsg           = fake_requestSendPrivateTextMsg;
+    functions.getConfigPath                       = fake_getConfigPath;
+    functions.printMessageToCurrentTab            = fake_printMessageToCurrentTab;
+    functions.createReturnCode                    = fake_createReturnCode;
+    plugin.setFunctionPointers(functions);
+    return 0;
+}
+
+/************************** Statistics ***************************/
+
+enum {
+    CB_CONNECT = 0,
+    CB_MOVE,
+    CB_MOVED,
+    CB_KICK,
+    CB_TEXT,
+    CB_TALK,
+    CB_VOICE,
+    CB_COMMAND,
+    CB_INFO,
+    CB_SERVER_ERROR,
+    CB_GROUP,
+    CB_PLUGIN,
+    CB_COUNT
+};
+static const char* const callback_names[CB_COUNT] = {"onConnectStatusChangeEvent",   "onClientMoveEvent",   "onClientMoveMovedEvent", "onClientKickFromChannelEvent",
+                                                     "onTextMessageEvent",           "onTalkStatusChangeEvent", "onEditCapturedVoiceDataEvent", "processCommand",
+                                                     "infoData",                     "onServerErrorEvent",      "onServerGroup*Event",
+                                                     "onPluginCommandEvent"};
+
+typedef struct {
+    uint64_t* samples; /* nanoseconds */
+    size_t    count;
+    size_t    capacity;
+} latency_series;
+
+static latency_series latencies[CB_COUNT];
+/* Callback start until the plugin's event loop handled it, only for plugins with a loop */
+static latency_series handled[CB_COUNT];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record_latency(latency_series* series, uint64_t ns)
+{
+    if (series->count == series->capacity) {
+        series->capacity = series->capacity ? series->capacity * 2 : 1024;
+        series->samples  = (uint64_t*)realloc(series->samples, series->capacity * sizeof(uint64_t));
+    }
+    series->samples[series->count++] = ns;
+}
+
+#define TIMED(callback, call)                                                                                                                                                                                                                                  \
+    do {                                                                                                                                                                                                                                                       \
+        uint64_t timed_start = now_ns();                                                                                                                                                                                                                       \
+        call;                                                                                                                                                                                                                                                  \
+        record_latency(&latencies[callback], now_ns() - timed_start);                                                                                                                                                                                          \
+        if (plugin.loop_sync) {                                                                                                                                                                                                                                \
+            pthread_mutex_unlock(&server_lock);                                                                                                                                                                                                                \
+            plugin.loop_sync();                                                                                                                                                                                                                                \
+            pthread_mutex_lock(&server_lock);                                                                                                                                                                                                                  \
+            record_latency(&handled[callback], now_ns() - timed_start);                                                                                                                                                                                        \
+        }                                                                                                                                                                                                                                                      \
+    } while (0)
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_series(const char* title, latency_series* series)
+{
+    printf("%-30s %10s %10s %10s %10s %10s\n", title, "count", "mean us", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < CB_COUNT; i++) {
+        if (!series[i].count)
+            continue;
+        qsort(series[i].samples, series[i].count, sizeof(uint64_t), compare_u64);
+        double sum = 0;
+        for (size_t j = 0; j < series[i].count; j++)
+            sum += (double)series[i].samples[j];
+        printf("%-30s %10zu %10.2f %10.2f %10.2f %10.2f\n", callback_names[i], series[i].count, sum / series[i].count / 1e3, series[i].samples[series[i].count / 2] / 1e3,
+               series[i].samples[(size_t)(series[i].count * 0.99)] / 1e3, series[i].samples[series[i].count - 1] / 1e3);
+        free(series[i].samples);
+    }
+}
+
+static void print_report(uint64_t elapsed_ns)
+{
+    size_t total = 0;
+    for (int i = 0; i < CB_COUNT; i++)
+        total += latencies[i].count;
+
+    printf("%zu callbacks in %.3f s, %.0f callbacks/s\n", total, elapsed_ns / 1e9, elapsed_ns ? total / (elapsed_ns / 1e9) : 0.0);
+    printf("%u private messages, %u plugin commands, %u codec changes, %u channel edits, %u nickname edits\n", messages_sent, plugin_commands, codec_changes, channel_edits,
+           nickname_edits);
+    print_series("callback", latencies);
+    if (plugin.loop_sync) {
+        printf("\n");
+        print_series("handled by the event loop", handled);
+    }
+}
+
+/************************** Replay ***************************/
+
+/* Answer the requests the last callback made, which may queue more */
+static void deliver_pending(void)
+{
+    for (int i = 0; i < pending_count; i++) {
+        fake_pending item = pending[i];
+        if (item.kind == PENDING_MOVE && plugin.onClientMoveEvent) {
+            TIMED(CB_MOVE, plugin.onClientMoveEvent(FAKEHOST_SERVER, item.client, item.from, item.to, ENTER_VISIBILITY, ""));
+        } else if (item.kind == PENDING_ERROR && plugin.onServerErrorEvent) {
+            TIMED(CB_SERVER_ERROR, plugin.onServerErrorEvent(FAKEHOST_SERVER, "client is flooding", ERROR_client_is_flooding, item.return_code, ""));
+        } else if (item.kind == PENDING_GROUPS && plugin.onServerGroupByClientIDEvent) {
+            /* Database ids are client ids here */
+            fake_client* client = find_client(item.client);
+            for (int g = 0; client && g < client->group_count; g++)
+                TIMED(CB_GROUP, plugin.onServerGroupByClientIDEvent(FAKEHOST_SERVER, "group", client->groups[g], item.client));
+        }
+    }
+    pending_count = 0;
+}
+
+/* Add group to or remove it from the client's server groups */
+static void set_client_group(fake_client* client, uint64 group, int add)
+{
+    for (int g = 0; client && g < client->group_count; g++) {
+        if (client->groups[g] == group)
+            client->groups[g--] = client->groups[--client->group_count];
+    }
+    if (client && add && client->group_count < FAKEHOST_MAX_GROUPS)
+        client->groups[client->group_count++] = group;
+}
+
+static uint64 move_client(anyID id, uint64 to)
+{
+    fake_client* client = find_client(id);
+    uint64       from   = client ? client->channel : 0;
+    add_client(id, to, NULL);
+    return from;
+}
+
+/* Read one line of the control socket into out, 0 if it came in time */
+static int control_read_line(char* out, size_t size)
+{
+    static char   buffer[FAKEHOST_MESSAGE_BUFSIZE * 8];
+    static size_t length = 0;
+    struct pollfd pfd    = {.fd = control_fd, .events = POLLIN};
+    char*         newline;
+    while (!(newline = memchr(buffer, '\n', length))) {
+        ssize_t n = length < sizeof(buffer) && poll(&pfd, 1, FAKEHOST_CONTROL_TIMEOUT_MS) > 0 ? read(control_fd, buffer + length, sizeof(buffer) - length) : -1;
+        if (n <= 0) {
+            length = 0;
+            return -1;
+        }
+        length += (size_t)n;
+    }
+    size_t line = (size_t)(newline - buffer);
+    snprintf(out, size, "%.*s", (int)line, buffer);
+    length -= line + 1;
+    memmove(buffer, newline + 1, length);
+    return 0;
+}
+
+/* Send request on the control socket and wait for its response, the lines of metrics appended */
+static int control_request(const char* request)
+{
+    if (control_fd < 0) {
+        const char*        path = getenv("MUSICBOT_CONTROL_SOCKET");
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path && *path ? path : FAKEHOST_CONTROL_SOCKET);
+        control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (control_fd < 0 || connect(control_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            snprintf(last_control, sizeof(last_control), "cannot connect to %s: %s", addr.sun_path, strerror(errno));
+            if (control_fd >= 0)
+                close(control_fd);
+            control_fd = -1;
+            return -1;
+        }
+    }
+    char line[FAKEHOST_MESSAGE_BUFSIZE];
+    snprintf(line, sizeof(line), "%s\n", request);
+    if (write(control_fd, line, strlen(line)) < 0 || control_read_line(last_control, sizeof(last_control)) != 0) {
+        snprintf(last_control, sizeof(last_control), "no response to %s", request);
+        close(control_fd);
+        control_fd = -1;
+        return -1;
+    }
+    char id[64], verb[64], status[8];
+    long lines = 0;
+    if (sscanf(request, "%63s %63s", id, verb) == 2 && strcmp(verb, "metrics") == 0 && sscanf(last_control, "%63s %7s %ld", id, status, &lines) == 3 && strcmp(status, "ok") == 0) {
+        for (long i = 0; i < lines && control_read_line(line, sizeof(line)) == 0; i++) {
+            size_t used = strlen(last_control);
+            snprintf(last_control + used, sizeof(last_control) - used, "\n%s", line);
+        }
+    }
+    if (verbose)
+        fprintf(stderr, "[control] %s\n", last_control);
+    return 0;
+}
+
+/* Returns 0, or -1 for a failed expectation or an unknown line */
+static int run_line(char* line, const char* file, int number)
+{
+    char* save = NULL;
+    char* verb = strtok_r(line, " \t", &save);
+    char* rest = save ? save + strspn(save, " \t") : NULL;
+    if (!verb || verb[0] == '#')
+        return 0;
+    rest = rest ? rest : (char*)"";
+#define NEXT_INT() (strtoull(strtok_r(NULL, " \t", &save) ?: "0", NULL, 10))
+
+    if (strcmp(verb, "channel") == 0) {
+        add_channel(NEXT_INT());
+    } else if (strcmp(verb, "client") == 0) {
+        anyID  id      = (anyID)NEXT_INT();
+        uint64 channel = NEXT_INT();
+        add_client(id, channel, strtok_r(NULL, " \t", &save));
+    } else if (strcmp(verb, "self") == 0) {
+        self_id        = (anyID)NEXT_INT();
+        uint64 channel = NEXT_INT();
+        add_client(self_id, channel, "MusicBot");
+    } else if (strcmp(verb, "connect") == 0 || strcmp(verb, "disconnect") == 0) {
+        connected = verb[0] == 'c';
+        if (plugin.onConnectStatusChangeEvent)
+            TIMED(CB_CONNECT, plugin.onConnectStatusChangeEvent(FAKEHOST_SERVER, connected ? STATUS_CONNECTION_ESTABLISHED : STATUS_DISCONNECTED, ERROR_ok));
+    } else if (strcmp(verb, "say") == 0) {
+        anyID        from   = (anyID)strtoul(rest, &rest, 10);
+        fake_client* client = find_client(from);
+        rest += strspn(rest, " \t");
+        char uid[16];
+        snprintf(uid, sizeof(uid), "uid-%u", (unsigned)from);
+        if (plugin.onTextMessageEvent)
+            TIMED(CB_TEXT, plugin.onTextMessageEvent(FAKEHOST_SERVER, TextMessageTarget_CLIENT, self_id, from, client ? client->name : "unknown", uid, rest, 0));
+    } else if (strcmp(verb, "move") == 0) {
+        anyID  id   = (anyID)NEXT_INT();
+        uint64 to   = NEXT_INT();
+        uint64 from = move_client(id, to);
+        if (plugin.onClientMoveEvent)
+            TIMED(CB_MOVE, plugin.onClientMoveEvent(FAKEHOST_SERVER, id, from, to, RETAIN_VISIBILITY, ""));
+    } else if (strcmp(verb, "moved") == 0) {
+        anyID        id     = (anyID)NEXT_INT();
+        uint64       to     = NEXT_INT();
+        anyID        mover  = (anyID)NEXT_INT();
+        uint64       from   = move_client(id, to);
+        fake_client* client = find_client(mover);
+        if (plugin.onClientMoveMovedEvent)
+            TIMED(CB_MOVED, plugin.onClientMoveMovedEvent(FAKEHOST_SERVER, id, from, to, RETAIN_VISIBILITY, mover, client ? client->name : "unknown", "fakehost", ""));
+    } else if (strcmp(verb, "kick") == 0) {
+        anyID  id   = (anyID)NEXT_INT();
+        uint64 to   = NEXT_INT();
+        uint64 from = move_client(id, to);
+        if (plugin.onClientKickFromChannelEvent)
+            TIMED(CB_KICK, plugin.onClientKickFromChannelEvent(FAKEHOST_SERVER, id, from, to, RETAIN_VISIBILITY, 0, "fakehost", "fakehost", ""));
+    } else if (strcmp(verb, "talk") == 0) {
+        anyID id     = (anyID)NEXT_INT();
+        int   status = (int)NEXT_INT();
+        if (plugin.onTalkStatusChangeEvent)
+            TIMED(CB_TALK, plugin.onTalkStatusChangeEvent(FAKEHOST_SERVER, status ? STATUS_TALKING : STATUS_NOT_TALKING, 0, id));
+    } else if (strcmp(verb, "voice") == 0) {
+        static short samples[FAKEHOST_VOICE_SAMPLES * 2];
+        unsigned long long frames = NEXT_INT();
+        for (unsigned long long i = 0; i < frames && plugin.onEditCapturedVoiceDataEvent; i++) {
+            int edited = 2;
+            memset(samples, 0, sizeof(samples));
+            TIMED(CB_VOICE, plugin.onEditCapturedVoiceDataEvent(FAKEHOST_SERVER, samples, FAKEHOST_VOICE_SAMPLES, 2, &edited));
+        }
+    } else if (strcmp(verb, "command") == 0) {
+        if (plugin.processCommand)
+            TIMED(CB_COMMAND, plugin.processCommand(FAKEHOST_SERVER, rest));
+    } else if (strcmp(verb, "info") == 0) {
+        const char* kind = strtok_r(NULL, " \t", &save);
+        uint64      id   = NEXT_INT();
+        char*       data = NULL;
+        if (plugin.infoData && kind)
+            TIMED(CB_INFO, plugin.infoData(FAKEHOST_SERVER, id, strcmp(kind, "client") == 0 ? PLUGIN_CLIENT : PLUGIN_CHANNEL, &data));
+        if (data) {
+            if (verbose)
+                fprintf(stderr, "[info] %s\n", data);
+            if (plugin.freeMemory)
+                plugin.freeMemory(data);
+        }
+    } else if (strcmp(verb, "groups") == 0) {
+        fake_client* client = find_client((anyID)NEXT_INT());
+        char*        list   = strtok_r(NULL, " \t", &save);
+        char*        hidden = strtok_r(NULL, " \t", &save);
+        char*        inner  = NULL;
+        if (client) {
+            client->group_count   = 0;
+            client->groups_hidden = hidden && strcmp(hidden, "hidden") == 0;
+            for (char* id = list ? strtok_r(list, ",", &inner) : NULL; id && client->group_count < FAKEHOST_MAX_GROUPS; id = strtok_r(NULL, ",", &inner))
+                client->groups[client->group_count++] = strtoull(id, NULL, 10);
+        }
+    } else if (strcmp(verb, "group-add") == 0 || strcmp(verb, "group-del") == 0) {
+        anyID        id     = (anyID)NEXT_INT();
+        uint64       group  = NEXT_INT();
+        fake_client* client = find_client(id);
+        int          add    = verb[6] == 'a';
+        char         uid[16];
+        snprintf(uid, sizeof(uid), "uid-%u", (unsigned)id);
+        set_client_group(client, group, add);
+        if (add && plugin.onServerGroupClientAddedEvent)
+            TIMED(CB_GROUP, plugin.onServerGroupClientAddedEvent(FAKEHOST_SERVER, id, client ? client->name : "unknown", uid, group, 0, "fakehost", "fakehost"));
+        else if (!add && plugin.onServerGroupClientDeletedEvent)
+            TIMED(CB_GROUP, plugin.onServerGroupClientDeletedEvent(FAKEHOST_SERVER, id, client ? client->name : "unknown", uid, group, 0, "fakehost", "fakehost"));
+    } else if (strcmp(verb, "remote") == 0 || strcmp(verb, "remote-raw") == 0) {
+        anyID        from   = (anyID)strtoul(rest, &rest, 10);
+        fake_client* client = find_client(from);
+        char         uid[16];
+        char         command[FAKEHOST_MESSAGE_BUFSIZE];
+        rest += strspn(rest, " \t");
+        snprintf(uid, sizeof(uid), "uid-%u", (unsigned)from);
+        if (verb[6] == '-') {
+            snprintf(command, sizeof(command), "%s", rest);
+        } else {
+            uint8_t  payload[REMOTE_MAX_REQUEST];
+            size_t   length = REMOTE_HEADER_BYTES;
+            uint16_t count  = 0;
+            char*    inner  = NULL;
+            for (char* op = strtok_r(rest, " \t", &inner); op && length + REMOTE_OP_HEADER_BYTES + 2 <= sizeof(payload); op = strtok_r(NULL, " \t", &inner)) {
+                char*    arg  = strchr(op, ':');
+                uint32_t code = (uint32_t)strtoul(arg ? arg + 1 : "0", NULL, 10);
+                if (arg)
+                    *arg = '\0';
+                for (uint32_t known = REMOTE_OP_STATION; known <= REMOTE_OP_SUBSCRIBE; known++) {
+                    if (strcmp(op, remote_op_names[known]) == 0)
+                        code = known;
+                }
+                length += remote_put_u32(payload + length, ++count);
+                payload[length++] = (uint8_t)code;
+                payload[length++] = REMOTE_OK;
+                if (code == REMOTE_OP_STATION) {
+                    payload[length++] = 2;
+                    length += remote_put_u16(payload + length, (uint16_t)strtoul(arg ? arg + 1 : "0", NULL, 10));
+                } else if (code == REMOTE_OP_SUBSCRIBE) {
+                    payload[length++] = 1;
+                    payload[length++] = (uint8_t)strtoul(arg ? arg + 1 : "1", NULL, 10);
+                } else {
+                    payload[length++] = 0;
+                }
+            }
+            payload[0] = REMOTE_VERSION;
+            payload[1] = REMOTE_REQUEST;
+            remote_put_u16(payload + 2, count);
+            memcpy(command, REMOTE_PREFIX, strlen(REMOTE_PREFIX));
+            remote_base64_encode(payload, length, command + strlen(REMOTE_PREFIX));
+        }
+        if (plugin.onPluginCommandEvent)
+            TIMED(CB_PLUGIN, plugin.onPluginCommandEvent(FAKEHOST_SERVER, "companion", command, from, client ? client->name : "unknown", uid));
+    } else if (strcmp(verb, "flood") == 0) {
+        flood_next = 1;
+    } else if (strcmp(verb, "wait") == 0) {
+        unsigned long long ms = NEXT_INT();
+        pthread_mutex_unlock(&server_lock);
+        usleep((useconds_t)(ms * 1000));
+        if (plugin.loop_sync)
+            plugin.loop_sync();
+        pthread_mutex_lock(&server_lock);
+    } else if (strcmp(verb, "expect") == 0) {
+        if (!strstr(last_message, rest)) {
+            fprintf(stderr, "%s:%d: expected a reply containing \"%s\", last reply was \"%s\"\n", file, number, rest, last_message);
+            return -1;
+        }
+    } else if (strcmp(verb, "expect-topic") == 0) {
+        uint64        id      = strtoull(rest, &rest, 10);
+        fake_channel* channel = find_channel(id);
+        rest += strspn(rest, " \t");
+        if (!channel || !strstr(channel->topic, rest)) {
+            fprintf(stderr, "%s:%d: expected the topic of channel %llu to contain \"%s\", it is \"%s\"\n", file, number, (unsigned long long)id, rest, channel ? channel->topic : "");
+            return -1;
+        }
+    } else if (strcmp(verb, "expect-remote") == 0 || strcmp(verb, "expect-notify") == 0) {
+        const char* last = verb[7] == 'r' ? last_answer : last_notify;
+        if (!strstr(last, rest)) {
+            fprintf(stderr, "%s:%d: expected %s containing \"%s\", the last one was \"%s\"\n", file, number, verb[7] == 'r' ? "an answer" : "a notification", rest, last);
+            return -1;
+        }
+    } else if (strcmp(verb, "control") == 0) {
+        /* The loop thread may call the server while it answers */
+        pthread_mutex_unlock(&server_lock);
+        int failed = control_request(rest);
+        pthread_mutex_lock(&server_lock);
+        if (failed) {
+            fprintf(stderr, "%s:%d: %s\n", file, number, last_control);
+            return -1;
+        }
+    } else if (strcmp(verb, "expect-control") == 0) {
+        if (!strstr(last_control, rest)) {
+            fprintf(stderr, "%s:%d: expected a control response containing \"%s\", the last one was \"%s\"\n", file, number, rest, last_control);
+            return -1;
+        }
+    } else if (strcmp(verb, "expect-nickname") == 0) {
+        if (!strstr(self_nickname, rest)) {
+            fprintf(stderr, "%s:%d: expected the bot's nickname to contain \"%s\", it is \"%s\"\n", file, number, rest, self_nickname);
+            return -1;
+        }
+    } else if (strcmp(verb, "expect-channel") == 0) {
+        anyID        id      = (anyID)NEXT_INT();
+        uint64       channel = NEXT_INT();
+        fake_client* client  = find_client(id);
+        if (!client || client->channel != channel) {
+            fprintf(stderr, "%s:%d: expected client %u in channel %llu, it is in %llu\n", file, number, (unsigned)id, (unsigned long long)channel,
+                    (unsigned long long)(client ? client->channel : 0));
+            return -1;
+        }
+    } else {
+        fprintf(stderr, "%s:%d: unknown line \"%s\"\n", file, number, verb);
+        return -1;
+    }
+#undef NEXT_INT
+    deliver_pending();
+    return 0;
+}
+
+static int run_script(const char* path, int* failures)
+{
+    FILE* script = fopen(path, "r");
+    if (!script) {
+        fprintf(stderr, "fakehost: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char line[FAKEHOST_LINE_BUFSIZE];
+    int  number = 0;
+    while (fgets(line, sizeof(line), script)) {
+        number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (run_line(line, path, number) != 0)
+            (*failures)++;
+    }
+    fclose(script);
+    return 0;
+}
+
+/* Sequential reads from one record, out of range reads yield zeros and empty strings */
+typedef struct {
+    const uint8_t* data;
+    size_t         size;
+    size_t         offset;
+} record_reader;
+
+static void read_bytes(record_reader* reader, void* out, size_t size)
+{
+    if (reader->offset + size > reader->size) {
+        memset(out, 0, size);
+        reader->offset = reader->size;
+        return;
+    }
+    memcpy(out, reader->data + reader->offset, size);
+    reader->offset += size;
+}
+
+#define READ(reader, type)                                                                                                                                                                                                                                     \
+    ({                                                                                                                                                                                                                                                         \
+        type read_value;                                                                                                                                                                                                                                       \
+        read_bytes((reader), &read_value, sizeof(read_value));                                                                                                                                                                                                 \
+        read_value;                                                                                                                                                                                                                                            \
+    })
+
+static const char* read_string(record_reader* reader, char* out)
+{
+    uint16_t length = READ(reader, uint16_t);
+    if (length > RECORDING_MAX_STRING || reader->offset + length > reader->size)
+        length = 0;
+    memcpy(out, reader->data + reader->offset, length);
+    out[length] = '\0';
+    reader->offset += length;
+    return out;
+}
+
+static void replay_record(uint16_t type, record_reader* reader)
+{
+    static char strings[4][RECORDING_MAX_STRING + 1];
+    static short samples[FAKEHOST_VOICE_SAMPLES * 2 * 4];
+
+    uint64 server = READ(reader, uint64_t);
+    switch (type) {
+    case RECORDING_SNAPSHOT: {
+        self_id        = READ(reader, uint16_t);
+        uint64 channel = READ(reader, uint64_t);
+        uint16_t count = READ(reader, uint16_t);
+        connected      = 1;
+        add_client(self_id, channel, "MusicBot");
+        for (uint16_t i = 0; i < count; i++)
+            add_client(READ(reader, uint16_t), channel, NULL);
+        break;
+    }
+    case RECORDING_CONNECT_STATUS: {
+        int          status = READ(reader, int32_t);
+        unsigned int error  = READ(reader, uint32_t);
+        connected           = status != STATUS_DISCONNECTED;
+        if (plugin.onConnectStatusChangeEvent)
+            TIMED(CB_CONNECT, plugin.onConnectStatusChangeEvent(server, status, error));
+        break;
+    }
+    case RECORDING_CLIENT_MOVE: {
+        anyID  client     = READ(reader, uint16_t);
+        uint64 from       = READ(reader, uint64_t);
+        uint64 to         = READ(reader, uint64_t);
+        int    visibility = READ(reader, int32_t);
+        read_string(reader, strings[0]);
+        move_client(client, to);
+        if (plugin.onClientMoveEvent)
+            TIMED(CB_MOVE, plugin.onClientMoveEvent(server, client, from, to, visibility, strings[0]));
+        break;
+    }
+    case RECORDING_CLIENT_MOVE_MOVED:
+    case RECORDING_CLIENT_KICK_CHANNEL: {
+        anyID  client     = READ(reader, uint16_t);
+        uint64 from       = READ(reader, uint64_t);
+        uint64 to         = READ(reader, uint64_t);
+        int    visibility = READ(reader, int32_t);
+        anyID  by         = READ(reader, uint16_t);
+        read_string(reader, strings[0]);
+        read_string(reader, strings[1]);
+        read_string(reader, strings[2]);
+        move_client(client, to);
+        if (type == RECORDING_CLIENT_MOVE_MOVED && plugin.onClientMoveMovedEvent)
+            TIMED(CB_MOVED, plugin.onClientMoveMovedEvent(server, client, from, to, visibility, by, strings[0], strings[1], strings[2]));
+        if (type == RECORDING_CLIENT_KICK_CHANNEL && plugin.onClientKickFromChannelEvent)
+            TIMED(CB_KICK, plugin.onClientKickFromChannelEvent(server, client, from, to, visibility, by, strings[0], strings[1], strings[2]));
+        break;
+    }
+    case RECORDING_TEXT_MESSAGE: {
+        anyID target_mode = READ(reader, uint16_t);
+        anyID to          = READ(reader, uint16_t);
+        anyID from        = READ(reader, uint16_t);
+        int   ff_ignored  = READ(reader, int32_t);
+        read_string(reader, strings[0]);
+        read_string(reader, strings[1]);
+        read_string(reader, strings[2]);
+        if (!find_client(from))
+            add_client(from, 0, strings[0]);
+        if (plugin.onTextMessageEvent)
+            TIMED(CB_TEXT, plugin.onTextMessageEvent(server, target_mode, to, from, strings[0], strings[1], strings[2], ff_ignored));
+        break;
+    }
+    case RECORDING_SERVER_ERROR: {
+        unsigned int error = READ(reader, uint32_t);
+        read_string(reader, strings[0]);
+        read_string(reader, strings[1]);
+        read_string(reader, strings[2]);
+        if (plugin.onServerErrorEvent)
+            TIMED(CB_SERVER_ERROR, plugin.onServerErrorEvent(server, strings[0], error, strings[1], strings[2]));
+        break;
+    }
+    case RECORDING_TALK_STATUS: {
+        int   status  = READ(reader, int32_t);
+        int   whisper = READ(reader, int32_t);
+        anyID client  = READ(reader, uint16_t);
+        if (plugin.onTalkStatusChangeEvent)
+            TIMED(CB_TALK, plugin.onTalkStatusChangeEvent(server, status, whisper, client));
+        break;
+    }
+    case RECORDING_CAPTURED_VOICE: {
+        int sample_count = READ(reader, int32_t);
+        int channels     = READ(reader, int32_t);
+        int edited       = 2;
+        if (sample_count < 0 || channels < 1 || (size_t)sample_count * (size_t)channels > sizeof(samples) / sizeof(samples[0]))
+            break;
+        memset(samples, 0, sizeof(samples));
+        if (plugin.onEditCapturedVoiceDataEvent)
+            TIMED(CB_VOICE, plugin.onEditCapturedVoiceDataEvent(server, samples, sample_count, channels, &edited));
+        break;
+    }
+    case RECORDING_PLUGIN_COMMAND: {
+        anyID invoker = READ(reader, uint16_t);
+        read_string(reader, strings[0]);
+        read_string(reader, strings[1]);
+        read_string(reader, strings[2]);
+        read_string(reader, strings[3]);
+        if (!find_client(invoker))
+            add_client(invoker, 0, strings[1]);
+        if (plugin.onPluginCommandEvent)
+            TIMED(CB_PLUGIN, plugin.onPluginCommandEvent(server, strings[0], strings[3], invoker, strings[1], strings[2]));
+        break;
+    }
+    case RECORDING_SERVER_GROUP_BY_CLIENT: {
+        uint64 group       = READ(reader, uint64_t);
+        uint64 database_id = READ(reader, uint64_t);
+        read_string(reader, strings[0]);
+        if (plugin.onServerGroupByClientIDEvent)
+            TIMED(CB_GROUP, plugin.onServerGroupByClientIDEvent(server, strings[0], group, database_id));
+        break;
+    }
+    case RECORDING_SERVER_GROUP_ADDED:
+    case RECORDING_SERVER_GROUP_DELETED: {
+        anyID  client  = READ(reader, uint16_t);
+        uint64 group   = READ(reader, uint64_t);
+        anyID  invoker = READ(reader, uint16_t);
+        read_string(reader, strings[0]);
+        read_string(reader, strings[1]);
+        read_string(reader, strings[2]);
+        read_string(reader, strings[3]);
+        set_client_group(find_client(client), group, type == RECORDING_SERVER_GROUP_ADDED);
+        if (type == RECORDING_SERVER_GROUP_ADDED && plugin.onServerGroupClientAddedEvent)
+            TIMED(CB_GROUP, plugin.onServerGroupClientAddedEvent(server, client, strings[0], strings[1], group, invoker, strings[2], strings[3]));
+        if (type == RECORDING_SERVER_GROUP_DELETED && plugin.onServerGroupClientDeletedEvent)
+            TIMED(CB_GROUP, plugin.onServerGroupClientDeletedEvent(server, client, strings[0], strings[1], group, invoker, strings[2], strings[3]));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Replay a recording, returns -1 if it is not one or cannot be read */
+static int run_recording(const char* path, int paced)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*)malloc(size > 0 ? (size_t)size : 1);
+    if (size <= 0 || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        fclose(file);
+        free(data);
+        return -1;
+    }
+    fclose(file);
+
+    recording_header header;
+    memcpy(&header, data, (size_t)size < sizeof(header) ? (size_t)size : sizeof(header));
+    if ((size_t)size < sizeof(header) || memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 || header.version != RECORDING_VERSION) {
+        fprintf(stderr, "fakehost: %s is not a version %d recording\n", path, RECORDING_VERSION);
+        free(data);
+        return -1;
+    }
+
+    replaying      = 1;
+    uint64_t start = now_ns();
+    for (size_t offset = header.header_size; offset + sizeof(recording_record_header) <= (size_t)size;) {
+        recording_record_header record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (record.length < sizeof(record) || record.length % 8 || offset + record.length > (size_t)size) {
+            fprintf(stderr, "fakehost: %s: damaged record at offset %zu, stopping\n", path, offset);
+            break;
+        }
+        if (paced) {
+            uint64_t due = start + record.time_ns;
+            uint64_t now = now_ns();
+            if (due > now)
+                usleep((useconds_t)((due - now) / 1000));
+        }
+        record_reader reader = {data + offset + sizeof(record), record.length - sizeof(record), 0};
+        replay_record(record.type, &reader);
+        offset += record.length;
+    }
+    replaying = 0;
+    free(data);
+    return 0;
+}
+
+static int is_recording(const char* path)
+{
+    char  magic[8] = {0};
+    FILE* file     = fopen(path, "rb");
+    if (!file)
+        return 0;
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return read == sizeof(magic) && memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: fakehost [-n repeat] [-t] [-v] [-c configdir] [-C self:channel] plugin.so script|recording\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int repeat  = 1;
+    int paced   = 0;
+    int own_dir = 0;
+    int option;
+    snprintf(config_path, sizeof(config_path), "/tmp/musicbot-fakehost/");
+    while ((option = getopt(argc, argv, "n:tvc:C:")) != -1) {
+        switch (option) {
+        case 'n':
+            repeat = atoi(optarg);
+            break;
+        case 't':
+            paced = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'c':
+            snprintf(config_path, sizeof(config_path), "%s/", optarg);
+            own_dir = 1;
+            break;
+        case 'C': {
+            unsigned           self;
+            unsigned long long channel;
+            if (sscanf(optarg, "%u:%llu", &self, &channel) != 2)
+                usage();
+            self_id   = (anyID)self;
+            connected = 1;
+            add_client(self_id, channel, "MusicBot");
+            break;
+        }
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 2 || repeat < 1)
+        usage();
+    mkdir(config_path, 0755);
+    if (!own_dir) {
+        /* Runs in the shared default directory do not pick up each other's warm start snapshot */
+        char snapshot[600];
+        snprintf(snapshot, sizeof(snapshot), "%smusicbot_snapshot.bin", config_path);
+        unlink(snapshot);
+    }
+    /* Keep the plugin's own logging out of the measurements unless asked for */
+    setenv("MUSICBOT_LOG_LEVEL", verbose ? "debug" : "error", 0);
+    /* Scripts expect the bot to leave an empty channel right away, use wait to test the grace period */
+    setenv("MUSICBOT_RETURN_DELAY_MS", "0", 0);
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&server_lock, &attributes);
+    pthread_mutex_lock(&server_lock);
+
+    if (load_plugin(argv[optind]) != 0)
+        return 1;
+    if (plugin.registerPluginID)
+        plugin.registerPluginID("fakehost");
+    if (plugin.init() != 0) {
+        fprintf(stderr, "fakehost: plugin init failed\n");
+        return 1;
+    }
+
+    const char* input     = argv[optind + 1];
+    int         recording = is_recording(input);
+    int         failures  = 0;
+    uint64_t    start     = now_ns();
+    for (int i = 0; i < repeat; i++) {
+        if ((recording ? run_recording(input, paced) : run_script(input, &failures)) != 0) {
+            failures++;
+            break;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    pthread_mutex_unlock(&server_lock);
+    plugin.shutdown();
+    print_report(elapsed);
+    if (failures)
+        printf("%d failed expectations\n", failures);
+    dlclose(plugin.handle);
+    return failures ? 1 : 0;
+}
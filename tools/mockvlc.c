@@ -0,0 +1,481 @@
+/*
+ * Mock VLC for load and chaos testing of the bot's D-Bus code.
+ *
+ * Owns org.mpris.MediaPlayer2.vlc (or -N name) on the session bus and
+ * answers the calls dbus_module.h and deck_module.h make:
+ *
+ *   org.freedesktop.DBus.Properties.Get   TrackList.Tracks, Player.Metadata, Player.PlaybackStatus
+ *   org.mpris.MediaPlayer2.TrackList.GoTo
+ *   org.mpris.MediaPlayer2.Player.Play / Pause / PlayPause / Stop / Next / Previous
+ *   org.mpris.MediaPlayer2.Player.OpenUri   file:// URIs only, played until the next GoTo
+ *
+ * and emits PropertiesChanged(Player, {Metadata}) when the track changes
+ * and when the song on the current stream changes (every -s seconds).
+ * Misbehaviour is configurable and reproducible with -S:
+ *
+ *   -l fixed:MS | uniform:MIN:MAX | exp:MEAN   reply latency in milliseconds
+ *   -d P     drop a call without ever replying, probability 0..1
+ *   -e P     reply with org.freedesktop.DBus.Error.Failed instead
+ *   -r SEC   "restart" every SEC seconds: release the name, stay away for
+ *            -R MS, take it again with new track ids like a new VLC would
+ *
+ *   make mockvlc
+ *   dbus-run-session -- sh -c './mockvlc -t 1000 -l exp:5 -d 0.01 & ./fakehost -C 1:12304 ./MusicBot.so script.txt'
+ *
+ * Prints call counts on exit (SIGINT/SIGTERM, or after -x seconds).
+ */
+
+#include <dbus/dbus.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOCK_OBJECT_PATH "/org/mpris/MediaPlayer2"
+#define MOCK_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+#define MOCK_TRACKLIST_INTERFACE "org.mpris.MediaPlayer2.TrackList"
+#define MOCK_TRACK_PREFIX "/org/videolan/vlc/playlist/"
+#define MOCK_MAX_DELAYED 4096
+
+enum { LATENCY_FIXED, LATENCY_UNIFORM, LATENCY_EXP };
+
+static struct {
+    const char* bus_name;
+    int         tracks;
+    int         latency_kind;
+    double      latency_a;
+    double      latency_b;
+    double      drop;
+    double      error;
+    double      song_seconds;
+    double      restart_seconds;
+    double      restart_down_ms;
+    double      exit_seconds;
+    uint64_t    seed;
+    int         verbose;
+} options = {"org.mpris.MediaPlayer2.vlc", 32, LATENCY_FIXED, 0, 0, 0, 0, 30, 0, 500, 0, 1, 0};
+
+static struct {
+    unsigned long calls;
+    unsigned long replies;
+    unsigned long dropped;
+    unsigned long errors;
+    unsigned long signals;
+    unsigned long restarts;
+} stats;
+
+static volatile sig_atomic_t running = 1;
+
+static DBusConnection* connection;
+static int             current_track = 0;
+static unsigned        song_number   = 1;
+/* Set by OpenUri, reported as xesam:url until a GoTo */
+static char            opened_uri[4096];
+static unsigned        track_id_base = 1;
+static int             playing       = 1;
+static int             owning_name   = 0;
+
+/* Replies held back for their latency */
+typedef struct {
+    double       due;
+    DBusMessage* reply;
+} delayed_reply;
+
+static delayed_reply delayed[MOCK_MAX_DELAYED];
+static int           delayed_count = 0;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* xorshift64*, deterministic for a given -S */
+static double random_unit(void)
+{
+    options.seed ^= options.seed >> 12;
+    options.seed ^= options.seed << 25;
+    options.seed ^= options.seed >> 27;
+    return (double)((options.seed * 2685821657736338717ull) >> 11) / 9007199254740992.0;
+}
+
+static double sample_latency(void)
+{
+    switch (options.latency_kind) {
+    case LATENCY_UNIFORM:
+        return options.latency_a + (options.latency_b - options.latency_a) * random_unit();
+    case LATENCY_EXP:
+        return -options.latency_a * log(1.0 - random_unit());
+    default:
+        return options.latency_a;
+    }
+}
+
+/************************** Replies ***************************/
+
+static void track_path(int track, char* out, size_t size)
+{
+    snprintf(out, size, MOCK_TRACK_PREFIX "%u", track_id_base + (unsigned)track);
+}
+
+static void append_entry(DBusMessageIter* dict, const char* key, int type, const void* value)
+{
+    DBusMessageIter entry, variant;
+    char            signature[2] = {(char)type, '\0'};
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* a{sv} the way VLC 3 fills it for a stream */
+static void append_metadata(DBusMessageIter* container)
+{
+    DBusMessageIter dict, entry, variant, array;
+    char            path[64], title[64], now_playing[128], genre[64];
+    const char*     path_value    = path;
+    const char*     title_value   = title;
+    const char*     playing_value = now_playing;
+    const char*     genre_value   = genre;
+    int64_t         length        = 0;
+
+    track_path(current_track, path, sizeof(path));
+    snprintf(title, sizeof(title), "Mock Radio %d", current_track);
+    snprintf(now_playing, sizeof(now_playing), "Mock Artist %u - Mock Song %u", song_number % 97, song_number);
+    snprintf(genre, sizeof(genre), "Mock Station %d", current_track);
+
+    dbus_message_iter_open_container(container, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_entry(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, &path_value);
+    append_entry(&dict, "xesam:title", DBUS_TYPE_STRING, &title_value);
+    append_entry(&dict, "mpris:length", DBUS_TYPE_INT64, &length);
+    append_entry(&dict, "vlc:nowplaying", DBUS_TYPE_STRING, &playing_value);
+    if (opened_uri[0]) {
+        const char* url_value = opened_uri;
+        append_entry(&dict, "xesam:url", DBUS_TYPE_STRING, &url_value);
+    }
+
+    const char* key = "xesam:genre";
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+    dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &genre_value);
+    dbus_message_iter_close_container(&variant, &array);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(&dict, &entry);
+
+    dbus_message_iter_close_container(container, &dict);
+}
+
+static void emit_metadata_changed(void)
+{
+    if (!owning_name)
+        return;
+    DBusMessage*    signal = dbus_message_new_signal(MOCK_OBJECT_PATH, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+    DBusMessageIter args, changed, entry, variant, invalidated;
+    const char*     interface = MOCK_PLAYER_INTERFACE;
+    const char*     key       = "Metadata";
+
+    dbus_message_iter_init_append(signal, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &changed);
+    dbus_message_iter_open_container(&changed, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+    append_metadata(&variant);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(&changed, &entry);
+    dbus_message_iter_close_container(&args, &changed);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "s", &invalidated);
+    dbus_message_iter_close_container(&args, &invalidated);
+
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+    stats.signals++;
+}
+
+static DBusMessage* handle_get(DBusMessage* call)
+{
+    const char* interface = NULL;
+    const char* property  = NULL;
+    if (!dbus_message_get_args(call, NULL, DBUS_TYPE_STRING, &interface, DBUS_TYPE_STRING, &property, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "Get takes (ss)");
+
+    DBusMessage*    reply = dbus_message_new_method_return(call);
+    DBusMessageIter args, variant, array;
+    dbus_message_iter_init_append(reply, &args);
+    if (strcmp(interface, MOCK_TRACKLIST_INTERFACE) == 0 && strcmp(property, "Tracks") == 0) {
+        char path[64];
+        dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, "ao", &variant);
+        dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "o", &array);
+        for (int i = 0; i < options.tracks; i++) {
+            const char* value = path;
+            track_path(i, path, sizeof(path));
+            dbus_message_iter_append_basic(&array, DBUS_TYPE_OBJECT_PATH, &value);
+        }
+        dbus_message_iter_close_container(&variant, &array);
+    } else if (strcmp(interface, MOCK_PLAYER_INTERFACE) == 0 && strcmp(property, "Metadata") == 0) {
+        dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+        append_metadata(&variant);
+    } else if (strcmp(interface, MOCK_PLAYER_INTERFACE) == 0 && strcmp(property, "PlaybackStatus") == 0) {
+        const char* status = playing ? "Playing" : "Stopped";
+        dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, "s", &variant);
+        dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &status);
+    } else {
+        dbus_message_unref(reply);
+        return dbus_message_new_error(call, DBUS_ERROR_UNKNOWN_PROPERTY, "No such property");
+    }
+    dbus_message_iter_close_container(&args, &variant);
+    return reply;
+}
+
+static DBusMessage* handle_goto(DBusMessage* call)
+{
+    const char* path = NULL;
+    if (!dbus_message_get_args(call, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "GoTo takes (o)");
+    if (strncmp(path, MOCK_TRACK_PREFIX, strlen(MOCK_TRACK_PREFIX)) != 0)
+        return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "Unknown track");
+    long track = strtol(path + strlen(MOCK_TRACK_PREFIX), NULL, 10) - (long)track_id_base;
+    if (track < 0 || track >= options.tracks)
+        return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "Unknown track");
+    current_track = (int)track;
+    opened_uri[0] = '\0';
+    song_number++;
+    playing = 1;
+    emit_metadata_changed();
+    return dbus_message_new_method_return(call);
+}
+
+static DBusMessage* handle_player(DBusMessage* call, const char* member)
+{
+    if (strcmp(member, "Stop") == 0 || strcmp(member, "Pause") == 0) {
+        playing = 0;
+    } else if (strcmp(member, "Play") == 0) {
+        playing = 1;
+    } else if (strcmp(member, "PlayPause") == 0) {
+        playing = !playing;
+    } else if (strcmp(member, "OpenUri") == 0) {
+        const char* uri = NULL;
+        if (!dbus_message_get_args(call, NULL, DBUS_TYPE_STRING, &uri, DBUS_TYPE_INVALID) || strncmp(uri, "file://", 7) != 0 || strlen(uri) >= sizeof(opened_uri))
+            return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "OpenUri takes (s), a file:// URI");
+        snprintf(opened_uri, sizeof(opened_uri), "%s", uri);
+        song_number++;
+        playing = 1;
+        emit_metadata_changed();
+    } else if (strcmp(member, "Next") == 0 || strcmp(member, "Previous") == 0) {
+        current_track = (current_track + (member[0] == 'N' ? 1 : options.tracks - 1)) % options.tracks;
+        song_number++;
+        emit_metadata_changed();
+    } else {
+        return dbus_message_new_error(call, DBUS_ERROR_UNKNOWN_METHOD, "No such method");
+    }
+    return dbus_message_new_method_return(call);
+}
+
+static void queue_reply(DBusMessage* reply)
+{
+    double latency = sample_latency();
+    if (latency <= 0 || delayed_count == MOCK_MAX_DELAYED) {
+        dbus_connection_send(connection, reply, NULL);
+        dbus_message_unref(reply);
+        stats.replies++;
+        return;
+    }
+    delayed[delayed_count++] = (delayed_reply){now_ms() + latency, reply};
+}
+
+static void flush_due_replies(void)
+{
+    double now = now_ms();
+    for (int i = 0; i < delayed_count;) {
+        if (delayed[i].due > now) {
+            i++;
+            continue;
+        }
+        dbus_connection_send(connection, delayed[i].reply, NULL);
+        dbus_message_unref(delayed[i].reply);
+        stats.replies++;
+        delayed[i] = delayed[--delayed_count];
+    }
+}
+
+static void handle_call(DBusMessage* call)
+{
+    const char* interface = dbus_message_get_interface(call);
+    const char* member    = dbus_message_get_member(call);
+    if (!interface || !member)
+        return;
+    stats.calls++;
+    if (options.verbose)
+        fprintf(stderr, "mockvlc: %s.%s\n", interface, member);
+
+    if (random_unit() < options.drop) {
+        stats.dropped++;
+        return;
+    }
+    DBusMessage* reply;
+    if (random_unit() < options.error) {
+        reply = dbus_message_new_error(call, DBUS_ERROR_FAILED, "Injected failure");
+        stats.errors++;
+    } else if (strcmp(interface, "org.freedesktop.DBus.Properties") == 0 && strcmp(member, "Get") == 0) {
+        reply = handle_get(call);
+    } else if (strcmp(interface, MOCK_TRACKLIST_INTERFACE) == 0 && strcmp(member, "GoTo") == 0) {
+        reply = handle_goto(call);
+    } else if (strcmp(interface, MOCK_PLAYER_INTERFACE) == 0) {
+        reply = handle_player(call, member);
+    } else {
+        reply = dbus_message_new_error(call, DBUS_ERROR_UNKNOWN_METHOD, "No such method");
+    }
+    if (!dbus_message_get_no_reply(call))
+        queue_reply(reply);
+    else
+        dbus_message_unref(reply);
+}
+
+/************************** Name ownership ***************************/
+
+static int take_name(void)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    int result = dbus_bus_request_name(connection, options.bus_name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &error);
+    if (dbus_error_is_set(&error) || result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr, "mockvlc: cannot own %s: %s\n", options.bus_name, dbus_error_is_set(&error) ? error.message : "already owned");
+        dbus_error_free(&error);
+        return -1;
+    }
+    owning_name = 1;
+    return 0;
+}
+
+static void release_name(void)
+{
+    dbus_bus_release_name(connection, options.bus_name, NULL);
+    owning_name = 0;
+    /* Calls that were in flight die with the old process */
+    for (int i = 0; i < delayed_count; i++)
+        dbus_message_unref(delayed[i].reply);
+    delayed_count = 0;
+}
+
+/************************** Main ***************************/
+
+static void stop(int signal)
+{
+    running = 0;
+}
+
+static int parse_latency(const char* text)
+{
+    if (sscanf(text, "fixed:%lf", &options.latency_a) == 1) {
+        options.latency_kind = LATENCY_FIXED;
+    } else if (sscanf(text, "uniform:%lf:%lf", &options.latency_a, &options.latency_b) == 2) {
+        options.latency_kind = LATENCY_UNIFORM;
+    } else if (sscanf(text, "exp:%lf", &options.latency_a) == 1) {
+        options.latency_kind = LATENCY_EXP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mockvlc [-N busname] [-t tracks] [-l fixed:MS|uniform:MIN:MAX|exp:MEAN] [-d drop] [-e error]\n"
+                    "               [-s song_seconds] [-r restart_seconds] [-R down_ms] [-x exit_seconds] [-S seed] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int option;
+    while ((option = getopt(argc, argv, "N:t:l:d:e:s:r:R:x:S:v")) != -1) {
+        switch (option) {
+        case 'N': options.bus_name = optarg; break;
+        case 't': options.tracks = atoi(optarg); break;
+        case 'l':
+            if (parse_latency(optarg) != 0)
+                usage();
+            break;
+        case 'd': options.drop = atof(optarg); break;
+        case 'e': options.error = atof(optarg); break;
+        case 's': options.song_seconds = atof(optarg); break;
+        case 'r': options.restart_seconds = atof(optarg); break;
+        case 'R': options.restart_down_ms = atof(optarg); break;
+        case 'x': options.exit_seconds = atof(optarg); break;
+        case 'S': options.seed = strtoull(optarg, NULL, 10) | 1; break;
+        case 'v': options.verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (options.tracks < 1)
+        usage();
+
+    DBusError error;
+    dbus_error_init(&error);
+    connection = dbus_bus_get(DBUS_BUS_SESSION, &error);
+    if (!connection) {
+        fprintf(stderr, "mockvlc: no session bus: %s\n", error.message);
+        return 1;
+    }
+    if (take_name() != 0)
+        return 1;
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    fprintf(stderr, "mockvlc: %s with %d tracks\n", options.bus_name, options.tracks);
+
+    double started     = now_ms();
+    double next_song   = started + options.song_seconds * 1000;
+    double next_change = options.restart_seconds > 0 ? started + options.restart_seconds * 1000 : INFINITY;
+    while (running) {
+        double now = now_ms();
+        if (options.exit_seconds > 0 && now - started >= options.exit_seconds * 1000)
+            break;
+        if (now >= next_change) {
+            if (owning_name) {
+                release_name();
+                next_change = now + options.restart_down_ms;
+            } else {
+                /* A new VLC numbers its playlist from scratch */
+                track_id_base += (unsigned)options.tracks;
+                current_track = 0;
+                stats.restarts++;
+                if (take_name() != 0)
+                    break;
+                next_change = now + options.restart_seconds * 1000;
+            }
+        }
+        if (options.song_seconds > 0 && now >= next_song) {
+            song_number++;
+            emit_metadata_changed();
+            next_song = now + options.song_seconds * 1000;
+        }
+
+        double wait = fmin(next_song, next_change) - now;
+        for (int i = 0; i < delayed_count; i++)
+            wait = fmin(wait, delayed[i].due - now);
+        wait = fmax(0, fmin(wait, 100));
+        dbus_connection_read_write(connection, (int)ceil(wait));
+
+        DBusMessage* message;
+        while ((message = dbus_connection_pop_message(connection))) {
+            if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_METHOD_CALL && owning_name)
+                handle_call(message);
+            dbus_message_unref(message);
+        }
+        flush_due_replies();
+        dbus_connection_flush(connection);
+    }
+
+    fprintf(stderr, "mockvlc: %lu calls, %lu replies, %lu dropped, %lu errors, %lu signals, %lu restarts\n", stats.calls, stats.replies, stats.dropped, stats.errors, stats.signals,
+            stats.restarts);
+    return 0;
+}